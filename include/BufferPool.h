@@ -0,0 +1,85 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+// Statische Puffer-Arena statt einzeln verteilter 16-KB-Felder.
+// Jeder Slot gehoert immer nur einem Besitzer auf Zeit (Lease). Alles laeuft
+// im loop()-Task nacheinander, daher teilen sich Polling und Web-Konsole den
+// UART-Puffer. Pro Slot wird der Hochwasserstand mitgeschrieben, damit die
+// Groessen anhand echter Nutzung nachgezogen werden koennen.
+
+namespace BufferPool {
+  enum class Slot : uint8_t {
+    Rx = 0,   // UART-Antworten (pwr/pwrsys/stat und Web-Konsole)
+    JsonDoc,  // Knotenspeicher fuer ArduinoJson-Dokumente
+    JsonOut,  // serialisierter JSON-Text vor dem Senden
+    StackJson,   // Snapshot-Cache /api/stack (dauerhaft vom Cache gehalten)
+    SystemJson,  // Snapshot-Cache /api/system
+    StatusJson,  // Snapshot-Cache /api/status
+    JobResult,   // Ausgabe des zuletzt beendeten Konsolen-Jobs (bis zum Ablauf)
+    StatusPack,  // Snapshot-Cache /api/status als MessagePack
+    Count
+  };
+
+  struct SlotStats {
+    const char* name;
+    const char* owner;      // aktueller bzw. letzter Besitzer
+    size_t      size;
+    size_t      highWater;
+    uint32_t    leases;
+    uint32_t    denied;     // acquire() bei belegtem Slot oder zu kleiner Groesse
+    bool        busy;
+  };
+
+  char*  acquire(Slot slot, const char* owner, size_t minSize = 0);
+  void   release(Slot slot);
+  void   noteUsed(Slot slot, size_t bytes);
+  size_t size(Slot slot);
+  size_t totalBytes();
+  bool   stats(Slot slot, SlotStats& out);
+}
+
+class BufferLease {
+public:
+  BufferLease(BufferPool::Slot slot, const char* owner)
+    : m_slot(slot), m_data(BufferPool::acquire(slot, owner)), m_size(m_data ? BufferPool::size(slot) : 0) {}
+  ~BufferLease() { if (m_data) BufferPool::release(m_slot); }
+
+  BufferLease(const BufferLease&) = delete;
+  BufferLease& operator=(const BufferLease&) = delete;
+
+  char*  data() const { return m_data; }
+  size_t size() const { return m_size; }
+  explicit operator bool() const { return m_data != nullptr; }
+  void noteUsed(size_t bytes) const { if (m_data) BufferPool::noteUsed(m_slot, bytes); }
+
+private:
+  BufferPool::Slot m_slot;
+  char*            m_data;
+  size_t           m_size;
+};
+
+// ArduinoJson-Allocator auf dem JsonDoc-Slot: Dokumente liegen damit weder
+// auf dem loop()-Stack noch auf dem Heap. Ist der Slot belegt, bekommt das
+// Dokument Kapazitaet 0 und doc.overflowed() meldet den Fehler.
+struct ArenaJsonAllocator {
+  void* allocate(size_t n) {
+    return BufferPool::acquire(BufferPool::Slot::JsonDoc, "json", n);
+  }
+  void deallocate(void* p) {
+    if (p) BufferPool::release(BufferPool::Slot::JsonDoc);
+  }
+  void* reallocate(void* p, size_t n) {
+    return (n <= BufferPool::size(BufferPool::Slot::JsonDoc)) ? p : nullptr;
+  }
+};
+
+class ArenaJsonDocument : public BasicJsonDocument<ArenaJsonAllocator> {
+public:
+  ArenaJsonDocument()
+    : BasicJsonDocument<ArenaJsonAllocator>(BufferPool::size(BufferPool::Slot::JsonDoc)) {}
+  ~ArenaJsonDocument() {
+    BufferPool::noteUsed(BufferPool::Slot::JsonDoc, memoryUsage());
+  }
+};
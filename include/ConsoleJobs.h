@@ -0,0 +1,54 @@
+#pragma once
+#include <WebServer.h>
+
+class BatteryLink;
+template<unsigned int Size> class circular_log;
+
+#ifndef CONSOLE_JOB_SLOTS
+#define CONSOLE_JOB_SLOTS 4              // wartende + laufende + beendete Jobs
+#endif
+#ifndef CONSOLE_JOB_MAX_WAITERS
+#define CONSOLE_JOB_MAX_WAITERS 4        // gleichzeitig wartende HTTP-Clients
+#endif
+#ifndef CONSOLE_JOB_RESULT_TTL_MS
+#define CONSOLE_JOB_RESULT_TTL_MS 60000UL
+#endif
+#ifndef CONSOLE_JOB_STALL_MS
+#define CONSOLE_JOB_STALL_MS 15000UL     // Client nimmt so lange nichts ab: trennen
+#endif
+#ifndef CONSOLE_JOB_GAP_MS
+#define CONSOLE_JOB_GAP_MS 1500UL        // Mindestabstand zwischen zwei Konsolen-Befehlen
+#endif
+
+// Konsolen-Befehle als Jobs. POST /api/jobs reiht einen Befehl ein und
+// liefert eine id; GET /api/jobs/<id>/stream schickt die Ausgabe chunked,
+// sobald sie am UART ankommt (inkl. weitergeblaetterter log-/data-Seiten).
+// Das Ergebnis des zuletzt beendeten Jobs bleibt CONSOLE_JOB_RESULT_TTL_MS
+// zum erneuten Lesen im JobResult-Slot der Arena liegen; laeuft es ab oder
+// wird der Job verdraengt, wird der Slot freigegeben. /api/cmd und /cmd
+// laufen ueber denselben Weg und bekommen die Antwort am Stueck.
+namespace ConsoleJobs {
+  void init(WebServer* server, BatteryLink* link, circular_log<16384>* clog);
+  void loop();
+
+  // Prueft Laenge und Zeichensatz. 0 = ok, sonst HTTP-Status; err zeigt auf
+  // einen kurzen Fehlertext.
+  int  checkCommand(const char* cmd, const char** err);
+  bool needsPrompt(const char* cmd);
+
+  // Liefert die Job-id oder 0, wenn die Warteschlange voll ist.
+  uint32_t submit(const char* cmd, bool promptMode, unsigned long timeoutMs);
+
+  // Haengt den aktuellen HTTP-Client an einen Job. whole = eine Antwort mit
+  // Content-Length nach Abschluss, sonst chunked Stream. Fehlerfaelle
+  // (unbekannt, abgelaufen, zu viele Clients) beantwortet attach() selbst.
+  void attach(uint32_t id, bool whole);
+
+  // Abfrage ohne HTTP-Client (z. B. fuer MQTT). Bei Done/Failed zeigen
+  // out/len auf das Ergebnis im JobResult-Slot; gueltig bis zum naechsten
+  // beendeten Job. Expired = Job fertig, Ergebnis aber schon verdraengt.
+  enum class JobStatus : uint8_t { Unknown, Pending, Done, Failed, Expired };
+  JobStatus status(uint32_t id, const char** out = nullptr, size_t* len = nullptr, bool* truncated = nullptr);
+
+  uint8_t pending();
+}
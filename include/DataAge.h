@@ -0,0 +1,61 @@
+#pragma once
+#include <WebServer.h>
+#include "batteryStack.h"
+#include "PylonLink.h"
+
+// Alter der Messwerte vom ersten UART-Byte bis zum Verbraucher. Je Quelle
+// (pwr, pwrsys) wird der zuletzt uebernommene Messwert mit seinen
+// Zeitpunkten gehalten: erstes Antwortbyte (= Messzeitpunkt), Prompt,
+// Parse fertig, Uebernahme nach StackGuard. Jede Auslieferung per MQTT oder
+// HTTP traegt das Alter zu diesem Zeitpunkt in ein Histogramm je Pfad und
+// Quelle ein. GET /api/latency zeigt beides.
+namespace DataAge {
+  enum class Source : uint8_t { Pwr, Pwrsys, Count };
+  enum class Path : uint8_t { Mqtt, Http, Count };
+
+  constexpr size_t kBuckets = 8;
+  // Obergrenzen der Alters-Buckets in Millisekunden
+  extern const uint32_t kBucketMs[kBuckets];
+
+  // Zeitpunkte eines Messwerts in millis()
+  struct Sample {
+    uint32_t seq = 0;             // 0 = noch kein Messwert
+    uint32_t sentMs = 0;          // Befehl geschrieben
+    uint32_t firstRxMs = 0;       // erstes Antwortbyte
+    uint32_t promptMs = 0;
+    uint32_t parsedMs = 0;
+    uint32_t acceptedMs = 0;      // in g_stack bzw. g_systemStack
+  };
+
+  // Dauer der Abschnitte: letzter und groesster Wert seit Boot
+  struct Stages {
+    uint32_t waitMs = 0,   waitMaxMs = 0;     // Befehl -> erstes Byte
+    uint32_t rxMs = 0,     rxMaxMs = 0;       // erstes Byte -> Prompt
+    uint32_t parseMs = 0,  parseMaxMs = 0;    // Prompt -> Parse fertig
+    uint32_t acceptMs = 0, acceptMaxMs = 0;   // Parse -> Uebernahme
+  };
+
+  struct PathStats {
+    uint32_t count = 0;
+    uint64_t sumMs = 0;
+    uint32_t lastMs = 0;
+    uint32_t maxMs = 0;
+    uint32_t buckets[kBuckets] = {0};         // nicht kumuliert, je Obergrenze
+    uint32_t overflow = 0;
+  };
+
+  void init(WebServer* server, const dailyEnergyData* energy);
+
+  void noteSample(Source src, const LinkTiming& timing, uint32_t parsedMs, uint32_t acceptedMs);
+  // Messwert von src wurde ausgeliefert (MQTT-Publish, HTTP-Antwort inkl. 304)
+  void noteConsumed(Path path, Source src);
+
+  const Sample&    sample(Source src);
+  const Stages&    stages(Source src);
+  const PathStats& pathStats(Path path, Source src);
+  uint32_t         ageMs(Source src);         // 0 ohne Messwert
+  unsigned long    sampleEpoch(Source src);   // Unixzeit des Messwerts, 0 ohne Zeitsync
+
+  const char* sourceName(Source src);
+  const char* pathName(Path path);
+}
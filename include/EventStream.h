@@ -0,0 +1,24 @@
+#pragma once
+#include <WebServer.h>
+#include "batteryStack.h"
+
+template<unsigned int Size> class circular_log;
+
+#ifndef EVENT_STREAM_MAX_CLIENTS
+#define EVENT_STREAM_MAX_CLIENTS 4
+#endif
+
+// Server-Sent-Events unter /api/events. Nach jedem uebernommenen pwr-/pwrsys-
+// Parse wird genau ein Delta serialisiert und an alle verbundenen Browser
+// geschrieben; neue Clients bekommen einmalig den kompletten Stand.
+namespace EventStream {
+  void init(WebServer* server,
+            batteryStack* stk,
+            systemData* sys,
+            dailyEnergyData* energy,
+            circular_log<16384>* clog);
+  void loop();
+  void notifyStack();
+  void notifySystem();
+  uint8_t clientCount();
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+class JsonWriter;
+
+#ifndef HEAP_SAMPLE_INTERVAL_MS
+#define HEAP_SAMPLE_INTERVAL_MS 10000UL   // heap_caps_get_info() laeuft ueber alle Bloecke
+#endif
+// 1 = malloc/free/realloc/calloc per Linker-Wrap zaehlen (Build-Env
+// esp32-heapdebug setzt zusaetzlich die -Wl,--wrap=...-Flags)
+#ifndef HEAP_ALLOC_HOOK
+#define HEAP_ALLOC_HOOK 0
+#endif
+
+// Heap-Zustand fuer Langzeitbetrieb: groesster freier Block und
+// Fragmentierung (periodisch abgetastet), fehlgeschlagene Allokationen,
+// Stack-Reserve der wichtigsten FreeRTOS-Tasks und optional Allokationen
+// je Teilsystem. Zugeordnet wird ueber Scope-Marken im loop(); Allokationen
+// anderer Tasks zaehlen unter "other".
+namespace HeapHealth {
+  enum class Sub : uint8_t { Other, Web, Mqtt, Poll, Jobs, Count };
+
+  struct Info {
+    uint32_t freeBytes = 0;
+    uint32_t minFreeBytes = 0;
+    uint32_t largestBlock = 0;
+    uint32_t largestBlockMin = 0;   // kleinster gesehener Wert seit Boot
+    uint32_t allocatedBlocks = 0;
+    uint32_t freeBlocks = 0;
+    uint8_t  fragPct = 0;           // 100 - groesster Block / frei
+    uint8_t  fragPctMax = 0;
+    uint32_t failedAllocs = 0;
+    uint32_t lastFailedSize = 0;
+    uint32_t samples = 0;
+  };
+
+  struct SubStats {
+    uint32_t allocs = 0;
+    uint32_t frees = 0;
+    uint64_t bytes = 0;             // angeforderte Bytes, ohne Freigaben
+  };
+
+  void begin();
+  void loop();                      // tastet im Abstand HEAP_SAMPLE_INTERVAL_MS ab
+  const Info& info();
+
+  bool hookEnabled();
+  const SubStats& subStats(Sub sub);
+  const char* subName(Sub sub);
+
+  // Freie Stack-Bytes (High-Water-Mark) der bekannten Tasks; false, wenn
+  // es den Task nicht gibt
+  size_t taskCount();
+  bool   task(size_t idx, const char*& name, uint32_t& freeStackBytes);
+
+  // Felder fuer /api/diag und MQTT in ein bereits geoeffnetes Objekt
+  void writeFields(JsonWriter& w);
+
+  // Ordnet Allokationen im loop()-Task bis zum Scope-Ende einem Teilsystem zu
+  class Scope {
+  public:
+    explicit Scope(Sub sub);
+    ~Scope();
+  private:
+    Sub m_prev;
+  };
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <Print.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streamender JSON-Emitter ohne Heap und ohne Dokumentmodell: jedes Feld
+// geht sofort in das Print-Ziel (Socket, Cache-Puffer, MQTT-Payload).
+// Kommas und Verschachtelung verwaltet der Writer selbst (max. 32 Ebenen).
+class JsonWriter {
+public:
+  explicit JsonWriter(Print& out) : m_out(out) {}
+
+  JsonWriter& beginObject(const char* key = nullptr);
+  JsonWriter& endObject();
+  JsonWriter& beginArray(const char* key = nullptr);
+  JsonWriter& endArray();
+
+  // Objektfelder
+  JsonWriter& field(const char* key, const char* v)        { prefix(key); putString(v); return *this; }
+  JsonWriter& field(const char* key, const char* v, size_t len) { prefix(key); putString(v, len); return *this; }
+  JsonWriter& field(const char* key, bool v)               { prefix(key); putBool(v); return *this; }
+  JsonWriter& field(const char* key, int v)                { prefix(key); putSigned(v); return *this; }
+  JsonWriter& field(const char* key, unsigned v)           { prefix(key); putUnsigned(v); return *this; }
+  JsonWriter& field(const char* key, long v)               { prefix(key); putSigned(v); return *this; }
+  JsonWriter& field(const char* key, unsigned long v)      { prefix(key); putUnsigned(v); return *this; }
+  JsonWriter& field(const char* key, long long v)          { prefix(key); putSigned(v); return *this; }
+  JsonWriter& field(const char* key, unsigned long long v) { prefix(key); putUnsigned(v); return *this; }
+  JsonWriter& field(const char* key, double v, uint8_t decimals = 3) {
+    prefix(key); putFloat(v, decimals); return *this;
+  }
+  JsonWriter& fieldNull(const char* key)                   { prefix(key); putRaw("null", 4); return *this; }
+
+  // Array-Elemente
+  JsonWriter& value(const char* v)        { prefix(nullptr); putString(v); return *this; }
+  JsonWriter& value(bool v)               { prefix(nullptr); putBool(v); return *this; }
+  JsonWriter& value(int v)                { prefix(nullptr); putSigned(v); return *this; }
+  JsonWriter& value(unsigned v)           { prefix(nullptr); putUnsigned(v); return *this; }
+  JsonWriter& value(long v)               { prefix(nullptr); putSigned(v); return *this; }
+  JsonWriter& value(unsigned long v)      { prefix(nullptr); putUnsigned(v); return *this; }
+  JsonWriter& value(double v, uint8_t decimals = 3) {
+    prefix(nullptr); putFloat(v, decimals); return *this;
+  }
+
+  // bisher geschriebene Bytes (auch wenn das Ziel sie verworfen hat)
+  size_t length() const { return m_len; }
+
+private:
+  void prefix(const char* key);
+  void putRaw(const char* s, size_t n);
+  void putString(const char* s);
+  void putString(const char* s, size_t len);  // ohne Nullterminator, darf \0 enthalten
+  void putBool(bool v) { v ? putRaw("true", 4) : putRaw("false", 5); }
+  void putSigned(long long v);
+  void putUnsigned(unsigned long long v);
+  void putFloat(double v, uint8_t decimals);
+
+  Print&   m_out;
+  size_t   m_len = 0;
+  uint32_t m_hasItems = 0;   // Bit je Ebene: dort steht schon ein Element
+  uint8_t  m_depth = 0;
+};
+
+// Print-Ziel fester Groesse, z. B. ein Slot der Arena. Bei Ueberlauf wird
+// abgeschnitten und overflowed() gesetzt; der Inhalt bleibt nullterminiert.
+class BufferPrint : public Print {
+public:
+  BufferPrint(char* buf, size_t size);
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* data, size_t n) override;
+  using Print::write;
+
+  const char* c_str() const { return m_buf; }
+  size_t length() const { return m_len; }
+  bool overflowed() const { return m_overflow; }
+
+private:
+  char*  m_buf;
+  size_t m_size;
+  size_t m_len = 0;
+  bool   m_overflow = false;
+};
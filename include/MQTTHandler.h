@@ -2,15 +2,139 @@
 #define MQTT_HANDLER_H
 
 #include <PubSubClient.h>
+#include <WiFi.h>
 #include "batteryStack.h"
 
+class BatteryLink;
+
+// Totzonen fuer change-driven Publishing, in den Rohwerten des Parsers.
+// Ein Topic wird erst neu gesendet, wenn der Wert mindestens so weit vom
+// zuletzt gesendeten abweicht. 0 bzw. 1 = jede Aenderung.
+#ifndef MQTT_DEADBAND_MV
+#define MQTT_DEADBAND_MV 10        // Modul-/Systemspannung, mV
+#endif
+#ifndef MQTT_DEADBAND_CELL_MV
+#define MQTT_DEADBAND_CELL_MV 2    // Zellspannung und Zellspreizung, mV
+#endif
+#ifndef MQTT_DEADBAND_MA
+#define MQTT_DEADBAND_MA 100       // Strom, mA
+#endif
+#ifndef MQTT_DEADBAND_MC
+#define MQTT_DEADBAND_MC 500       // Temperatur, m°C
+#endif
+#ifndef MQTT_DEADBAND_PCT
+#define MQTT_DEADBAND_PCT 1        // SoC/SoH, %
+#endif
+#ifndef MQTT_DEADBAND_W
+#define MQTT_DEADBAND_W 10         // Leistung, W
+#endif
+#ifndef MQTT_DEADBAND_WH
+#define MQTT_DEADBAND_WH 10        // Tagesenergie, Wh
+#endif
+#ifndef MQTT_DEADBAND_MAH
+#define MQTT_DEADBAND_MAH 100      // Restkapazitaet, mAh
+#endif
+// 1 = statt Einzel-Topics je Zyklus ein JSON-Dokument fuer Stack
+// (<root>stack/json), System (<root>system/json) und jede Batterie
+// (<root><n>/json); die Discovery liest die Felder per value_template.
+#ifndef MQTT_AGGREGATED_STATE
+#define MQTT_AGGREGATED_STATE 0
+#endif
+// Discovery wird schrittweise aus loop() gesendet: je Schritt hoechstens
+// MQTT_DISCOVERY_BATCH Configs, Schritte mindestens MQTT_DISCOVERY_GAP_MS
+// auseinander. Reconnects innerhalb MQTT_DISCOVERY_QUICK_RECONNECT_MS
+// ueberspringen unveraenderte Configs.
+#ifndef MQTT_DISCOVERY_BATCH
+#define MQTT_DISCOVERY_BATCH 4
+#endif
+#ifndef MQTT_DISCOVERY_GAP_MS
+#define MQTT_DISCOVERY_GAP_MS 100UL
+#endif
+#ifndef MQTT_DISCOVERY_QUICK_RECONNECT_MS
+#define MQTT_DISCOVERY_QUICK_RECONNECT_MS 600000UL
+#endif
+// Birth-Topic von Home Assistant; "online" loest eine neue Discovery aus
+#ifndef HA_STATUS_TOPIC
+#define HA_STATUS_TOPIC "homeassistant/status"
+#endif
+// Verbindungsaufbau: TCP-Timeout je Versuch, Backoff-Grenzen (mit +/-25 %
+// Jitter) und Timeout fuer CONNACK/Lesen innerhalb von PubSubClient
+#ifndef MQTT_CONNECT_TIMEOUT_MS
+#define MQTT_CONNECT_TIMEOUT_MS 5000UL
+#endif
+#ifndef MQTT_BACKOFF_MIN_MS
+#define MQTT_BACKOFF_MIN_MS 1000UL
+#endif
+#ifndef MQTT_BACKOFF_MAX_MS
+#define MQTT_BACKOFF_MAX_MS 120000UL
+#endif
+#ifndef MQTT_SOCKET_TIMEOUT_S
+#define MQTT_SOCKET_TIMEOUT_S 2
+#endif
+// Abstand der zeitgestempelten Verlaufswerte auf <root>history
+#ifndef MQTT_SAMPLE_INTERVAL_MS
+#define MQTT_SAMPLE_INTERVAL_MS 60000UL
+#endif
+// Mindestabstand je Publish-Klasse; ausgewertet wird eine Klasse nur, wenn
+// eine ihrer Quellen (markUpdated) seitdem neue Daten geliefert hat
+#ifndef MQTT_FAST_INTERVAL_MS
+#define MQTT_FAST_INTERVAL_MS 2000UL       // Strom, Leistung, SoC
+#endif
+#ifndef MQTT_MEDIUM_INTERVAL_MS
+#define MQTT_MEDIUM_INTERVAL_MS 30000UL    // Temperaturen, Zellspreizung
+#endif
+#ifndef MQTT_SLOW_INTERVAL_MS
+#define MQTT_SLOW_INTERVAL_MS 60000UL      // Zyklen, SOH, FCC, Empfehlungen
+#endif
+// Abstand der UART-Link-Statistik auf <root>diag/link/<befehl> und des
+// Heap-Zustands auf <root>diag/heap
+#ifndef MQTT_LINK_STATS_INTERVAL_MS
+#define MQTT_LINK_STATS_INTERVAL_MS 60000UL
+#endif
+// Abstand, in dem alle Topics unabhaengig von Aenderungen neu gesendet werden
+#ifndef MQTT_FULL_REFRESH_MS
+#define MQTT_FULL_REFRESH_MS 300000UL
+#endif
+// Befehlskanal: <root>cmd/<id> nimmt Konsolen-Befehle (wie /api/cmd) und
+// mit '!' beginnende Steuerbefehle an; Antwort auf <root>cmd/<id>/result in
+// JSON-Stuecken von hoechstens MQTT_CMD_CHUNK_BYTES escapetem Text.
+#ifndef MQTT_CMD_ENABLE
+#define MQTT_CMD_ENABLE 1
+#endif
+#ifndef MQTT_CMD_SLOTS
+#define MQTT_CMD_SLOTS 4           // gleichzeitig offene Anfragen
+#endif
+#ifndef MQTT_CMD_CHUNK_BYTES
+#define MQTT_CMD_CHUNK_BYTES 512
+#endif
+#ifndef MQTT_CMD_CHUNKS_PER_LOOP
+#define MQTT_CMD_CHUNKS_PER_LOOP 4
+#endif
+
 class MQTTHandler {
 public:
-  static void init(PubSubClient* client, batteryStack* stack, systemData* system = nullptr, dailyEnergyData* energy = nullptr);
+  enum class ConnPhase : uint8_t { Backoff, Connecting, Connected };
+  enum class Source : uint8_t { Pwr, Pwrsys, Stat };
+
+  struct ConnStats {
+    ConnPhase     phase;
+    uint8_t       health;          // 0..100, gleitend aus Versuchen und Abbruechen
+    uint32_t      attempts;
+    uint32_t      successes;
+    uint32_t      failures;
+    uint32_t      disconnects;
+    unsigned long backoffMs;       // aktueller Abstand bis zum naechsten Versuch
+    unsigned long lastConnectMs;   // Dauer des letzten erfolgreichen Aufbaus
+    unsigned long maxConnectMs;
+    unsigned long sumConnectMs;
+    unsigned long connectedSinceMs;
+  };
+
+  static void init(PubSubClient* client, WiFiClient* net, batteryStack* stack, systemData* system = nullptr, dailyEnergyData* energy = nullptr);
   static void loop();
   static void publishIfConnected();
   static void publishDiscovery();
-  static void publishData();
+  static void publishData(uint8_t classes = 0xFF);  // Bitmaske der Publish-Klassen
   static void publishDiagnostic(const char* resetReason,
                                 const char* savedPhase,
                                 const char* rtcPhase,
@@ -20,17 +144,48 @@ public:
                                 uint32_t minFreeHeap);
   static void publishDiagnosticEvent(const char* eventText);
   static void publishDiagnosticDetail(const char* key, const char* value);
+  // Je Befehlsart ein retained JSON-Dokument, hoechstens alle MQTT_LINK_STATS_INTERVAL_MS
+  static void publishLinkStats(const BatteryLink& link);
+  // Heap-Zustand (HeapHealth) retained auf <root>diag/heap, im selben Takt
+  static void publishHeapHealth();
+
+  // Quelle hat neue Werte geliefert; markiert die betroffenen Klassen
+  static void markUpdated(Source source);
+  // Naechster Zyklus sendet alle Topics, unabhaengig von den Totzonen
+  static void invalidatePublished();
+  static void publishCounters(uint32_t& published, uint32_t& suppressed);
+  static ConnStats connStats();
+  // Trennt die Verbindung und baut sie fruehestens nach ms wieder auf
+  // (Ausfall-Simulation im Soak-Test)
+  static void suspend(unsigned long ms);
+
+  // Steuerbefehl ohne fuehrendes '!'; reply bekommt eine kurze Antwort.
+  // Rueckgabe false = Fehler (state "error" im Ergebnis).
+  using ControlHandler = bool (*)(const char* cmd, char* reply, size_t replySize);
+  static void setControlHandler(ControlHandler handler);
 
 private:
   static void connectIfNeeded();
+  static bool mqttHandshake();
+  static void onConnected();
+  static void scheduleRetry(bool failedAttempt);
   static void heartbeatAvailability();
+  static void discoveryStep();
+  static void sampleTick();
+  static void forgetDiscovery();
+  static void onMessage(char* topic, uint8_t* payload, unsigned int length);
+  static void onCommand(const char* reqId, const uint8_t* payload, unsigned int length);
+  static void cmdStep();
 
   static PubSubClient* s_client;
+  static WiFiClient*   s_net;
+  static ConnStats     s_conn;
   static batteryStack* s_stack;
   static systemData*   s_system;
   static dailyEnergyData* s_energy;
-  static unsigned long s_lastPublishMs;
   static unsigned long s_lastAvailMs;
+  static unsigned long s_lastSampleMs;
+  static ControlHandler s_control;
 };
 
 #endif // MQTT_HANDLER_H
@@ -0,0 +1,17 @@
+#pragma once
+#include <WebServer.h>
+#include "batteryStack.h"
+
+class BatteryLink;
+
+// Prometheus-Textformat unter /metrics. Wird beim Scrape direkt aus den
+// Live-Strukturen in die Antwort gestreamt (feste Label-Sets, kein String,
+// Puffer aus dem JsonOut-Slot), damit mehrere Collector im 10-s-Takt das
+// Polling nicht stoeren.
+namespace Metrics {
+  void init(WebServer* server,
+            BatteryLink* link,
+            batteryStack* stk,
+            systemData* sys,
+            dailyEnergyData* energy);
+}
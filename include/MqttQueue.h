@@ -0,0 +1,55 @@
+#pragma once
+#include <PubSubClient.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Groesse des RAM-Puffers fuer ausstehende Publishes (Topic + Payload + Kopf)
+#ifndef MQTT_QUEUE_BYTES
+#define MQTT_QUEUE_BYTES 4096
+#endif
+// 1 = bei vollem RAM-Puffer die aeltesten Eintraege nach LittleFS auslagern
+#ifndef MQTT_QUEUE_SPILL
+#define MQTT_QUEUE_SPILL 0
+#endif
+#ifndef MQTT_QUEUE_SPILL_MAX_BYTES
+#define MQTT_QUEUE_SPILL_MAX_BYTES 65536UL
+#endif
+// Abbau nach Reconnect: hoechstens BATCH Nachrichten je GAP_MS
+#ifndef MQTT_QUEUE_DRAIN_BATCH
+#define MQTT_QUEUE_DRAIN_BATCH 5
+#endif
+#ifndef MQTT_QUEUE_DRAIN_GAP_MS
+#define MQTT_QUEUE_DRAIN_GAP_MS 200UL
+#endif
+
+// Store-and-forward fuer MQTT waehrend Broker- oder WLAN-Ausfaellen.
+// Eintraege liegen in einem festen Byte-Puffer in Einfuegereihenfolge.
+// Ein neuer retained-Wert ersetzt einen noch wartenden mit gleichem Topic
+// (nur der letzte Stand zaehlt). Ist der Puffer voll, wird der aelteste
+// Eintrag ausgelagert (MQTT_QUEUE_SPILL) oder verworfen und gezaehlt.
+namespace MqttQueue {
+  struct Stats {
+    uint16_t depth;       // wartende Nachrichten im RAM
+    uint32_t bytes;       // davon belegte Bytes
+    uint32_t spillBytes;  // noch nicht gesendete Bytes in LittleFS
+    uint32_t enqueued;
+    uint32_t sent;
+    uint32_t coalesced;   // durch neueren retained-Wert ersetzt
+    uint32_t spilled;
+    uint32_t dropped;     // Puffer und Auslagerung voll bzw. Eintrag zu gross
+  };
+
+  // Nach LittleFS.begin(): uebernimmt eine Auslagerung vom letzten Lauf
+  void begin();
+
+  // false, wenn die Nachricht nicht aufgenommen werden konnte
+  bool push(const char* topic, const uint8_t* payload, size_t len, bool retained);
+  bool push(const char* topic, const char* payload, bool retained);
+
+  // Sendet wartende Nachrichten ratenbegrenzt; bricht ab, sobald publish()
+  // scheitert (Sendepuffer voll oder Verbindung weg).
+  void drain(PubSubClient* client);
+
+  bool  empty();
+  Stats stats();
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <Print.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streamender MessagePack-Emitter, Gegenstueck zum JsonWriter. Maps und
+// Arrays tragen ihre Laenge im Kopf, daher wird die Anzahl beim Oeffnen
+// angegeben; end() prueft, dass genau so viele Elemente geschrieben wurden
+// (sonst ok() == false). Zahlen gehen immer in der kuerzesten Kodierung raus.
+class MsgPackWriter {
+public:
+  explicit MsgPackWriter(Print& out) : m_out(out) {}
+
+  MsgPackWriter& beginMap(uint16_t entries, const char* key = nullptr);
+  MsgPackWriter& beginArray(uint16_t items, const char* key = nullptr);
+  MsgPackWriter& end();
+
+  // Map-Eintraege
+  MsgPackWriter& field(const char* key, const char* v)        { prefix(key); putString(v); return *this; }
+  MsgPackWriter& field(const char* key, bool v)               { prefix(key); putBool(v); return *this; }
+  MsgPackWriter& field(const char* key, int v)                { prefix(key); putSigned(v); return *this; }
+  MsgPackWriter& field(const char* key, unsigned v)           { prefix(key); putUnsigned(v); return *this; }
+  MsgPackWriter& field(const char* key, long v)               { prefix(key); putSigned(v); return *this; }
+  MsgPackWriter& field(const char* key, unsigned long v)      { prefix(key); putUnsigned(v); return *this; }
+  MsgPackWriter& field(const char* key, long long v)          { prefix(key); putSigned(v); return *this; }
+  MsgPackWriter& field(const char* key, unsigned long long v) { prefix(key); putUnsigned(v); return *this; }
+  MsgPackWriter& fieldNil(const char* key)                    { prefix(key); putByte(0xc0); return *this; }
+
+  // Array-Elemente
+  MsgPackWriter& value(const char* v)   { prefix(nullptr); putString(v); return *this; }
+  MsgPackWriter& value(bool v)          { prefix(nullptr); putBool(v); return *this; }
+  MsgPackWriter& value(long long v)     { prefix(nullptr); putSigned(v); return *this; }
+
+  size_t length() const { return m_len; }
+  bool   ok() const { return !m_error && m_depth == 0; }
+
+private:
+  static constexpr uint8_t kMaxDepth = 8;
+
+  void prefix(const char* key);
+  void putByte(uint8_t b) { putRaw(&b, 1); }
+  void putRaw(const uint8_t* p, size_t n);
+  void putBE(uint64_t v, uint8_t bytes);
+  void putString(const char* s);
+  void putBool(bool v) { putByte(v ? 0xc3 : 0xc2); }
+  void putSigned(long long v);
+  void putUnsigned(unsigned long long v);
+  void open(uint16_t count);
+
+  Print&   m_out;
+  size_t   m_len = 0;
+  uint16_t m_remaining[kMaxDepth] = {0};
+  uint8_t  m_depth = 0;
+  bool     m_error = false;
+};
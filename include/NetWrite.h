@@ -0,0 +1,21 @@
+#pragma once
+#include <stddef.h>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <errno.h>
+
+// Nicht blockierendes Schreiben auf einen uebernommenen Client. Anders als
+// WiFiClient::write() wartet send() mit MSG_DONTWAIT nie auf Platz im
+// TCP-Sendepuffer; was nicht passt, schreibt der Aufrufer beim naechsten
+// loop()-Durchlauf ab seinem eigenen Offset weiter.
+namespace NetWrite {
+  // Geschriebene Bytes (0 = Sendepuffer voll), -1 = Verbindung kaputt
+  inline int sendSome(WiFiClient& c, const void* data, size_t len) {
+    const int fd = c.fd();
+    if (fd < 0) return -1;
+    if (!len) return 0;
+    const int n = (int)send(fd, data, len, MSG_DONTWAIT);
+    if (n >= 0) return n;
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "batteryStack.h"
+
+class JsonWriter;
+
+#ifndef NVS_WRITE_INTERVAL_MS
+#define NVS_WRITE_INTERVAL_MS 300000UL    // normale Aenderungen hoechstens so oft
+#endif
+#ifndef NVS_URGENT_PER_HOUR
+#define NVS_URGENT_PER_HOUR 6             // sofortige Schreibvorgaenge je Stunde, danach im Intervall
+#endif
+
+// Ein gemeinsamer Datensatz fuer alles, was Neustarts ueberleben soll
+// (CrashTrace, EnergyTracker), statt einzelner Keys in eigenen Namespaces.
+// Gespeichert als ein NVS-Blob mit Version und CRC-32; geschrieben wird
+// nur bei Aenderung und im Rahmen des Budgets, unveraenderte Daten gar
+// nicht. Vor esp_restart() (Shutdown-Handler) und vor OTA wird sofort
+// geschrieben. Beim ersten Start werden die alten Namespaces uebernommen
+// und geloescht. Nur aus dem loop()-Task aufrufen.
+namespace NvsStore {
+  constexpr uint16_t kVersion = 1;
+
+  struct Record {
+    uint32_t      writes;           // Schreibvorgaenge seit Anlage, fuer den Verschleiss
+    // CrashTrace
+    uint32_t      bootCount;
+    uint8_t       crashPhase;
+    // EnergyTracker
+    uint32_t      energyDay;
+    energyCounter chargeToday, dischargeToday;
+    energyCounter chargeTotal, dischargeTotal;
+    energyCounter batCharge[MAX_PYLON_BATTERIES];
+    energyCounter batDischarge[MAX_PYLON_BATTERIES];
+  };
+
+  enum class Load : uint8_t { Empty, Ok, Migrated, CrcError, Mismatch };
+
+  struct Stats {
+    Load     load = Load::Empty;
+    uint32_t writes = 0;            // seit Boot
+    uint32_t unchanged = 0;         // faellig, aber identisch mit dem Flash-Stand
+    uint32_t deferred = 0;          // dringend, aber Stundenbudget verbraucht
+    uint32_t failed = 0;
+    uint32_t lastUs = 0;
+    uint32_t maxUs = 0;
+    uint64_t sumUs = 0;
+    uint32_t lastWriteMs = 0;
+  };
+
+  void begin();                     // vor CrashTrace und EnergyTracker
+  void loop();
+
+  // Stand im RAM; nach Aenderungen markDirty() aufrufen
+  Record&       record();
+  // Zuletzt geschriebener bzw. beim Start geladener Stand
+  const Record& stored();
+  // urgent = sofort schreiben, solange das Stundenbudget reicht
+  void markDirty(bool urgent = false);
+  // Schreibt sofort, falls etwas offen ist (Neustart, OTA)
+  bool flush();
+
+  const Stats& stats();
+  const char*  loadName();
+  void writeFields(JsonWriter& w);
+}
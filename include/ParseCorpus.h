@@ -0,0 +1,32 @@
+#pragma once
+#include <WebServer.h>
+#include "batteryStack.h"
+
+#ifndef PARSE_CORPUS_ENABLE
+#define PARSE_CORPUS_ENABLE 1
+#endif
+#ifndef PARSE_CORPUS_FILES
+#define PARSE_CORPUS_FILES 16          // Ringgroesse; aelteste Datei wird ueberschrieben
+#endif
+#ifndef PARSE_CORPUS_MAX_BYTES
+#define PARSE_CORPUS_MAX_BYTES 16384   // Rohdaten je Datei (= Rx-Slot)
+#endif
+#ifndef PARSE_CORPUS_MIN_GAP_MS
+#define PARSE_CORPUS_MIN_GAP_MS 60000UL  // Flash schonen, wenn ein Fehler dauerhaft ansteht
+#endif
+
+// Rohantworten fehlgeschlagener oder auffaelliger Parses als Dateien unter
+// /corpus auf LittleFS, je Datei ein Kopf mit "# key: value"-Zeilen, eine
+// Leerzeile und dann die Antwort byte-genau. Gleiche Antworten direkt
+// hintereinander werden nur einmal abgelegt.
+// GET /api/corpus listet, GET /api/corpus/<n> liefert eine Datei,
+// DELETE /api/corpus leert den Ring. tools/fetch_corpus.py laedt alles
+// herunter, z. B. als Eingabe fuer Parser-Tests auf dem Host.
+namespace ParseCorpus {
+  void init(WebServer* server, const dailyEnergyData* energy);
+
+  // reason z. B. "parse_failed", "misattributed", "held_drop"
+  void capture(const char* cmd, const char* reason, const char* payload, unsigned long latencyMs);
+
+  uint32_t captured();
+}
@@ -2,28 +2,143 @@
 #include <HardwareSerial.h>
 #include "circular_log.h"
 
+#ifndef PYLON_UART_RX_BUFFER
+#define PYLON_UART_RX_BUFFER 2048   // UART-Treiberpuffer; traegt Antworten ueber laengere loop()-Durchlaeufe
+#endif
+
+// Befehlsart fuer die Link-Statistik. Polling-Befehle werden am Text
+// erkannt, alles ueber ConsoleJobs zaehlt als User.
+enum class CmdClass : uint8_t { Pwr, Pwrsys, Stat, User, Count };
+
+constexpr size_t kLinkLatencyBuckets = 8;
+// Obergrenzen der Latenz-Buckets in Millisekunden
+extern const uint32_t kLinkLatencyBucketMs[kLinkLatencyBuckets];
+
+// Zaehler je Befehlsart: Latenzverteilung und Fehlerbilder, um Timeouts
+// einzustellen und ein schlechter werdendes RS232-Kabel frueh zu sehen.
+struct LinkClassStats {
+  uint32_t ok = 0;
+  uint32_t failed = 0;
+  uint32_t timeouts = 0;         // Lesefenster abgelaufen ohne Prompt
+  uint32_t retries = 0;
+  uint32_t promptOnly = 0;       // Antworten, die nur aus dem Prompt bestanden
+  uint32_t misattributed = 0;    // Antwort gehoerte zu einem anderen Befehl (vom Aufrufer gemeldet)
+  uint32_t pagesAnswered = 0;    // "Press [Enter]" beantwortet
+  uint32_t parseFailed = 0;      // vom Aufrufer gemeldet
+  uint64_t rxBytes = 0;
+  uint64_t latencySumMs = 0;
+  uint32_t lastLatencyMs = 0;
+  uint32_t maxLatencyMs = 0;
+  uint32_t buckets[kLinkLatencyBuckets] = {0};  // nicht kumuliert, je Obergrenze
+  uint32_t overflow = 0;
+};
+
+const char* cmdClassName(CmdClass cls);
+
+class JsonWriter;
+// Felder einer Befehlsart in ein bereits geoeffnetes JSON-Objekt
+// (/api/link und MQTT-Diagnose)
+void writeLinkClassFields(JsonWriter& w, const LinkClassStats& st);
+
+// Zaehler ueber alle Konsolen-Transaktionen (Polling und Web-Konsole).
+struct LinkStats {
+  uint32_t ok = 0;
+  uint32_t failed = 0;
+  uint32_t retries = 0;          // zweiter Versuch nach reinem Prompt
+  uint64_t rxBytes = 0;
+  uint64_t latencySumMs = 0;     // begin bis Done/Failed
+  uint32_t lastLatencyMs = 0;
+  uint32_t maxLatencyMs = 0;
+};
+
+// Zeitpunkte (millis) der letzten abgeschlossenen Transaktion, fuer die
+// Alterskette eines Messwerts (DataAge)
+struct LinkTiming {
+  uint32_t startMs = 0;          // beginTransaction()
+  uint32_t sentMs = 0;           // Befehl geschrieben (letzter Versuch)
+  uint32_t firstRxMs = 0;        // erstes Antwortbyte; 0 = keins
+  uint32_t promptMs = 0;         // Prompt erkannt, sonst Ende des Lesefensters
+  uint32_t endMs = 0;
+};
+
 class BatteryLink {
 public:
+  // Zustand einer Konsolen-Transaktion. poll() liefert Done/Failed genau
+  // einmal, danach ist der Link wieder Idle.
+  enum class TxnState : uint8_t { Idle, Busy, Done, Failed };
+
   BatteryLink(HardwareSerial& serial, int rx, int tx);
+  // Beliebiger Stream ohne UART-Steuerung, z. B. PylonSim
+  explicit BatteryLink(Stream& stream);
   void begin(int b);
   void switchBaud(int nb);
 
+  // Blockierende Varianten fuer das Polling; intern dieselbe Zustandsmaschine.
   bool sendAndReceive(const char* cmd, char* outBuf, size_t bufSize, unsigned long timeoutMs=6000);
   bool sendAndReceivePrompt(const char* cmd, char* outBuf, size_t bufSize, unsigned long timeoutMs=12000);
 
+  // Nicht-blockierend: beginTransaction() startet, poll() einmal pro loop()
+  // treibt weiter. promptMode entspricht sendAndReceivePrompt().
+  bool     beginTransaction(const char* cmd, char* outBuf, size_t bufSize,
+                            unsigned long timeoutMs, bool promptMode,
+                            CmdClass cls = CmdClass::User);
+  TxnState poll();
+  size_t   rxLength() const { return m_txn.len; }
+
   int  available() const;
   void logIncoming(circular_log<16384>* log);
   bool isBusy() const { return m_busy; }
+  const LinkStats& stats() const { return m_stats; }
+  const LinkClassStats& classStats(CmdClass cls) const { return m_classStats[(size_t)cls]; }
+  const LinkTiming& lastTiming() const { return m_timing; }
+
+  // Befunde, die erst der Aufrufer beim Auswerten der Antwort erkennt
+  void noteParseFailure(CmdClass cls) { m_classStats[(size_t)cls].parseFailed++; }
+  void noteMisattributed(CmdClass cls) { m_classStats[(size_t)cls].misattributed++; }
 
 private:
-  HardwareSerial& port;
+  enum class Phase : uint8_t { Wake, Send, Read, RetryWait };
+
+  struct Txn {
+    char*         buf = nullptr;
+    size_t        bufSize = 0;
+    size_t        len = 0;
+    unsigned long timeoutMs = 0;
+    uint32_t      startMs = 0;
+    uint32_t      phaseMs = 0;
+    uint32_t      sentMs = 0;
+    uint32_t      firstRxMs = 0;
+    uint32_t      promptMs = 0;
+    uint64_t      readStartUs = 0;  // Trace
+    Phase         phase = Phase::Wake;
+    uint8_t       wakeSent = 0;
+    uint8_t       attempt = 0;
+    bool          promptMode = false;
+    bool          found = false;
+    bool          pageHint = false;  // Pagination-Hinweis im Fenster
+    char          last6[7];     // "pylon>"
+    char          last12[13];   // "pylon_debug>"
+    char          last96[97];   // Pagination etc. in lowercase
+    size_t        last6Len = 0;
+    size_t        last12Len = 0;
+    size_t        last96Len = 0;
+  };
+
+  Stream&         port;
+  HardwareSerial* uart = nullptr;   // nur fuer begin()/switchBaud()
   int rxPin, txPin;
   int baud = 0;
 
   volatile bool m_busy = false;
-  bool lock(uint32_t waitMs);
-  void unlock();
-  int  readUntil(char* buf, const char* term, size_t maxLen, unsigned long timeoutMs);
-  void wakeUpConsole(); // <— WICHTIG: Deklaration
-};
+  Txn m_txn;
+  LinkStats m_stats;
+  LinkClassStats m_classStats[(size_t)CmdClass::Count];
+  LinkTiming m_timing;
+  CmdClass  m_class = CmdClass::User;
+  char m_cmd[72] = {0};
 
+  void startAttempt();
+  bool readAvailable();
+  TxnState finishAttempt();
+  void     recordResult(bool ok, bool timedOut);
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include <Arduino.h>
+#include <WebServer.h>
+
+// 1 = BatteryLink spricht statt mit Serial2 mit dem Simulator (Build-Env
+// esp32-sim); Polling, Parser, MQTT und Web laufen unveraendert mit
+#ifndef PYLON_SIMULATOR
+#define PYLON_SIMULATOR 0
+#endif
+#ifndef PYLON_SIM_BATTERIES
+#define PYLON_SIM_BATTERIES 3
+#endif
+#ifndef PYLON_SIM_FW_VERSION
+#define PYLON_SIM_FW_VERSION 2          // Spaltenlayout von pwr wie FW_VERSION
+#endif
+#ifndef PYLON_SIM_TX_BYTES
+#define PYLON_SIM_TX_BYTES 8192         // groesste Antwort (log, bat) inkl. Seitenumbrueche
+#endif
+#ifndef PYLON_SIM_US_PER_BYTE
+#define PYLON_SIM_US_PER_BYTE 87        // 115200 Baud
+#endif
+#ifndef PYLON_SIM_REPLY_DELAY_MS
+#define PYLON_SIM_REPLY_DELAY_MS 40     // BMS "denkt" vor der ersten Zeile
+#endif
+
+// Pylontech-Konsole als Stream: nimmt Befehlszeilen ueber write() an und
+// liefert die Antwort mit Echo, "$$"-Trenner und pylon>-Prompt ueber
+// available()/read() im Tempo der eingestellten Baudrate aus. Kennt pwr,
+// pwrsys, stat N, bat N und log; lange Ausgaben halten an
+// "Press [Enter] to be continued" an, bis ein '\r' kommt.
+// Fehlerbilder fuer Tests: verlorene Bytes (Promille), haengende Konsole
+// (keine Antwort), nur Prompt, Antwort ohne Prompt.
+class PylonSim : public Stream {
+public:
+  enum class Fault : uint8_t { None, Silent, PromptOnly, NoPrompt };
+
+  struct Config {
+    uint8_t  batteries = PYLON_SIM_BATTERIES;
+    uint8_t  fwVersion = PYLON_SIM_FW_VERSION;
+    uint32_t usPerByte = PYLON_SIM_US_PER_BYTE;
+    uint32_t replyDelayMs = PYLON_SIM_REPLY_DELAY_MS;
+    uint16_t dropPermille = 0;
+    Fault    fault = Fault::None;
+    uint16_t pageLines = 24;            // Zeilen je Seite bei log/bat
+    uint16_t logLines = 60;
+  };
+
+  struct Counters {
+    uint32_t commands = 0;
+    uint32_t unknown = 0;
+    uint32_t pages = 0;                 // per '\r' freigegebene Seiten
+    uint32_t dropped = 0;
+    uint32_t truncated = 0;             // Antwort passte nicht in den Puffer
+    uint64_t txBytes = 0;
+  };
+
+  PylonSim() = default;
+
+  int    available() override;
+  int    read() override;
+  int    peek() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  Config&         config() { return m_cfg; }
+  const Counters& counters() const { return m_counters; }
+  const char*     faultName() const;
+  bool            setFault(const char* name);
+  // Summe Spannung x Strom ueber alle Module in mW, wie die Konsole sie
+  // gerade meldet; Referenz fuer die Energiebilanz im Soak-Test
+  long            stackPowerMw() const;
+
+  // GET /api/sim (Einstellungen und Zaehler), POST /api/sim setzt
+  // usPerByte, replyDelayMs, dropPermille, fault, fw, batteries
+  void init(WebServer* server);
+
+private:
+  static constexpr size_t kMaxPages = 16;
+
+  Config   m_cfg;
+  Counters m_counters;
+
+  char     m_line[72] = {0};
+  size_t   m_lineLen = 0;
+
+  char     m_tx[PYLON_SIM_TX_BYTES];
+  size_t   m_txLen = 0;
+  size_t   m_txPos = 0;
+  size_t   m_pageEnd[kMaxPages];      // Offsets direkt hinter den Seitenhinweisen
+  size_t   m_pageCount = 0;
+  size_t   m_pageIdx = 0;
+  size_t   m_segPos = 0;              // ab hier laeuft der aktuelle Zeittakt
+  uint32_t m_segStartUs = 0;
+  uint32_t m_segDelayUs = 0;
+
+  uint32_t m_seed = 0x2545F491u;
+
+  size_t released();
+  void   onLine();
+  void   startReply(uint32_t delayMs);
+  void   put(const char* fmt, ...);
+  void   pageBreak();
+  void   putPrompt();
+
+  void   replyPwr();
+  void   replyPwrsys();
+  void   replyStat(int idx);
+  void   replyBat(int idx);
+  void   replyLog();
+
+  // Messwerte aus der Laufzeit, damit Polls sich bewegen
+  long   batVoltage(int idx) const;
+  long   batCurrent(int idx) const;
+  long   batTemp(int idx) const;
+  int    batSoc(int idx) const;
+  uint32_t nextRandom();
+};
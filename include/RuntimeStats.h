@@ -0,0 +1,33 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Laufzeit des loop()-Tasks als feste Histogramm-Buckets. Kostet pro
+// Durchlauf zwei micros()-Aufrufe und ein paar Vergleiche; ausgelesen wird
+// von /metrics und /api/diag.
+namespace RuntimeStats {
+  constexpr size_t kLoopBuckets = 8;
+
+  struct LoopStats {
+    uint32_t count = 0;
+    uint64_t sumUs = 0;
+    uint32_t lastUs = 0;
+    uint32_t maxUs = 0;
+    uint32_t buckets[kLoopBuckets] = {0};  // nicht kumuliert, je Obergrenze
+    uint32_t overflow = 0;                 // laenger als die letzte Grenze
+  };
+
+  // Obergrenzen der Buckets in Mikrosekunden
+  extern const uint32_t kLoopBucketUs[kLoopBuckets];
+
+  void recordLoop(uint32_t us);
+  const LoopStats& loop();
+
+  class LoopTimer {
+  public:
+    LoopTimer();
+    ~LoopTimer();
+  private:
+    uint32_t m_startUs;
+  };
+}
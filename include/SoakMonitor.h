@@ -0,0 +1,58 @@
+#pragma once
+#include <WebServer.h>
+#include "batteryStack.h"
+#include "circular_log.h"
+
+#ifndef SOAK_SAMPLE_INTERVAL_MS
+#define SOAK_SAMPLE_INTERVAL_MS 600000UL  // eine Abtastung je 10 min
+#endif
+#ifndef SOAK_SAMPLES
+#define SOAK_SAMPLES 48                   // Verlauf, aelteste fallen heraus
+#endif
+#ifndef SOAK_GROWTH_RUN
+#define SOAK_GROWTH_RUN 12                // so viele Abtastungen ohne Erholung = Fehler
+#endif
+#ifndef SOAK_ENERGY_ERR_PERMILLE
+#define SOAK_ENERGY_ERR_PERMILLE 30       // erlaubte Abweichung der Energiebilanz
+#endif
+
+// Langzeitbeobachtung fuer Dauerlaeufe: tastet im Abstand
+// SOAK_SAMPLE_INTERVAL_MS Heap, Allokationen, loop()-Laufzeit und die
+// Verspaetung der pwr/pwrsys-Polls ab und haelt einen Verlauf. Eine Groesse,
+// die sich ueber SOAK_GROWTH_RUN Abtastungen nie erholt und dabei
+// mindestens in der Haelfte der Schritte verschlechtert, setzt das Urteil
+// dauerhaft auf "fail". Mit einer Referenzleistung (PylonSim) wird
+// zusaetzlich die Energiebilanz des EnergyTracker gegen die im Sekundentakt
+// integrierte Wahrheit gestellt. GET /api/soak liefert Urteil und Verlauf,
+// POST /api/soak setzt zurueck (reset=1) oder trennt MQTT (mqttOutageS=N).
+namespace SoakMonitor {
+  enum class Poll : uint8_t { Pwr, Pwrsys, Count };
+
+  enum class Metric : uint8_t {
+    FreeHeap,       // Bytes, Abnahme ist schlecht
+    LargestBlock,   // Bytes, Abnahme ist schlecht
+    AllocBlocks,    // belegte Heap-Bloecke
+    NetAllocs,      // malloc - free ueber alle Teilsysteme, nur mit HEAP_ALLOC_HOOK
+    LoopAvgUs,      // mittlere loop()-Dauer im Abtastfenster
+    PwrLateMs,      // mittlere Verspaetung der Polls im Abtastfenster
+    PwrsysLateMs,
+    MinStackFree,   // nur Anzeige: High-Water-Mark faellt naturgemaess
+    Count
+  };
+
+  // Referenzleistung in mW (positiv = Laden)
+  using PowerFn = long (*)();
+  using OutageFn = void (*)(unsigned long ms);
+
+  void init(WebServer* server, const dailyEnergyData* energy, circular_log<16384>* clog);
+  void setReference(PowerFn fn);
+  void setOutageHandler(OutageFn fn);
+  void loop();
+
+  // Abstand zum vorigen Poll gleicher Art und der dafuer geplante Abstand
+  void notePoll(Poll poll, uint32_t intervalMs, uint32_t expectedMs);
+
+  bool        failed();
+  const char* failedMetric();       // nullptr, solange alles gut ist
+  const char* metricName(Metric m);
+}
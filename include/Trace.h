@@ -0,0 +1,61 @@
+#pragma once
+#include <WebServer.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 1
+#endif
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 256            // Ringgroesse, Zweierpotenz; 16 Byte je Ereignis
+#endif
+#ifndef TRACE_MIN_US
+#define TRACE_MIN_US 2000UL         // kuerzere Spans werden nicht aufgezeichnet
+#endif
+
+// Ring aus kompakten Span-Ereignissen (Kennung, Start in µs seit Boot, Dauer,
+// Argument) fuer die Frage, wo ein langsamer loop()-Durchlauf seine Zeit
+// gelassen hat. Aufgezeichnet wird am Span-Ende und nur ab TRACE_MIN_US, so
+// reicht der Ring ueber viele unauffaellige Durchlaeufe hinweg bis zum
+// letzten Ausreisser. GET /api/trace liefert den Ring im Chrome-Trace-Format
+// (chrome://tracing, ui.perfetto.dev), Spans ineinander geschachtelt.
+// Nur aus dem loop()-Task aufrufen.
+namespace Trace {
+  enum class Ev : uint8_t {
+    Loop,
+    HandleClient,   // server.handleClient()
+    Jobs,           // ConsoleJobs::loop()
+    Ntp,            // timeClient.update()
+    MqttLoop,       // MQTTHandler::loop(), inkl. Verbindungsaufbau
+    MqttPublish,    // publishData(), arg = Klassen
+    MqttDiscovery,  // ein Discovery-Schritt, arg = gesendete Configs
+    UartTxn,        // sendAndReceive*(), arg = CmdClass
+    UartRead,       // Lesefenster einer Transaktion, arg = Bytes
+    ParsePwr,
+    ParsePwrsys,
+    ParseStat,
+    Roam,           // roamIfNeeded()
+    NvsWrite,       // NvsStore-Datensatz, arg = Bytes
+    Count
+  };
+
+  void init(WebServer* server);
+
+  // Abgeschlossener Span; startUs aus now()
+  void record(Ev ev, uint64_t startUs, uint32_t durUs, uint16_t arg = 0);
+  uint64_t now();
+
+  uint32_t recorded();              // seit Boot, inkl. ueberschriebener
+  const char* name(Ev ev);
+
+  class Span {
+  public:
+    explicit Span(Ev ev, uint16_t arg = 0) : m_ev(ev), m_arg(arg), m_startUs(now()) {}
+    ~Span();
+    void setArg(uint16_t arg) { m_arg = arg; }
+  private:
+    Ev       m_ev;
+    uint16_t m_arg;
+    uint64_t m_startUs;
+  };
+}
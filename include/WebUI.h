@@ -2,10 +2,38 @@
 #include <WebServer.h>
 #include <cstddef>
 #include "batteryStack.h"
+#include "BufferPool.h"
+#include "JsonWriter.h"
 
 class BatteryLink;
 template<unsigned int Size> class circular_log;
 
+// Print-Ziel fuer eine HTTP-Antwort ueber WebServer mit festem Puffer.
+// Der Inhalt wird gesammelt; erst wenn der Puffer voll ist, wird auf
+// Transfer-Encoding: chunked umgeschaltet und stueckweise gesendet.
+class ChunkedPrint : public Print {
+public:
+  ChunkedPrint(WebServer& server, const char* contentType, char* buf, size_t size);
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* data, size_t n) override;
+  using Print::write;
+
+  void   finish();
+  size_t total() const { return m_total; }
+
+private:
+  void flush();
+
+  WebServer&  m_server;
+  const char* m_type;
+  char*       m_buf;
+  size_t      m_size;
+  size_t      m_len = 0;
+  size_t      m_total = 0;
+  bool        m_started = false;
+};
+
 struct statDebugData {
   uint8_t currentIdx = 0;
   uint8_t maxBat = 0;
@@ -30,7 +58,39 @@ namespace WebUI {
             systemData* sys,
             dailyEnergyData* energy,
             statDebugData* statDbg,
-            char* rawBuf,
-            size_t rawBufLen,
             circular_log<16384>* clog);
+  // Schreibt laufende Datei-Auslieferungen weiter (siehe serveStatic)
+  void loop();
+
+  // JSON-Antwort direkt aus dem JsonWriter. Gepuffert wird im JsonOut-Slot
+  // (sonst in 256 Byte auf dem Stack); passt alles hinein, geht die Antwort
+  // mit Content-Length raus, sonst chunked. Der Destruktor schliesst ab.
+  //   WebUI::JsonResponse res;
+  //   res.json().beginObject().field("ok", true).endObject();
+  class JsonResponse {
+  public:
+    JsonResponse();
+    ~JsonResponse();
+    JsonResponse(const JsonResponse&) = delete;
+    JsonResponse& operator=(const JsonResponse&) = delete;
+
+    JsonWriter& json() { return m_writer; }
+
+  private:
+    BufferLease  m_lease;
+    char         m_fallback[256];
+    ChunkedPrint m_print;
+    JsonWriter   m_writer;
+  };
+
+  // Neue Datengeneration: gecachte /api/stack-, /api/system- und
+  // /api/status-Antworten werden beim naechsten Abruf einmal neu gebaut.
+  void markStackChanged();
+  void markSystemChanged();
+
+  // Statische Dateien aus LittleFS. Liegt eine .gz-Variante daneben und
+  // erlaubt der Browser gzip, wird diese mit Content-Encoding ausgeliefert.
+  // ETag = Inhalts-Hash, Cache-Control no-cache (Revalidierung mit 304).
+  // Der Rumpf geht nicht blockierend ueber WebUI::loop() hinaus.
+  void serveStatic(const String& uri);
 }
@@ -1,6 +1,7 @@
 #ifndef BATTERYSTACK_H
 #define BATTERYSTACK_H
 
+#include <cstdint>
 #include <cstring>
 
 #ifndef MAX_PYLON_BATTERIES
@@ -145,14 +146,49 @@ struct batteryStack {
   }
 };
 
+// Energie (mWs) und Ladung (mAs) als Ganzzahlen. add() nimmt nWs bzw.
+// uAs und fuehrt den Rest unter einer Einheit mit, damit kleine Schritte
+// nicht wegrunden.
+struct energyCounter {
+  uint64_t mWs = 0;
+  uint64_t mAs = 0;
+  uint32_t remNWs = 0;
+  uint32_t remUAs = 0;
+
+  void add(uint64_t nWs, uint64_t uAs) {
+    nWs += remNWs;
+    uAs += remUAs;
+    mWs += nWs / 1000000ULL;
+    mAs += uAs / 1000ULL;
+    remNWs = (uint32_t)(nWs % 1000000ULL);
+    remUAs = (uint32_t)(uAs % 1000ULL);
+  }
+
+  float kWh() const { return (float)((double)mWs / 3600000000.0); }
+  long  wh()  const { return (long)(mWs / 3600000ULL); }
+  long  mAh() const { return (long)(mAs / 3600ULL); }
+};
+
 struct dailyEnergyData {
   bool valid = false;
   bool timeSynced = false;
   unsigned long lastUpdateMs = 0;
   unsigned long currentEpoch = 0;
   unsigned long localDayNumber = 0;
+  // Aus chargeToday/dischargeToday abgeleitet, fuer Anzeige und MQTT
   float chargeKWhToday = 0.0f;
   float dischargeKWhToday = 0.0f;
+
+  energyCounter chargeToday;
+  energyCounter dischargeToday;
+  energyCounter chargeTotal;                        // seit Inbetriebnahme
+  energyCounter dischargeTotal;
+  energyCounter batCharge[MAX_PYLON_BATTERIES];     // je Modulplatz, seit Inbetriebnahme
+  energyCounter batDischarge[MAX_PYLON_BATTERIES];
+
+  uint32_t      samples = 0;                        // integrierte pwr-Intervalle
+  uint32_t      gaps = 0;                           // zu lange Intervalle, nicht integriert
+  uint64_t      gapMs = 0;
 };
 
 #endif // BATTERYSTACK_H
@@ -27,17 +27,20 @@ class circular_log {
     }
   }
 
-  const char* c_str() {
-    static char out[Size + 1];
-    if (filled) {
-      memcpy(out, buffer + index, Size - index);
-      memcpy(out + Size - index, buffer, index);
-      out[Size] = 0;
-    } else {
-      memcpy(out, buffer, index);
-      out[index] = 0;
-    }
-    return out;
+  size_t length() const {
+    return filled ? Size : index;
+  }
+
+  static constexpr size_t capacity() {
+    return Size;
+  }
+
+  // Liefert den Inhalt in zeitlicher Reihenfolge als hoechstens zwei
+  // zusammenhaengende Abschnitte, ohne ihn in einen zweiten Puffer zu kopieren.
+  template <typename Fn>
+  void forEachSegment(Fn&& fn) const {
+    if (filled) fn(buffer + index, Size - index);
+    if (index > 0) fn(buffer, index);
   }
 };
 
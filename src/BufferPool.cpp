@@ -0,0 +1,114 @@
+#include "BufferPool.h"
+#include <string.h>
+
+namespace {
+  struct SlotDef {
+    const char* name;
+    size_t      offset;
+    size_t      size;
+    bool        measureText;  // beim Freigeben strnlen() als Nutzung werten
+  };
+
+  constexpr size_t kRxSize      = 16384;
+  constexpr size_t kJsonDocSize = 4096;
+  constexpr size_t kJsonOutSize = 4096;
+  constexpr size_t kStackJsonSize  = 4096;
+  constexpr size_t kSystemJsonSize = 2048;
+  constexpr size_t kStatusJsonSize = 2048;
+  constexpr size_t kJobResultSize  = 8192;
+  constexpr size_t kStatusPackSize = 1024;
+
+  constexpr size_t kOffJsonDoc    = kRxSize;
+  constexpr size_t kOffJsonOut    = kOffJsonDoc + kJsonDocSize;
+  constexpr size_t kOffStackJson  = kOffJsonOut + kJsonOutSize;
+  constexpr size_t kOffSystemJson = kOffStackJson + kStackJsonSize;
+  constexpr size_t kOffStatusJson = kOffSystemJson + kSystemJsonSize;
+  constexpr size_t kOffJobResult  = kOffStatusJson + kStatusJsonSize;
+  constexpr size_t kOffStatusPack = kOffJobResult + kJobResultSize;
+  constexpr size_t kArenaSize     = kOffStatusPack + kStatusPackSize;
+
+  constexpr SlotDef kSlots[(size_t)BufferPool::Slot::Count] = {
+    { "rx",          0,              kRxSize,         true  },
+    { "json_doc",    kOffJsonDoc,    kJsonDocSize,    false },
+    { "json_out",    kOffJsonOut,    kJsonOutSize,    false },
+    { "stack_json",  kOffStackJson,  kStackJsonSize,  false },
+    { "system_json", kOffSystemJson, kSystemJsonSize, false },
+    { "status_json", kOffStatusJson, kStatusJsonSize, false },
+    { "job_result",  kOffJobResult,  kJobResultSize,  false },
+    { "status_pack", kOffStatusPack, kStatusPackSize, false },
+  };
+
+  struct SlotState {
+    const char* owner = "";
+    size_t      highWater = 0;
+    uint32_t    leases = 0;
+    uint32_t    denied = 0;
+    bool        busy = false;
+  };
+
+  alignas(8) char s_arena[kArenaSize];
+  SlotState s_state[(size_t)BufferPool::Slot::Count];
+
+  inline bool validSlot(BufferPool::Slot slot) {
+    return (size_t)slot < (size_t)BufferPool::Slot::Count;
+  }
+}
+
+char* BufferPool::acquire(Slot slot, const char* owner, size_t minSize) {
+  if (!validSlot(slot)) return nullptr;
+
+  const SlotDef& def = kSlots[(size_t)slot];
+  SlotState& st = s_state[(size_t)slot];
+
+  if (st.busy || minSize > def.size) {
+    st.denied++;
+    return nullptr;
+  }
+
+  st.busy = true;
+  st.owner = owner ? owner : "";
+  st.leases++;
+  return s_arena + def.offset;
+}
+
+void BufferPool::release(Slot slot) {
+  if (!validSlot(slot)) return;
+
+  const SlotDef& def = kSlots[(size_t)slot];
+  SlotState& st = s_state[(size_t)slot];
+  if (!st.busy) return;
+
+  if (def.measureText) {
+    noteUsed(slot, strnlen(s_arena + def.offset, def.size));
+  }
+  st.busy = false;
+}
+
+void BufferPool::noteUsed(Slot slot, size_t bytes) {
+  if (!validSlot(slot)) return;
+  SlotState& st = s_state[(size_t)slot];
+  if (bytes > st.highWater) st.highWater = bytes;
+}
+
+size_t BufferPool::size(Slot slot) {
+  return validSlot(slot) ? kSlots[(size_t)slot].size : 0;
+}
+
+size_t BufferPool::totalBytes() {
+  return kArenaSize;
+}
+
+bool BufferPool::stats(Slot slot, SlotStats& out) {
+  if (!validSlot(slot)) return false;
+
+  const SlotDef& def = kSlots[(size_t)slot];
+  const SlotState& st = s_state[(size_t)slot];
+  out.name      = def.name;
+  out.owner     = st.owner;
+  out.size      = def.size;
+  out.highWater = st.highWater;
+  out.leases    = st.leases;
+  out.denied    = st.denied;
+  out.busy      = st.busy;
+  return true;
+}
@@ -0,0 +1,604 @@
+#include "ConsoleJobs.h"
+#include "PylonLink.h"
+#include "BufferPool.h"
+#include "WebUI.h"
+#include "circular_log.h"
+#include "NetWrite.h"
+#include <uri/UriBraces.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Arduino.h>
+
+namespace {
+  enum class JobState : uint8_t { Free, Queued, Running, Done, Failed };
+
+  struct Job {
+    uint32_t      id = 0;
+    JobState      state = JobState::Free;
+    bool          promptMode = false;
+    bool          truncated = false;   // Ausgabe groesser als der JobResult-Slot
+    unsigned long timeoutMs = 0;
+    unsigned long createdMs = 0;
+    unsigned long startedMs = 0;
+    unsigned long finishedMs = 0;
+    size_t        outLen = 0;
+    char          cmd[72] = {0};
+  };
+
+  // Ein wartender HTTP-Client. Geschrieben wird nie blockierend: erst die
+  // ausstehenden Protokollbytes in frame (Kopf, Chunk-Kopf, Abschluss),
+  // dann die Nutzdaten bis bodyEnd direkt aus Rx- bzw. JobResult-Slot.
+  // Was der Sendepuffer nicht aufnimmt, folgt im naechsten loop().
+  struct Waiter {
+    WiFiClient    client;
+    uint32_t      jobId = 0;
+    size_t        sent = 0;           // Nutzdaten bis hier geschrieben
+    size_t        bodyEnd = 0;        // Ende des aktuellen Chunks bzw. Rumpfs
+    char          frame[192];
+    uint16_t      frameLen = 0;
+    uint16_t      frameOff = 0;
+    bool          chunkOpen = false;  // nach bodyEnd fehlt noch "\r\n"
+    bool          closing = false;    // Ende eingereiht, danach schliessen
+    bool          whole = false;
+    bool          active = false;
+    unsigned long lastProgressMs = 0;
+  };
+
+  WebServer*           s_server = nullptr;
+  BatteryLink*         s_link   = nullptr;
+  circular_log<16384>* s_log    = nullptr;
+
+  Job      s_jobs[CONSOLE_JOB_SLOTS];
+  Waiter   s_waiters[CONSOLE_JOB_MAX_WAITERS];
+  uint32_t s_nextId = 1;
+
+  // laufender Job: Ausgabe liegt im Rx-Slot, bis der Link fertig ist
+  Job*   s_running = nullptr;
+  char*  s_rxBuf   = nullptr;
+  size_t s_rxSeen  = 0;
+  size_t s_visible = 0;
+  unsigned long s_lastFinishMs = 0;
+
+  // Ergebnis des zuletzt beendeten Jobs (Slot bis zum Ablauf gehalten)
+  char*    s_resultBuf   = nullptr;
+  size_t   s_resultLen   = 0;
+  uint32_t s_resultJobId = 0;
+
+  bool startsWithIgnoreCase(const char* text, const char* prefix) {
+    if (!text || !prefix) return false;
+    while (*prefix) {
+      if (!*text) return false;
+      if (tolower((unsigned char)*text) != tolower((unsigned char)*prefix)) return false;
+      ++text;
+      ++prefix;
+    }
+    return true;
+  }
+
+  bool equalsIgnoreCase(const char* a, const char* b) {
+    if (!a || !b) return false;
+    while (*a && *b) {
+      if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) return false;
+      ++a;
+      ++b;
+    }
+    return *a == '\0' && *b == '\0';
+  }
+
+  const char* stateName(JobState st) {
+    switch (st) {
+      case JobState::Queued:  return "queued";
+      case JobState::Running: return "running";
+      case JobState::Done:    return "done";
+      case JobState::Failed:  return "failed";
+      default:                return "free";
+    }
+  }
+
+  bool finished(const Job& job) {
+    return job.state == JobState::Done || job.state == JobState::Failed;
+  }
+
+  // Gesichertes Ergebnis verwerfen und den JobResult-Slot zurueckgeben
+  void dropResult() {
+    s_resultJobId = 0;
+    s_resultLen = 0;
+    if (s_resultBuf) {
+      BufferPool::release(BufferPool::Slot::JobResult);
+      s_resultBuf = nullptr;
+    }
+  }
+
+  Job* findJob(uint32_t id) {
+    if (!id) return nullptr;
+    for (Job& job : s_jobs) {
+      if (job.state != JobState::Free && job.id == id) return &job;
+    }
+    return nullptr;
+  }
+
+  uint32_t parseId(const String& text) {
+    char* end = nullptr;
+    const unsigned long v = strtoul(text.c_str(), &end, 10);
+    return (end && *end == '\0') ? (uint32_t)v : 0;
+  }
+
+  // Sichtbarer Teil der Ausgabe: alles vor dem ersten Prompt. Solange der
+  // Job laeuft, werden die letzten 12 Zeichen zurueckgehalten (dort koennte
+  // gerade ein Prompt entstehen) und reine Leerzeichen nicht gesendet, weil
+  // ein Wiederholungsversuch den Puffer noch verwerfen kann.
+  size_t visibleEnd(const char* buf, size_t len, bool final) {
+    const char* p = strstr(buf, "pylon_debug>");
+    if (!p) p = strstr(buf, "pylon>");
+    size_t end = p ? (size_t)(p - buf) : len;
+    if (final) return end;
+    if (!p) end = (len > 12) ? len - 12 : 0;
+
+    for (size_t i = 0; i < end; ++i) {
+      if (!isspace((unsigned char)buf[i])) return end;
+    }
+    return 0;
+  }
+
+  void queueFrame(Waiter& w, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+  void queueFrame(Waiter& w, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(w.frame, sizeof(w.frame), fmt, ap);
+    va_end(ap);
+    w.frameOff = 0;
+    w.lastProgressMs = millis();
+    w.frameLen = (n > 0) ? (uint16_t)((size_t)n < sizeof(w.frame) ? n : sizeof(w.frame) - 1) : 0;
+  }
+
+  void queueStreamHead(Waiter& w) {
+    queueFrame(w, "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/plain; charset=utf-8\r\n"
+                  "Transfer-Encoding: chunked\r\n"
+                  "Cache-Control: no-store\r\n"
+                  "X-Content-Type-Options: nosniff\r\n"
+                  "Connection: close\r\n\r\n");
+  }
+
+  void closeWaiter(Waiter& w) {
+    w.client.stop();
+    w.client = WiFiClient();
+    w.active = false;
+  }
+
+  // Nutzdaten fuer einen Waiter: waehrend der Job laeuft der sichtbare Teil
+  // im Rx-Slot, danach das gesicherte Ergebnis. nullptr = Ergebnis weg.
+  const char* waiterSource(const Waiter& w, size_t& avail, const Job*& done) {
+    done = nullptr;
+    avail = 0;
+    if (s_running && s_running->id == w.jobId) {
+      avail = s_visible;
+      return s_rxBuf;
+    }
+    const Job* job = findJob(w.jobId);
+    if (!job || !finished(*job) || s_resultJobId != w.jobId || !s_resultBuf) return nullptr;
+    done = job;
+    avail = s_resultLen;
+    return s_resultBuf;
+  }
+
+  enum class Next : uint8_t { Queued, Wait, Gone };
+
+  // Reiht den naechsten Abschnitt ein, sobald der vorige komplett raus ist
+  Next queueNext(Waiter& w, const char* src, size_t avail, const Job* done) {
+    if (!src) return Next::Gone;
+
+    if (w.whole) {
+      if (!done) return Next::Wait;
+      w.closing = true;
+      if (done->state == JobState::Failed) {
+        queueFrame(w, "HTTP/1.1 504 Gateway Timeout\r\n"
+                      "Content-Type: text/plain\r\n"
+                      "Content-Length: 7\r\n"
+                      "Cache-Control: no-store\r\n"
+                      "Connection: close\r\n\r\ntimeout");
+        return Next::Queued;
+      }
+      queueFrame(w, "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: text/plain\r\n"
+                    "Content-Length: %u\r\n"
+                    "Cache-Control: no-store\r\n"
+                    "%s"
+                    "Connection: close\r\n\r\n",
+                 (unsigned)avail, done->truncated ? "X-Job-Truncated: 1\r\n" : "");
+      w.sent = 0;
+      w.bodyEnd = avail;
+      return Next::Queued;
+    }
+
+    if (avail > w.sent) {
+      queueFrame(w, "%x\r\n", (unsigned)(avail - w.sent));
+      w.bodyEnd = avail;
+      w.chunkOpen = true;
+      return Next::Queued;
+    }
+    if (!done) return Next::Wait;
+    w.closing = true;
+    if (done->state == JobState::Failed) queueFrame(w, "b\r\n\n[timeout]\n\r\n0\r\n\r\n");
+    else                                 queueFrame(w, "0\r\n\r\n");
+    return Next::Queued;
+  }
+
+  // Schreibt, was der Sendepuffer gerade aufnimmt. false = fertig, Ergebnis
+  // verdraengt oder Verbindung kaputt; ein Teil-Schreiben ist kein Fehler.
+  bool pumpWaiter(Waiter& w) {
+    for (;;) {
+      if (w.frameOff < w.frameLen) {
+        const int n = NetWrite::sendSome(w.client, w.frame + w.frameOff, w.frameLen - w.frameOff);
+        if (n < 0) return false;
+        if (n > 0) {
+          w.frameOff += (uint16_t)n;
+          w.lastProgressMs = millis();
+        }
+        if (w.frameOff < w.frameLen) return true;
+      }
+
+      size_t avail = 0;
+      const Job* done = nullptr;
+      const char* src = waiterSource(w, avail, done);
+
+      if (w.sent < w.bodyEnd) {
+        // Laenge ist schon angekuendigt; fehlt die Quelle, bleibt nur Abbruch
+        if (!src || avail < w.bodyEnd) return false;
+        const int n = NetWrite::sendSome(w.client, src + w.sent, w.bodyEnd - w.sent);
+        if (n < 0) return false;
+        if (n > 0) {
+          w.sent += (size_t)n;
+          w.lastProgressMs = millis();
+        }
+        if (w.sent < w.bodyEnd) return true;
+      }
+
+      if (w.chunkOpen) {
+        queueFrame(w, "\r\n");
+        w.chunkOpen = false;
+        continue;
+      }
+      if (w.closing) return false;
+
+      switch (queueNext(w, src, avail, done)) {
+        case Next::Queued: break;
+        case Next::Wait:   return true;
+        case Next::Gone:   return false;
+      }
+    }
+  }
+
+  bool waiterPending(const Waiter& w) {
+    return w.frameOff < w.frameLen || w.sent < w.bodyEnd;
+  }
+
+  void pumpWaiters() {
+    for (Waiter& w : s_waiters) {
+      if (!w.active) continue;
+      if (!pumpWaiter(w)) closeWaiter(w);
+    }
+  }
+
+  void serveFinished(const Job& job, bool whole) {
+    if (s_resultJobId != job.id || !s_resultBuf) {
+      s_server->send(410, "text/plain", "result expired");
+      return;
+    }
+    if (whole && job.state == JobState::Failed) {
+      s_server->send(504, "text/plain", "timeout");
+      return;
+    }
+    s_server->sendHeader("Cache-Control", "no-store");
+    s_server->sendHeader("X-Job-State", stateName(job.state));
+    if (job.truncated) s_server->sendHeader("X-Job-Truncated", "1");
+    s_server->setContentLength(s_resultLen);
+    s_server->send(200, "text/plain", "");
+    s_server->sendContent(s_resultBuf, s_resultLen);
+  }
+
+  void finishRunning(bool ok) {
+    Job& job = *s_running;
+    const unsigned long now = millis();
+    const size_t end = visibleEnd(s_rxBuf, strlen(s_rxBuf), true);
+
+    // Ergebnis sichern, bevor der Rx-Slot frei wird; wartende Clients
+    // schreiben ab hier aus dem JobResult-Slot weiter
+    if (!s_resultBuf) s_resultBuf = BufferPool::acquire(BufferPool::Slot::JobResult, "jobs");
+    if (s_resultBuf) {
+      const size_t cap = BufferPool::size(BufferPool::Slot::JobResult) - 1;
+      s_resultLen = (end < cap) ? end : cap;
+      memcpy(s_resultBuf, s_rxBuf, s_resultLen);
+      s_resultBuf[s_resultLen] = '\0';
+      BufferPool::noteUsed(BufferPool::Slot::JobResult, s_resultLen + 1);
+      s_resultJobId = job.id;
+      job.truncated = (s_resultLen < end);
+    }
+
+    job.outLen = end;
+    job.state = ok ? JobState::Done : JobState::Failed;
+    job.finishedMs = now;
+
+    if (s_log) {
+      char msg[80];
+      snprintf(msg, sizeof(msg), "JOB %lu %s: %lums %u bytes",
+               (unsigned long)job.id, ok ? "ok" : "timeout",
+               now - job.startedMs, (unsigned)end);
+      s_log->Log(msg);
+    }
+
+    BufferPool::release(BufferPool::Slot::Rx);
+    s_rxBuf = nullptr;
+    s_running = nullptr;
+    s_lastFinishMs = now;
+  }
+
+  void startNext() {
+    if (s_running || !s_link || s_link->isBusy()) return;
+    if (millis() - s_lastFinishMs < CONSOLE_JOB_GAP_MS) return;
+
+    Job* next = nullptr;
+    for (Job& job : s_jobs) {
+      if (job.state == JobState::Queued && (!next || job.id < next->id)) next = &job;
+    }
+    if (!next) return;
+
+    char* buf = BufferPool::acquire(BufferPool::Slot::Rx, "job");
+    if (!buf) return;
+    const size_t size = BufferPool::size(BufferPool::Slot::Rx);
+    memset(buf, 0, size);
+
+    if (!s_link->beginTransaction(next->cmd, buf, size, next->timeoutMs, next->promptMode)) {
+      BufferPool::release(BufferPool::Slot::Rx);
+      return;
+    }
+
+    next->state = JobState::Running;
+    next->startedMs = millis();
+    s_running = next;
+    s_rxBuf = buf;
+    s_rxSeen = 0;
+    s_visible = 0;
+
+    if (s_log) {
+      char msg[96];
+      snprintf(msg, sizeof(msg), "JOB %lu start: %s", (unsigned long)next->id, next->cmd);
+      s_log->Log(msg);
+    }
+  }
+
+  void expireFinished() {
+    const unsigned long now = millis();
+    for (Job& job : s_jobs) {
+      if (!finished(job) || now - job.finishedMs < CONSOLE_JOB_RESULT_TTL_MS) continue;
+      if (s_resultJobId == job.id) dropResult();
+      job.state = JobState::Free;
+    }
+  }
+
+  void sweepWaiters() {
+    const unsigned long now = millis();
+    for (Waiter& w : s_waiters) {
+      if (!w.active) continue;
+      if (!w.client.connected()) {
+        closeWaiter(w);
+        continue;
+      }
+      while (w.client.available()) w.client.read();
+      if (waiterPending(w) && now - w.lastProgressMs > CONSOLE_JOB_STALL_MS) {
+        if (s_log) s_log->Log("JOB: client stalled");
+        closeWaiter(w);
+      }
+    }
+  }
+
+  void sendJobStatus(const Job& job) {
+    const unsigned long now = millis();
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    w.beginObject();
+    w.field("id", job.id);
+    w.field("cmd", job.cmd);
+    w.field("state", stateName(job.state));
+    w.field("ageMs", now - job.createdMs);
+    if (job.state == JobState::Running) {
+      w.field("runMs", now - job.startedMs);
+    } else if (finished(job)) {
+      w.field("runMs", job.finishedMs - job.startedMs);
+      w.field("bytes", job.outLen);
+      w.field("truncated", job.truncated);
+      w.field("cached", (s_resultJobId == job.id));
+    }
+    w.endObject();
+  }
+}
+
+int ConsoleJobs::checkCommand(const char* cmd, const char** err) {
+  const size_t len = cmd ? strlen(cmd) : 0;
+  if (!len) {
+    *err = "empty";
+    return 400;
+  }
+  if (len > 64) {
+    *err = "command too long";
+    return 413;
+  }
+  for (size_t i = 0; i < len; i++) {
+    const unsigned char c = (unsigned char)cmd[i];
+    if (c < 0x20 || c > 0x7E) {
+      *err = "invalid characters";
+      return 400;
+    }
+  }
+  return 0;
+}
+
+bool ConsoleJobs::needsPrompt(const char* cmd) {
+  if (!cmd) return false;
+
+  return equalsIgnoreCase(cmd, "help") ||
+         startsWithIgnoreCase(cmd, "stat") ||
+         startsWithIgnoreCase(cmd, "log") ||
+         startsWithIgnoreCase(cmd, "bat") ||
+         startsWithIgnoreCase(cmd, "data");
+}
+
+uint32_t ConsoleJobs::submit(const char* cmd, bool promptMode, unsigned long timeoutMs) {
+  Job* slot = nullptr;
+  for (Job& job : s_jobs) {
+    if (job.state == JobState::Free) {
+      slot = &job;
+      break;
+    }
+  }
+  // Kein freier Platz: aeltesten beendeten Job verdraengen
+  if (!slot) {
+    for (Job& job : s_jobs) {
+      if (finished(job) && (!slot || job.id < slot->id)) slot = &job;
+    }
+    if (slot && s_resultJobId == slot->id) dropResult();
+  }
+  if (!slot) return 0;
+
+  *slot = Job();
+  slot->id = s_nextId++;
+  if (s_nextId == 0) s_nextId = 1;
+  slot->state = JobState::Queued;
+  slot->promptMode = promptMode;
+  slot->timeoutMs = timeoutMs;
+  slot->createdMs = millis();
+  snprintf(slot->cmd, sizeof(slot->cmd), "%s", cmd ? cmd : "");
+  return slot->id;
+}
+
+void ConsoleJobs::attach(uint32_t id, bool whole) {
+  Job* job = findJob(id);
+  if (!job) {
+    s_server->send(404, "text/plain", "unknown job");
+    return;
+  }
+  const bool done = finished(*job);
+  // Abgelaufenes Ergebnis bzw. Timeout am Stueck beantwortet serveFinished()
+  if (done && (s_resultJobId != id || !s_resultBuf || (whole && job->state == JobState::Failed))) {
+    serveFinished(*job, whole);
+    return;
+  }
+
+  for (Waiter& w : s_waiters) {
+    if (w.active) continue;
+    w = Waiter();
+    w.client = s_server->client();
+    // Eigene Referenz des WebServers freigeben (der Socket bleibt ueber
+    // w.client offen); sonst wartet er bis HTTP_MAX_CLOSE_WAIT (2 s) auf
+    // das Schliessen und bedient solange keinen anderen Client.
+    s_server->client().stop();
+    w.jobId = id;
+    w.whole = whole;
+    w.active = true;
+    w.lastProgressMs = millis();
+    if (!whole) queueStreamHead(w);
+    if (!pumpWaiter(w)) closeWaiter(w);
+    return;
+  }
+  // Kein Platz: fertige Ergebnisse wie bisher am Stueck
+  if (done) {
+    serveFinished(*job, whole);
+    return;
+  }
+  s_server->send(503, "text/plain", "too many clients");
+}
+
+ConsoleJobs::JobStatus ConsoleJobs::status(uint32_t id, const char** out, size_t* len, bool* truncated) {
+  const Job* job = findJob(id);
+  if (!job) return JobStatus::Unknown;
+  if (!finished(*job)) return JobStatus::Pending;
+  if (s_resultJobId != job->id || !s_resultBuf) return JobStatus::Expired;
+
+  if (out) *out = s_resultBuf;
+  if (len) *len = s_resultLen;
+  if (truncated) *truncated = job->truncated;
+  return (job->state == JobState::Done) ? JobStatus::Done : JobStatus::Failed;
+}
+
+uint8_t ConsoleJobs::pending() {
+  uint8_t n = 0;
+  for (const Job& job : s_jobs) {
+    if (job.state == JobState::Queued || job.state == JobState::Running) n++;
+  }
+  return n;
+}
+
+void ConsoleJobs::init(WebServer* server, BatteryLink* link, circular_log<16384>* clog) {
+  s_server = server;
+  s_link   = link;
+  s_log    = clog;
+
+  s_server->on("/api/jobs", HTTP_POST, []() {
+    if (!s_link) {
+      s_server->send(503, "text/plain", "no link");
+      return;
+    }
+    String code;
+    if (s_server->hasArg("plain")) code = s_server->arg("plain");
+    else if (s_server->hasArg("code")) code = s_server->arg("code");
+    else if (s_server->args() >= 1) code = s_server->arg(0);
+    code.trim();
+
+    const char* err = nullptr;
+    const int status = checkCommand(code.c_str(), &err);
+    if (status) {
+      s_server->send(status, "text/plain", err);
+      return;
+    }
+
+    const bool prompt = needsPrompt(code.c_str());
+    const uint32_t id = submit(code.c_str(), prompt, prompt ? 20000UL : 8000UL);
+    if (!id) {
+      s_server->send(429, "text/plain", "queue full");
+      return;
+    }
+
+    char body[96];
+    snprintf(body, sizeof(body),
+             "{\"id\":%lu,\"state\":\"queued\",\"pending\":%u,\"stream\":\"/api/jobs/%lu/stream\"}",
+             (unsigned long)id, (unsigned)pending(), (unsigned long)id);
+    s_server->sendHeader("Cache-Control", "no-store");
+    s_server->send(202, "application/json", body);
+  });
+
+  // Reihenfolge wichtig: {} am Ende wuerde auch ".../stream" schlucken.
+  s_server->on(UriBraces("/api/jobs/{}/stream"), HTTP_GET, []() {
+    attach(parseId(s_server->pathArg(0)), false);
+  });
+
+  s_server->on(UriBraces("/api/jobs/{}"), HTTP_GET, []() {
+    const Job* job = findJob(parseId(s_server->pathArg(0)));
+    if (!job) {
+      s_server->send(404, "text/plain", "unknown job");
+      return;
+    }
+    sendJobStatus(*job);
+  });
+}
+
+void ConsoleJobs::loop() {
+  if (s_running) {
+    const BatteryLink::TxnState st = s_link->poll();
+    if (st == BatteryLink::TxnState::Busy) {
+      const size_t len = s_link->rxLength();
+      if (len != s_rxSeen) {
+        s_rxSeen = len;
+        s_visible = visibleEnd(s_rxBuf, len, false);
+      }
+    } else {
+      finishRunning(st == BatteryLink::TxnState::Done);
+    }
+  }
+
+  pumpWaiters();
+  if (!s_running) startNext();
+  expireFinished();
+  sweepWaiters();
+}
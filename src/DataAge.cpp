@@ -0,0 +1,151 @@
+#include "DataAge.h"
+#include "JsonWriter.h"
+#include "WebUI.h"
+#include <Arduino.h>
+
+const uint32_t DataAge::kBucketMs[DataAge::kBuckets] = {
+  250, 500, 1000, 2000, 5000, 15000, 30000, 60000
+};
+
+namespace {
+  constexpr size_t kSources = (size_t)DataAge::Source::Count;
+  constexpr size_t kPaths   = (size_t)DataAge::Path::Count;
+
+  const char* const kSourceNames[kSources] = { "pwr", "pwrsys" };
+  const char* const kPathNames[kPaths]     = { "mqtt", "http" };
+
+  WebServer*             s_server = nullptr;
+  const dailyEnergyData* s_energy = nullptr;
+
+  DataAge::Sample    s_samples[kSources];
+  DataAge::Stages    s_stages[kSources];
+  DataAge::PathStats s_paths[kPaths][kSources];
+  uint32_t           s_seq = 0;
+
+  void stage(uint32_t from, uint32_t to, uint32_t& last, uint32_t& max) {
+    last = (from && to >= from) ? to - from : 0;
+    if (last > max) max = last;
+  }
+
+  void writePath(JsonWriter& w, const DataAge::PathStats& st) {
+    w.field("count", st.count);
+    w.field("avgMs", st.count ? (uint32_t)(st.sumMs / st.count) : 0U);
+    w.field("lastMs", st.lastMs);
+    w.field("maxMs", st.maxMs);
+    w.beginArray("buckets");
+    for (size_t i = 0; i < DataAge::kBuckets; ++i) w.value(st.buckets[i]);
+    w.endArray();
+    w.field("overflow", st.overflow);
+  }
+
+  void sendJson() {
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    w.beginObject();
+    w.field("uptimeMs", millis());
+    w.beginArray("boundsMs");
+    for (size_t i = 0; i < DataAge::kBuckets; ++i) w.value(DataAge::kBucketMs[i]);
+    w.endArray();
+    for (size_t s = 0; s < kSources; ++s) {
+      const DataAge::Source src = (DataAge::Source)s;
+      const DataAge::Sample& sm = s_samples[s];
+      const DataAge::Stages& st = s_stages[s];
+      w.beginObject(kSourceNames[s]);
+      w.field("seq", sm.seq);
+      w.field("sampleMs", sm.firstRxMs);
+      w.field("ageMs", DataAge::ageMs(src));
+      if (DataAge::sampleEpoch(src)) w.field("sampleEpoch", DataAge::sampleEpoch(src));
+      w.beginObject("stages");
+      w.field("waitMs", st.waitMs);
+      w.field("waitMaxMs", st.waitMaxMs);
+      w.field("rxMs", st.rxMs);
+      w.field("rxMaxMs", st.rxMaxMs);
+      w.field("parseMs", st.parseMs);
+      w.field("parseMaxMs", st.parseMaxMs);
+      w.field("acceptMs", st.acceptMs);
+      w.field("acceptMaxMs", st.acceptMaxMs);
+      w.endObject();
+      w.beginObject("consumers");
+      for (size_t p = 0; p < kPaths; ++p) {
+        w.beginObject(kPathNames[p]);
+        writePath(w, s_paths[p][s]);
+        w.endObject();
+      }
+      w.endObject();
+      w.endObject();
+    }
+    w.endObject();
+  }
+}
+
+void DataAge::init(WebServer* server, const dailyEnergyData* energy) {
+  s_server = server;
+  s_energy = energy;
+  if (s_server) s_server->on("/api/latency", HTTP_GET, []() { sendJson(); });
+}
+
+void DataAge::noteSample(Source src, const LinkTiming& timing, uint32_t parsedMs, uint32_t acceptedMs) {
+  if ((size_t)src >= kSources) return;
+  Sample& sm = s_samples[(size_t)src];
+  sm.seq        = ++s_seq;
+  sm.sentMs     = timing.sentMs;
+  sm.firstRxMs  = timing.firstRxMs ? timing.firstRxMs : timing.sentMs;
+  sm.promptMs   = timing.promptMs;
+  sm.parsedMs   = parsedMs;
+  sm.acceptedMs = acceptedMs;
+
+  Stages& st = s_stages[(size_t)src];
+  stage(sm.sentMs,    sm.firstRxMs,  st.waitMs,   st.waitMaxMs);
+  stage(sm.firstRxMs, sm.promptMs,   st.rxMs,     st.rxMaxMs);
+  stage(sm.promptMs,  sm.parsedMs,   st.parseMs,  st.parseMaxMs);
+  stage(sm.parsedMs,  sm.acceptedMs, st.acceptMs, st.acceptMaxMs);
+}
+
+void DataAge::noteConsumed(Path path, Source src) {
+  if ((size_t)path >= kPaths || (size_t)src >= kSources) return;
+  if (!s_samples[(size_t)src].seq) return;
+
+  const uint32_t age = ageMs(src);
+  PathStats& st = s_paths[(size_t)path][(size_t)src];
+  st.count++;
+  st.sumMs += age;
+  st.lastMs = age;
+  if (age > st.maxMs) st.maxMs = age;
+  size_t b = 0;
+  while (b < kBuckets && age > kBucketMs[b]) ++b;
+  if (b < kBuckets) st.buckets[b]++;
+  else              st.overflow++;
+}
+
+const DataAge::Sample& DataAge::sample(Source src) {
+  return s_samples[(size_t)src < kSources ? (size_t)src : 0];
+}
+
+const DataAge::Stages& DataAge::stages(Source src) {
+  return s_stages[(size_t)src < kSources ? (size_t)src : 0];
+}
+
+const DataAge::PathStats& DataAge::pathStats(Path path, Source src) {
+  return s_paths[(size_t)path < kPaths ? (size_t)path : 0][(size_t)src < kSources ? (size_t)src : 0];
+}
+
+uint32_t DataAge::ageMs(Source src) {
+  const Sample& sm = sample(src);
+  return sm.seq ? millis() - sm.firstRxMs : 0;
+}
+
+unsigned long DataAge::sampleEpoch(Source src) {
+  const Sample& sm = sample(src);
+  if (!sm.seq || !s_energy || !s_energy->timeSynced || !s_energy->currentEpoch) return 0;
+  // currentEpoch gehoert zu lastUpdateMs; auf den Messzeitpunkt zurueckrechnen
+  const long deltaMs = (long)(s_energy->lastUpdateMs - sm.firstRxMs);
+  return s_energy->currentEpoch - deltaMs / 1000;
+}
+
+const char* DataAge::sourceName(Source src) {
+  return (size_t)src < kSources ? kSourceNames[(size_t)src] : "?";
+}
+
+const char* DataAge::pathName(Path path) {
+  return (size_t)path < kPaths ? kPathNames[(size_t)path] : "?";
+}
@@ -0,0 +1,406 @@
+#include "EventStream.h"
+#include "BufferPool.h"
+#include "circular_log.h"
+#include "JsonWriter.h"
+#include "NetWrite.h"
+#include <string.h>
+#include <Arduino.h>
+
+namespace {
+  struct EventClient {
+    WiFiClient client;
+    bool active = false;
+    bool resync = false;              // kompletter Stand steht noch aus
+    unsigned long connectedMs = 0;
+  };
+
+  // Stand, den alle verbundenen Clients zuletzt bekommen haben. Deltas werden
+  // immer gegen diese gemeinsame Basis gebildet, damit ein Serialisieren fuer
+  // alle Clients reicht.
+  struct StackBaseline {
+    batteryStack stack;
+    float chargeKWhToday = 0.0f;
+    float dischargeKWhToday = 0.0f;
+    bool timeSynced = false;
+    unsigned long currentEpoch = 0;
+  };
+
+  WebServer*           s_server = nullptr;
+  batteryStack*        s_stack  = nullptr;
+  systemData*          s_system = nullptr;
+  dailyEnergyData*     s_energy = nullptr;
+  circular_log<16384>* s_log    = nullptr;
+
+  EventClient   s_clients[EVENT_STREAM_MAX_CLIENTS];
+  StackBaseline s_stackBase;
+  systemData    s_systemBase;
+  bool          s_haveStackBase = false;
+  bool          s_haveSystemBase = false;
+  unsigned long s_lastPingMs = 0;
+
+  constexpr unsigned long kPingIntervalMs = 15000UL;
+
+  // Schreibt ein Feld nur, wenn es sich gegenueber der Basis geaendert hat
+  // (oder full), und zaehlt die Felder. Ohne Writer wird nur gezaehlt, um
+  // vorab zu pruefen, ob ein Batterie-Objekt ueberhaupt noetig ist.
+  class Delta {
+  public:
+    Delta(JsonWriter* w, bool full) : m_w(w), m_full(full) {}
+
+    template <typename T>
+    void put(const char* key, const T& now, const T& last) {
+      if (!m_full && now == last) return;
+      if (m_w) m_w->field(key, now);
+      m_count++;
+    }
+    void putText(const char* key, const char* now, const char* last) {
+      if (!m_full && strcmp(now, last) == 0) return;
+      if (m_w) m_w->field(key, now);
+      m_count++;
+    }
+    size_t count() const { return m_count; }
+
+  private:
+    JsonWriter* m_w;
+    bool        m_full;
+    size_t      m_count = 0;
+  };
+
+  void captureStackBaseline(StackBaseline& out) {
+    out.stack = *s_stack;
+    if (s_energy) {
+      out.chargeKWhToday = s_energy->chargeKWhToday;
+      out.dischargeKWhToday = s_energy->dischargeKWhToday;
+      out.timeSynced = s_energy->timeSynced;
+      out.currentEpoch = s_energy->currentEpoch;
+    }
+  }
+
+  bool presenceChanged(const batteryStack& now, const batteryStack& last) {
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      if (now.batts[i].isPresent != last.batts[i].isPresent) return true;
+    }
+    return false;
+  }
+
+  void fillBattery(Delta& d, const pylonBattery& b, const pylonBattery& last) {
+    d.put("soc",          b.soc,          last.soc);
+    d.put("voltage",      b.voltage,      last.voltage);
+    d.put("current",      b.current,      last.current);
+    d.put("tempr",        b.tempr,        last.tempr);
+    d.put("cellVoltLow",  b.cellVoltLow,  last.cellVoltLow);
+    d.put("cellVoltHigh", b.cellVoltHigh, last.cellVoltHigh);
+    d.put("cellTempLow",  b.cellTempLow,  last.cellTempLow);
+    d.put("cellTempHigh", b.cellTempHigh, last.cellTempHigh);
+    d.put("cycleTimes",   b.cycleTimes,   last.cycleTimes);
+    d.putText("baseState", b.baseState[0] ? b.baseState : "Unknown",
+              last.baseState[0] ? last.baseState : "Unknown");
+    d.putText("alarmText", b.alarmText[0] ? b.alarmText : "Normal",
+              last.alarmText[0] ? last.alarmText : "Normal");
+  }
+
+  // Schreibt die Felder des Stack-Events in das offene Objekt; false, wenn
+  // sich gegenueber der Basis nichts geaendert hat.
+  bool buildStackEvent(JsonWriter& w, const StackBaseline& now, const StackBaseline* base) {
+    const bool full = (base == nullptr);
+    static const StackBaseline kEmpty{};
+    const StackBaseline& last = full ? kEmpty : *base;
+
+    if (full) w.field("full", true);
+    Delta d(&w, full);
+    d.put("soc",               now.stack.soc,          last.stack.soc);
+    d.put("batteryCount",      now.stack.batteryCount, last.stack.batteryCount);
+    d.put("avgVoltage",        now.stack.avgVoltage,   last.stack.avgVoltage);
+    d.put("currentDC",         now.stack.currentDC,    last.stack.currentDC);
+    d.put("temp",              now.stack.temp,         last.stack.temp);
+    d.putText("baseState",     now.stack.baseState,    last.stack.baseState);
+    d.put("chargeKWhToday",    now.chargeKWhToday,     last.chargeKWhToday);
+    d.put("dischargeKWhToday", now.dischargeKWhToday,  last.dischargeKWhToday);
+    d.put("energyTimeSynced",  now.timeSynced,         last.timeSynced);
+    d.put("currentEpoch",      now.currentEpoch,       last.currentEpoch);
+    bool any = full || d.count() > 0;
+
+    // Aendert sich die Belegung, bekommt der Browser die komplette Liste,
+    // sonst nur die geaenderten Felder je Batterie.
+    const bool fullBatts = full || presenceChanged(now.stack, last.stack);
+    bool open = false;
+    if (fullBatts) {
+      w.beginArray("batts");
+      open = true;
+    }
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      const pylonBattery& b = now.stack.batts[i];
+      if (!b.isPresent) continue;
+      if (!fullBatts) {
+        Delta probe(nullptr, false);
+        fillBattery(probe, b, last.stack.batts[i]);
+        if (!probe.count()) continue;
+        if (!open) {
+          w.beginArray("battsDelta");
+          open = true;
+        }
+      }
+      w.beginObject();
+      w.field("idx", i + 1);
+      Delta bd(&w, fullBatts);
+      fillBattery(bd, b, last.stack.batts[i]);
+      w.endObject();
+    }
+    if (open) w.endArray();
+
+    return any || open;
+  }
+
+  bool buildSystemEvent(JsonWriter& w, const systemData& now, const systemData* base) {
+    const bool full = (base == nullptr);
+    static const systemData kEmpty{};
+    const systemData& last = full ? kEmpty : *base;
+
+    if (full) w.field("full", true);
+    Delta d(&w, full);
+    d.put("soc",       now.soc,       last.soc);
+    d.put("soh",       now.soh,       last.soh);
+    d.put("voltage",   now.voltage,   last.voltage);
+    d.put("current",   now.current,   last.current);
+    d.put("rc",        now.rc,        last.rc);
+    d.put("fcc",       now.fcc,       last.fcc);
+    d.put("temp_avg",  now.temp_avg,  last.temp_avg);
+    d.put("temp_low",  now.temp_low,  last.temp_low);
+    d.put("temp_high", now.temp_high, last.temp_high);
+    d.put("volt_avg",  now.volt_avg,  last.volt_avg);
+    d.put("volt_low",  now.volt_low,  last.volt_low);
+    d.put("volt_high", now.volt_high, last.volt_high);
+    d.putText("state",      now.state,      last.state);
+    d.putText("alarmState", now.alarmState, last.alarmState);
+
+    d.put("rec_chg_voltage",     now.rec_chg_voltage,     last.rec_chg_voltage);
+    d.put("rec_dsg_voltage",     now.rec_dsg_voltage,     last.rec_dsg_voltage);
+    d.put("rec_chg_current",     now.rec_chg_current,     last.rec_chg_current);
+    d.put("rec_dsg_current",     now.rec_dsg_current,     last.rec_dsg_current);
+    d.put("sys_rec_chg_voltage", now.sys_rec_chg_voltage, last.sys_rec_chg_voltage);
+    d.put("sys_rec_dsg_voltage", now.sys_rec_dsg_voltage, last.sys_rec_dsg_voltage);
+    d.put("sys_rec_chg_current", now.sys_rec_chg_current, last.sys_rec_chg_current);
+    d.put("sys_rec_dsg_current", now.sys_rec_dsg_current, last.sys_rec_dsg_current);
+
+    return full || d.count() > 0;
+  }
+
+  void dropClient(int slot, const char* why) {
+    EventClient& c = s_clients[slot];
+    if (!c.active) return;
+    c.client.stop();
+    c.client = WiFiClient();
+    c.active = false;
+    c.resync = false;
+    if (s_log) {
+      char msg[64];
+      snprintf(msg, sizeof(msg), "SSE: client %d closed (%s)", slot, why);
+      s_log->Log(msg);
+    }
+  }
+
+  // Nicht blockierend: passt ein Event nicht mehr in den Sendepuffer
+  // (Browser liest nicht, WLAN haengt), wird der Client verworfen, statt
+  // loop() in WiFiClient::write() warten zu lassen. Nach "retry" verbindet
+  // er sich neu und bekommt den kompletten Stand.
+  bool writeAll(EventClient& c, const char* data, size_t len) {
+    return NetWrite::sendSome(c.client, data, len) == (int)len;
+  }
+
+  // Schreibt ein fertig serialisiertes Event an einen (onlySlot >= 0) oder alle Clients.
+  void writeEvent(const char* event, const char* data, size_t len, int onlySlot = -1) {
+    char head[32];
+    const int headLen = snprintf(head, sizeof(head), "event: %s\ndata: ", event);
+    if (headLen <= 0) return;
+
+    for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; ++i) {
+      if (onlySlot >= 0 && i != onlySlot) continue;
+      EventClient& c = s_clients[i];
+      if (!c.active) continue;
+
+      if (!writeAll(c, head, (size_t)headLen) ||
+          !writeAll(c, data, len) ||
+          !writeAll(c, "\n\n", 2)) {
+        dropClient(i, "write");
+      }
+    }
+  }
+
+  // Serialisiert einmal per JsonWriter in den JsonOut-Slot und verteilt das
+  // Ergebnis; build() schreibt die Felder und meldet, ob sich etwas
+  // geaendert hat. false nur, wenn nichts rausging, obwohl es noetig war
+  // (Puffer belegt, Ueberlauf); Clients mit Schreibfehler sind danach getrennt.
+  template <typename Build>
+  bool sendEvent(const char* event, Build build, int onlySlot = -1) {
+    BufferLease out(BufferPool::Slot::JsonOut, "sse");
+    if (!out) return false;
+
+    BufferPrint bp(out.data(), out.size());
+    JsonWriter w(bp);
+    w.beginObject();
+    const bool any = build(w);
+    w.endObject();
+    out.noteUsed(w.length() + 1);
+    if (bp.overflowed()) {
+      if (s_log) s_log->Log("SSE: json overflow");
+      return false;
+    }
+    if (any) writeEvent(event, bp.c_str(), bp.length(), onlySlot);
+    return true;
+  }
+
+  // Kompletter Stand der aktuellen Basis; gelingt das nicht, bleibt
+  // resync gesetzt und der naechste notify*()-Aufruf versucht es erneut.
+  void sendFullState(int slot) {
+    bool ok = true;
+    if (s_stack && s_stack->valid) {
+      if (!s_haveStackBase) {
+        captureStackBaseline(s_stackBase);
+        s_haveStackBase = true;
+      }
+      ok = sendEvent("stack", [](JsonWriter& w) {
+        return buildStackEvent(w, s_stackBase, nullptr);
+      }, slot) && ok;
+    }
+    if (s_system && s_system->valid) {
+      if (!s_haveSystemBase) {
+        s_systemBase = *s_system;
+        s_haveSystemBase = true;
+      }
+      ok = sendEvent("system", [](JsonWriter& w) {
+        return buildSystemEvent(w, s_systemBase, nullptr);
+      }, slot) && ok;
+    }
+    s_clients[slot].resync = s_clients[slot].active && !ok;
+  }
+
+  // Vor jedem Delta: Clients ohne vollstaendigen Stand nachziehen, damit
+  // das Delta auf dieselbe Basis passt.
+  void resyncClients() {
+    for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; ++i) {
+      if (s_clients[i].active && s_clients[i].resync) sendFullState(i);
+    }
+  }
+
+  void handleSubscribe() {
+    int slot = -1;
+    for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; ++i) {
+      if (!s_clients[i].active) {
+        slot = i;
+        break;
+      }
+    }
+    if (slot < 0) {
+      s_server->send(503, "text/plain", "too many event clients");
+      return;
+    }
+
+    // Die Verbindung wird hier uebernommen und bleibt offen. Die Referenz
+    // des WebServers wird sofort freigegeben, sonst haelt er den Client bis
+    // HTTP_MAX_CLOSE_WAIT (2 s) fest und bedient solange niemand anderen.
+    WiFiClient client = s_server->client();
+    s_server->client().stop();
+    client.setNoDelay(true);
+    client.print("HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/event-stream\r\n"
+                 "Cache-Control: no-store\r\n"
+                 "Connection: keep-alive\r\n"
+                 "\r\n"
+                 "retry: 5000\n\n");
+
+    EventClient& c = s_clients[slot];
+    c.client = client;
+    c.active = true;
+    c.connectedMs = millis();
+
+    if (s_log) {
+      char msg[48];
+      snprintf(msg, sizeof(msg), "SSE: client %d connected", slot);
+      s_log->Log(msg);
+    }
+
+    sendFullState(slot);
+  }
+}
+
+void EventStream::init(WebServer* server,
+                       batteryStack* stk,
+                       systemData* sys,
+                       dailyEnergyData* energy,
+                       circular_log<16384>* clog)
+{
+  s_server = server;
+  s_stack  = stk;
+  s_system = sys;
+  s_energy = energy;
+  s_log    = clog;
+
+  s_server->on("/api/events", HTTP_GET, []() {
+    handleSubscribe();
+  });
+}
+
+void EventStream::loop() {
+  const unsigned long now = millis();
+  const bool pingDue = (now - s_lastPingMs) >= kPingIntervalMs;
+  if (pingDue) s_lastPingMs = now;
+
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; ++i) {
+    EventClient& c = s_clients[i];
+    if (!c.active) continue;
+
+    if (!c.client.connected()) {
+      dropClient(i, "disconnected");
+      continue;
+    }
+    // Eingehende Bytes (z. B. TCP-Keepalive-Reste) verwerfen
+    while (c.client.available()) c.client.read();
+
+    if (pingDue && !writeAll(c, ": ping\n\n", 8)) {
+      dropClient(i, "ping");
+    }
+  }
+}
+
+void EventStream::notifyStack() {
+  if (!s_stack || !s_stack->valid) return;
+
+  static StackBaseline now;  // statisch: ~1.5 KB nicht auf dem loop()-Stack
+  captureStackBaseline(now);
+
+  // Die Basis rueckt nur vor, wenn das Delta rausging; sonst enthaelt das
+  // naechste Delta die verpassten Aenderungen mit.
+  if (clientCount() > 0) {
+    resyncClients();
+    const StackBaseline* base = s_haveStackBase ? &s_stackBase : nullptr;
+    if (!sendEvent("stack", [base](JsonWriter& w) { return buildStackEvent(w, now, base); })) {
+      return;
+    }
+  }
+
+  s_stackBase = now;
+  s_haveStackBase = true;
+}
+
+void EventStream::notifySystem() {
+  if (!s_system || !s_system->valid) return;
+
+  if (clientCount() > 0) {
+    resyncClients();
+    const systemData* base = s_haveSystemBase ? &s_systemBase : nullptr;
+    if (!sendEvent("system", [base](JsonWriter& w) { return buildSystemEvent(w, *s_system, base); })) {
+      return;
+    }
+  }
+
+  s_systemBase = *s_system;
+  s_haveSystemBase = true;
+}
+
+uint8_t EventStream::clientCount() {
+  uint8_t n = 0;
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; ++i) {
+    if (s_clients[i].active) n++;
+  }
+  return n;
+}
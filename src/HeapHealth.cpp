@@ -0,0 +1,191 @@
+#include "HeapHealth.h"
+#include "JsonWriter.h"
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace {
+  HeapHealth::Info     s_info;
+  HeapHealth::SubStats s_subs[(size_t)HeapHealth::Sub::Count];
+  HeapHealth::Sub      s_current = HeapHealth::Sub::Other;
+  TaskHandle_t         s_loopTask = nullptr;
+  unsigned long        s_lastSampleMs = 0;
+
+  // Namen wie im Arduino-Core/ESP-IDF; fehlende Tasks werden uebersprungen
+  const char* const kTaskNames[] = { "loopTask", "tiT", "wifi", "esp_timer", "IDLE0", "IDLE1" };
+  constexpr size_t kTaskCount = sizeof(kTaskNames) / sizeof(kTaskNames[0]);
+
+  const char* const kSubNames[(size_t)HeapHealth::Sub::Count] = {
+    "other", "web", "mqtt", "poll", "jobs"
+  };
+
+  void onAllocFailed(size_t size, uint32_t caps, const char* functionName) {
+    (void)caps;
+    (void)functionName;
+    s_info.failedAllocs++;
+    s_info.lastFailedSize = (uint32_t)size;
+  }
+
+  void sample() {
+    multi_heap_info_t hi;
+    heap_caps_get_info(&hi, MALLOC_CAP_8BIT);
+
+    s_info.freeBytes       = (uint32_t)hi.total_free_bytes;
+    s_info.minFreeBytes    = (uint32_t)hi.minimum_free_bytes;
+    s_info.largestBlock    = (uint32_t)hi.largest_free_block;
+    s_info.allocatedBlocks = (uint32_t)hi.allocated_blocks;
+    s_info.freeBlocks      = (uint32_t)hi.free_blocks;
+    s_info.fragPct = hi.total_free_bytes
+      ? (uint8_t)(100U - (uint32_t)((uint64_t)hi.largest_free_block * 100U / hi.total_free_bytes))
+      : 0;
+
+    if (!s_info.samples || s_info.largestBlock < s_info.largestBlockMin) s_info.largestBlockMin = s_info.largestBlock;
+    if (s_info.fragPct > s_info.fragPctMax) s_info.fragPctMax = s_info.fragPct;
+    s_info.samples++;
+  }
+
+#if HEAP_ALLOC_HOOK
+  // Laeuft in jedem Task und darf selbst nichts allozieren. Zaehler anderer
+  // Tasks sind nicht atomar; fuer Trends reicht das.
+  inline HeapHealth::SubStats& currentSub() {
+    const bool loopTask = s_loopTask && xTaskGetCurrentTaskHandle() == s_loopTask;
+    return s_subs[(size_t)(loopTask ? s_current : HeapHealth::Sub::Other)];
+  }
+#endif
+}
+
+#if HEAP_ALLOC_HOOK
+extern "C" {
+  void* __real_malloc(size_t size);
+  void  __real_free(void* ptr);
+  void* __real_realloc(void* ptr, size_t size);
+  void* __real_calloc(size_t n, size_t size);
+
+  void* __wrap_malloc(size_t size) {
+    void* p = __real_malloc(size);
+    if (p) {
+      HeapHealth::SubStats& s = currentSub();
+      s.allocs++;
+      s.bytes += size;
+    }
+    return p;
+  }
+
+  void __wrap_free(void* ptr) {
+    if (ptr) currentSub().frees++;
+    __real_free(ptr);
+  }
+
+  void* __wrap_realloc(void* ptr, size_t size) {
+    void* p = __real_realloc(ptr, size);
+    HeapHealth::SubStats& s = currentSub();
+    if (!size) {
+      if (ptr) s.frees++;
+    } else if (p) {
+      s.allocs++;
+      s.bytes += size;
+      if (ptr) s.frees++;   // Umzug zaehlt als Freigabe + neue Allokation
+    }
+    return p;
+  }
+
+  void* __wrap_calloc(size_t n, size_t size) {
+    void* p = __real_calloc(n, size);
+    if (p) {
+      HeapHealth::SubStats& s = currentSub();
+      s.allocs++;
+      s.bytes += (uint64_t)n * size;
+    }
+    return p;
+  }
+}
+#endif
+
+void HeapHealth::begin() {
+  s_loopTask = xTaskGetCurrentTaskHandle();
+  heap_caps_register_failed_alloc_callback(onAllocFailed);
+  sample();
+  s_lastSampleMs = millis();
+}
+
+void HeapHealth::loop() {
+  const unsigned long now = millis();
+  if (now - s_lastSampleMs < HEAP_SAMPLE_INTERVAL_MS) return;
+  s_lastSampleMs = now;
+  sample();
+}
+
+const HeapHealth::Info& HeapHealth::info() {
+  return s_info;
+}
+
+bool HeapHealth::hookEnabled() {
+  return HEAP_ALLOC_HOOK != 0;
+}
+
+const HeapHealth::SubStats& HeapHealth::subStats(Sub sub) {
+  const size_t i = (size_t)sub < (size_t)Sub::Count ? (size_t)sub : 0;
+  return s_subs[i];
+}
+
+const char* HeapHealth::subName(Sub sub) {
+  return (size_t)sub < (size_t)Sub::Count ? kSubNames[(size_t)sub] : "?";
+}
+
+size_t HeapHealth::taskCount() {
+  return kTaskCount;
+}
+
+bool HeapHealth::task(size_t idx, const char*& name, uint32_t& freeStackBytes) {
+  if (idx >= kTaskCount) return false;
+  TaskHandle_t h = xTaskGetHandle(kTaskNames[idx]);
+  if (!h) return false;
+  name = kTaskNames[idx];
+  // ESP-IDF: StackType_t ist ein Byte, der Wert also schon in Bytes
+  freeStackBytes = (uint32_t)uxTaskGetStackHighWaterMark(h);
+  return true;
+}
+
+void HeapHealth::writeFields(JsonWriter& w) {
+  const Info& i = s_info;
+  w.field("free", i.freeBytes);
+  w.field("minFree", i.minFreeBytes);
+  w.field("largestBlock", i.largestBlock);
+  w.field("largestBlockMin", i.largestBlockMin);
+  w.field("fragPct", (unsigned)i.fragPct);
+  w.field("fragPctMax", (unsigned)i.fragPctMax);
+  w.field("allocatedBlocks", i.allocatedBlocks);
+  w.field("freeBlocks", i.freeBlocks);
+  w.field("failedAllocs", i.failedAllocs);
+  w.field("lastFailedSize", i.lastFailedSize);
+
+  w.beginObject("stackFree");
+  for (size_t t = 0; t < kTaskCount; ++t) {
+    const char* name = nullptr;
+    uint32_t freeBytes = 0;
+    if (task(t, name, freeBytes)) w.field(name, freeBytes);
+  }
+  w.endObject();
+
+  if (hookEnabled()) {
+    w.beginObject("allocs");
+    for (size_t s = 0; s < (size_t)Sub::Count; ++s) {
+      const SubStats& st = s_subs[s];
+      w.beginObject(kSubNames[s]);
+      w.field("allocs", st.allocs);
+      w.field("frees", st.frees);
+      w.field("bytes", (unsigned long long)st.bytes);
+      w.endObject();
+    }
+    w.endObject();
+  }
+}
+
+HeapHealth::Scope::Scope(Sub sub) : m_prev(s_current) {
+  s_current = sub;
+}
+
+HeapHealth::Scope::~Scope() {
+  s_current = m_prev;
+}
@@ -0,0 +1,141 @@
+#include "JsonWriter.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+JsonWriter& JsonWriter::beginObject(const char* key) {
+  prefix(key);
+  putRaw("{", 1);
+  if (m_depth < 31) m_depth++;
+  m_hasItems &= ~(1UL << m_depth);
+  return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+  if (m_depth > 0) m_depth--;
+  putRaw("}", 1);
+  return *this;
+}
+
+JsonWriter& JsonWriter::beginArray(const char* key) {
+  prefix(key);
+  putRaw("[", 1);
+  if (m_depth < 31) m_depth++;
+  m_hasItems &= ~(1UL << m_depth);
+  return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+  if (m_depth > 0) m_depth--;
+  putRaw("]", 1);
+  return *this;
+}
+
+void JsonWriter::prefix(const char* key) {
+  const uint32_t bit = 1UL << m_depth;
+  if (m_hasItems & bit) putRaw(",", 1);
+  m_hasItems |= bit;
+
+  if (key) {
+    putString(key);
+    putRaw(":", 1);
+  }
+}
+
+void JsonWriter::putRaw(const char* s, size_t n) {
+  m_out.write((const uint8_t*)s, n);
+  m_len += n;
+}
+
+void JsonWriter::putString(const char* s) {
+  if (!s) {
+    putRaw("null", 4);
+    return;
+  }
+  putString(s, strlen(s));
+}
+
+void JsonWriter::putString(const char* s, size_t len) {
+  putRaw("\"", 1);
+  const char* run = s;
+  const char* end = s + len;
+  for (const char* p = s; p < end; ++p) {
+    const unsigned char c = (unsigned char)*p;
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+    // unkritische Zeichen am Stueck schreiben, dann das Escape
+    if (p > run) putRaw(run, (size_t)(p - run));
+    char esc[8];
+    switch (c) {
+      case '"':  putRaw("\\\"", 2); break;
+      case '\\': putRaw("\\\\", 2); break;
+      case '\n': putRaw("\\n", 2); break;
+      case '\r': putRaw("\\r", 2); break;
+      case '\t': putRaw("\\t", 2); break;
+      default:
+        snprintf(esc, sizeof(esc), "\\u%04x", c);
+        putRaw(esc, 6);
+        break;
+    }
+    run = p + 1;
+  }
+  if (end > run) putRaw(run, (size_t)(end - run));
+  putRaw("\"", 1);
+}
+
+void JsonWriter::putSigned(long long v) {
+  char buf[24];
+  const int n = snprintf(buf, sizeof(buf), "%lld", v);
+  putRaw(buf, (size_t)n);
+}
+
+void JsonWriter::putUnsigned(unsigned long long v) {
+  char buf[24];
+  const int n = snprintf(buf, sizeof(buf), "%llu", v);
+  putRaw(buf, (size_t)n);
+}
+
+void JsonWriter::putFloat(double v, uint8_t decimals) {
+  if (!isfinite(v)) {
+    putRaw("null", 4);
+    return;
+  }
+
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+  if (n <= 0 || n >= (int)sizeof(buf)) {
+    putRaw("null", 4);
+    return;
+  }
+
+  // 52.100 -> 52.1, 3.000 -> 3 (wie ArduinoJson)
+  if (memchr(buf, '.', (size_t)n)) {
+    while (n > 0 && buf[n - 1] == '0') n--;
+    if (n > 0 && buf[n - 1] == '.') n--;
+  }
+  if (n == 2 && buf[0] == '-' && buf[1] == '0') {
+    putRaw("0", 1);
+    return;
+  }
+  putRaw(buf, (size_t)n);
+}
+
+BufferPrint::BufferPrint(char* buf, size_t size) : m_buf(buf), m_size(size) {
+  if (m_buf && m_size) m_buf[0] = '\0';
+}
+
+size_t BufferPrint::write(const uint8_t* data, size_t n) {
+  if (!m_buf || m_size == 0) {
+    m_overflow = true;
+    return 0;
+  }
+
+  const size_t room = m_size - 1 - m_len;
+  const size_t take = (n <= room) ? n : room;
+  if (take < n) m_overflow = true;
+
+  memcpy(m_buf + m_len, data, take);
+  m_len += take;
+  m_buf[m_len] = '\0';
+  return take;
+}
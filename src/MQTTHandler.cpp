@@ -1,15 +1,234 @@
 #include "MQTTHandler.h"
 #include "Config.h"
-#include <ArduinoJson.h>
+#include "JsonWriter.h"
+#include "MqttQueue.h"
+#include "ConsoleJobs.h"
+#include "PylonLink.h"
+#include "HeapHealth.h"
+#include "DataAge.h"
+#include "Trace.h"
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <ctype.h>
 #include <string.h>
+#include <math.h>
 
 namespace {
+  // Direkt senden, solange verbunden und nichts aussteht; sonst in die
+  // Warteschlange, damit die Reihenfolge erhalten bleibt.
+  void sendOrQueue(PubSubClient* client, const char* topic, const uint8_t* payload, size_t len, bool retained) {
+    if (client && client->connected() && MqttQueue::empty() &&
+        client->publish(topic, payload, len, retained)) {
+      return;
+    }
+    MqttQueue::push(topic, payload, len, retained);
+  }
+
   void publishRetainedText(PubSubClient* client, const char* suffix, const char* payload) {
     if (!client || !suffix || !payload) return;
 
     char topic[160];
     snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "diag/%s", suffix);
-    client->publish(topic, payload, true);
+    sendOrQueue(client, topic, (const uint8_t*)payload, strlen(payload), true);
+  }
+
+  void writeDevice(JsonWriter& w) {
+    w.beginObject("device");
+    w.beginArray("identifiers").value(WIFI_HOSTNAME).endArray();
+    w.field("manufacturer", "Pylontech");
+    w.field("model",        "Battery Monitor");
+    w.field("name",         WIFI_HOSTNAME);
+    w.endObject();
+  }
+
+  // Werte aus pwrsys; alles andere stammt aus pwr
+  bool isSystemSuffix(const char* suffix) {
+    return strncmp(suffix, "system_", 7) == 0 ||
+           strncmp(suffix, "rec_", 4) == 0 ||
+           strncmp(suffix, "sys_rec_", 8) == 0;
+  }
+
+#if MQTT_AGGREGATED_STATE
+  // Zustandsdokument und Feldname zu einem Einzel-Topic-Suffix:
+  // "<n>/<key>" -> <n>/json, system_*/rec_*/sys_rec_* -> system/json,
+  // alles andere -> stack/json. Feldnamen = bisherige Topic-Suffixe.
+  const char* stateDocFor(const char* suffix, char* topic, size_t size) {
+    const char* slash = strchr(suffix, '/');
+    if (slash) {
+      snprintf(topic, size, MQTT_TOPIC_ROOT "%.*s/json", (int)(slash - suffix), suffix);
+      return slash + 1;
+    }
+    snprintf(topic, size, MQTT_TOPIC_ROOT "%s", isSystemSuffix(suffix) ? "system/json" : "stack/json");
+    return suffix;
+  }
+#endif
+
+  // ---------- Discovery ----------
+  // Alle Entitaeten stehen in Tabellen; die Config einer Entitaet wird bei
+  // Bedarf per Index erzeugt (Topic per snprintf, Payload per JsonWriter in
+  // einen Stack-Puffer). Gesendet wird schrittweise aus loop(), je Schritt
+  // nur MQTT_DISCOVERY_BATCH Configs. Pro Entitaet merkt sich der Handler
+  // den Hash der zuletzt gesendeten Config; nach kurzem Reconnect werden
+  // unveraenderte Configs uebersprungen.
+
+  struct SensorDef {
+    const char* objectId;
+    const char* name;
+    const char* stateSuffix;
+    const char* unit;
+    const char* deviceClass;
+    bool        stateClass;
+    const char* icon;
+  };
+
+  const SensorDef kStackSensors[] = {
+    { "soc",                 "Battery SoC",                        "soc",                 "%",   "battery",     true,  "mdi:battery-medium" },
+    { "temp",                "Battery Temp",                       "temp",                "°C",  "temperature", true,  nullptr },
+    { "currentDC",           "Battery Current",                    "currentDC",           "mA",  "current",     true,  nullptr },
+    { "avgVoltage",          "Battery Voltage",                    "avgVoltage",          "V",   "voltage",     true,  nullptr },
+    { "dc_power",            "Battery DC Power",                   "dc_power",            "W",   "power",       true,  "mdi:gauge" },
+    { "ac_power_est",        "Battery AC Power",                   "ac_power_est",        "W",   "power",       true,  nullptr },
+    { "charge_kwh_today",    "Laden heute",                        "charge_kwh_today",    "kWh", "energy",      false, "mdi:battery-arrow-up" },
+    { "discharge_kwh_today", "Entladen heute",                     "discharge_kwh_today", "kWh", "energy",      false, "mdi:battery-arrow-down" },
+    { "cell_delta_max",      "Battery Cell Delta Max",             "cell_delta_max",      "mV",  nullptr,       false, nullptr },
+    { "battery_state",       "Battery State",                      "base_state",          nullptr, nullptr,     false, "mdi:battery-heart-variant" },
+    { "system_soc",          "System SOC",                         "system_soc",          "%",   "battery",     true,  nullptr },
+    { "system_soh",          "System SOH",                         "system_soh",          "%",   nullptr,       true,  nullptr },
+    { "system_voltage",      "System Voltage",                     "system_voltage",      "V",   "voltage",     true,  nullptr },
+    { "system_current",      "System Current",                     "system_current",      "A",   "current",     true,  nullptr },
+    { "system_rc",           "System RC",                          "system_rc",           "mAh", nullptr,       true,  nullptr },
+    { "system_fcc",          "System FCC",                         "system_fcc",          "mAh", nullptr,       true,  nullptr },
+    { "system_temp_avg",     "System Temp Avg",                    "system_temp_avg",     "°C",  "temperature", true,  nullptr },
+    { "system_temp_low",     "System Temp Low",                    "system_temp_low",     "°C",  "temperature", true,  nullptr },
+    { "system_temp_high",    "System Temp High",                   "system_temp_high",    "°C",  "temperature", true,  nullptr },
+    { "system_volt_avg",     "System Volt Avg",                    "system_volt_avg",     "V",   "voltage",     true,  nullptr },
+    { "system_volt_low",     "System Volt Low",                    "system_volt_low",     "V",   "voltage",     true,  nullptr },
+    { "system_volt_high",    "System Volt High",                   "system_volt_high",    "V",   "voltage",     true,  nullptr },
+    { "rec_chg_voltage",     "Recommend Charge Voltage",           "rec_chg_voltage",     "V",   "voltage",     true,  nullptr },
+    { "rec_dsg_voltage",     "Recommend Discharge Voltage",        "rec_dsg_voltage",     "V",   "voltage",     true,  nullptr },
+    { "rec_chg_current",     "Recommend Charge Current",           "rec_chg_current",     "A",   "current",     true,  nullptr },
+    { "rec_dsg_current",     "Recommend Discharge Current",        "rec_dsg_current",     "A",   "current",     true,  nullptr },
+    { "sys_rec_chg_voltage", "System Recommend Charge Voltage",    "sys_rec_chg_voltage", "V",   "voltage",     true,  nullptr },
+    { "sys_rec_dsg_voltage", "System Recommend Discharge Voltage", "sys_rec_dsg_voltage", "V",   "voltage",     true,  nullptr },
+    { "sys_rec_chg_current", "System Recommend Charge Current",    "sys_rec_chg_current", "A",   "current",     true,  nullptr },
+    { "sys_rec_dsg_current", "System Recommend Discharge Current", "sys_rec_dsg_current", "A",   "current",     true,  nullptr },
+  };
+
+  // Je Batterie; objectId = b<n>_<key>, Topic-Suffix = <n>/<key>
+  const SensorDef kBatterySensors[] = {
+    { "soc",         "SoC",         nullptr, "%",     "battery", true,  nullptr },
+    { "voltage",     "Voltage",     nullptr, "V",     "voltage", true,  nullptr },
+    { "current",     "Current",     nullptr, "A",     "current", true,  nullptr },
+    { "power",       "Power",       nullptr, "W",     "power",   true,  "mdi:gauge" },
+    { "cell_delta",  "Cell Delta",  nullptr, "mV",    nullptr,   false, nullptr },
+    { "cycle_times", "Cycle Times", nullptr, nullptr, nullptr,   false, nullptr },
+    { "alarm_text",  "Alarm",       nullptr, nullptr, nullptr,   false, "mdi:alert-circle-outline" },
+    { "state",       "State",       nullptr, nullptr, nullptr,   false, "mdi:battery" },
+  };
+
+  constexpr size_t kStackSensorCount   = sizeof(kStackSensors) / sizeof(kStackSensors[0]);
+  constexpr size_t kBatterySensorCount = sizeof(kBatterySensors) / sizeof(kBatterySensors[0]);
+  // Stack-Sensoren, binary_sensor "online", dann alle Batterien
+  constexpr size_t kDiscoveryCount = kStackSensorCount + 1 + MAX_PYLON_BATTERIES * kBatterySensorCount;
+
+  uint32_t s_discoveryHash[kDiscoveryCount];
+  uint16_t s_discoveryCursor  = 0;
+  bool     s_discoveryActive  = false;
+  unsigned long s_discoveryStepMs = 0;
+  unsigned long s_disconnectedMs  = 0;
+
+  uint32_t fnv1a(uint32_t h, const char* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+      h ^= (uint8_t)data[i];
+      h *= 16777619u;
+    }
+    return h;
+  }
+
+  // Sensor-Config in topic/payload; liefert die Payload-Laenge, 0 bei Ueberlauf
+  size_t buildSensorConfig(const SensorDef& d,
+                           const char* objectId,
+                           const char* name,
+                           const char* stateSuffix,
+                           char* topic, size_t topicSize,
+                           char* payload, size_t payloadSize)
+  {
+    char stateTopic[96], uniqueId[64];
+#if MQTT_AGGREGATED_STATE
+    char valueTemplate[64];
+    const char* field = stateDocFor(stateSuffix, stateTopic, sizeof(stateTopic));
+    snprintf(valueTemplate, sizeof(valueTemplate), "{{ value_json.%s }}", field);
+#else
+    snprintf(stateTopic, sizeof(stateTopic), MQTT_TOPIC_ROOT "%s", stateSuffix);
+#endif
+    snprintf(uniqueId, sizeof(uniqueId), WIFI_HOSTNAME "_%s", objectId);
+    snprintf(topic, topicSize, HA_DISCOVERY_SENSOR_PREFIX WIFI_HOSTNAME "/%s/config", objectId);
+
+    BufferPrint out(payload, payloadSize);
+    JsonWriter w(out);
+    w.beginObject();
+    w.field("name",                  name);
+    w.field("state_topic",           stateTopic);
+#if MQTT_AGGREGATED_STATE
+    w.field("value_template",        valueTemplate);
+#endif
+    w.field("unique_id",             uniqueId);
+    // Messzeitpunkt und Alter als Attribute, siehe publishFreshness()
+    w.field("json_attributes_topic", isSystemSuffix(stateSuffix) ? MQTT_TOPIC_ROOT "system/freshness"
+                                                                 : MQTT_TOPIC_ROOT "stack/freshness");
+    w.field("availability_topic",    MQTT_TOPIC_ROOT "availability");
+    w.field("payload_available",     "online");
+    w.field("payload_not_available", "offline");
+
+    if (d.stateClass && (d.unit || d.deviceClass)) {
+      w.field("state_class", "measurement");
+    }
+    if (d.unit)        w.field("unit_of_measurement", d.unit);
+    if (d.deviceClass) w.field("device_class",        d.deviceClass);
+    if (d.icon)        w.field("icon",                d.icon);
+
+    writeDevice(w);
+    w.endObject();
+
+    return out.overflowed() ? 0 : out.length();
+  }
+
+  size_t buildOnlineConfig(char* topic, size_t topicSize, char* payload, size_t payloadSize) {
+    snprintf(topic, topicSize, HA_DISCOVERY_BINARY_PREFIX WIFI_HOSTNAME "/online/config");
+
+    BufferPrint out(payload, payloadSize);
+    JsonWriter w(out);
+    w.beginObject();
+    w.field("name",            "Pylontech Online");
+    w.field("state_topic",     MQTT_TOPIC_ROOT "availability");
+    w.field("unique_id",       WIFI_HOSTNAME "_online");
+    w.field("device_class",    "connectivity");
+    w.field("payload_on",      "online");
+    w.field("payload_off",     "offline");
+    w.field("entity_category", "diagnostic");
+    writeDevice(w);
+    w.endObject();
+
+    return out.overflowed() ? 0 : out.length();
+  }
+
+  // Config der Entitaet mit Index idx (0 .. kDiscoveryCount-1)
+  size_t buildDiscovery(size_t idx, char* topic, size_t topicSize, char* payload, size_t payloadSize) {
+    if (idx < kStackSensorCount) {
+      const SensorDef& d = kStackSensors[idx];
+      return buildSensorConfig(d, d.objectId, d.name, d.stateSuffix, topic, topicSize, payload, payloadSize);
+    }
+    idx -= kStackSensorCount;
+    if (idx == 0) return buildOnlineConfig(topic, topicSize, payload, payloadSize);
+    idx -= 1;
+
+    const int battery = (int)(idx / kBatterySensorCount) + 1;
+    const SensorDef& d = kBatterySensors[idx % kBatterySensorCount];
+    char objectId[32], name[40], suffix[24];
+    snprintf(objectId, sizeof(objectId), "b%d_%s", battery, d.objectId);
+    snprintf(name, sizeof(name), "Battery %d %s", battery, d.name);
+    snprintf(suffix, sizeof(suffix), "%d/%s", battery, d.objectId);
+    return buildSensorConfig(d, objectId, name, suffix, topic, topicSize, payload, payloadSize);
   }
 
   void publishRetainedNumber(PubSubClient* client, const char* suffix, uint32_t value) {
@@ -17,35 +236,387 @@ namespace {
     snprintf(payload, sizeof(payload), "%lu", (unsigned long)value);
     publishRetainedText(client, suffix, payload);
   }
+
+  // Messzeitpunkt einer Quelle, retained auf <root>stack/freshness bzw.
+  // <root>system/freshness: sample_epoch (Unixzeit, nur mit Zeitsync),
+  // age_ms beim Publish und seq. Geht mit jeder Auswertung der schnellen
+  // Klasse raus, auch wenn alle Werte in ihrer Totzone blieben; bleibt es
+  // aus, sind die retained Werte veraltet.
+  void publishFreshness(PubSubClient* client, const char* topic, DataAge::Source src) {
+    const DataAge::Sample& sm = DataAge::sample(src);
+    if (!client || !sm.seq) return;
+
+    char payload[96];
+    BufferPrint out(payload, sizeof(payload));
+    JsonWriter w(out);
+    w.beginObject();
+    const unsigned long epoch = DataAge::sampleEpoch(src);
+    if (epoch) w.field("sample_epoch", epoch);
+    w.field("age_ms", DataAge::ageMs(src));
+    w.field("seq", sm.seq);
+    w.endObject();
+    if (out.overflowed()) return;
+
+    sendOrQueue(client, topic, (const uint8_t*)payload, out.length(), true);
+    DataAge::noteConsumed(DataAge::Path::Mqtt, src);
+  }
+
+  // ---------- Change-Detection ----------
+  // Pro Topic merkt sich der Handler den zuletzt gesendeten Rohwert (mV, mA,
+  // m°C, Wh, ...). Veroeffentlicht wird erst, wenn der Wert um mindestens die
+  // Totzone abweicht; Texte per Hash bei jeder Aenderung. Nach (Re-)Connect
+  // und alle MQTT_FULL_REFRESH_MS geht alles einmal komplett raus.
+
+  struct LastValue {
+    long long value = 0;
+    bool      valid = false;
+  };
+
+  enum class Fmt : uint8_t {
+    Int,     // Rohwert ganzzahlig
+    Milli1,  // Rohwert / 1000 mit einer Nachkommastelle
+    Milli3,  // Rohwert / 1000 mit drei Nachkommastellen
+  };
+
+  enum StackTopic : uint8_t {
+    S_ChargeKwh, S_DischargeKwh, S_Soc, S_Temp, S_CurrentDC, S_AvgVoltage,
+    S_BaseState, S_DcPower, S_AcPower, S_CellDeltaMax, S_SystemSoc, S_SystemSoh,
+    S_Count
+  };
+
+  enum BatteryTopic : uint8_t {
+    B_Soc, B_Voltage, B_Current, B_Cycles, B_CellDelta, B_Power, B_State, B_AlarmText,
+    B_Count
+  };
+
+  // Publish-Klassen: jede hat ihren eigenen Mindestabstand und wird nur
+  // neu ausgewertet, wenn eine Quelle (pwr/pwrsys/stat) sie als geaendert
+  // markiert hat. So werden z. B. cycle_times und FCC nicht mehr alle 2 s
+  // formatiert und verglichen.
+  enum PubClass : uint8_t {
+    C_Fast   = 1 << 0,   // Strom, Leistung, SoC, Spannung, Zustand
+    C_Medium = 1 << 1,   // Temperaturen, Zellspreizung, Tagesenergie
+    C_Slow   = 1 << 2,   // Zyklen, SOH, FCC, empfohlene Grenzwerte
+    C_All    = C_Fast | C_Medium | C_Slow,
+  };
+
+  const unsigned long kClassIntervalMs[3] = {
+    MQTT_FAST_INTERVAL_MS, MQTT_MEDIUM_INTERVAL_MS, MQTT_SLOW_INTERVAL_MS
+  };
+
+  uint8_t       s_classDirty = 0;
+  unsigned long s_classLastMs[3] = {0, 0, 0};
+
+  struct SystemTopic {
+    const char* key;
+    long systemData::* field;
+    long        deadband;
+    Fmt         fmt;
+    uint8_t     cls;
+  };
+
+  const SystemTopic kSystemTopics[] = {
+    { "system_voltage",      &systemData::voltage,             MQTT_DEADBAND_MV,  Fmt::Milli3, C_Fast },
+    { "system_current",      &systemData::current,             MQTT_DEADBAND_MA,  Fmt::Milli3, C_Fast },
+    { "system_rc",           &systemData::rc,                  MQTT_DEADBAND_MAH, Fmt::Int,    C_Medium },
+    { "system_fcc",          &systemData::fcc,                 MQTT_DEADBAND_MAH, Fmt::Int,    C_Slow },
+    { "system_temp_avg",     &systemData::temp_avg,            MQTT_DEADBAND_MC,  Fmt::Milli1, C_Medium },
+    { "system_temp_low",     &systemData::temp_low,            MQTT_DEADBAND_MC,  Fmt::Milli1, C_Medium },
+    { "system_temp_high",    &systemData::temp_high,           MQTT_DEADBAND_MC,  Fmt::Milli1, C_Medium },
+    { "system_volt_avg",     &systemData::volt_avg,            MQTT_DEADBAND_CELL_MV, Fmt::Milli3, C_Medium },
+    { "system_volt_low",     &systemData::volt_low,            MQTT_DEADBAND_CELL_MV, Fmt::Milli3, C_Medium },
+    { "system_volt_high",    &systemData::volt_high,           MQTT_DEADBAND_CELL_MV, Fmt::Milli3, C_Medium },
+    { "rec_chg_voltage",     &systemData::rec_chg_voltage,     MQTT_DEADBAND_MV,  Fmt::Milli3, C_Slow },
+    { "rec_dsg_voltage",     &systemData::rec_dsg_voltage,     MQTT_DEADBAND_MV,  Fmt::Milli3, C_Slow },
+    { "rec_chg_current",     &systemData::rec_chg_current,     MQTT_DEADBAND_MA,  Fmt::Milli3, C_Slow },
+    { "rec_dsg_current",     &systemData::rec_dsg_current,     MQTT_DEADBAND_MA,  Fmt::Milli3, C_Slow },
+    { "sys_rec_chg_voltage", &systemData::sys_rec_chg_voltage, MQTT_DEADBAND_MV,  Fmt::Milli3, C_Slow },
+    { "sys_rec_dsg_voltage", &systemData::sys_rec_dsg_voltage, MQTT_DEADBAND_MV,  Fmt::Milli3, C_Slow },
+    { "sys_rec_chg_current", &systemData::sys_rec_chg_current, MQTT_DEADBAND_MA,  Fmt::Milli3, C_Slow },
+    { "sys_rec_dsg_current", &systemData::sys_rec_dsg_current, MQTT_DEADBAND_MA,  Fmt::Milli3, C_Slow },
+  };
+  constexpr size_t kSystemTopicCount = sizeof(kSystemTopics) / sizeof(kSystemTopics[0]);
+
+  LastValue     s_stackLast[S_Count];
+  LastValue     s_systemLast[kSystemTopicCount];
+  LastValue     s_battLast[MAX_PYLON_BATTERIES][B_Count];
+  bool          s_fullRefresh = true;
+  unsigned long s_lastFullMs  = 0;
+  uint32_t      s_published   = 0;
+  uint32_t      s_suppressed  = 0;
+
+  bool moved(const LastValue& last, long long value, long deadband) {
+    if (s_fullRefresh || !last.valid) return true;
+    const long long step = deadband > 0 ? deadband : 1;
+    const long long diff = value - last.value;
+    return diff >= step || diff <= -step;
+  }
+
+  long cellDelta(const pylonBattery& b) {
+    return (b.cellVoltHigh > 0 && b.cellVoltLow > 0) ? b.cellVoltHigh - b.cellVoltLow : 0;
+  }
+
+  uint32_t textHash(const char* text) {
+    // FNV-1a als Vergleichswert fuer Text-Topics
+    uint32_t h = 2166136261u;
+    for (const char* p = text; *p; ++p) {
+      h ^= (uint8_t)*p;
+      h *= 16777619u;
+    }
+    return h;
+  }
+
+  // Ziel einer Gruppe von Zustandswerten (Stack, System, eine Batterie).
+  // Einzel-Topic-Modus: jeder bewegte Wert geht als eigenes Topic
+  // <root><prefix><key> raus. Mit MQTT_AGGREGATED_STATE sammelt die Gruppe
+  // alle Werte in einem JSON-Dokument, das als Ganzes gesendet wird, sobald
+  // mindestens ein Wert seine Totzone verlassen hat.
+  class StateSink {
+  public:
+    StateSink(PubSubClient* client, uint8_t classes, const char* prefix, const char* docTopic)
+      : m_client(client), m_classes(classes), m_prefix(prefix), m_docTopic(docTopic)
+#if MQTT_AGGREGATED_STATE
+      , m_out(m_buf, sizeof(m_buf)), m_w(m_out)
+#endif
+    {
+#if MQTT_AGGREGATED_STATE
+      m_w.beginObject();
+#else
+      (void)m_docTopic;
+#endif
+    }
+
+    void scaled(uint8_t cls, LastValue& last, const char* key, long long raw, long deadband, Fmt fmt) {
+      if (!wants(cls)) return;
+      const bool due = moved(last, raw, deadband);
+#if MQTT_AGGREGATED_STATE
+      switch (fmt) {
+        case Fmt::Milli1: m_w.field(key, raw / 1000.0, 1); break;
+        case Fmt::Milli3: m_w.field(key, raw / 1000.0, 3); break;
+        default:          m_w.field(key, raw); break;
+      }
+      remember(last, raw, due);
+#else
+      if (!due) {
+        s_suppressed++;
+        return;
+      }
+      char payload[32];
+      switch (fmt) {
+        case Fmt::Milli1: snprintf(payload, sizeof(payload), "%.1f", raw / 1000.0); break;
+        case Fmt::Milli3: snprintf(payload, sizeof(payload), "%.3f", raw / 1000.0); break;
+        default:          snprintf(payload, sizeof(payload), "%lld", raw); break;
+      }
+      send(last, raw, key, payload);
+#endif
+    }
+
+    void text(uint8_t cls, LastValue& last, const char* key, const char* text) {
+      if (!text || !wants(cls)) return;
+      const uint32_t h = textHash(text);
+      const bool due = moved(last, h, 0);
+#if MQTT_AGGREGATED_STATE
+      m_w.field(key, text);
+      remember(last, h, due);
+#else
+      if (!due) {
+        s_suppressed++;
+        return;
+      }
+      send(last, h, key, text);
+#endif
+    }
+
+    // Sendet das gesammelte Dokument (nur im Aggregat-Modus)
+    void finish() {
+#if MQTT_AGGREGATED_STATE
+      m_w.endObject();
+      if (!m_client || !m_count) return;
+      if (!m_due) {
+        s_suppressed++;
+        return;
+      }
+      if (m_out.overflowed()) return;
+      if (!m_client->publish(m_docTopic, (const uint8_t*)m_buf, m_out.length(), true)) return;
+      for (uint8_t i = 0; i < m_count; ++i) {
+        m_pending[i].last->value = m_pending[i].value;
+        m_pending[i].last->valid = true;
+      }
+      s_published++;
+#endif
+    }
+
+  private:
+    // Ein retained Dokument muss vollstaendig sein: im Aggregat-Modus landen
+    // alle Felder darin, sobald irgendeine Klasse faellig ist.
+    bool wants(uint8_t cls) const {
+#if MQTT_AGGREGATED_STATE
+      (void)cls;
+      return m_classes != 0;
+#else
+      return (m_classes & cls) != 0;
+#endif
+    }
+
+#if MQTT_AGGREGATED_STATE
+    void remember(LastValue& last, long long value, bool due) {
+      m_due = m_due || due;
+      if (m_count < kMaxFields) m_pending[m_count++] = { &last, value };
+    }
+#else
+    void send(LastValue& last, long long value, const char* key, const char* payload) {
+      if (!m_client) return;
+      char topic[96];
+      snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%s%s", m_prefix, key);
+      if (m_client->publish(topic, payload, true)) {
+        last.value = value;
+        last.valid = true;
+        s_published++;
+      }
+    }
+#endif
+
+    PubSubClient* m_client;
+    uint8_t       m_classes;
+    const char*   m_prefix;
+    const char*   m_docTopic;
+#if MQTT_AGGREGATED_STATE
+    struct Pending {
+      LastValue* last;
+      long long  value;
+    };
+    static constexpr uint8_t kMaxFields = 24;
+
+    char        m_buf[768];
+    BufferPrint m_out;
+    JsonWriter  m_w;
+    Pending     m_pending[kMaxFields];
+    uint8_t     m_count = 0;
+    bool        m_due = false;
+#endif
+  };
 }
 
 PubSubClient* MQTTHandler::s_client        = nullptr;
+WiFiClient*   MQTTHandler::s_net           = nullptr;
+MQTTHandler::ConnStats MQTTHandler::s_conn = {};
 batteryStack* MQTTHandler::s_stack         = nullptr;
 systemData*   MQTTHandler::s_system        = nullptr;
 dailyEnergyData* MQTTHandler::s_energy     = nullptr;
-unsigned long MQTTHandler::s_lastPublishMs = 0;
 unsigned long MQTTHandler::s_lastAvailMs   = 0;
+unsigned long MQTTHandler::s_lastSampleMs  = 0;
+MQTTHandler::ControlHandler MQTTHandler::s_control = nullptr;
 
-void MQTTHandler::init(PubSubClient* client, batteryStack* stack, systemData* system, dailyEnergyData* energy) {
+void MQTTHandler::init(PubSubClient* client, WiFiClient* net, batteryStack* stack, systemData* system, dailyEnergyData* energy) {
   s_client = client;
+  s_net    = net;
+  s_conn.health = 100;
   s_stack  = stack;
   s_system = system;
   s_energy = energy;
 
   if (s_client) {
     s_client->setKeepAlive(45);
-    s_client->setSocketTimeout(10);
+    s_client->setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
     s_client->setBufferSize(1024);
+    s_client->setCallback(onMessage);
   }
+  MqttQueue::begin();
 }
 
-void MQTTHandler::connectIfNeeded() {
-  if (!s_client) return;
-  if (s_client->connected()) return;
+// ---------- Verbindungsaufbau ----------
+// Zustandsautomat statt blockierendem connect(): der TCP-Aufbau laeuft ueber
+// einen nicht-blockierenden Socket und wird in jedem loop() nur per select()
+// mit Timeout 0 abgefragt. Erst wenn der Socket steht, uebernimmt ihn der
+// WiFiClient und PubSubClient schickt CONNECT (CONNACK kommt von einem
+// erreichbaren Broker sofort). Fehlversuche verlaengern den Abstand
+// exponentiell mit Jitter; ein Broker-Ausfall kostet loop() damit nichts.
+
+namespace {
+  int           s_connectFd      = -1;
+  unsigned long s_attemptStartMs = 0;
+  unsigned long s_nextAttemptMs  = 0;
+  unsigned long s_backoffMs      = 0;
+
+  unsigned long withJitter(unsigned long ms) {
+    // +/- 25 %
+    const unsigned long span = ms / 2;
+    return ms - ms / 4 + (span ? esp_random() % span : 0);
+  }
+
+  void closeConnectSocket() {
+    if (s_connectFd >= 0) close(s_connectFd);
+    s_connectFd = -1;
+  }
 
-  bool ok = false;
+  bool resolveBroker(IPAddress& ip) {
+    if (ip.fromString(MQTT_SERVER)) return true;
+    return WiFi.hostByName(MQTT_SERVER, ip) == 1;
+  }
+
+  // Startet den TCP-Aufbau; false bei sofortigem Fehler
+  bool startTcpConnect() {
+    IPAddress ip;
+    if (!resolveBroker(ip)) return false;
+
+    const int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(MQTT_PORT);
+    addr.sin_addr.s_addr = (uint32_t)ip;
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+      close(fd);
+      return false;
+    }
+    s_connectFd = fd;
+    return true;
+  }
+
+  // 1 = verbunden, 0 = laeuft noch, -1 = fehlgeschlagen
+  int pollTcpConnect() {
+    fd_set wfds;
+    FD_ZERO(&wfds);
+    FD_SET(s_connectFd, &wfds);
+    struct timeval tv = { 0, 0 };
+    const int r = select(s_connectFd + 1, nullptr, &wfds, nullptr, &tv);
+    if (r == 0) return 0;
+    if (r < 0) return -1;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(s_connectFd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) return -1;
+
+    // Ab hier wie ein von WiFiClient::connect() geoeffneter Socket
+    fcntl(s_connectFd, F_SETFL, fcntl(s_connectFd, F_GETFL, 0) & ~O_NONBLOCK);
+    const int one = 1;
+    setsockopt(s_connectFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 1;
+  }
+}
+
+void MQTTHandler::scheduleRetry(bool failedAttempt) {
+  const unsigned long now = millis();
+  if (failedAttempt) {
+    s_conn.failures++;
+    s_conn.health = (uint8_t)((s_conn.health * 7U) / 8U);
+    s_backoffMs = s_backoffMs ? s_backoffMs * 2 : MQTT_BACKOFF_MIN_MS;
+    if (s_backoffMs > MQTT_BACKOFF_MAX_MS) s_backoffMs = MQTT_BACKOFF_MAX_MS;
+  } else {
+    s_backoffMs = MQTT_BACKOFF_MIN_MS;
+  }
+  s_conn.backoffMs = s_backoffMs;
+  s_nextAttemptMs = now + withJitter(s_backoffMs);
+  s_conn.phase = ConnPhase::Backoff;
+}
+
+bool MQTTHandler::mqttHandshake() {
 #if defined(MQTT_USER) && defined(MQTT_PASSWORD)
-  ok = s_client->connect(
+  return s_client->connect(
         WIFI_HOSTNAME,
         MQTT_USER, MQTT_PASSWORD,
         MQTT_TOPIC_ROOT "availability",
@@ -53,19 +624,116 @@ void MQTTHandler::connectIfNeeded() {
         "offline"
       );
 #else
-  ok = s_client->connect(
+  return s_client->connect(
         WIFI_HOSTNAME,
         MQTT_TOPIC_ROOT "availability",
         1, true,
         "offline"
       );
 #endif
+}
+
+void MQTTHandler::onConnected() {
+  const unsigned long now = millis();
+  const unsigned long took = now - s_attemptStartMs;
+  s_conn.successes++;
+  s_conn.lastConnectMs = took;
+  s_conn.sumConnectMs += took;
+  if (took > s_conn.maxConnectMs) s_conn.maxConnectMs = took;
+  s_conn.health = (uint8_t)((s_conn.health * 7U + 100U) / 8U);
+  s_conn.phase = ConnPhase::Connected;
+  s_conn.connectedSinceMs = now;
+  s_backoffMs = 0;
+  s_conn.backoffMs = 0;
+
+  s_client->publish(MQTT_TOPIC_ROOT "availability", "online", true);
+  s_lastAvailMs = now;
+
+  // Nach laengerer Trennung kann der Broker die retained Configs verloren
+  // haben; nur bei kurzem Reconnect gelten die gemerkten Hashes weiter.
+  if (!s_disconnectedMs || s_lastAvailMs - s_disconnectedMs > MQTT_DISCOVERY_QUICK_RECONNECT_MS) {
+    forgetDiscovery();
+  }
+  s_disconnectedMs = 0;
+
+  s_client->subscribe(HA_STATUS_TOPIC);
+#if MQTT_CMD_ENABLE
+  s_client->subscribe(MQTT_TOPIC_ROOT "cmd/+");
+#endif
+  publishDiscovery();
+  invalidatePublished();
+}
 
-  if (ok) {
-    s_client->publish(MQTT_TOPIC_ROOT "availability", "online", true);
-    s_lastAvailMs = millis();
-    publishDiscovery();
+void MQTTHandler::connectIfNeeded() {
+  if (!s_client || !s_net) return;
+
+  const unsigned long now = millis();
+
+  if (s_conn.phase == ConnPhase::Connected) {
+    if (s_client->connected()) return;
+    // Verbindung verloren: kurz warten, dann neu aufbauen
+    s_conn.disconnects++;
+    s_conn.health = (uint8_t)((s_conn.health * 7U) / 8U);
+    s_disconnectedMs = now;
+    scheduleRetry(false);
+    return;
+  }
+
+  if (WiFi.status() != WL_CONNECTED) {
+    closeConnectSocket();
+    if (s_conn.phase == ConnPhase::Connecting) scheduleRetry(true);
+    return;
+  }
+
+  if (s_conn.phase == ConnPhase::Backoff) {
+    if ((long)(now - s_nextAttemptMs) < 0) return;
+    s_conn.attempts++;
+    s_attemptStartMs = now;
+    if (!startTcpConnect()) {
+      scheduleRetry(true);
+      return;
+    }
+    s_conn.phase = ConnPhase::Connecting;
+    return;
+  }
+
+  // ConnPhase::Connecting
+  const int tcp = pollTcpConnect();
+  if (tcp == 0) {
+    if (now - s_attemptStartMs >= MQTT_CONNECT_TIMEOUT_MS) {
+      closeConnectSocket();
+      scheduleRetry(true);
+    }
+    return;
+  }
+  if (tcp < 0) {
+    closeConnectSocket();
+    scheduleRetry(true);
+    return;
+  }
+
+  *s_net = WiFiClient(s_connectFd);  // Socket gehoert jetzt dem WiFiClient
+  s_connectFd = -1;
+  if (mqttHandshake()) {
+    onConnected();
+  } else {
+    s_net->stop();
+    scheduleRetry(true);
+  }
+}
+
+void MQTTHandler::suspend(unsigned long ms) {
+  if (!s_client) return;
+  closeConnectSocket();
+  const unsigned long now = millis();
+  if (s_conn.phase == ConnPhase::Connected) {
+    s_client->publish(MQTT_TOPIC_ROOT "availability", "offline", true);
+    s_client->disconnect();
+    s_conn.disconnects++;
+    s_disconnectedMs = now;
   }
+  s_nextAttemptMs = now + ms;
+  s_conn.phase = ConnPhase::Backoff;
 }
 
 void MQTTHandler::heartbeatAvailability() {
@@ -82,6 +750,10 @@ void MQTTHandler::loop() {
   if (s_client) {
     s_client->loop();
     heartbeatAvailability();
+    discoveryStep();
+    sampleTick();
+    cmdStep();
+    MqttQueue::drain(s_client);
   }
 }
 
@@ -90,378 +762,459 @@ void MQTTHandler::publishIfConnected() {
   if (!s_client->connected()) return;
 
   const unsigned long now = millis();
-  const unsigned long intervalMs = 2000;
-  if (now - s_lastPublishMs < intervalMs) return;
-  s_lastPublishMs = now;
 
-  publishData();
-
-  if (!s_stack) return;
+  // Regulaer nur geaenderte Werte; in festem Abstand alles einmal komplett
+  if (!s_lastFullMs || now - s_lastFullMs >= MQTT_FULL_REFRESH_MS) {
+    s_fullRefresh = true;
+    s_lastFullMs = now;
+  }
 
-  long stackCellDeltaMax = 0;
+  uint8_t classes = 0;
+  for (uint8_t c = 0; c < 3; ++c) {
+    const uint8_t bit = (uint8_t)(1U << c);
+    if (s_fullRefresh ||
+        ((s_classDirty & bit) && now - s_classLastMs[c] >= kClassIntervalMs[c])) {
+      classes |= bit;
+      s_classLastMs[c] = now;
+    }
+  }
+  if (!classes) return;
+  s_classDirty &= (uint8_t)~classes;
+
+  publishData(classes);
+
+  if (s_stack) {
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      const pylonBattery& b = s_stack->batts[i];
+      if (!b.isPresent) continue;
+
+      LastValue* last = s_battLast[i];
+      char prefix[8], docTopic[96];
+      snprintf(prefix, sizeof(prefix), "%d/", i + 1);
+      snprintf(docTopic, sizeof(docTopic), MQTT_TOPIC_ROOT "%d/json", i + 1);
+      StateSink sink(s_client, classes, prefix, docTopic);
+
+      sink.scaled(C_Fast,   last[B_Soc],     "soc",         b.soc,        MQTT_DEADBAND_PCT, Fmt::Int);
+      sink.scaled(C_Fast,   last[B_Voltage], "voltage",     b.voltage,    MQTT_DEADBAND_MV,  Fmt::Milli3);
+      sink.scaled(C_Fast,   last[B_Current], "current",     b.current,    MQTT_DEADBAND_MA,  Fmt::Milli3);
+      sink.scaled(C_Slow,   last[B_Cycles],  "cycle_times", b.cycleTimes, 1,                 Fmt::Int);
+      sink.scaled(C_Medium, last[B_CellDelta], "cell_delta", cellDelta(b), MQTT_DEADBAND_CELL_MV, Fmt::Int);
+      sink.scaled(C_Fast,   last[B_Power],   "power",
+                  lround((b.voltage / 1000.0) * (b.current / 1000.0)), MQTT_DEADBAND_W, Fmt::Int);
+
+      const char* st =
+        b.isAlarm()       ? "Alarm"   :
+        b.isProtect()     ? "Protect" :
+        b.isCharging()    ? "Charge"  :
+        b.isDischarging() ? "Dischg"  :
+        b.isIdle()        ? "Idle"    :
+        b.isBalancing()   ? "Balance" :
+                            "Unknown";
+
+      sink.text(C_Fast, last[B_State],     "state",      st);
+      sink.text(C_Fast, last[B_AlarmText], "alarm_text", b.alarmText[0] ? b.alarmText : "Normal");
+      sink.finish();
+    }
+  }
 
-  for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
-    const pylonBattery& b = s_stack->batts[i];
-    if (!b.isPresent) continue;
+  s_fullRefresh = false;
+}
 
-    char topic[96], payload[32];
+void MQTTHandler::markUpdated(Source source) {
+  switch (source) {
+    case Source::Pwr:    s_classDirty |= C_Fast | C_Medium; break;
+    case Source::Pwrsys: s_classDirty |= C_All; break;
+    case Source::Stat:   s_classDirty |= C_Slow; break;
+  }
+}
 
-    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/soc", i + 1);
-    snprintf(payload, sizeof(payload), "%ld", b.soc);
-    s_client->publish(topic, payload, true);
+void MQTTHandler::invalidatePublished() {
+  s_fullRefresh = true;
+  s_lastFullMs = millis();
+}
 
-    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/voltage", i + 1);
-    snprintf(payload, sizeof(payload), "%.3f", b.voltage / 1000.0);
-    s_client->publish(topic, payload, true);
+void MQTTHandler::publishDiscovery() {
+  if (!s_client) return;
+  s_discoveryCursor = 0;
+  s_discoveryActive = true;
+  s_discoveryStepMs = 0;
+}
 
-    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/current", i + 1);
-    snprintf(payload, sizeof(payload), "%.3f", b.current / 1000.0);
-    s_client->publish(topic, payload, true);
+void MQTTHandler::forgetDiscovery() {
+  memset(s_discoveryHash, 0, sizeof(s_discoveryHash));
+}
 
-    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/cycle_times", i + 1);
-    snprintf(payload, sizeof(payload), "%ld", b.cycleTimes);
-    s_client->publish(topic, payload, true);
+void MQTTHandler::discoveryStep() {
+  if (!s_discoveryActive || !s_client || !s_client->connected()) return;
 
-    long delta = 0;
-    if (b.cellVoltHigh > 0 && b.cellVoltLow > 0) {
-      delta = b.cellVoltHigh - b.cellVoltLow;
+  const unsigned long now = millis();
+  if (s_discoveryStepMs && now - s_discoveryStepMs < MQTT_DISCOVERY_GAP_MS) return;
+  s_discoveryStepMs = now;
+  Trace::Span span(Trace::Ev::MqttDiscovery);
+
+  char topic[128], payload[640];
+  uint8_t sent = 0;
+  while (s_discoveryCursor < kDiscoveryCount && sent < MQTT_DISCOVERY_BATCH) {
+    const size_t len = buildDiscovery(s_discoveryCursor, topic, sizeof(topic), payload, sizeof(payload));
+    if (!len) {
+      s_discoveryCursor++;  // zu gross fuer den Puffer, nicht sendbar
+      continue;
     }
 
-    if (delta > stackCellDeltaMax) {
-      stackCellDeltaMax = delta;
+    const uint32_t h = fnv1a(fnv1a(2166136261u, topic, strlen(topic)), payload, len);
+    if (h == s_discoveryHash[s_discoveryCursor]) {
+      s_discoveryCursor++;  // unveraendert und noch retained
+      continue;
     }
 
-    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/cell_delta", i + 1);
-    snprintf(payload, sizeof(payload), "%ld", delta);
-    s_client->publish(topic, payload, true);
-
-    {
-      double w = (b.voltage / 1000.0) * (b.current / 1000.0);
-      snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/power", i + 1);
-      snprintf(payload, sizeof(payload), "%.0f", w);
-      s_client->publish(topic, payload, true);
-    }
+    // Sendepuffer voll oder Verbindung weg: im naechsten Schritt erneut
+    if (!s_client->publish(topic, (const uint8_t*)payload, len, true)) return;
+    s_discoveryHash[s_discoveryCursor] = h;
+    s_discoveryCursor++;
+    sent++;
+    span.setArg(sent);
+  }
 
-    const char* st =
-      b.isAlarm()       ? "Alarm"   :
-      b.isProtect()     ? "Protect" :
-      b.isCharging()    ? "Charge"  :
-      b.isDischarging() ? "Dischg"  :
-      b.isIdle()        ? "Idle"    :
-      b.isBalancing()   ? "Balance" :
-                          "Unknown";
+  if (s_discoveryCursor >= kDiscoveryCount) s_discoveryActive = false;
+}
 
-    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/state", i + 1);
-    s_client->publish(topic, st, true);
+void MQTTHandler::onMessage(char* topic, uint8_t* payload, unsigned int length) {
+  if (!topic) return;
 
-    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "%d/alarm_text", i + 1);
-    s_client->publish(topic, b.alarmText[0] ? b.alarmText : "Normal", true);
+  // Home Assistant neu gestartet: Discovery komplett neu senden
+  if (strcmp(topic, HA_STATUS_TOPIC) == 0 && length == 6 && memcmp(payload, "online", 6) == 0) {
+    forgetDiscovery();
+    publishDiscovery();
+    invalidatePublished();
+    return;
   }
 
-  char maxBuf[32];
-  snprintf(maxBuf, sizeof(maxBuf), "%ld", stackCellDeltaMax);
-  s_client->publish(MQTT_TOPIC_ROOT "cell_delta_max", maxBuf, true);
+#if MQTT_CMD_ENABLE
+  static const char kCmdPrefix[] = MQTT_TOPIC_ROOT "cmd/";
+  if (strncmp(topic, kCmdPrefix, sizeof(kCmdPrefix) - 1) == 0) {
+    onCommand(topic + sizeof(kCmdPrefix) - 1, payload, length);
+  }
+#endif
 }
 
-void MQTTHandler::publishDiscovery() {
+void MQTTHandler::publishData(uint8_t classes) {
   if (!s_client) return;
+  Trace::Span span(Trace::Ev::MqttPublish, classes);
 
-  const String node = WIFI_HOSTNAME;
-
-  auto pub_cfg = [&](const String& object_id,
-                     const String& name,
-                     const String& state_topic,
-                     const char* unit = nullptr,
-                     const char* device_class = nullptr,
-                     bool with_state_class = true,
-                     const char* entity_category = nullptr,
-                     const char* icon = nullptr)
   {
-    StaticJsonDocument<512> doc;
-    doc["name"]                  = name;
-    doc["state_topic"]           = state_topic;
-    doc["unique_id"]             = node + "_" + object_id;
-    doc["availability_topic"]    = String(MQTT_TOPIC_ROOT) + "availability";
-    doc["payload_available"]     = "online";
-    doc["payload_not_available"] = "offline";
-
-    if (with_state_class && (unit || device_class)) {
-      doc["state_class"] = "measurement";
-    }
-    if (unit)         doc["unit_of_measurement"] = unit;
-    if (device_class) doc["device_class"]        = device_class;
-    if (entity_category) doc["entity_category"]  = entity_category;
-    if (icon)         doc["icon"]                = icon;
-
-    JsonObject dev = doc.createNestedObject("device");
-    JsonArray ids  = dev.createNestedArray("identifiers");
-    ids.add(node);
-    dev["manufacturer"] = "Pylontech";
-    dev["model"]        = "Battery Monitor";
-    dev["name"]         = node;
-
-    char payload[512];
-    size_t len = serializeJson(doc, payload, sizeof(payload));
-    String topic = String(HA_DISCOVERY_SENSOR_PREFIX) + node + "/" + object_id + "/config";
-    s_client->publish(topic.c_str(), (uint8_t*)payload, len, true);
-  };
+    StateSink sink(s_client, classes, "", MQTT_TOPIC_ROOT "stack/json");
 
-  pub_cfg("soc",
-          "Battery SoC",
-          String(MQTT_TOPIC_ROOT) + "soc",
-          "%",
-          "battery",
-          true,
-          nullptr,
-          "mdi:battery-medium");
-  pub_cfg("temp",         "Battery Temp",       String(MQTT_TOPIC_ROOT) + "temp",         "°C", "temperature");
-  pub_cfg("currentDC",    "Battery Current",    String(MQTT_TOPIC_ROOT) + "currentDC",    "mA", "current");
-  pub_cfg("avgVoltage",   "Battery Voltage",    String(MQTT_TOPIC_ROOT) + "avgVoltage",   "V",  "voltage");
-  pub_cfg("dc_power",
-          "Battery DC Power",
-          String(MQTT_TOPIC_ROOT) + "dc_power",
-          "W",
-          "power",
-          true,
-          nullptr,
-          "mdi:gauge");
-  pub_cfg("ac_power_est", "Battery AC Power",   String(MQTT_TOPIC_ROOT) + "ac_power_est", "W",  "power");
-  pub_cfg("charge_kwh_today",
-          "Laden heute",
-          String(MQTT_TOPIC_ROOT) + "charge_kwh_today",
-          "kWh",
-          "energy",
-          false,
-          nullptr,
-          "mdi:battery-arrow-up");
-  pub_cfg("discharge_kwh_today",
-          "Entladen heute",
-          String(MQTT_TOPIC_ROOT) + "discharge_kwh_today",
-          "kWh",
-          "energy",
-          false,
-          nullptr,
-          "mdi:battery-arrow-down");
-
-  pub_cfg("cell_delta_max",
-          "Battery Cell Delta Max",
-          String(MQTT_TOPIC_ROOT) + "cell_delta_max",
-          "mV",
-          nullptr,
-          false);
-
-  pub_cfg("battery_state",
-          "Battery State",
-          String(MQTT_TOPIC_ROOT) + "base_state",
-          nullptr,
-          nullptr,
-          false,
-          nullptr,
-          "mdi:battery-heart-variant");
-
-  pub_cfg("system_soc",       "System SOC",        String(MQTT_TOPIC_ROOT) + "system_soc",       "%",  "battery");
-  pub_cfg("system_soh",       "System SOH",        String(MQTT_TOPIC_ROOT) + "system_soh",       "%",  nullptr);
-  pub_cfg("system_voltage",   "System Voltage",    String(MQTT_TOPIC_ROOT) + "system_voltage",   "V",  "voltage");
-  pub_cfg("system_current",   "System Current",    String(MQTT_TOPIC_ROOT) + "system_current",   "A",  "current");
-  pub_cfg("system_rc",        "System RC",         String(MQTT_TOPIC_ROOT) + "system_rc",        "mAh", nullptr);
-  pub_cfg("system_fcc",       "System FCC",        String(MQTT_TOPIC_ROOT) + "system_fcc",       "mAh", nullptr);
-  pub_cfg("system_temp_avg",  "System Temp Avg",   String(MQTT_TOPIC_ROOT) + "system_temp_avg",  "°C", "temperature");
-  pub_cfg("system_temp_low",  "System Temp Low",   String(MQTT_TOPIC_ROOT) + "system_temp_low",  "°C", "temperature");
-  pub_cfg("system_temp_high", "System Temp High",  String(MQTT_TOPIC_ROOT) + "system_temp_high", "°C", "temperature");
-  pub_cfg("system_volt_avg",  "System Volt Avg",   String(MQTT_TOPIC_ROOT) + "system_volt_avg",  "V",  "voltage");
-  pub_cfg("system_volt_low",  "System Volt Low",   String(MQTT_TOPIC_ROOT) + "system_volt_low",  "V",  "voltage");
-  pub_cfg("system_volt_high", "System Volt High",  String(MQTT_TOPIC_ROOT) + "system_volt_high", "V",  "voltage");
-  pub_cfg("rec_chg_voltage",     "Recommend Charge Voltage",        String(MQTT_TOPIC_ROOT) + "rec_chg_voltage",     "V",  "voltage");
-  pub_cfg("rec_dsg_voltage",     "Recommend Discharge Voltage",     String(MQTT_TOPIC_ROOT) + "rec_dsg_voltage",     "V",  "voltage");
-  pub_cfg("rec_chg_current",     "Recommend Charge Current",        String(MQTT_TOPIC_ROOT) + "rec_chg_current",     "A",  "current");
-  pub_cfg("rec_dsg_current",     "Recommend Discharge Current",     String(MQTT_TOPIC_ROOT) + "rec_dsg_current",     "A",  "current");
-
-  pub_cfg("sys_rec_chg_voltage", "System Recommend Charge Voltage", String(MQTT_TOPIC_ROOT) + "sys_rec_chg_voltage", "V",  "voltage");
-  pub_cfg("sys_rec_dsg_voltage", "System Recommend Discharge Voltage", String(MQTT_TOPIC_ROOT) + "sys_rec_dsg_voltage", "V", "voltage");
-  pub_cfg("sys_rec_chg_current", "System Recommend Charge Current", String(MQTT_TOPIC_ROOT) + "sys_rec_chg_current", "A",  "current");
-  pub_cfg("sys_rec_dsg_current", "System Recommend Discharge Current", String(MQTT_TOPIC_ROOT) + "sys_rec_dsg_current", "A", "current");
-  {
-    StaticJsonDocument<384> doc;
-    doc["name"]            = "Pylontech Online";
-    doc["state_topic"]     = String(MQTT_TOPIC_ROOT) + "availability";
-    doc["unique_id"]       = node + "_online";
-    doc["device_class"]    = "connectivity";
-    doc["payload_on"]      = "online";
-    doc["payload_off"]     = "offline";
-    doc["entity_category"] = "diagnostic";
-
-    JsonObject dev = doc.createNestedObject("device");
-    JsonArray ids  = dev.createNestedArray("identifiers");
-    ids.add(node);
-    dev["manufacturer"] = "Pylontech";
-    dev["model"]        = "Battery Monitor";
-    dev["name"]         = node;
+    if (s_energy && s_energy->valid) {
+      sink.scaled(C_Medium, s_stackLast[S_ChargeKwh],    "charge_kwh_today",
+                  s_energy->chargeToday.wh(),    MQTT_DEADBAND_WH, Fmt::Milli3);
+      sink.scaled(C_Medium, s_stackLast[S_DischargeKwh], "discharge_kwh_today",
+                  s_energy->dischargeToday.wh(), MQTT_DEADBAND_WH, Fmt::Milli3);
+    }
 
-    char payload[384];
-    size_t len = serializeJson(doc, payload, sizeof(payload));
-    String topic = String(HA_DISCOVERY_BINARY_PREFIX) + node + "/online/config";
-    s_client->publish(topic.c_str(), (uint8_t*)payload, len, true);
-  }
-
-  for (int i = 1; i <= MAX_PYLON_BATTERIES; ++i) {
-    const String idp = "b" + String(i);
-
-    pub_cfg(idp + "_soc",      String("Battery ") + i + " SoC",      String(MQTT_TOPIC_ROOT) + i + "/soc",      "%", "battery");
-    pub_cfg(idp + "_voltage",  String("Battery ") + i + " Voltage",  String(MQTT_TOPIC_ROOT) + i + "/voltage",  "V", "voltage");
-    pub_cfg(idp + "_current",  String("Battery ") + i + " Current",  String(MQTT_TOPIC_ROOT) + i + "/current",  "A", "current");
-    pub_cfg(idp + "_power",
-            String("Battery ") + i + " Power",
-            String(MQTT_TOPIC_ROOT) + i + "/power",
-            "W",
-            "power",
-            true,
-            nullptr,
-            "mdi:gauge");
-    pub_cfg(idp + "_cell_delta", String("Battery ") + i + " Cell Delta", String(MQTT_TOPIC_ROOT) + i + "/cell_delta", "mV", nullptr, false);
-    pub_cfg(idp + "_cycle_times", String("Battery ") + i + " Cycle Times", String(MQTT_TOPIC_ROOT) + i + "/cycle_times", nullptr, nullptr, false);
-    pub_cfg(idp + "_alarm_text",
-            String("Battery ") + i + " Alarm",
-            String(MQTT_TOPIC_ROOT) + i + "/alarm_text",
-            nullptr,
-            nullptr,
-            false,
-            nullptr,
-            "mdi:alert-circle-outline");
-    pub_cfg(idp + "_state",
-            String("Battery ") + i + " State",
-            String(MQTT_TOPIC_ROOT) + i + "/state",
-            nullptr,
-            nullptr,
-            false,
-            nullptr,
-            "mdi:battery");
+    if (s_stack && s_stack->valid) {
+      long cellDeltaMax = 0;
+      for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+        if (!s_stack->batts[i].isPresent) continue;
+        const long delta = cellDelta(s_stack->batts[i]);
+        if (delta > cellDeltaMax) cellDeltaMax = delta;
+      }
+
+      sink.scaled(C_Fast,   s_stackLast[S_Soc],        "soc",        s_stack->soc,        MQTT_DEADBAND_PCT, Fmt::Int);
+      sink.scaled(C_Medium, s_stackLast[S_Temp],       "temp",       s_stack->temp,       MQTT_DEADBAND_MC,  Fmt::Milli1);
+      sink.scaled(C_Fast,   s_stackLast[S_CurrentDC],  "currentDC",  s_stack->currentDC,  MQTT_DEADBAND_MA,  Fmt::Int);
+      sink.scaled(C_Fast,   s_stackLast[S_AvgVoltage], "avgVoltage", s_stack->avgVoltage, MQTT_DEADBAND_MV,  Fmt::Milli3);
+      sink.text(C_Fast,     s_stackLast[S_BaseState],  "base_state", s_stack->baseState);
+
+      const long pdc = lround((s_stack->avgVoltage / 1000.0) * (s_stack->currentDC / 1000.0));
+      sink.scaled(C_Fast,   s_stackLast[S_DcPower],      "dc_power",       pdc,                      MQTT_DEADBAND_W,       Fmt::Int);
+      sink.scaled(C_Fast,   s_stackLast[S_AcPower],      "ac_power_est",   s_stack->getEstPowerAc(), MQTT_DEADBAND_W,       Fmt::Int);
+      sink.scaled(C_Medium, s_stackLast[S_CellDeltaMax], "cell_delta_max", cellDeltaMax,             MQTT_DEADBAND_CELL_MV, Fmt::Int);
+    }
+    sink.finish();
+    if ((classes & C_Fast) && s_stack && s_stack->valid) {
+      publishFreshness(s_client, MQTT_TOPIC_ROOT "stack/freshness", DataAge::Source::Pwr);
+    }
   }
-}
-
-void MQTTHandler::publishData() {
-  if (!s_client) return;
 
-  char buf[32];
+  if (s_stack && s_stack->valid && s_system && s_system->valid) {
+    StateSink sink(s_client, classes, "", MQTT_TOPIC_ROOT "system/json");
 
-  if (s_energy && s_energy->valid) {
-    snprintf(buf, sizeof(buf), "%.3f", s_energy->chargeKWhToday);
-    s_client->publish(MQTT_TOPIC_ROOT "charge_kwh_today", buf, true);
+    sink.scaled(C_Fast, s_stackLast[S_SystemSoc], "system_soc", s_system->soc, MQTT_DEADBAND_PCT, Fmt::Int);
+    sink.scaled(C_Slow, s_stackLast[S_SystemSoh], "system_soh", s_system->soh, MQTT_DEADBAND_PCT, Fmt::Int);
 
-    snprintf(buf, sizeof(buf), "%.3f", s_energy->dischargeKWhToday);
-    s_client->publish(MQTT_TOPIC_ROOT "discharge_kwh_today", buf, true);
+    for (size_t i = 0; i < kSystemTopicCount; ++i) {
+      const SystemTopic& t = kSystemTopics[i];
+      sink.scaled(t.cls, s_systemLast[i], t.key, s_system->*t.field, t.deadband, t.fmt);
+    }
+    sink.finish();
+    if (classes & C_Fast) {
+      publishFreshness(s_client, MQTT_TOPIC_ROOT "system/freshness", DataAge::Source::Pwrsys);
+    }
   }
+}
 
-  if (!s_stack || !s_stack->valid) return;
+void MQTTHandler::publishDiagnostic(const char* resetReason,
+                                    const char* savedPhase,
+                                    const char* rtcPhase,
+                                    uint32_t bootCount,
+                                    uint32_t abnormalResetCount,
+                                    uint32_t freeHeap,
+                                    uint32_t minFreeHeap) {
+  if (!s_client || !s_client->connected()) return;
 
-  snprintf(buf, sizeof(buf), "%d", s_stack->soc);
-  s_client->publish(MQTT_TOPIC_ROOT "soc", buf, true);
+  publishRetainedText(s_client, "reset_reason", resetReason ? resetReason : "Unknown");
+  publishRetainedText(s_client, "saved_phase", savedPhase ? savedPhase : "Unknown");
+  publishRetainedText(s_client, "rtc_phase", rtcPhase ? rtcPhase : "Unknown");
+  publishRetainedNumber(s_client, "boot_count", bootCount);
+  publishRetainedNumber(s_client, "abnormal_resets", abnormalResetCount);
+  publishRetainedNumber(s_client, "free_heap", freeHeap);
+  publishRetainedNumber(s_client, "min_free_heap", minFreeHeap);
+}
 
-  snprintf(buf, sizeof(buf), "%.1f", s_stack->temp / 1000.0);
-  s_client->publish(MQTT_TOPIC_ROOT "temp", buf, true);
+void MQTTHandler::publishDiagnosticEvent(const char* eventText) {
+  if (!s_client || !eventText || !*eventText) return;
+  publishRetainedText(s_client, "last_event", eventText);
+}
 
-  snprintf(buf, sizeof(buf), "%ld", s_stack->currentDC);
-  s_client->publish(MQTT_TOPIC_ROOT "currentDC", buf, true);
+void MQTTHandler::publishDiagnosticDetail(const char* key, const char* value) {
+  if (!s_client || !key || !*key || !value) return;
+  publishRetainedText(s_client, key, value);
+}
 
-  snprintf(buf, sizeof(buf), "%.3f", s_stack->avgVoltage / 1000.0);
-  s_client->publish(MQTT_TOPIC_ROOT "avgVoltage", buf, true);
+void MQTTHandler::publishLinkStats(const BatteryLink& link) {
+  static unsigned long s_lastLinkStatsMs = 0;
+  if (!s_client) return;
+  const unsigned long now = millis();
+  if (s_lastLinkStatsMs && now - s_lastLinkStatsMs < MQTT_LINK_STATS_INTERVAL_MS) return;
+  s_lastLinkStatsMs = now;
 
-  s_client->publish(MQTT_TOPIC_ROOT "base_state", s_stack->baseState, true);
+  for (size_t c = 0; c < (size_t)CmdClass::Count; ++c) {
+    char payload[384];
+    BufferPrint out(payload, sizeof(payload));
+    JsonWriter w(out);
+    w.beginObject();
+    writeLinkClassFields(w, link.classStats((CmdClass)c));
+    w.endObject();
+    if (out.overflowed()) continue;
+
+    char topic[96];
+    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "diag/link/%s", cmdClassName((CmdClass)c));
+    sendOrQueue(s_client, topic, (const uint8_t*)payload, out.length(), true);
+  }
+}
 
-  double pdc = (s_stack->avgVoltage / 1000.0) * (s_stack->currentDC / 1000.0);
-  snprintf(buf, sizeof(buf), "%.0f", pdc);
-  s_client->publish(MQTT_TOPIC_ROOT "dc_power", buf, true);
+void MQTTHandler::publishHeapHealth() {
+  static unsigned long s_lastHeapMs = 0;
+  if (!s_client) return;
+  const unsigned long now = millis();
+  if (s_lastHeapMs && now - s_lastHeapMs < MQTT_LINK_STATS_INTERVAL_MS) return;
+  s_lastHeapMs = now;
+
+  char payload[768];
+  BufferPrint out(payload, sizeof(payload));
+  JsonWriter w(out);
+  w.beginObject();
+  HeapHealth::writeFields(w);
+  w.endObject();
+  if (out.overflowed()) return;
+
+  sendOrQueue(s_client, MQTT_TOPIC_ROOT "diag/heap", (const uint8_t*)payload, out.length(), true);
+}
 
-  long pac = s_stack->getEstPowerAc();
-  snprintf(buf, sizeof(buf), "%ld", pac);
-  s_client->publish(MQTT_TOPIC_ROOT "ac_power_est", buf, true);
+// Zeitgestempelter Verlaufswert, auch waehrend Broker-Ausfaellen: landet
+// dann in der Warteschlange und wird nach dem Reconnect nachgeliefert.
+void MQTTHandler::sampleTick() {
+  const unsigned long now = millis();
+  if (now - s_lastSampleMs < MQTT_SAMPLE_INTERVAL_MS) return;
+  s_lastSampleMs = now;
 
-  if (s_system && s_system->valid) {
-    snprintf(buf, sizeof(buf), "%d", s_system->soc);
-    s_client->publish(MQTT_TOPIC_ROOT "system_soc", buf, true);
+  if (!s_stack || !s_stack->valid) return;
 
-    snprintf(buf, sizeof(buf), "%d", s_system->soh);
-    s_client->publish(MQTT_TOPIC_ROOT "system_soh", buf, true);
+  char payload[192];
+  BufferPrint out(payload, sizeof(payload));
+  JsonWriter w(out);
+  w.beginObject();
+  if (s_energy && s_energy->timeSynced) w.field("ts", s_energy->currentEpoch);
+  else                                  w.fieldNull("ts");
+  w.field("up",  now);
+  w.field("soc", s_stack->soc);
+  w.field("mV",  s_stack->avgVoltage);
+  w.field("mA",  s_stack->currentDC);
+  w.field("W",   s_stack->getPowerDC());
+  if (s_energy && s_energy->valid) {
+    w.field("chgWh", s_energy->chargeToday.wh());
+    w.field("dsgWh", s_energy->dischargeToday.wh());
+  }
+  w.endObject();
+  if (out.overflowed()) return;
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->voltage / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_voltage", buf, true);
+  sendOrQueue(s_client, MQTT_TOPIC_ROOT "history", (const uint8_t*)payload, out.length(), false);
+}
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->current / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_current", buf, true);
+// ---------- Befehlskanal ----------
+// Konsolen-Befehle laufen als ConsoleJobs-Job ueber denselben Weg wie
+// /api/cmd; cmdStep() fragt den Job in jedem loop() ab und verteilt das
+// Ergebnis auf mehrere Nachrichten. PubSubClient nutzt einen gemeinsamen
+// Puffer fuer Empfang und Senden, deshalb wird im Callback nur gemerkt und
+// erst aus loop() geantwortet.
 
-    snprintf(buf, sizeof(buf), "%ld", s_system->rc);
-    s_client->publish(MQTT_TOPIC_ROOT "system_rc", buf, true);
+namespace {
+  struct CmdRequest {
+    uint32_t jobId = 0;            // 0 = Steuerbefehl, Antwort steht in reply
+    char     reqId[33] = {0};
+    char     reply[96] = {0};
+    const char* state = "";        // fuer Steuerbefehle und Fehler
+    size_t   offset = 0;
+    uint16_t seq = 0;
+    bool     active = false;
+  };
 
-    snprintf(buf, sizeof(buf), "%ld", s_system->fcc);
-    s_client->publish(MQTT_TOPIC_ROOT "system_fcc", buf, true);
+  CmdRequest s_cmdReq[MQTT_CMD_SLOTS];
 
-    snprintf(buf, sizeof(buf), "%.1f", s_system->temp_avg / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_temp_avg", buf, true);
+  CmdRequest* freeCmdSlot() {
+    for (CmdRequest& r : s_cmdReq) {
+      if (!r.active) return &r;
+    }
+    return nullptr;
+  }
 
-    snprintf(buf, sizeof(buf), "%.1f", s_system->temp_low / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_temp_low", buf, true);
+  // Rohbytes, die escaped hoechstens budget Bytes JSON-Text ergeben
+  size_t chunkLength(const char* data, size_t len, size_t budget) {
+    size_t used = 0;
+    size_t n = 0;
+    while (n < len) {
+      const unsigned char c = (unsigned char)data[n];
+      size_t cost = 1;
+      if (c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t') cost = 2;
+      else if (c < 0x20) cost = 6;
+      if (used + cost > budget) break;
+      used += cost;
+      n++;
+    }
+    return n;
+  }
 
-    snprintf(buf, sizeof(buf), "%.1f", s_system->temp_high / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_temp_high", buf, true);
+  bool publishChunk(PubSubClient* client, CmdRequest& r, const char* state,
+                    const char* data, size_t len, bool last, bool truncated) {
+    char topic[128];
+    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "cmd/%s/result", r.reqId);
+
+    char payload[MQTT_CMD_CHUNK_BYTES + 96];
+    BufferPrint out(payload, sizeof(payload));
+    JsonWriter w(out);
+    w.beginObject();
+    w.field("seq", (unsigned long)r.seq);
+    w.field("last", last);
+    w.field("state", state);
+    if (truncated) w.field("truncated", true);
+    w.field("data", data ? data : "", len);
+    w.endObject();
+    if (out.overflowed()) return false;
+
+    if (!client->publish(topic, (const uint8_t*)payload, out.length(), false)) return false;
+    r.seq++;
+    return true;
+  }
+}
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->volt_avg / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_volt_avg", buf, true);
+void MQTTHandler::setControlHandler(ControlHandler handler) {
+  s_control = handler;
+}
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->volt_low / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_volt_low", buf, true);
+void MQTTHandler::onCommand(const char* reqId, const uint8_t* payload, unsigned int length) {
+  const size_t idLen = strlen(reqId);
+  if (idLen == 0 || idLen >= sizeof(CmdRequest::reqId) || strchr(reqId, '/')) return;
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->volt_high / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "system_volt_high", buf, true);
+  CmdRequest* r = freeCmdSlot();
+  if (!r) return;  // ohne freien Slot laesst sich auch keine Antwort zustellen
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->rec_chg_voltage / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "rec_chg_voltage", buf, true);
+  *r = CmdRequest();
+  memcpy(r->reqId, reqId, idLen + 1);
+  r->active = true;
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->rec_dsg_voltage / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "rec_dsg_voltage", buf, true);
+  char cmd[72];
+  while (length && isspace(payload[length - 1])) length--;
+  while (length && isspace(*payload)) { payload++; length--; }
+  if (length >= sizeof(cmd)) {
+    r->state = "error";
+    snprintf(r->reply, sizeof(r->reply), "command too long");
+    return;
+  }
+  memcpy(cmd, payload, length);
+  cmd[length] = '\0';
+
+  if (cmd[0] == '!') {
+    if (!s_control) {
+      r->state = "error";
+      snprintf(r->reply, sizeof(r->reply), "no control handler");
+      return;
+    }
+    const bool ok = s_control(cmd + 1, r->reply, sizeof(r->reply));
+    r->state = ok ? "done" : "error";
+    return;
+  }
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->rec_chg_current / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "rec_chg_current", buf, true);
+  const char* err = nullptr;
+  if (ConsoleJobs::checkCommand(cmd, &err) != 0) {
+    r->state = "error";
+    snprintf(r->reply, sizeof(r->reply), "%s", err ? err : "invalid command");
+    return;
+  }
+  const bool prompt = ConsoleJobs::needsPrompt(cmd);
+  r->jobId = ConsoleJobs::submit(cmd, prompt, prompt ? 20000UL : 8000UL);
+  if (!r->jobId) {
+    r->state = "error";
+    snprintf(r->reply, sizeof(r->reply), "busy");
+  }
+}
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->rec_dsg_current / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "rec_dsg_current", buf, true);
+void MQTTHandler::cmdStep() {
+  if (!s_client->connected()) {
+    // ohne Verbindung kommt keine Antwort mehr an; Jobs laufen trotzdem zu Ende
+    for (CmdRequest& r : s_cmdReq) r.active = false;
+    return;
+  }
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->sys_rec_chg_voltage / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "sys_rec_chg_voltage", buf, true);
+  for (CmdRequest& r : s_cmdReq) {
+    if (!r.active) continue;
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->sys_rec_dsg_voltage / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "sys_rec_dsg_voltage", buf, true);
+    if (!r.jobId) {
+      if (publishChunk(s_client, r, r.state, r.reply, strlen(r.reply), true, false)) r.active = false;
+      continue;
+    }
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->sys_rec_chg_current / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "sys_rec_chg_current", buf, true);
+    const char* out = nullptr;
+    size_t len = 0;
+    bool truncated = false;
+    const ConsoleJobs::JobStatus st = ConsoleJobs::status(r.jobId, &out, &len, &truncated);
+    if (st == ConsoleJobs::JobStatus::Pending) continue;
+
+    if (st == ConsoleJobs::JobStatus::Unknown || st == ConsoleJobs::JobStatus::Expired) {
+      static const char kLost[] = "result expired";
+      publishChunk(s_client, r, "error", kLost, sizeof(kLost) - 1, true, false);
+      r.active = false;
+      continue;
+    }
 
-    snprintf(buf, sizeof(buf), "%.3f", s_system->sys_rec_dsg_current / 1000.0);
-    s_client->publish(MQTT_TOPIC_ROOT "sys_rec_dsg_current", buf, true);
+    const char* state = (st == ConsoleJobs::JobStatus::Done) ? "done" : "failed";
+    for (int i = 0; i < MQTT_CMD_CHUNKS_PER_LOOP; i++) {
+      const size_t n = chunkLength(out + r.offset, len - r.offset, MQTT_CMD_CHUNK_BYTES);
+      const bool last = (r.offset + n >= len);
+      if (!publishChunk(s_client, r, state, out + r.offset, n, last, last && truncated)) break;
+      r.offset += n;
+      if (last) {
+        r.active = false;
+        break;
+      }
+    }
   }
 }
 
-void MQTTHandler::publishDiagnostic(const char* resetReason,
-                                    const char* savedPhase,
-                                    const char* rtcPhase,
-                                    uint32_t bootCount,
-                                    uint32_t abnormalResetCount,
-                                    uint32_t freeHeap,
-                                    uint32_t minFreeHeap) {
-  if (!s_client || !s_client->connected()) return;
-
-  publishRetainedText(s_client, "reset_reason", resetReason ? resetReason : "Unknown");
-  publishRetainedText(s_client, "saved_phase", savedPhase ? savedPhase : "Unknown");
-  publishRetainedText(s_client, "rtc_phase", rtcPhase ? rtcPhase : "Unknown");
-  publishRetainedNumber(s_client, "boot_count", bootCount);
-  publishRetainedNumber(s_client, "abnormal_resets", abnormalResetCount);
-  publishRetainedNumber(s_client, "free_heap", freeHeap);
-  publishRetainedNumber(s_client, "min_free_heap", minFreeHeap);
-}
-
-void MQTTHandler::publishDiagnosticEvent(const char* eventText) {
-  if (!s_client || !s_client->connected() || !eventText || !*eventText) return;
-  publishRetainedText(s_client, "last_event", eventText);
+void MQTTHandler::publishCounters(uint32_t& published, uint32_t& suppressed) {
+  published  = s_published;
+  suppressed = s_suppressed;
 }
 
-void MQTTHandler::publishDiagnosticDetail(const char* key, const char* value) {
-  if (!s_client || !s_client->connected() || !key || !*key || !value) return;
-  publishRetainedText(s_client, key, value);
+MQTTHandler::ConnStats MQTTHandler::connStats() {
+  return s_conn;
 }
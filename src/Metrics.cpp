@@ -0,0 +1,410 @@
+#include "Metrics.h"
+#include "PylonLink.h"
+#include "BufferPool.h"
+#include "RuntimeStats.h"
+#include "HeapHealth.h"
+#include "DataAge.h"
+#include "EventStream.h"
+#include "ConsoleJobs.h"
+#include "WebUI.h"
+#include "Config.h"
+#if ENABLE_MQTT
+#include "MqttQueue.h"
+#include "MQTTHandler.h"
+#endif
+#include <WiFi.h>
+#include <stdio.h>
+#include <Arduino.h>
+
+namespace {
+  WebServer*       s_server = nullptr;
+  BatteryLink*     s_link   = nullptr;
+  batteryStack*    s_stack  = nullptr;
+  systemData*      s_system = nullptr;
+  dailyEnergyData* s_energy = nullptr;
+
+  // Eine Zeile pro Sample, formatiert in einen Stack-Puffer
+  class PromWriter {
+  public:
+    explicit PromWriter(Print& out) : m_out(out) {}
+
+    void family(const char* name, const char* type, const char* help) {
+      line("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+
+    void sample(const char* name, const char* labels, double v, uint8_t decimals = 3) {
+      if (!isfinite(v)) v = 0.0;
+      if (labels) line("%s{%s} %.*f\n", name, labels, (int)decimals, v);
+      else        line("%s %.*f\n", name, (int)decimals, v);
+    }
+
+    void sample(const char* name, const char* labels, unsigned long long v) {
+      if (labels) line("%s{%s} %llu\n", name, labels, v);
+      else        line("%s %llu\n", name, v);
+    }
+
+    void sample(const char* name, const char* labels, long long v) {
+      if (labels) line("%s{%s} %lld\n", name, labels, v);
+      else        line("%s %lld\n", name, v);
+    }
+
+    void gauge(const char* name, const char* help, double v, uint8_t decimals = 3) {
+      family(name, "gauge", help);
+      sample(name, nullptr, v, decimals);
+    }
+
+    void gauge(const char* name, const char* help, long long v) {
+      family(name, "gauge", help);
+      sample(name, nullptr, v);
+    }
+
+    void counter(const char* name, const char* help, unsigned long long v) {
+      family(name, "counter", help);
+      sample(name, nullptr, v);
+    }
+
+  private:
+    template <typename... Args>
+    void line(const char* fmt, Args... args) {
+      char buf[192];
+      const int n = snprintf(buf, sizeof(buf), fmt, args...);
+      if (n <= 0) return;
+      m_out.write((const uint8_t*)buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+    }
+
+    Print& m_out;
+  };
+
+  struct BatteryMetric {
+    const char* name;
+    const char* help;
+    long pylonBattery::* field;
+    double      scale;
+    uint8_t     decimals;
+  };
+
+  const BatteryMetric kBatteryMetrics[] = {
+    { "pylontech_battery_voltage_volts",              "Battery module voltage",       &pylonBattery::voltage,      0.001, 3 },
+    { "pylontech_battery_current_amperes",            "Battery module current",       &pylonBattery::current,      0.001, 3 },
+    { "pylontech_battery_temperature_celsius",        "Battery module temperature",   &pylonBattery::tempr,        0.001, 1 },
+    { "pylontech_battery_soc_percent",                "Battery module state of charge", &pylonBattery::soc,      1.0,   0 },
+    { "pylontech_battery_cycles",                     "Battery module cycle count",   &pylonBattery::cycleTimes,   1.0,   0 },
+    { "pylontech_battery_cell_voltage_min_volts",     "Lowest cell voltage",          &pylonBattery::cellVoltLow,  0.001, 3 },
+    { "pylontech_battery_cell_voltage_max_volts",     "Highest cell voltage",         &pylonBattery::cellVoltHigh, 0.001, 3 },
+    { "pylontech_battery_cell_temperature_min_celsius", "Lowest cell temperature",    &pylonBattery::cellTempLow,  0.001, 1 },
+    { "pylontech_battery_cell_temperature_max_celsius", "Highest cell temperature",   &pylonBattery::cellTempHigh, 0.001, 1 },
+  };
+
+  struct SystemMetric {
+    const char* name;
+    const char* help;
+    long systemData::* field;
+    double      scale;
+    uint8_t     decimals;
+  };
+
+  const SystemMetric kSystemMetrics[] = {
+    { "pylontech_system_voltage_volts",             "System voltage",                 &systemData::voltage,             0.001, 3 },
+    { "pylontech_system_current_amperes",           "System current",                 &systemData::current,             0.001, 3 },
+    { "pylontech_system_remaining_capacity_amphours", "Remaining capacity",           &systemData::rc,                  0.001, 3 },
+    { "pylontech_system_full_capacity_amphours",    "Full charge capacity",           &systemData::fcc,                 0.001, 3 },
+    { "pylontech_system_temperature_avg_celsius",   "Average cell temperature",       &systemData::temp_avg,            0.001, 1 },
+    { "pylontech_system_temperature_min_celsius",   "Lowest cell temperature",        &systemData::temp_low,            0.001, 1 },
+    { "pylontech_system_temperature_max_celsius",   "Highest cell temperature",       &systemData::temp_high,           0.001, 1 },
+    { "pylontech_system_cell_voltage_avg_volts",    "Average cell voltage",           &systemData::volt_avg,            0.001, 3 },
+    { "pylontech_system_cell_voltage_min_volts",    "Lowest cell voltage",            &systemData::volt_low,            0.001, 3 },
+    { "pylontech_system_cell_voltage_max_volts",    "Highest cell voltage",           &systemData::volt_high,           0.001, 3 },
+    { "pylontech_system_rec_charge_voltage_volts",      "Recommended charge voltage",     &systemData::rec_chg_voltage,     0.001, 3 },
+    { "pylontech_system_rec_discharge_voltage_volts",   "Recommended discharge voltage",  &systemData::rec_dsg_voltage,     0.001, 3 },
+    { "pylontech_system_rec_charge_current_amperes",    "Recommended charge current",     &systemData::rec_chg_current,     0.001, 3 },
+    { "pylontech_system_rec_discharge_current_amperes", "Recommended discharge current",  &systemData::rec_dsg_current,     0.001, 3 },
+    { "pylontech_system_sys_rec_charge_voltage_volts",      "System recommended charge voltage",    &systemData::sys_rec_chg_voltage, 0.001, 3 },
+    { "pylontech_system_sys_rec_discharge_voltage_volts",   "System recommended discharge voltage", &systemData::sys_rec_dsg_voltage, 0.001, 3 },
+    { "pylontech_system_sys_rec_charge_current_amperes",    "System recommended charge current",    &systemData::sys_rec_chg_current, 0.001, 3 },
+    { "pylontech_system_sys_rec_discharge_current_amperes", "System recommended discharge current", &systemData::sys_rec_dsg_current, 0.001, 3 },
+  };
+
+  double ageSeconds(unsigned long lastMs) {
+    return lastMs ? (millis() - lastMs) / 1000.0 : -1.0;
+  }
+
+  void writeBatteries(PromWriter& p) {
+    char label[20];
+
+    for (const BatteryMetric& m : kBatteryMetrics) {
+      p.family(m.name, "gauge", m.help);
+      for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+        const pylonBattery& b = s_stack->batts[i];
+        if (!b.isPresent) continue;
+        snprintf(label, sizeof(label), "battery=\"%d\"", i + 1);
+        p.sample(m.name, label, (double)(b.*m.field) * m.scale, m.decimals);
+      }
+    }
+
+    p.family("pylontech_battery_cell_delta_volts", "gauge", "Cell voltage spread (max - min)");
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      const pylonBattery& b = s_stack->batts[i];
+      if (!b.isPresent) continue;
+      const long delta = (b.cellVoltHigh > 0 && b.cellVoltLow > 0) ? b.cellVoltHigh - b.cellVoltLow : 0;
+      snprintf(label, sizeof(label), "battery=\"%d\"", i + 1);
+      p.sample("pylontech_battery_cell_delta_volts", label, delta * 0.001, 3);
+    }
+
+    p.family("pylontech_battery_alarm", "gauge", "1 if the module reports an alarm or protection state");
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      const pylonBattery& b = s_stack->batts[i];
+      if (!b.isPresent) continue;
+      snprintf(label, sizeof(label), "battery=\"%d\"", i + 1);
+      p.sample("pylontech_battery_alarm", label, (long long)(b.hasAlarm() ? 1 : 0));
+    }
+  }
+
+  void writeStack(PromWriter& p) {
+    p.gauge("pylontech_stack_valid", "1 if the last pwr parse was accepted", (long long)(s_stack->valid ? 1 : 0));
+    p.gauge("pylontech_stack_update_age_seconds", "Seconds since the last accepted pwr parse", ageSeconds(s_stack->lastUpdateMs), 1);
+    if (!s_stack->valid) return;
+
+    p.gauge("pylontech_stack_battery_count", "Detected battery modules", (long long)s_stack->batteryCount);
+    p.gauge("pylontech_stack_soc_percent", "Stack state of charge", (long long)s_stack->soc);
+    p.gauge("pylontech_stack_voltage_volts", "Stack average voltage", s_stack->avgVoltage * 0.001);
+    p.gauge("pylontech_stack_current_amperes", "Stack DC current", s_stack->currentDC * 0.001);
+    p.gauge("pylontech_stack_temperature_celsius", "Stack temperature", s_stack->temp * 0.001, 1);
+    p.gauge("pylontech_stack_power_watts", "Stack DC power", (long long)s_stack->getPowerDC());
+    p.gauge("pylontech_stack_ac_power_estimate_watts", "Estimated AC power", (long long)s_stack->getEstPowerAc());
+    writeBatteries(p);
+  }
+
+  void writeSystem(PromWriter& p) {
+    p.gauge("pylontech_system_valid", "1 if the last pwrsys parse was accepted", (long long)(s_system->valid ? 1 : 0));
+    p.gauge("pylontech_system_update_age_seconds", "Seconds since the last accepted pwrsys parse", ageSeconds(s_system->lastUpdateMs), 1);
+    if (!s_system->valid) return;
+
+    p.gauge("pylontech_system_soc_percent", "System state of charge", (long long)s_system->soc);
+    p.gauge("pylontech_system_soh_percent", "System state of health", (long long)s_system->soh);
+    for (const SystemMetric& m : kSystemMetrics) {
+      p.gauge(m.name, m.help, (double)(s_system->*m.field) * m.scale, m.decimals);
+    }
+  }
+
+  void writeEnergy(PromWriter& p) {
+    p.gauge("pylontech_energy_time_synced", "1 if the daily energy counters follow NTP time", (long long)(s_energy->timeSynced ? 1 : 0));
+    p.gauge("pylontech_energy_charged_today_kwh", "Energy charged today", s_energy->chargeKWhToday);
+    p.gauge("pylontech_energy_discharged_today_kwh", "Energy discharged today", s_energy->dischargeKWhToday);
+
+    // Ganzzahlige Zaehler seit Inbetriebnahme; mWs / 1000 = J, mAs / 1000 = C
+    p.family("pylontech_energy_joules_total", "counter", "Stack energy since first start, by direction");
+    p.sample("pylontech_energy_joules_total", "direction=\"charge\"", (unsigned long long)(s_energy->chargeTotal.mWs / 1000));
+    p.sample("pylontech_energy_joules_total", "direction=\"discharge\"", (unsigned long long)(s_energy->dischargeTotal.mWs / 1000));
+    p.family("pylontech_charge_coulombs_total", "counter", "Stack charge since first start, by direction");
+    p.sample("pylontech_charge_coulombs_total", "direction=\"charge\"", (unsigned long long)(s_energy->chargeTotal.mAs / 1000));
+    p.sample("pylontech_charge_coulombs_total", "direction=\"discharge\"", (unsigned long long)(s_energy->dischargeTotal.mAs / 1000));
+
+    char label[40];
+    p.family("pylontech_battery_energy_joules_total", "counter", "Module energy since first start, by direction");
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      const energyCounter& chg = s_energy->batCharge[i];
+      const energyCounter& dsg = s_energy->batDischarge[i];
+      if (!chg.mWs && !dsg.mWs) continue;
+      snprintf(label, sizeof(label), "battery=\"%d\",direction=\"charge\"", i + 1);
+      p.sample("pylontech_battery_energy_joules_total", label, (unsigned long long)(chg.mWs / 1000));
+      snprintf(label, sizeof(label), "battery=\"%d\",direction=\"discharge\"", i + 1);
+      p.sample("pylontech_battery_energy_joules_total", label, (unsigned long long)(dsg.mWs / 1000));
+    }
+
+    p.counter("pylontech_energy_gaps_total", "pwr intervals too long to integrate", (unsigned long long)s_energy->gaps);
+  }
+
+  void writeLink(PromWriter& p) {
+    const LinkStats& st = s_link->stats();
+
+    p.family("pylontech_uart_transactions_total", "counter", "Console transactions by result");
+    p.sample("pylontech_uart_transactions_total", "result=\"ok\"", (unsigned long long)st.ok);
+    p.sample("pylontech_uart_transactions_total", "result=\"failed\"", (unsigned long long)st.failed);
+    p.counter("pylontech_uart_retries_total", "Second attempts after a prompt-only reply", st.retries);
+    p.counter("pylontech_uart_rx_bytes_total", "Bytes received from the console", st.rxBytes);
+
+    p.family("pylontech_uart_latency_seconds", "summary", "Console transaction latency");
+    p.sample("pylontech_uart_latency_seconds_sum", nullptr, st.latencySumMs / 1000.0);
+    p.sample("pylontech_uart_latency_seconds_count", nullptr, (unsigned long long)(st.ok + st.failed));
+    p.gauge("pylontech_uart_latency_max_seconds", "Slowest console transaction since boot", st.maxLatencyMs / 1000.0);
+    p.gauge("pylontech_uart_busy", "1 while a console transaction is running", (long long)(s_link->isBusy() ? 1 : 0));
+
+    char label[48];
+    p.family("pylontech_uart_command_latency_seconds", "histogram", "Console transaction latency by command");
+    for (size_t c = 0; c < (size_t)CmdClass::Count; ++c) {
+      const LinkClassStats& cs = s_link->classStats((CmdClass)c);
+      const char* name = cmdClassName((CmdClass)c);
+      unsigned long long cumulative = 0;
+      for (size_t i = 0; i < kLinkLatencyBuckets; ++i) {
+        cumulative += cs.buckets[i];
+        snprintf(label, sizeof(label), "cmd=\"%s\",le=\"%g\"", name, kLinkLatencyBucketMs[i] / 1000.0);
+        p.sample("pylontech_uart_command_latency_seconds_bucket", label, cumulative);
+      }
+      snprintf(label, sizeof(label), "cmd=\"%s\",le=\"+Inf\"", name);
+      p.sample("pylontech_uart_command_latency_seconds_bucket", label, (unsigned long long)(cs.ok + cs.failed));
+      snprintf(label, sizeof(label), "cmd=\"%s\"", name);
+      p.sample("pylontech_uart_command_latency_seconds_sum", label, cs.latencySumMs / 1000.0);
+      p.sample("pylontech_uart_command_latency_seconds_count", label, (unsigned long long)(cs.ok + cs.failed));
+    }
+
+    struct Problem { const char* kind; uint32_t LinkClassStats::* field; };
+    static const Problem kProblems[] = {
+      { "timeout",       &LinkClassStats::timeouts },
+      { "prompt_only",   &LinkClassStats::promptOnly },
+      { "misattributed", &LinkClassStats::misattributed },
+      { "parse_failed",  &LinkClassStats::parseFailed },
+    };
+    p.family("pylontech_uart_problems_total", "counter", "Console replies by command and problem");
+    for (size_t c = 0; c < (size_t)CmdClass::Count; ++c) {
+      const LinkClassStats& cs = s_link->classStats((CmdClass)c);
+      for (const Problem& pr : kProblems) {
+        snprintf(label, sizeof(label), "cmd=\"%s\",kind=\"%s\"", cmdClassName((CmdClass)c), pr.kind);
+        p.sample("pylontech_uart_problems_total", label, (unsigned long long)(cs.*pr.field));
+      }
+    }
+  }
+
+  // Alter der Messwerte beim Ausliefern, ab erstem UART-Byte
+  void writeDataAge(PromWriter& p) {
+    char label[48];
+    p.family("pylontech_data_age_seconds", "histogram", "Sample age when delivered, by path and source");
+    for (size_t d = 0; d < (size_t)DataAge::Path::Count; ++d) {
+      for (size_t s = 0; s < (size_t)DataAge::Source::Count; ++s) {
+        const DataAge::PathStats& st = DataAge::pathStats((DataAge::Path)d, (DataAge::Source)s);
+        const char* path = DataAge::pathName((DataAge::Path)d);
+        const char* src  = DataAge::sourceName((DataAge::Source)s);
+        unsigned long long cumulative = 0;
+        for (size_t i = 0; i < DataAge::kBuckets; ++i) {
+          cumulative += st.buckets[i];
+          snprintf(label, sizeof(label), "path=\"%s\",source=\"%s\",le=\"%g\"", path, src, DataAge::kBucketMs[i] / 1000.0);
+          p.sample("pylontech_data_age_seconds_bucket", label, cumulative);
+        }
+        snprintf(label, sizeof(label), "path=\"%s\",source=\"%s\",le=\"+Inf\"", path, src);
+        p.sample("pylontech_data_age_seconds_bucket", label, (unsigned long long)st.count);
+        snprintf(label, sizeof(label), "path=\"%s\",source=\"%s\"", path, src);
+        p.sample("pylontech_data_age_seconds_sum", label, st.sumMs / 1000.0);
+        p.sample("pylontech_data_age_seconds_count", label, (unsigned long long)st.count);
+      }
+    }
+  }
+
+  void writeRuntime(PromWriter& p) {
+    p.gauge("esp_uptime_seconds", "Seconds since boot", millis() / 1000.0, 0);
+    p.gauge("esp_heap_free_bytes", "Free heap", (long long)ESP.getFreeHeap());
+    p.gauge("esp_heap_min_free_bytes", "Lowest free heap since boot", (long long)ESP.getMinFreeHeap());
+    p.gauge("esp_heap_max_alloc_bytes", "Largest allocatable heap block", (long long)ESP.getMaxAllocHeap());
+
+    const HeapHealth::Info& hi = HeapHealth::info();
+    p.gauge("esp_heap_largest_block_min_bytes", "Smallest sampled largest free block since boot", (long long)hi.largestBlockMin);
+    p.gauge("esp_heap_fragmentation_ratio", "1 - largest free block / free heap (last sample)", hi.fragPct / 100.0, 2);
+    p.counter("esp_heap_failed_allocs_total", "Failed heap allocations", hi.failedAllocs);
+
+    char label[40];
+    p.family("esp_task_stack_free_bytes", "gauge", "Lowest free stack per task since start");
+    for (size_t t = 0; t < HeapHealth::taskCount(); ++t) {
+      const char* name = nullptr;
+      uint32_t freeBytes = 0;
+      if (!HeapHealth::task(t, name, freeBytes)) continue;
+      snprintf(label, sizeof(label), "task=\"%s\"", name);
+      p.sample("esp_task_stack_free_bytes", label, (long long)freeBytes);
+    }
+
+    if (HeapHealth::hookEnabled()) {
+      p.family("esp_heap_allocs_total", "counter", "Heap allocations by subsystem");
+      for (size_t i = 0; i < (size_t)HeapHealth::Sub::Count; ++i) {
+        snprintf(label, sizeof(label), "subsystem=\"%s\"", HeapHealth::subName((HeapHealth::Sub)i));
+        p.sample("esp_heap_allocs_total", label, (unsigned long long)HeapHealth::subStats((HeapHealth::Sub)i).allocs);
+      }
+      p.family("esp_heap_frees_total", "counter", "Heap frees by subsystem");
+      for (size_t i = 0; i < (size_t)HeapHealth::Sub::Count; ++i) {
+        snprintf(label, sizeof(label), "subsystem=\"%s\"", HeapHealth::subName((HeapHealth::Sub)i));
+        p.sample("esp_heap_frees_total", label, (unsigned long long)HeapHealth::subStats((HeapHealth::Sub)i).frees);
+      }
+    }
+    p.gauge("esp_wifi_rssi_dbm", "WiFi signal strength", (long long)((WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0));
+    p.gauge("pylontech_sse_clients", "Connected /api/events clients", (long long)EventStream::clientCount());
+    p.gauge("pylontech_console_jobs_pending", "Queued or running console jobs", (long long)ConsoleJobs::pending());
+
+    const RuntimeStats::LoopStats& ls = RuntimeStats::loop();
+    p.family("pylontech_loop_duration_seconds", "histogram", "Duration of one loop() iteration");
+    unsigned long long cumulative = 0;
+    for (size_t i = 0; i < RuntimeStats::kLoopBuckets; ++i) {
+      cumulative += ls.buckets[i];
+      snprintf(label, sizeof(label), "le=\"%g\"", RuntimeStats::kLoopBucketUs[i] / 1e6);
+      p.sample("pylontech_loop_duration_seconds_bucket", label, cumulative);
+    }
+    p.sample("pylontech_loop_duration_seconds_bucket", "le=\"+Inf\"", (unsigned long long)ls.count);
+    p.sample("pylontech_loop_duration_seconds_sum", nullptr, ls.sumUs / 1e6, 6);
+    p.sample("pylontech_loop_duration_seconds_count", nullptr, (unsigned long long)ls.count);
+    p.gauge("pylontech_loop_duration_max_seconds", "Longest loop() iteration since boot", ls.maxUs / 1e6, 6);
+  }
+
+#if ENABLE_MQTT
+  void writeMqtt(PromWriter& p) {
+    const MQTTHandler::ConnStats c = MQTTHandler::connStats();
+    p.gauge("pylontech_mqtt_connected", "1 while the MQTT session is up",
+            (long long)(c.phase == MQTTHandler::ConnPhase::Connected ? 1 : 0));
+    p.gauge("pylontech_mqtt_health", "Connection health score 0..100", (long long)c.health);
+    p.family("pylontech_mqtt_connect_attempts_total", "counter", "MQTT connect attempts by result");
+    p.sample("pylontech_mqtt_connect_attempts_total", "result=\"ok\"", (unsigned long long)c.successes);
+    p.sample("pylontech_mqtt_connect_attempts_total", "result=\"failed\"", (unsigned long long)c.failures);
+    p.counter("pylontech_mqtt_disconnects_total", "Lost MQTT sessions", c.disconnects);
+    p.gauge("pylontech_mqtt_backoff_seconds", "Current delay before the next connect attempt", c.backoffMs / 1000.0);
+    p.family("pylontech_mqtt_connect_duration_seconds", "summary", "Time from attempt start to CONNACK");
+    p.sample("pylontech_mqtt_connect_duration_seconds_sum", nullptr, c.sumConnectMs / 1000.0);
+    p.sample("pylontech_mqtt_connect_duration_seconds_count", nullptr, (unsigned long long)c.successes);
+    p.gauge("pylontech_mqtt_connect_duration_max_seconds", "Slowest successful MQTT connect", c.maxConnectMs / 1000.0);
+
+    const MqttQueue::Stats q = MqttQueue::stats();
+    p.gauge("pylontech_mqtt_queue_depth", "Messages waiting in the MQTT queue", (long long)q.depth);
+    p.gauge("pylontech_mqtt_queue_bytes", "RAM bytes used by the MQTT queue", (long long)q.bytes);
+    p.gauge("pylontech_mqtt_queue_spill_bytes", "Bytes waiting in the LittleFS spill file", (long long)q.spillBytes);
+    p.counter("pylontech_mqtt_queue_enqueued_total", "Messages put into the MQTT queue", q.enqueued);
+    p.counter("pylontech_mqtt_queue_sent_total", "Queued messages delivered after reconnect", q.sent);
+    p.counter("pylontech_mqtt_queue_coalesced_total", "Queued retained values replaced by a newer one", q.coalesced);
+    p.counter("pylontech_mqtt_queue_spilled_total", "Queued messages moved to LittleFS", q.spilled);
+    p.counter("pylontech_mqtt_queue_dropped_total", "Messages lost because the queue was full", q.dropped);
+  }
+#endif
+
+  void handleMetrics() {
+    BufferLease lease(BufferPool::Slot::JsonOut, "metrics");
+    char fallback[256];
+    char* buf = lease ? lease.data() : fallback;
+    const size_t size = lease ? lease.size() : sizeof(fallback);
+
+    s_server->sendHeader("Cache-Control", "no-store");
+    ChunkedPrint out(*s_server, "text/plain; version=0.0.4; charset=utf-8", buf, size);
+    PromWriter p(out);
+
+    if (s_stack)  writeStack(p);
+    if (s_system) writeSystem(p);
+    if (s_energy) writeEnergy(p);
+    if (s_link)   writeLink(p);
+    writeDataAge(p);
+    writeRuntime(p);
+#if ENABLE_MQTT
+    writeMqtt(p);
+#endif
+
+    out.finish();
+    lease.noteUsed(out.total() < size ? out.total() : size);
+  }
+}
+
+void Metrics::init(WebServer* server,
+                   BatteryLink* link,
+                   batteryStack* stk,
+                   systemData* sys,
+                   dailyEnergyData* energy)
+{
+  s_server = server;
+  s_link   = link;
+  s_stack  = stk;
+  s_system = sys;
+  s_energy = energy;
+
+  s_server->on("/metrics", HTTP_GET, []() {
+    handleMetrics();
+  });
+}
@@ -0,0 +1,241 @@
+#include "MqttQueue.h"
+#include <Arduino.h>
+#include <string.h>
+#if MQTT_QUEUE_SPILL
+#include <LittleFS.h>
+#endif
+
+namespace {
+  // Jeder Eintrag: Kopf, Topic (ohne Null), Payload
+  struct RecordHeader {
+    uint16_t topicLen;
+    uint16_t payloadLen;
+    uint8_t  flags;
+    uint8_t  reserved;
+  };
+
+  constexpr uint8_t kRetained = 0x01;
+  constexpr uint8_t kDead     = 0x02;  // ersetzt, beim Abbau ueberspringen
+
+  constexpr size_t kMaxTopic   = 127;
+  constexpr size_t kMaxPayload = 511;
+
+  alignas(4) uint8_t s_buf[MQTT_QUEUE_BYTES];
+  size_t   s_head  = 0;   // erster Eintrag
+  size_t   s_tail  = 0;   // Ende des letzten Eintrags
+  uint16_t s_depth = 0;   // lebende Eintraege
+  MqttQueue::Stats s_stats = {};
+  unsigned long s_lastDrainMs = 0;
+
+#if MQTT_QUEUE_SPILL
+  const char* kSpillPath = "/mqtt_spill.bin";
+  uint32_t s_spillRead = 0;   // Leseposition im Auslagerungsfile
+  uint32_t s_spillSize = 0;
+#endif
+
+  size_t recordSize(const RecordHeader& h) {
+    return sizeof(RecordHeader) + h.topicLen + h.payloadLen;
+  }
+
+  RecordHeader* headerAt(size_t off) {
+    return reinterpret_cast<RecordHeader*>(s_buf + off);
+  }
+
+  // Kopf muss ausgerichtet liegen
+  size_t aligned(size_t n) {
+    return (n + 3) & ~(size_t)3;
+  }
+
+  void popHead() {
+    RecordHeader* h = headerAt(s_head);
+    if (!(h->flags & kDead)) s_depth--;
+    s_head += aligned(recordSize(*h));
+    if (s_head >= s_tail) s_head = s_tail = 0;
+  }
+
+  void compact() {
+    if (s_head == 0) return;
+    memmove(s_buf, s_buf + s_head, s_tail - s_head);
+    s_tail -= s_head;
+    s_head = 0;
+  }
+
+#if MQTT_QUEUE_SPILL
+  // h liegt im Puffer, Topic und Payload folgen direkt dahinter
+  bool spill(const RecordHeader& h) {
+    if (s_spillSize - s_spillRead + recordSize(h) > MQTT_QUEUE_SPILL_MAX_BYTES) return false;
+    File f = LittleFS.open(kSpillPath, "a");
+    if (!f) return false;
+    const size_t n = recordSize(h);
+    const bool ok = f.write(reinterpret_cast<const uint8_t*>(&h), n) == n;
+    f.close();
+    if (ok) s_spillSize += n;
+    return ok;
+  }
+#endif
+
+  // Aeltesten Eintrag aus dem RAM entfernen: retained-Werte werden nach dem
+  // Reconnect ohnehin neu gesendet, alles andere wird ausgelagert oder gezaehlt.
+  void evictOldest() {
+    RecordHeader* h = headerAt(s_head);
+    if (!(h->flags & (kDead | kRetained))) {
+#if MQTT_QUEUE_SPILL
+      if (spill(*h)) s_stats.spilled++;
+      else s_stats.dropped++;
+#else
+      s_stats.dropped++;
+#endif
+    } else if (!(h->flags & kDead)) {
+      s_stats.dropped++;
+    }
+    popHead();
+  }
+
+  void coalesce(const char* topic, size_t topicLen) {
+    for (size_t off = s_head; off < s_tail; ) {
+      RecordHeader* h = headerAt(off);
+      if ((h->flags & kRetained) && !(h->flags & kDead) && h->topicLen == topicLen &&
+          memcmp(s_buf + off + sizeof(RecordHeader), topic, topicLen) == 0) {
+        h->flags |= kDead;
+        s_depth--;
+        s_stats.coalesced++;
+      }
+      off += aligned(recordSize(*h));
+    }
+  }
+
+  bool publishRecord(PubSubClient* client, const RecordHeader& h, const uint8_t* body) {
+    char topic[kMaxTopic + 1];
+    memcpy(topic, body, h.topicLen);
+    topic[h.topicLen] = '\0';
+    return client->publish(topic, body + h.topicLen, h.payloadLen, (h.flags & kRetained) != 0);
+  }
+
+#if MQTT_QUEUE_SPILL
+  // Naechsten ausgelagerten Eintrag senden; false = nichts gesendet
+  bool drainSpilled(PubSubClient* client) {
+    if (s_spillRead >= s_spillSize) return false;
+
+    File f = LittleFS.open(kSpillPath, "r");
+    if (!f) {
+      s_spillRead = s_spillSize = 0;
+      return false;
+    }
+
+    RecordHeader h;
+    uint8_t body[kMaxTopic + kMaxPayload];
+    bool ok = f.seek(s_spillRead) &&
+              f.read(reinterpret_cast<uint8_t*>(&h), sizeof(h)) == sizeof(h) &&
+              h.topicLen <= kMaxTopic && h.payloadLen <= kMaxPayload &&
+              f.read(body, h.topicLen + h.payloadLen) == (size_t)(h.topicLen + h.payloadLen);
+    f.close();
+
+    if (!ok) {
+      // Datei beschaedigt: Rest verwerfen
+      LittleFS.remove(kSpillPath);
+      s_spillRead = s_spillSize = 0;
+      s_stats.dropped++;
+      return false;
+    }
+    if (!publishRecord(client, h, body)) return false;
+
+    s_stats.sent++;
+    s_spillRead += recordSize(h);
+    if (s_spillRead >= s_spillSize) {
+      LittleFS.remove(kSpillPath);
+      s_spillRead = s_spillSize = 0;
+    }
+    return true;
+  }
+#endif
+}
+
+void MqttQueue::begin() {
+#if MQTT_QUEUE_SPILL
+  // Nach einem Neustart noch nicht gesendete Eintraege weiter abbauen
+  File f = LittleFS.open(kSpillPath, "r");
+  s_spillRead = 0;
+  s_spillSize = f ? (uint32_t)f.size() : 0;
+  if (f) f.close();
+#endif
+}
+
+bool MqttQueue::push(const char* topic, const uint8_t* payload, size_t len, bool retained) {
+  if (!topic) return false;
+  const size_t topicLen = strlen(topic);
+  if (topicLen == 0 || topicLen > kMaxTopic || len > kMaxPayload) {
+    s_stats.dropped++;
+    return false;
+  }
+
+  if (retained) coalesce(topic, topicLen);
+
+  RecordHeader h = { (uint16_t)topicLen, (uint16_t)len, (uint8_t)(retained ? kRetained : 0), 0 };
+  const size_t need = aligned(recordSize(h));
+
+  while (s_tail - s_head + need > sizeof(s_buf) && s_head < s_tail) {
+    evictOldest();
+  }
+  if (s_tail + need > sizeof(s_buf)) compact();
+  if (s_tail + need > sizeof(s_buf)) {
+    s_stats.dropped++;
+    return false;
+  }
+
+  memcpy(s_buf + s_tail, &h, sizeof(h));
+  memcpy(s_buf + s_tail + sizeof(h), topic, topicLen);
+  if (len) memcpy(s_buf + s_tail + sizeof(h) + topicLen, payload, len);
+  s_tail += need;
+  s_depth++;
+  s_stats.enqueued++;
+  return true;
+}
+
+bool MqttQueue::push(const char* topic, const char* payload, bool retained) {
+  return push(topic, reinterpret_cast<const uint8_t*>(payload ? payload : ""),
+              payload ? strlen(payload) : 0, retained);
+}
+
+void MqttQueue::drain(PubSubClient* client) {
+  if (!client || !client->connected() || empty()) return;
+
+  const unsigned long now = millis();
+  if (now - s_lastDrainMs < MQTT_QUEUE_DRAIN_GAP_MS) return;
+  s_lastDrainMs = now;
+
+  uint8_t sent = 0;
+#if MQTT_QUEUE_SPILL
+  // Ausgelagerte Eintraege sind aelter als alles im RAM
+  while (sent < MQTT_QUEUE_DRAIN_BATCH && drainSpilled(client)) sent++;
+  if (s_spillRead < s_spillSize) return;
+#endif
+
+  while (sent < MQTT_QUEUE_DRAIN_BATCH && s_head < s_tail) {
+    RecordHeader* h = headerAt(s_head);
+    if (!(h->flags & kDead)) {
+      if (!publishRecord(client, *h, s_buf + s_head + sizeof(RecordHeader))) return;
+      s_stats.sent++;
+      sent++;
+    }
+    popHead();
+  }
+}
+
+bool MqttQueue::empty() {
+#if MQTT_QUEUE_SPILL
+  if (s_spillRead < s_spillSize) return false;
+#endif
+  return s_head >= s_tail;
+}
+
+MqttQueue::Stats MqttQueue::stats() {
+  Stats st = s_stats;
+  st.depth = s_depth;
+  st.bytes = (uint32_t)(s_tail - s_head);
+#if MQTT_QUEUE_SPILL
+  st.spillBytes = s_spillSize - s_spillRead;
+#else
+  st.spillBytes = 0;
+#endif
+  return st;
+}
@@ -0,0 +1,124 @@
+#include "MsgPackWriter.h"
+#include <string.h>
+
+MsgPackWriter& MsgPackWriter::beginMap(uint16_t entries, const char* key) {
+  prefix(key);
+  if (entries < 16) {
+    putByte(0x80 | entries);
+  } else {
+    putByte(0xde);
+    putBE(entries, 2);
+  }
+  open(entries);
+  return *this;
+}
+
+MsgPackWriter& MsgPackWriter::beginArray(uint16_t items, const char* key) {
+  prefix(key);
+  if (items < 16) {
+    putByte(0x90 | items);
+  } else {
+    putByte(0xdc);
+    putBE(items, 2);
+  }
+  open(items);
+  return *this;
+}
+
+MsgPackWriter& MsgPackWriter::end() {
+  if (m_depth == 0) {
+    m_error = true;
+    return *this;
+  }
+  if (m_remaining[m_depth - 1] != 0) m_error = true;  // Kopf passt nicht zum Inhalt
+  m_depth--;
+  return *this;
+}
+
+void MsgPackWriter::open(uint16_t count) {
+  if (m_depth >= kMaxDepth) {
+    m_error = true;
+    return;
+  }
+  m_remaining[m_depth++] = count;
+}
+
+void MsgPackWriter::prefix(const char* key) {
+  if (m_depth == 0) return;  // Wurzelelement
+  uint16_t& left = m_remaining[m_depth - 1];
+  if (left == 0) {
+    m_error = true;
+  } else {
+    left--;
+  }
+  if (key) putString(key);
+}
+
+void MsgPackWriter::putRaw(const uint8_t* p, size_t n) {
+  m_out.write(p, n);
+  m_len += n;
+}
+
+void MsgPackWriter::putBE(uint64_t v, uint8_t bytes) {
+  uint8_t buf[8];
+  for (uint8_t i = 0; i < bytes; i++) {
+    buf[bytes - 1 - i] = (uint8_t)(v >> (8 * i));
+  }
+  putRaw(buf, bytes);
+}
+
+void MsgPackWriter::putString(const char* s) {
+  if (!s) s = "";
+  const size_t n = strlen(s);
+  if (n < 32) {
+    putByte(0xa0 | (uint8_t)n);
+  } else if (n <= 0xff) {
+    putByte(0xd9);
+    putBE(n, 1);
+  } else if (n <= 0xffff) {
+    putByte(0xda);
+    putBE(n, 2);
+  } else {
+    putByte(0xdb);
+    putBE(n, 4);
+  }
+  putRaw((const uint8_t*)s, n);
+}
+
+void MsgPackWriter::putUnsigned(unsigned long long v) {
+  if (v < 0x80) {
+    putByte((uint8_t)v);
+  } else if (v <= 0xff) {
+    putByte(0xcc);
+    putBE(v, 1);
+  } else if (v <= 0xffff) {
+    putByte(0xcd);
+    putBE(v, 2);
+  } else if (v <= 0xffffffffULL) {
+    putByte(0xce);
+    putBE(v, 4);
+  } else {
+    putByte(0xcf);
+    putBE(v, 8);
+  }
+}
+
+void MsgPackWriter::putSigned(long long v) {
+  if (v >= 0) {
+    putUnsigned((unsigned long long)v);
+  } else if (v >= -32) {
+    putByte((uint8_t)(int8_t)v);
+  } else if (v >= -128) {
+    putByte(0xd0);
+    putBE((uint64_t)v, 1);
+  } else if (v >= -32768) {
+    putByte(0xd1);
+    putBE((uint64_t)v, 2);
+  } else if (v >= -2147483648LL) {
+    putByte(0xd2);
+    putBE((uint64_t)v, 4);
+  } else {
+    putByte(0xd3);
+    putBE((uint64_t)v, 8);
+  }
+}
@@ -0,0 +1,238 @@
+#include "NvsStore.h"
+#include "JsonWriter.h"
+#include "Trace.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_system.h>
+
+namespace {
+  constexpr uint32_t kMagic = 0x50594C4E;   // "PYLN"
+  const char* const kNamespace = "persist";
+  const char* const kKey = "rec";
+
+  const char* const kLoadNames[] = { "empty", "ok", "migrated", "crc_error", "mismatch" };
+
+  struct Stored {
+    uint32_t         magic;
+    uint16_t         version;
+    uint16_t         size;              // sizeof(Record), z.B. bei anderem MAX_PYLON_BATTERIES
+    NvsStore::Record rec;
+    uint32_t         crc;               // CRC-32 ueber alles davor
+  };
+
+  // Layout von daily-energy/ctr (Firmware vor NvsStore), nur zum Uebernehmen
+  struct LegacyEnergy {
+    uint8_t       version;
+    uint32_t      day;
+    energyCounter chargeToday, dischargeToday;
+    energyCounter chargeTotal, dischargeTotal;
+    energyCounter batCharge[MAX_PYLON_BATTERIES];
+    energyCounter batDischarge[MAX_PYLON_BATTERIES];
+  };
+
+  Preferences      s_prefs;
+  bool             s_open = false;
+  NvsStore::Record s_rec;
+  NvsStore::Record s_stored;
+  NvsStore::Stats  s_stats;
+  bool             s_dirty = false;
+  bool             s_urgent = false;
+  uint32_t         s_hourStartMs = 0;
+  uint8_t          s_urgentThisHour = 0;
+
+  uint32_t crc32(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; ++i) {
+      crc ^= p[i];
+      for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+  }
+
+  bool write() {
+    if (!s_open) return false;
+    if (memcmp(&s_rec, &s_stored, sizeof(s_rec)) == 0) {
+      s_stats.unchanged++;
+      s_dirty = false;
+      s_urgent = false;
+      return true;
+    }
+
+    s_rec.writes++;
+    Stored st;
+    memset(&st, 0, sizeof(st));
+    st.magic = kMagic;
+    st.version = NvsStore::kVersion;
+    st.size = (uint16_t)sizeof(NvsStore::Record);
+    memcpy(&st.rec, &s_rec, sizeof(s_rec));
+    st.crc = crc32(&st, offsetof(Stored, crc));
+
+    const uint32_t t0 = micros();
+    size_t n;
+    {
+      Trace::Span span(Trace::Ev::NvsWrite, (uint16_t)sizeof(st));
+      n = s_prefs.putBytes(kKey, &st, sizeof(st));
+    }
+    const uint32_t us = micros() - t0;
+
+    s_stats.lastUs = us;
+    s_stats.sumUs += us;
+    if (us > s_stats.maxUs) s_stats.maxUs = us;
+    s_stats.lastWriteMs = millis();
+    if (n != sizeof(st)) {
+      // Beim naechsten Intervall erneut; nicht im Takt von loop() wiederholen
+      s_stats.failed++;
+      s_rec.writes--;
+      s_urgent = false;
+      return false;
+    }
+    s_stats.writes++;
+    memcpy(&s_stored, &s_rec, sizeof(s_rec));
+    s_dirty = false;
+    s_urgent = false;
+    return true;
+  }
+
+  bool load() {
+    Stored st;
+    if (s_prefs.getBytesLength(kKey) != sizeof(st)) {
+      s_stats.load = s_prefs.isKey(kKey) ? NvsStore::Load::Mismatch : NvsStore::Load::Empty;
+      return false;
+    }
+    s_prefs.getBytes(kKey, &st, sizeof(st));
+    if (st.magic != kMagic || st.version != NvsStore::kVersion || st.size != sizeof(NvsStore::Record)) {
+      s_stats.load = NvsStore::Load::Mismatch;
+      return false;
+    }
+    if (st.crc != crc32(&st, offsetof(Stored, crc))) {
+      s_stats.load = NvsStore::Load::CrcError;
+      return false;
+    }
+    memcpy(&s_rec, &st.rec, sizeof(s_rec));
+    s_stats.load = NvsStore::Load::Ok;
+    return true;
+  }
+
+  // Alte Namespaces von CrashTrace und EnergyTracker uebernehmen und leeren
+  bool migrate() {
+    bool found = false;
+    Preferences old;
+
+    if (old.begin("crash-trace", false)) {
+      if (old.isKey("boot")) {
+        s_rec.crashPhase = old.getUChar("phase", 0);
+        s_rec.bootCount = old.getULong("boot", 0);
+        old.clear();
+        found = true;
+      }
+      old.end();
+    }
+
+    if (old.begin("daily-energy", false)) {
+      LegacyEnergy le;
+      if (old.getBytesLength("ctr") == sizeof(le) &&
+          old.getBytes("ctr", &le, sizeof(le)) == sizeof(le) &&
+          le.version == 1) {
+        s_rec.energyDay = le.day;
+        s_rec.chargeToday = le.chargeToday;
+        s_rec.dischargeToday = le.dischargeToday;
+        s_rec.chargeTotal = le.chargeTotal;
+        s_rec.dischargeTotal = le.dischargeTotal;
+        memcpy(s_rec.batCharge, le.batCharge, sizeof(le.batCharge));
+        memcpy(s_rec.batDischarge, le.batDischarge, sizeof(le.batDischarge));
+        found = true;
+      } else if (old.isKey("chg")) {
+        // Tageswerte als float-kWh, ohne Gesamtzaehler
+        s_rec.energyDay = old.getULong("day", 0);
+        s_rec.chargeToday.mWs = (uint64_t)(old.getFloat("chg", 0.0f) * 3600000000.0);
+        s_rec.dischargeToday.mWs = (uint64_t)(old.getFloat("dsg", 0.0f) * 3600000000.0);
+        found = true;
+      }
+      if (found) old.clear();
+      old.end();
+    }
+    return found;
+  }
+
+  void onShutdown() {
+    NvsStore::flush();
+  }
+}
+
+void NvsStore::begin() {
+  s_open = s_prefs.begin(kNamespace, false);
+  if (!s_open) return;
+
+  if (load()) {
+    memcpy(&s_stored, &s_rec, sizeof(s_rec));
+  } else if (s_stats.load == Load::Empty && migrate()) {
+    s_stats.load = Load::Migrated;
+    write();
+  }
+  esp_register_shutdown_handler(onShutdown);
+}
+
+void NvsStore::loop() {
+  if (!s_dirty || !s_open) return;
+  const uint32_t now = millis();
+
+  if (now - s_hourStartMs >= 3600000UL) {
+    s_hourStartMs = now;
+    s_urgentThisHour = 0;
+  }
+
+  if (s_urgent) {
+    if (s_urgentThisHour < NVS_URGENT_PER_HOUR) {
+      s_urgentThisHour++;
+      write();
+      return;
+    }
+    s_stats.deferred++;
+    s_urgent = false;
+  }
+
+  if (now - s_stats.lastWriteMs >= NVS_WRITE_INTERVAL_MS) write();
+}
+
+NvsStore::Record& NvsStore::record() {
+  return s_rec;
+}
+
+const NvsStore::Record& NvsStore::stored() {
+  return s_stored;
+}
+
+void NvsStore::markDirty(bool urgent) {
+  s_dirty = true;
+  if (urgent) s_urgent = true;
+}
+
+bool NvsStore::flush() {
+  if (!s_dirty) return true;
+  return write();
+}
+
+const NvsStore::Stats& NvsStore::stats() {
+  return s_stats;
+}
+
+const char* NvsStore::loadName() {
+  return kLoadNames[(size_t)s_stats.load];
+}
+
+void NvsStore::writeFields(JsonWriter& w) {
+  w.field("load", loadName());
+  w.field("recordBytes", (unsigned)sizeof(Stored));
+  w.field("writesTotal", s_stored.writes);
+  w.field("writes", s_stats.writes);
+  w.field("unchanged", s_stats.unchanged);
+  w.field("deferred", s_stats.deferred);
+  w.field("failed", s_stats.failed);
+  w.field("dirty", s_dirty);
+  w.field("lastUs", s_stats.lastUs);
+  w.field("maxUs", s_stats.maxUs);
+  w.field("avgUs", s_stats.writes ? (uint32_t)(s_stats.sumUs / s_stats.writes) : 0U);
+  w.field("lastWriteMs", s_stats.lastWriteMs);
+  if (s_open) w.field("freeEntries", (unsigned long)s_prefs.freeEntries());
+}
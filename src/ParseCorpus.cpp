@@ -0,0 +1,223 @@
+#include "ParseCorpus.h"
+#include "JsonWriter.h"
+#include "WebUI.h"
+#include <LittleFS.h>
+#include <uri/UriBraces.h>
+#include <string.h>
+#include <stdlib.h>
+#include <Arduino.h>
+
+namespace {
+  const char* kDir = "/corpus";
+
+  WebServer*             s_server = nullptr;
+  const dailyEnergyData* s_energy = nullptr;
+
+  uint32_t      s_nextSeq = 1;
+  uint32_t      s_captured = 0;
+  unsigned long s_lastCaptureMs = 0;
+  bool          s_anyCapture = false;
+  uint32_t      s_lastHash = 0;
+
+  struct Meta {
+    uint32_t      seq = 0;
+    char          cmd[16] = "";
+    char          reason[20] = "";
+    unsigned long uptimeMs = 0;
+    uint32_t      rxLen = 0;
+  };
+
+  void pathFor(uint32_t slot, char* out, size_t size) {
+    snprintf(out, size, "%s/%02lu.txt", kDir, (unsigned long)slot);
+  }
+
+  uint32_t fnv1a(const char* s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+      h ^= (uint8_t)s[i];
+      h *= 16777619u;
+    }
+    return h;
+  }
+
+  // Eine Zeile ohne Zeilenende; false am Dateiende
+  bool readLine(File& f, char* out, size_t size) {
+    size_t n = 0;
+    int c = -1;
+    while ((c = f.read()) >= 0 && c != '\n') {
+      if (n + 1 < size) out[n++] = (char)c;
+    }
+    out[n] = '\0';
+    return c >= 0 || n > 0;
+  }
+
+  bool readMeta(uint32_t slot, Meta& m) {
+    char path[32];
+    pathFor(slot, path, sizeof(path));
+    if (!LittleFS.exists(path)) return false;
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+
+    char line[96];
+    while (readLine(f, line, sizeof(line)) && line[0] == '#') {
+      const char* colon = strchr(line, ':');
+      if (!colon || colon[1] != ' ') continue;
+      const char* v = colon + 2;
+      const size_t keyLen = (size_t)(colon - line);
+      if      (keyLen == 5 && !strncmp(line, "# seq", 5))       m.seq = strtoul(v, nullptr, 10);
+      else if (keyLen == 5 && !strncmp(line, "# cmd", 5))       snprintf(m.cmd, sizeof(m.cmd), "%s", v);
+      else if (keyLen == 8 && !strncmp(line, "# reason", 8))    snprintf(m.reason, sizeof(m.reason), "%s", v);
+      else if (keyLen == 11 && !strncmp(line, "# uptime_ms", 11)) m.uptimeMs = strtoul(v, nullptr, 10);
+      else if (keyLen == 8 && !strncmp(line, "# rx_len", 8))    m.rxLen = strtoul(v, nullptr, 10);
+    }
+    f.close();
+    return m.seq != 0;
+  }
+
+  // Spaltenkopf der pwr-Tabelle ("Power Volt Curr ...") als Hinweis auf
+  // das Ausgabeformat der BMS-Firmware
+  void findLayout(const char* payload, char* out, size_t size) {
+    out[0] = '\0';
+    const char* line = payload;
+    while (line && *line) {
+      const char* end = strchr(line, '\n');
+      const size_t len = end ? (size_t)(end - line) : strlen(line);
+      const char* volt = strstr(line, "Volt");
+      if (volt && volt < line + len) {
+        const char* curr = strstr(line, "Curr");
+        if (curr && curr < line + len) {
+          size_t n = len < size - 1 ? len : size - 1;
+          while (n && (line[n - 1] == '\r' || line[n - 1] == ' ')) n--;
+          memcpy(out, line, n);
+          out[n] = '\0';
+          return;
+        }
+      }
+      line = end ? end + 1 : nullptr;
+    }
+  }
+
+  void sendList() {
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    w.beginObject();
+    w.field("captured", s_captured);
+    w.field("slots", (unsigned)PARSE_CORPUS_FILES);
+    w.beginArray("files");
+    for (uint32_t slot = 0; slot < PARSE_CORPUS_FILES; ++slot) {
+      Meta m;
+      if (!readMeta(slot, m)) continue;
+      w.beginObject();
+      w.field("file", slot);
+      w.field("seq", m.seq);
+      w.field("cmd", m.cmd);
+      w.field("reason", m.reason);
+      w.field("uptimeMs", m.uptimeMs);
+      w.field("rxLen", m.rxLen);
+      w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+  }
+}
+
+void ParseCorpus::init(WebServer* server, const dailyEnergyData* energy) {
+  s_server = server;
+  s_energy = energy;
+
+#if PARSE_CORPUS_ENABLE
+  if (!LittleFS.exists(kDir)) LittleFS.mkdir(kDir);
+
+  // Fortlaufende Nummer ueber Neustarts: hinter der hoechsten vorhandenen
+  for (uint32_t slot = 0; slot < PARSE_CORPUS_FILES; ++slot) {
+    Meta m;
+    if (readMeta(slot, m) && m.seq >= s_nextSeq) s_nextSeq = m.seq + 1;
+  }
+#endif
+
+  if (!s_server) return;
+
+  s_server->on("/api/corpus", HTTP_GET, []() { sendList(); });
+
+  s_server->on("/api/corpus", HTTP_DELETE, []() {
+    char path[32];
+    for (uint32_t slot = 0; slot < PARSE_CORPUS_FILES; ++slot) {
+      pathFor(slot, path, sizeof(path));
+      if (LittleFS.exists(path)) LittleFS.remove(path);
+    }
+    s_lastHash = 0;
+    s_server->send(204);
+  });
+
+  s_server->on(UriBraces("/api/corpus/{}"), HTTP_GET, []() {
+    char* end = nullptr;
+    const String arg = s_server->pathArg(0);
+    const unsigned long slot = strtoul(arg.c_str(), &end, 10);
+    char path[32];
+    pathFor((uint32_t)slot, path, sizeof(path));
+    if (!end || *end || slot >= PARSE_CORPUS_FILES || !LittleFS.exists(path)) {
+      s_server->send(404, "text/plain", "no such file");
+      return;
+    }
+    File f = LittleFS.open(path, "r");
+    if (!f) {
+      s_server->send(500, "text/plain", "open failed");
+      return;
+    }
+    s_server->streamFile(f, "text/plain");
+    f.close();
+  });
+}
+
+void ParseCorpus::capture(const char* cmd, const char* reason, const char* payload, unsigned long latencyMs) {
+#if PARSE_CORPUS_ENABLE
+  if (!cmd || !reason || !payload) return;
+
+  const unsigned long now = millis();
+  if (s_anyCapture && now - s_lastCaptureMs < PARSE_CORPUS_MIN_GAP_MS) return;
+
+  const size_t len = strnlen(payload, PARSE_CORPUS_MAX_BYTES);
+  const uint32_t hash = fnv1a(payload, len) ^ fnv1a(cmd, strlen(cmd));
+  if (hash == s_lastHash) return;
+
+  const uint32_t seq = s_nextSeq;
+  char path[32];
+  pathFor(seq % PARSE_CORPUS_FILES, path, sizeof(path));
+  File f = LittleFS.open(path, "w");
+  if (!f) return;
+
+  char layout[160];
+  findLayout(payload, layout, sizeof(layout));
+
+  f.printf("# pylon-corpus: 1\n");
+  f.printf("# seq: %lu\n", (unsigned long)seq);
+  f.printf("# cmd: %s\n", cmd);
+  f.printf("# reason: %s\n", reason);
+  f.printf("# uptime_ms: %lu\n", now);
+  if (s_energy && s_energy->timeSynced) f.printf("# epoch: %lu\n", (unsigned long)s_energy->currentEpoch);
+  f.printf("# latency_ms: %lu\n", latencyMs);
+  f.printf("# rx_len: %u\n", (unsigned)len);
+  f.printf("# build: %s %s\n", __DATE__, __TIME__);
+  f.printf("# max_batteries: %d\n", MAX_PYLON_BATTERIES);
+  if (layout[0]) f.printf("# layout: %s\n", layout);
+  f.printf("\n");
+  const bool ok = f.write((const uint8_t*)payload, len) == len;
+  f.close();
+  if (!ok) return;
+
+  s_nextSeq++;
+  s_captured++;
+  s_lastHash = hash;
+  s_lastCaptureMs = now;
+  s_anyCapture = true;
+#else
+  (void)cmd;
+  (void)reason;
+  (void)payload;
+  (void)latencyMs;
+#endif
+}
+
+uint32_t ParseCorpus::captured() {
+  return s_captured;
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include "Parser.h"
 #include "batteryStack.h"
+#include "Trace.h"
 #include <cstring>
 #include <cstdlib>
 #include <cctype>
@@ -124,6 +125,7 @@ static bool isSubStateToken(const char* s) {
 }
 
 bool Parser::parsePwr(const char* in, batteryStack* out) {
+  Trace::Span span(Trace::Ev::ParsePwr);
   if (!in || !out) return false;
 
   long oldCycleTimes[MAX_PYLON_BATTERIES] = {0};
@@ -471,6 +473,7 @@ static void setBatteryAlarmText(pylonBattery& b) {
 }
 
 bool Parser::parsePwrsys(const char* in, systemData* out) {
+  Trace::Span span(Trace::Ev::ParsePwrsys);
   if (!in || !out) return false;
 
   memset(out, 0, sizeof(*out));
@@ -646,6 +649,7 @@ bool Parser::parsePwrsys(const char* in, systemData* out) {
   return out->valid;
 }
 bool Parser::parseStat(const char* in, pylonBattery* batt) {
+  Trace::Span span(Trace::Ev::ParseStat);
   if (!in || !batt) return false;
 
   long v = readLongAfterMulti(in, {
@@ -1,7 +1,52 @@
 #include "PylonLink.h"
+#include "JsonWriter.h"
+#include "Trace.h"
 #include <string.h>   // strstr, strchr
 #include <Arduino.h>  // millis, delay
 #include <ctype.h>    // tolower
+#include <stdio.h>    // snprintf
+
+const uint32_t kLinkLatencyBucketMs[kLinkLatencyBuckets] = {
+  100, 250, 500, 1000, 2000, 4000, 8000, 12000
+};
+
+const char* cmdClassName(CmdClass cls) {
+  switch (cls) {
+    case CmdClass::Pwr:    return "pwr";
+    case CmdClass::Pwrsys: return "pwrsys";
+    case CmdClass::Stat:   return "stat";
+    default:               return "user";
+  }
+}
+
+void writeLinkClassFields(JsonWriter& w, const LinkClassStats& st) {
+  const uint32_t n = st.ok + st.failed;
+  w.field("ok", st.ok);
+  w.field("failed", st.failed);
+  w.field("timeouts", st.timeouts);
+  w.field("retries", st.retries);
+  w.field("promptOnly", st.promptOnly);
+  w.field("misattributed", st.misattributed);
+  w.field("pagesAnswered", st.pagesAnswered);
+  w.field("parseFailed", st.parseFailed);
+  w.field("rxBytes", (unsigned long long)st.rxBytes);
+  w.field("avgMs", n ? (unsigned long)(st.latencySumMs / n) : 0UL);
+  w.field("lastMs", st.lastLatencyMs);
+  w.field("maxMs", st.maxLatencyMs);
+  // Buckets nicht kumuliert; letzter Eintrag = ueber der letzten Grenze
+  w.beginArray("hist");
+  for (size_t i = 0; i < kLinkLatencyBuckets; ++i) w.value(st.buckets[i]);
+  w.value(st.overflow);
+  w.endArray();
+}
+
+static CmdClass classifyPollCommand(const char* cmd) {
+  if (!cmd) return CmdClass::User;
+  if (strcmp(cmd, "pwr") == 0) return CmdClass::Pwr;
+  if (strcmp(cmd, "pwrsys") == 0) return CmdClass::Pwrsys;
+  if (strncmp(cmd, "stat", 4) == 0 && (cmd[4] == '\0' || cmd[4] == ' ')) return CmdClass::Stat;
+  return CmdClass::User;
+}
 
 static bool tokenMatchesPromptSuffix(const char* token, size_t len, const char* prompt) {
   if (!token || !prompt || len == 0) return false;
@@ -63,99 +108,195 @@ static inline void pushWindow(char* window, size_t capacity, size_t& len, char c
 }
 
 BatteryLink::BatteryLink(HardwareSerial& serial, int rx, int tx)
-  : port(serial), rxPin(rx), txPin(tx) {}
+  : port(serial), uart(&serial), rxPin(rx), txPin(tx) {}
+
+BatteryLink::BatteryLink(Stream& stream)
+  : port(stream), rxPin(-1), txPin(-1) {}
 
 void BatteryLink::begin(int b) {
   baud = b;
-  port.begin(baud, SERIAL_8N1, rxPin, txPin);
-  delay(50);
+  if (uart) {
+    uart->setRxBufferSize(PYLON_UART_RX_BUFFER);  // nur vor begin() wirksam
+    uart->begin(baud, SERIAL_8N1, rxPin, txPin);
+    delay(50);
+  }
   // Eingang puffern leeren (alte Bytes loswerden)
   while (port.available()) { port.read(); }
 }
 
 void BatteryLink::switchBaud(int nb) {
   if (baud == nb) return;
-  port.flush();         // wartet TX leer
-  delay(20);
-  port.end();
-  delay(20);
-  port.begin(nb, SERIAL_8N1, rxPin, txPin);
   baud = nb;
-  delay(20);
+  if (uart) {
+    uart->flush();        // wartet TX leer
+    delay(20);
+    uart->end();
+    delay(20);
+    uart->begin(nb, SERIAL_8N1, rxPin, txPin);
+    delay(20);
+  }
   while (port.available()) { port.read(); }
 }
 
-bool BatteryLink::lock(uint32_t waitMs) {
-  uint32_t t0 = millis();
-  while (m_busy) {
-    if (millis() - t0 > waitMs) return false;
-    delay(1);
-  }
+bool BatteryLink::beginTransaction(const char* cmd, char* outBuf, size_t bufSize,
+                                   unsigned long timeoutMs, bool promptMode,
+                                   CmdClass cls) {
+  if (!outBuf || bufSize < 2) return false;
+  if (m_busy) return false;
   m_busy = true;
+  m_class = cls;
+
+  snprintf(m_cmd, sizeof(m_cmd), "%s", cmd ? cmd : "");
+  m_txn.buf = outBuf;
+  m_txn.bufSize = bufSize;
+  m_txn.timeoutMs = timeoutMs;
+  m_txn.promptMode = promptMode;
+  m_txn.attempt = 0;
+  m_txn.startMs = millis();
+  startAttempt();
   return true;
 }
 
-void BatteryLink::unlock() { m_busy = false; }
+void BatteryLink::startAttempt() {
+  m_txn.buf[0] = '\0';
+  m_txn.len = 0;
+  m_txn.found = false;
+  m_txn.pageHint = false;
+  m_txn.firstRxMs = m_txn.promptMs = 0;
+  m_txn.last6[0] = m_txn.last12[0] = m_txn.last96[0] = '\0';
+  m_txn.last6Len = m_txn.last12Len = m_txn.last96Len = 0;
+  port.flush();
+
+  // Weckversuch: drei Newlines im 10-ms-Abstand, ohne den loop() zu blockieren.
+  // (Die harte 1200-Baud-Sequenz der Ursprungsversion wird bewusst nicht gesendet.)
+  m_txn.wakeSent = 0;
+  m_txn.phase = Phase::Wake;
+  m_txn.phaseMs = millis() - 10;
+}
 
-bool BatteryLink::sendAndReceive(const char* cmd, char* outBuf, size_t bufSize, unsigned long timeoutMs) {
-  if (!outBuf || bufSize == 0) return false;
-  if (!lock(6000)) return false;
-
-  bool ok = false;
-  for (int attempt = 0; attempt < 2 && !ok; ++attempt) {
-    outBuf[0] = '\0';
-    port.flush();
-    wakeUpConsole();
-
-    // Rx leeren, damit nur Antwort auf DIESEN Befehl kommt
-    while (port.available()) { port.read(); }
-
-    if (cmd && *cmd) port.print(cmd);
-    port.print('\n');
-
-    // Feste Poll-Kommandos sollen bis zum bekannten Prompt lesen und nicht schon
-    // bei einem einzelnen '>' abbrechen, sonst bleiben nur Prompt/Leerantworten uebrig.
-    const int n = readUntil(outBuf, nullptr, bufSize, timeoutMs);
-    ok = (n > 0) && responseHasPayload(outBuf);
-
-    if (!ok && responseIsOnlyPrompt(outBuf) && attempt == 0) {
-      delay(40);
-    } else {
-      break;
-    }
-  }
+BatteryLink::TxnState BatteryLink::poll() {
+  if (!m_busy) return TxnState::Idle;
+
+  const uint32_t now = millis();
+  switch (m_txn.phase) {
+    case Phase::Wake:
+      if (now - m_txn.phaseMs < 10) return TxnState::Busy;
+      if (m_txn.wakeSent < 3) {
+        port.write('\n');
+        m_txn.wakeSent++;
+        m_txn.phaseMs = now;
+        return TxnState::Busy;
+      }
+      m_txn.phase = Phase::Send;
+      // fallthrough
+
+    case Phase::Send:
+      // Rx leeren, damit nur Antwort auf DIESEN Befehl kommt
+      while (port.available()) { port.read(); }
+      if (m_cmd[0]) port.print(m_cmd);
+      port.print('\n');
+      m_txn.phase = Phase::Read;
+      m_txn.phaseMs = millis();
+      m_txn.sentMs = m_txn.phaseMs;
+      m_txn.readStartUs = Trace::now();
+      return TxnState::Busy;
+
+    case Phase::Read:
+      if (readAvailable() || (millis() - m_txn.phaseMs) >= m_txn.timeoutMs) {
+        return finishAttempt();
+      }
+      return TxnState::Busy;
 
-  unlock();
-  return ok;
+    case Phase::RetryWait:
+      if (now - m_txn.phaseMs >= 40) startAttempt();
+      return TxnState::Busy;
+  }
+  return TxnState::Busy;
 }
 
-bool BatteryLink::sendAndReceivePrompt(const char* cmd, char* outBuf, size_t bufSize, unsigned long timeoutMs) {
-  if (!outBuf || bufSize < 2) return false;
-  if (!lock(6000)) return false;
+BatteryLink::TxnState BatteryLink::finishAttempt() {
+  Trace::record(Trace::Ev::UartRead, m_txn.readStartUs,
+                (uint32_t)(Trace::now() - m_txn.readStartUs), m_txn.len > 0xFFFF ? 0xFFFF : (uint16_t)m_txn.len);
+  const bool gotBytes = m_txn.len > 0;
+  const bool promptOnly = responseIsOnlyPrompt(m_txn.buf);
+  const bool firstAttempt = (m_txn.attempt == 0);
+
+  // Feste Poll-Kommandos brauchen Nutzdaten; Prompt-Kommandos nur irgendeine
+  // Antwort. Reiner Prompt beim ersten Versuch: 40 ms warten und wiederholen.
+  const bool ok = m_txn.promptMode ? (gotBytes && !(promptOnly && firstAttempt))
+                                   : (gotBytes && responseHasPayload(m_txn.buf));
+  LinkClassStats& cs = m_classStats[(size_t)m_class];
+  if (gotBytes && promptOnly) cs.promptOnly++;
+
+  // readAvailable() endet nur bei Prompt oder vollem Puffer vorzeitig
+  const bool timedOut = !m_txn.found && m_txn.len < m_txn.bufSize - 1;
+  if (ok) {
+    recordResult(true, timedOut);
+    return TxnState::Done;
+  }
 
-  bool ok = false;
-  for (int attempt = 0; attempt < 2 && !ok; ++attempt) {
-    outBuf[0] = '\0';
-    port.flush();
+  if (firstAttempt && promptOnly) {  // leerer Puffer zaehlt als reiner Prompt
+    m_stats.retries++;
+    cs.retries++;
+    m_txn.attempt++;
+    m_txn.phase = Phase::RetryWait;
+    m_txn.phaseMs = millis();
+    return TxnState::Busy;
+  }
 
-    wakeUpConsole();
-    while (port.available()) { port.read(); }
+  recordResult(false, timedOut);
+  return TxnState::Failed;
+}
 
-    if (cmd && *cmd) port.print(cmd);
-    port.print('\n');
+void BatteryLink::recordResult(bool ok, bool timedOut) {
+  const uint32_t now = millis();
+  const uint32_t latency = now - m_txn.startMs;
+  m_timing.startMs   = m_txn.startMs;
+  m_timing.sentMs    = m_txn.sentMs;
+  m_timing.firstRxMs = m_txn.firstRxMs;
+  m_timing.promptMs  = m_txn.promptMs ? m_txn.promptMs : now;
+  m_timing.endMs     = now;
+  if (ok) m_stats.ok++;
+  else    m_stats.failed++;
+  m_stats.rxBytes += m_txn.len;
+  m_stats.latencySumMs += latency;
+  m_stats.lastLatencyMs = latency;
+  if (latency > m_stats.maxLatencyMs) m_stats.maxLatencyMs = latency;
+
+  LinkClassStats& cs = m_classStats[(size_t)m_class];
+  if (ok) cs.ok++;
+  else    cs.failed++;
+  if (timedOut) cs.timeouts++;
+  cs.rxBytes += m_txn.len;
+  cs.latencySumMs += latency;
+  cs.lastLatencyMs = latency;
+  if (latency > cs.maxLatencyMs) cs.maxLatencyMs = latency;
+  size_t b = 0;
+  while (b < kLinkLatencyBuckets && latency > kLinkLatencyBucketMs[b]) ++b;
+  if (b < kLinkLatencyBuckets) cs.buckets[b]++;
+  else                         cs.overflow++;
+
+  m_busy = false;
+}
 
-    // Kein fester Terminator, readUntil erkennt pylon> und pylon_debug> selbst.
-    int n = readUntil(outBuf, nullptr, bufSize, timeoutMs);
-    ok = (n > 0);
+bool BatteryLink::sendAndReceive(const char* cmd, char* outBuf, size_t bufSize, unsigned long timeoutMs) {
+  Trace::Span span(Trace::Ev::UartTxn, (uint16_t)classifyPollCommand(cmd));
+  // Feste Poll-Kommandos sollen bis zum bekannten Prompt lesen und nicht schon
+  // bei einem einzelnen '>' abbrechen, sonst bleiben nur Prompt/Leerantworten uebrig.
+  if (!beginTransaction(cmd, outBuf, bufSize, timeoutMs, false, classifyPollCommand(cmd))) return false;
+
+  TxnState st;
+  while ((st = poll()) == TxnState::Busy) delay(1);
+  return st == TxnState::Done;
+}
 
-    if (ok && responseIsOnlyPrompt(outBuf) && attempt == 0) {
-      ok = false;
-      delay(40);
-    }
-  }
+bool BatteryLink::sendAndReceivePrompt(const char* cmd, char* outBuf, size_t bufSize, unsigned long timeoutMs) {
+  Trace::Span span(Trace::Ev::UartTxn, (uint16_t)classifyPollCommand(cmd));
+  if (!beginTransaction(cmd, outBuf, bufSize, timeoutMs, true, classifyPollCommand(cmd))) return false;
 
-  unlock();
-  return ok;
+  TxnState st;
+  while ((st = poll()) == TxnState::Busy) delay(1);
+  return st == TxnState::Done;
 }
 
 
@@ -174,116 +315,61 @@ void BatteryLink::logIncoming(circular_log<16384>* log) {
   }
 }
 
-// Liest bis Terminator (z.B. ">"), erkennt außerdem pylon> und "Press [Enter]..."
-int BatteryLink::readUntil(char* buf, const char* term, size_t maxLen, unsigned long timeoutMs) {
-  if (!buf || maxLen < 2) return 0;
-
-  size_t len = 0;
-  bool found = false;
-  const uint32_t t0 = millis();
-  const size_t termLen = (term && *term) ? strlen(term) : 0;
-  buf[0] = '\0';
-
-  // kurze Vorwartezeit
-  while (!port.available() && (millis() - t0 < timeoutMs)) {
-    delay(1);
-  }
-
-  // Sliding Windows
-  char last6[7]    = {0};  // "pylon>"
-  char last12[13]  = {0};  // "pylon_debug>"
-  char last96[97]  = {0};  // Pagination etc. in lowercase
-  size_t last6Len = 0;
-  size_t last12Len = 0;
-  size_t last96Len = 0;
-  uint16_t bytesSinceYield = 0;
-
-  while ((millis() - t0) < timeoutMs && len < maxLen - 1) {
-    while (port.available() && len < maxLen - 1) {
-      int ci = port.read();
-      if (ci < 0) break;
-      char c = (char)ci;
-
-      // Puffer füllen
-      buf[len++] = c;
-      buf[len] = '\0';
-      if (++bytesSinceYield >= 128) {
-        bytesSinceYield = 0;
-        delay(0);
-      }
-
-      // Sliding windows aktualisieren
-      pushWindow(last6, sizeof(last6), last6Len, c);
-      pushWindow(last12, sizeof(last12), last12Len, c);
-      pushWindow(last96, sizeof(last96), last96Len, (char)tolower((unsigned char)c));
-
-      // 1) expliziten Terminator nur am Pufferende pruefen statt den ganzen Buffer jedes Mal zu durchsuchen
-      if (termLen > 0 && len >= termLen) {
-        if (memcmp(buf + len - termLen, term, termLen) == 0) {
-          found = true;
-          break;
-        }
-      }
-
-      // 2) bekannte Prompts immer erkennen
-      if (last6Len == 6 && memcmp(last6, "pylon>", 6) == 0) {
-        found = true;
-        break;
-      }
-      if (last12Len == 12 && memcmp(last12, "pylon_debug>", 12) == 0) {
-        found = true;
-        break;
-      }
+// Liest, was im UART-Puffer liegt, erkennt pylon>, pylon_debug> und
+// "Press [Enter]...". true = Antwort vollstaendig oder Puffer voll.
+bool BatteryLink::readAvailable() {
+  Txn& t = m_txn;
+  uint16_t bytesThisPoll = 0;
+
+  while (port.available() && t.len < t.bufSize - 1) {
+    int ci = port.read();
+    if (ci < 0) break;
+    char c = (char)ci;
+    if (t.len == 0) t.firstRxMs = millis();
+
+    // Puffer füllen
+    t.buf[t.len++] = c;
+    t.buf[t.len] = '\0';
+
+    // Sliding windows aktualisieren
+    pushWindow(t.last6, sizeof(t.last6), t.last6Len, c);
+    pushWindow(t.last12, sizeof(t.last12), t.last12Len, c);
+    pushWindow(t.last96, sizeof(t.last96), t.last96Len, (char)tolower((unsigned char)c));
+
+    // bekannte Prompts immer erkennen
+    if (t.last6Len == 6 && memcmp(t.last6, "pylon>", 6) == 0) {
+      t.found = true;
+      t.promptMs = millis();
+      return true;
+    }
+    if (t.last12Len == 12 && memcmp(t.last12, "pylon_debug>", 12) == 0) {
+      t.found = true;
+      t.promptMs = millis();
+      return true;
+    }
 
-      // 3) Pagination heuristik (case-insensitive)
-      // Varianten wie:
-      // "press [enter] to be continued", "press enter to continue", "press any key to continue"
-      bool needEnter = false;
-      if (strstr(last96, "press") && (strstr(last96, "[enter]") || strstr(last96, " enter"))) {
-        if (strstr(last96, "continue") || strstr(last96, "continued") || strstr(last96, "to be continued"))
-          needEnter = true;
-      }
-      if (!needEnter && strstr(last96, "press any key") && strstr(last96, "continue")) {
+    // Pagination heuristik (case-insensitive)
+    // Varianten wie:
+    // "press [enter] to be continued", "press enter to continue", "press any key to continue"
+    bool needEnter = false;
+    if (strstr(t.last96, "press") && (strstr(t.last96, "[enter]") || strstr(t.last96, " enter"))) {
+      if (strstr(t.last96, "continue") || strstr(t.last96, "continued") || strstr(t.last96, "to be continued"))
         needEnter = true;
-      }
-
-      if (needEnter) {
-        port.write('\r');   // nächste Seite anfordern
-      }
+    }
+    if (!needEnter && strstr(t.last96, "press any key") && strstr(t.last96, "continue")) {
+      needEnter = true;
     }
 
-    if (found) break;
-    delay(0);
-  }
-
-  if (!found && len == 0) return 0; // gar nichts empfangen
-  return (int)len;                  // ggf. teilgefüllt (bei Pufferlimit)
-}
-
+    if (needEnter) {
+      port.write('\r');   // nächste Seite anfordern
+      // das Fenster enthaelt den Hinweis ueber mehrere Zeichen; einmal zaehlen
+      if (!t.pageHint) m_classStats[(size_t)m_class].pagesAnswered++;
+    }
+    t.pageHint = needEnter;
 
-// Kurzer Weckversuch wie in deiner Ursprungsversion
-void BatteryLink::wakeUpConsole() {
-  // Minimal-invasiv: ein paar Newlines auf aktueller Baudrate
-  for (int i = 0; i < 3; i++) {
-    port.write('\n');
-    delay(10);
+    // Rest beim naechsten poll(), damit WLAN und Webserver dazwischen laufen
+    if (++bytesThisPoll >= 512) break;
   }
 
-  // Optional: harte Sequenz (deine ältere Folge). Nur nutzen, wenn lange nichts kommt.
-  // Hier NICHT automatisch senden, um unnötige Frames zu vermeiden.
-  // -> Wenn du die harte Sequenz brauchst: auskommentieren und aufrufen.
-  /*
-  int original = baud ? baud : 115200;
-  switchBaud(1200);
-  port.write("~20014682C0048520FCC3\r");
-  delay(100);
-  byte nl[] = {0x0E, 0x0A};
-  switchBaud(original);
-  for (int i=0; i<5; i++) {
-    port.write(nl, sizeof(nl));
-    delay(20);
-    if (port.available()) { while (port.available()) port.read(); break; }
-    delay(0);
-  }
-  */
+  return t.len >= t.bufSize - 1;
 }
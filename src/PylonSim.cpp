@@ -0,0 +1,453 @@
+#include "PylonSim.h"
+#include "batteryStack.h"
+#include "JsonWriter.h"
+#include "WebUI.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+  // Platz fuer "$$" und Prompt, auch wenn die Antwort abgeschnitten wurde
+  constexpr size_t kTailReserve = 24;
+
+  const char* const kFaultNames[] = { "none", "silent", "prompt_only", "no_prompt" };
+
+  // Lastprofil ueber 20 Minuten: laden, ruhen, entladen
+  constexpr uint32_t kCycleS = 1200;
+
+  uint32_t cyclePos() {
+    return (millis() / 1000UL) % kCycleS;
+  }
+}
+
+// ---------- Stream ----------
+
+size_t PylonSim::released() {
+  const size_t limit = m_pageIdx < m_pageCount ? m_pageEnd[m_pageIdx] : m_txLen;
+  const uint32_t elapsed = micros() - m_segStartUs;
+  if (elapsed < m_segDelayUs) return m_segPos;
+  if (m_cfg.usPerByte == 0) return limit;
+  const size_t n = m_segPos + (elapsed - m_segDelayUs) / m_cfg.usPerByte;
+  return n < limit ? n : limit;
+}
+
+int PylonSim::available() {
+  const size_t r = released();
+  return r > m_txPos ? (int)(r - m_txPos) : 0;
+}
+
+int PylonSim::read() {
+  const size_t r = released();
+  while (m_txPos < r) {
+    const char c = m_tx[m_txPos++];
+    m_counters.txBytes++;
+    if (m_cfg.dropPermille && nextRandom() % 1000U < m_cfg.dropPermille) {
+      m_counters.dropped++;
+      continue;
+    }
+    return (uint8_t)c;
+  }
+  return -1;
+}
+
+int PylonSim::peek() {
+  return m_txPos < released() ? (uint8_t)m_tx[m_txPos] : -1;
+}
+
+size_t PylonSim::write(uint8_t c) {
+  if (c == '\r') {
+    // Nur an einem Seitenhinweis von Bedeutung; weitere '\r' verfallen
+    if (m_pageIdx < m_pageCount && m_txPos >= m_pageEnd[m_pageIdx]) {
+      m_pageIdx++;
+      m_counters.pages++;
+      m_segPos = m_txPos;
+      m_segStartUs = micros();
+      m_segDelayUs = 0;
+    }
+    return 1;
+  }
+  if (c == '\n') {
+    onLine();
+    m_lineLen = 0;
+    m_line[0] = '\0';
+    return 1;
+  }
+  if (m_lineLen < sizeof(m_line) - 1) {
+    m_line[m_lineLen++] = (char)c;
+    m_line[m_lineLen] = '\0';
+  }
+  return 1;
+}
+
+// ---------- Antworten ----------
+
+void PylonSim::startReply(uint32_t delayMs) {
+  // Eine neue Zeile verwirft, was von der vorigen Antwort noch aussteht
+  m_txLen = 0;
+  m_txPos = 0;
+  m_tx[0] = '\0';
+  m_pageCount = 0;
+  m_pageIdx = 0;
+  m_segPos = 0;
+  m_segStartUs = micros();
+  m_segDelayUs = delayMs * 1000UL;
+}
+
+void PylonSim::put(const char* fmt, ...) {
+  const size_t cap = sizeof(m_tx) - kTailReserve;
+  if (m_txLen >= cap - 1) return;
+  va_list ap;
+  va_start(ap, fmt);
+  const int n = vsnprintf(m_tx + m_txLen, cap - m_txLen, fmt, ap);
+  va_end(ap);
+  if (n < 0) return;
+  if ((size_t)n >= cap - m_txLen) {
+    m_txLen = cap - 1;
+    m_counters.truncated++;
+  } else {
+    m_txLen += (size_t)n;
+  }
+}
+
+void PylonSim::pageBreak() {
+  // Haelt direkt hinter dem Hinweis an; der Zeilenwechsel folgt erst nach Enter
+  put("Press [Enter] to be continued");
+  if (m_pageCount < kMaxPages) m_pageEnd[m_pageCount++] = m_txLen;
+  put("\r\n");
+}
+
+void PylonSim::putPrompt() {
+  static const char kPrompt[] = "\rpylon>";
+  const size_t n = sizeof(kPrompt) - 1;
+  if (m_txLen + n >= sizeof(m_tx)) return;
+  memcpy(m_tx + m_txLen, kPrompt, n + 1);
+  m_txLen += n;
+}
+
+void PylonSim::onLine() {
+  char* cmd = m_line;
+  while (*cmd == ' ') ++cmd;
+  size_t len = strlen(cmd);
+  while (len && cmd[len - 1] == ' ') cmd[--len] = '\0';
+
+  if (m_cfg.fault == Fault::Silent) return;
+
+  // Leere Zeile (Weckversuch): nur neuer Prompt
+  if (!len || m_cfg.fault == Fault::PromptOnly) {
+    startReply(len ? m_cfg.replyDelayMs : 0);
+    put("\r\n");
+    putPrompt();
+    return;
+  }
+
+  m_counters.commands++;
+  startReply(m_cfg.replyDelayMs);
+  put("%s\r\n@\r\r\n", cmd);
+
+  char* arg = strchr(cmd, ' ');
+  if (arg) {
+    *arg++ = '\0';
+    while (*arg == ' ') ++arg;
+  }
+  const int idx = arg ? atoi(arg) : 0;
+
+  bool known = true;
+  if      (!strcmp(cmd, "pwrsys"))      replyPwrsys();
+  else if (!strcmp(cmd, "pwr"))         replyPwr();
+  else if (!strcmp(cmd, "stat") && arg) replyStat(idx);
+  else if (!strcmp(cmd, "bat") && arg)  replyBat(idx);
+  else if (!strcmp(cmd, "log"))         replyLog();
+  else known = false;
+
+  if (known) {
+    put("Command completed successfully\r\n");
+  } else {
+    m_counters.unknown++;
+    put("Unknown command '%s'\r\n", cmd);
+  }
+  put("$$\r\n");
+  if (m_cfg.fault != Fault::NoPrompt) putPrompt();
+}
+
+void PylonSim::replyPwr() {
+  const bool v2 = m_cfg.fwVersion >= 2;
+  if (v2) {
+    put("Power Volt   Curr   Tempr  Tlow   Tlow.Id  Thigh  Thigh.Id Vlow   Vlow.Id  Vhigh  Vhigh.Id "
+        "Base.St  Volt.St  Curr.St  Temp.St  Coulomb  Time                 B.V.St   B.T.St   MosTempr M.T.St   \r\n");
+  } else {
+    put("Power Volt   Curr   Tempr  Tlow   Thigh  Vlow   Vhigh  "
+        "Base.St  Volt.St  Curr.St  Temp.St  Coulomb  Time                 B.V.St   B.T.St  \r\n");
+  }
+
+  const uint32_t up = millis() / 1000UL;
+  char stamp[24];
+  snprintf(stamp, sizeof(stamp), "2024-01-01 %02lu:%02lu:%02lu",
+           (unsigned long)((up / 3600) % 24), (unsigned long)((up / 60) % 60), (unsigned long)(up % 60));
+
+  const int rows = m_cfg.batteries > 8 ? m_cfg.batteries : 8;
+  for (int i = 1; i <= rows; ++i) {
+    if (i > m_cfg.batteries) {
+      put(v2 ? "%-6d-      -      -      -      -        -      -        -      -        -      -        "
+               "Absent   -        -        -        -        -                    -        -        -        -        \r\n"
+             : "%-6d-      -      -      -      -      -      -      "
+               "Absent   -        -        -        -        -                    -        -       \r\n", i);
+      continue;
+    }
+    const long v = batVoltage(i);
+    const long c = batCurrent(i);
+    const long t = batTemp(i);
+    const long cell = v / 15;
+    const char* base = c > 200 ? "Charge" : (c < -200 ? "Dischg" : "Idle");
+    char soc[8];
+    snprintf(soc, sizeof(soc), "%d%%", batSoc(i));
+    if (v2) {
+      put("%-6d%-7ld%-7ld%-7ld%-7ld%-9d%-7ld%-9d%-7ld%-9d%-7ld%-9d%-9s%-9s%-9s%-9s%-9s%-21s%-9s%-9s%-9ld%-9s\r\n",
+          i, v, c, t, t - 1000, (i * 3) % 15, t + 500, (i * 5) % 15, cell - 3, (i * 7) % 15, cell + 4, (i * 11) % 15,
+          base, "Normal", "Normal", "Normal", soc, stamp, "Normal", "Normal", t - 2000, "Normal");
+    } else {
+      put("%-6d%-7ld%-7ld%-7ld%-7ld%-7ld%-7ld%-7ld%-9s%-9s%-9s%-9s%-9s%-21s%-9s%-9s\r\n",
+          i, v, c, t, t - 1000, t + 500, cell - 3, cell + 4,
+          base, "Normal", "Normal", "Normal", soc, stamp, "Normal", "Normal");
+    }
+  }
+}
+
+void PylonSim::replyPwrsys() {
+  const int n = m_cfg.batteries;
+  long vSum = 0, cSum = 0, tSum = 0, tMin = 0, tMax = 0;
+  int socSum = 0;
+  for (int i = 1; i <= n; ++i) {
+    const long t = batTemp(i);
+    vSum += batVoltage(i);
+    cSum += batCurrent(i);
+    tSum += t;
+    socSum += batSoc(i);
+    if (i == 1 || t < tMin) tMin = t;
+    if (i == 1 || t > tMax) tMax = t;
+  }
+  const long vAvg = n ? vSum / n : 0;
+  const int  soc  = n ? socSum / n : 0;
+  const long fcc  = 74000L * n;
+  const long cell = vAvg / 15;
+
+  put("%s\r\n", cSum > 200 ? "System is charging" : (cSum < -200 ? "System is discharging" : "System is idle"));
+  put(" Total Num                : %d\r\n", n);
+  put(" Present Num              : %d\r\n", n);
+  put(" Sleep Num                : 0\r\n");
+  put(" System Volt              : %ld mV\r\n", vAvg);
+  put(" System Curr              : %ld mA\r\n", cSum);
+  put(" System RC                : %ld mAh\r\n", fcc * soc / 100);
+  put(" System FCC               : %ld mAh\r\n", fcc);
+  put(" System SOC               : %d %%\r\n", soc);
+  put(" System SOH               : 100 %%\r\n");
+  put(" Highest voltage          : %ld mV\r\n", cell + 4);
+  put(" Average voltage          : %ld mV\r\n", cell);
+  put(" Lowest voltage           : %ld mV\r\n", cell - 3);
+  put(" Highest temperature      : %ld mC\r\n", tMax + 500);
+  put(" Average temperature      : %ld mC\r\n", n ? tSum / n : 0);
+  put(" Lowest temperature       : %ld mC\r\n", tMin - 1000);
+  put(" Recommend chg voltage    : 53250 mV\r\n");
+  put(" Recommend dsg voltage    : 47000 mV\r\n");
+  put(" Recommend chg current    : %ld mA\r\n", 37000L * n);
+  put(" Recommend dsg current    : %ld mA\r\n", -37000L * n);
+  put(" system Recommend chg voltage: 53250 mV\r\n");
+  put(" system Recommend dsg voltage: 47000 mV\r\n");
+  put(" system Recommend chg current: %ld mA\r\n", 37000L * n);
+  put(" system Recommend dsg current: %ld mA\r\n", -37000L * n);
+  put(" Alarm status             : Normal\r\n");
+}
+
+void PylonSim::replyStat(int idx) {
+  if (idx < 1 || idx > m_cfg.batteries) {
+    put("Device address %d not present\r\n", idx);
+    return;
+  }
+  put("Device address      : %d\r\n", idx);
+  put("Data Items          : 92\r\n");
+  put("Charge Cnt.         : %d\r\n", 400 + idx * 13);
+  put("Discharge Cnt.      : %d\r\n", 390 + idx * 11);
+  put("Charge Times        : %d\r\n", 380 + idx * 9);
+  put("Idle Times          : %d\r\n", 1200 + idx * 5);
+  put("COC Times           : 0\r\n");
+  put("DOC Times           : 0\r\n");
+  put("Bat OV Times        : 0\r\n");
+  put("Bat UV Times        : 0\r\n");
+  put("Bat HT Times        : 0\r\n");
+  put("Bat LT Times        : 0\r\n");
+  put("Shut Times          : 2\r\n");
+  put("Reset Times         : 1\r\n");
+  put("CYCLE Times         : %d\r\n", 120 + idx * 7);
+  put("Pwr Percent         : %d\r\n", batSoc(idx));
+}
+
+void PylonSim::replyBat(int idx) {
+  if (idx < 1 || idx > m_cfg.batteries) {
+    put("Device address %d not present\r\n", idx);
+    return;
+  }
+  const long v = batVoltage(idx);
+  const long c = batCurrent(idx);
+  const long t = batTemp(idx);
+  const int soc = batSoc(idx);
+  const char* base = c > 200 ? "Charge" : (c < -200 ? "Dischg" : "Idle");
+
+  char socCol[8];
+  snprintf(socCol, sizeof(socCol), "%d%%", soc);
+
+  put("Battery  Volt     Curr     Tempr    Base State   Volt. State  Curr. State  Temp. State  SOC          Coulomb      BAL\r\n");
+  uint16_t lines = 1;
+  for (int cell = 0; cell < 15; ++cell) {
+    if (m_cfg.pageLines && lines >= m_cfg.pageLines) {
+      pageBreak();
+      lines = 0;
+    }
+    put("%-9d%-9ld%-9ld%-9ld%-13s%-13s%-13s%-13s%-13s%-13ld%s\r\n",
+        cell, v / 15 - 3 + (cell % 7), c, t - 500 + (cell % 4) * 250,
+        base, "Normal", "Normal", "Normal", socCol, 74000L * soc / 100, "N");
+    lines++;
+  }
+}
+
+void PylonSim::replyLog() {
+  static const char* const kEvents[] = {
+    "Chg start", "Chg end", "Dsg start", "Dsg end", "Bal start", "Bal end", "Cell OV rel", "Sleep"
+  };
+  uint16_t lines = 0;
+  for (uint16_t i = 0; i < m_cfg.logLines; ++i) {
+    if (m_cfg.pageLines && lines >= m_cfg.pageLines) {
+      pageBreak();
+      lines = 0;
+    }
+    const uint32_t s = 3600UL * 24UL - (uint32_t)i * 617UL;
+    put("%-6u 24-01-01 %02lu:%02lu:%02lu  Info   Bat %-2d %s\r\n",
+        (unsigned)(1000 + m_cfg.logLines - i),
+        (unsigned long)((s / 3600) % 24), (unsigned long)((s / 60) % 60), (unsigned long)(s % 60),
+        1 + (int)(i % (m_cfg.batteries ? m_cfg.batteries : 1)),
+        kEvents[i % (sizeof(kEvents) / sizeof(kEvents[0]))]);
+    lines++;
+  }
+}
+
+// ---------- Messwerte ----------
+
+long PylonSim::batCurrent(int idx) const {
+  const uint32_t p = cyclePos();
+  const long spread = (long)((idx * 53) % 150) - 75;
+  if (p < 400) return 6000 + spread;
+  if (p < 600) return 0;
+  return -4500 + spread;
+}
+
+int PylonSim::batSoc(int idx) const {
+  const uint32_t p = cyclePos();
+  int soc;
+  if (p < 400)      soc = 50 + (int)(p * 20 / 400);
+  else if (p < 600) soc = 70;
+  else              soc = 70 - (int)((p - 600) * 20 / 600);
+  return soc - (idx % 3);
+}
+
+long PylonSim::batVoltage(int idx) const {
+  return 48000L + batSoc(idx) * 50L + batCurrent(idx) / 10;
+}
+
+long PylonSim::batTemp(int idx) const {
+  const long c = batCurrent(idx);
+  return 23000L + idx * 400L + (c < 0 ? -c : c) / 10;
+}
+
+long PylonSim::stackPowerMw() const {
+  long long uW = 0;
+  for (int i = 1; i <= m_cfg.batteries; ++i) uW += (long long)batVoltage(i) * batCurrent(i);
+  return (long)(uW / 1000);
+}
+
+uint32_t PylonSim::nextRandom() {
+  // xorshift32, reproduzierbar ueber Neustarts
+  m_seed ^= m_seed << 13;
+  m_seed ^= m_seed >> 17;
+  m_seed ^= m_seed << 5;
+  return m_seed;
+}
+
+// ---------- Web ----------
+
+const char* PylonSim::faultName() const {
+  return kFaultNames[(size_t)m_cfg.fault];
+}
+
+bool PylonSim::setFault(const char* name) {
+  for (size_t i = 0; i < sizeof(kFaultNames) / sizeof(kFaultNames[0]); ++i) {
+    if (name && !strcmp(name, kFaultNames[i])) {
+      m_cfg.fault = (Fault)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PylonSim::init(WebServer* server) {
+  if (!server) return;
+
+  server->on("/api/sim", HTTP_GET, [this]() {
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    w.beginObject();
+    w.field("batteries", (unsigned)m_cfg.batteries);
+    w.field("fw", (unsigned)m_cfg.fwVersion);
+    w.field("usPerByte", m_cfg.usPerByte);
+    w.field("replyDelayMs", m_cfg.replyDelayMs);
+    w.field("dropPermille", (unsigned)m_cfg.dropPermille);
+    w.field("fault", faultName());
+    w.field("pageLines", (unsigned)m_cfg.pageLines);
+    w.field("logLines", (unsigned)m_cfg.logLines);
+    w.beginObject("counters");
+    w.field("commands", m_counters.commands);
+    w.field("unknown", m_counters.unknown);
+    w.field("pages", m_counters.pages);
+    w.field("dropped", m_counters.dropped);
+    w.field("truncated", m_counters.truncated);
+    w.field("txBytes", (unsigned long long)m_counters.txBytes);
+    w.endObject();
+    w.endObject();
+  });
+
+  server->on("/api/sim", HTTP_POST, [this, server]() {
+    auto num = [server](const char* name, unsigned long lo, unsigned long hi, unsigned long& out) {
+      if (!server->hasArg(name)) return true;
+      char* end = nullptr;
+      const String v = server->arg(name);
+      const unsigned long n = strtoul(v.c_str(), &end, 10);
+      if (!end || *end || n < lo || n > hi) return false;
+      out = n;
+      return true;
+    };
+
+    unsigned long usPerByte = m_cfg.usPerByte, delayMs = m_cfg.replyDelayMs;
+    unsigned long drop = m_cfg.dropPermille, fw = m_cfg.fwVersion, bats = m_cfg.batteries;
+    unsigned long pageLines = m_cfg.pageLines, logLines = m_cfg.logLines;
+    if (!num("usPerByte", 0, 100000, usPerByte) ||
+        !num("replyDelayMs", 0, 60000, delayMs) ||
+        !num("dropPermille", 0, 1000, drop) ||
+        !num("fw", 1, 2, fw) ||
+        !num("batteries", 1, MAX_PYLON_BATTERIES, bats) ||
+        !num("pageLines", 0, 200, pageLines) ||
+        !num("logLines", 0, 400, logLines)) {
+      server->send(400, "text/plain", "value out of range");
+      return;
+    }
+    if (server->hasArg("fault") && !setFault(server->arg("fault").c_str())) {
+      server->send(400, "text/plain", "fault: none|silent|prompt_only|no_prompt");
+      return;
+    }
+
+    m_cfg.usPerByte = usPerByte;
+    m_cfg.replyDelayMs = delayMs;
+    m_cfg.dropPermille = (uint16_t)drop;
+    m_cfg.fwVersion = (uint8_t)fw;
+    m_cfg.batteries = (uint8_t)bats;
+    m_cfg.pageLines = (uint16_t)pageLines;
+    m_cfg.logLines = (uint16_t)logLines;
+    server->send(204);
+  });
+}
@@ -7,7 +7,6 @@
 #include <ESPmDNS.h>
 #include <WebServer.h>
 #include <NTPClient.h>
-#include <Preferences.h>
 #include <ArduinoJson.h>
 #include <circular_log.h>
 #include <esp_wifi.h>
@@ -15,15 +14,28 @@
 #include <LittleFS.h>
 
 #include "batteryStack.h"
+#include "BufferPool.h"
 #include "WebUI.h"
+#include "EventStream.h"
+#include "ConsoleJobs.h"
+#include "Metrics.h"
+#include "RuntimeStats.h"
+#include "HeapHealth.h"
+#include "ParseCorpus.h"
+#include "DataAge.h"
+#include "Trace.h"
+#include "SoakMonitor.h"
+#include "NvsStore.h"
 batteryStack g_stack{};
 systemData   g_systemStack{};
 dailyEnergyData g_dailyEnergy{};
 statDebugData g_statDebug{};
 
 #include "PylonLink.h"
+#include "PylonSim.h"
 #include "Parser.h"
 #include "MQTTHandler.h"
+#include "MqttQueue.h"
 
 // --- LED-Statushelfer ---
 namespace Led {
@@ -98,12 +110,17 @@ NTPClient timeClient(ntpUDP, NTP_SERVER, GMT_OFFSET_SEC);
 
 circular_log<16384> g_log;
 
-// Polling-Kommandos laufen nacheinander und koennen sich daher einen Buffer teilen.
-char g_szRecvBuffPoll[16384];
-char g_szRecvBuffCmd[16384];
+// UART-Empfangspuffer kommen aus der BufferPool-Arena (Slot Rx). Polling und
+// Web-Konsole laufen beide im loop()-Task nacheinander und teilen sich den Slot.
 
+#if PYLON_SIMULATOR
+// Simulierte Konsole statt UART2 (Build-Env esp32-sim, /api/sim)
+PylonSim    g_sim;
+BatteryLink batt(g_sim);
+#else
 // UART2
 BatteryLink batt(Serial2, PIN_RX2, PIN_TX2);
+#endif
 
 #if ENABLE_MQTT
   WiFiClient   espClient;
@@ -168,46 +185,22 @@ static const char* crashPhaseToString(CrashPhase phase) {
 }
 
 namespace CrashTrace {
-  static Preferences s_prefs;
-  static bool s_prefsOpen = false;
-  static unsigned long s_lastPersistMs = 0;
-  static CrashPhase s_lastSavedPhase = CrashPhase::Unknown;
-  static uint32_t s_lastSavedBootCount = 0;
-  static constexpr unsigned long kPersistIntervalMs = 300000UL;
-
-  static void begin() {
-    s_prefsOpen = s_prefs.begin("crash-trace", false);
-    if (!s_prefsOpen) return;
-    s_lastSavedPhase = static_cast<CrashPhase>(s_prefs.getUChar("phase", (uint8_t)CrashPhase::Unknown));
-    s_lastSavedBootCount = s_prefs.getULong("boot", 0);
-  }
-
-  static void persist(CrashPhase phase) {
-    if (!s_prefsOpen) return;
-    s_prefs.putUChar("phase", (uint8_t)phase);
-    s_prefs.putULong("boot", g_bootCount);
-    s_lastSavedPhase = phase;
-    s_lastSavedBootCount = g_bootCount;
-    s_lastPersistMs = millis();
-  }
-
   static void mark(CrashPhase phase, bool forcePersist = false) {
     g_lastPhaseRTC = (uint8_t)phase;
-    if (!s_prefsOpen) return;
 
-    const bool changed = s_lastSavedPhase != phase;
-    const bool bootChanged = s_lastSavedBootCount != g_bootCount;
-    const bool due = (millis() - s_lastPersistMs) >= kPersistIntervalMs;
+    NvsStore::Record& rec = NvsStore::record();
+    const bool bootChanged = rec.bootCount != g_bootCount;
+    if (!bootChanged && rec.crashPhase == (uint8_t)phase) return;
+    rec.crashPhase = (uint8_t)phase;
+    rec.bootCount = g_bootCount;
 
-    // RTC-Daten reichen fuer die unmittelbare Crash-Phase; NVS nur sparsam
-    // beschreiben, damit Flash-Schreiblast und Loop-Blockaden klein bleiben.
-    if (bootChanged || (changed && (forcePersist || due))) {
-      persist(phase);
-    }
+    // RTC-Daten reichen fuer die unmittelbare Crash-Phase; in den Flash
+    // geht die Phase mit dem naechsten gesammelten NvsStore-Schreibvorgang.
+    NvsStore::markDirty(bootChanged || forcePersist);
   }
 
   static const char* savedPhaseText() {
-    return crashPhaseToString(s_lastSavedPhase);
+    return crashPhaseToString(static_cast<CrashPhase>(NvsStore::stored().crashPhase));
   }
 
   static const char* rtcPhaseText() {
@@ -229,6 +222,8 @@ static void publishMqttDiagnosticSnapshot(bool force = false) {
                                  g_abnormalResetCount,
                                  ESP.getFreeHeap(),
                                  ESP.getMinFreeHeap());
+  MQTTHandler::publishLinkStats(batt);
+  MQTTHandler::publishHeapHealth();
 #else
   (void)force;
 #endif
@@ -454,50 +449,134 @@ namespace StackGuard {
 
 static uint8_t g_targetBSSID[6] = {0};
 
+#ifndef ENERGY_MAX_GAP_MS
+#define ENERGY_MAX_GAP_MS 60000UL   // laengere Luecken zwischen pwr-Messwerten werden nicht ueberbrueckt
+#endif
+
+// Energie- und Ladungszaehler in Ganzzahlen. Integriert wird je
+// uebernommenem pwr-Messwert per Trapezregel ueber U x I jedes Moduls
+// zwischen dem vorigen und diesem Messzeitpunkt (erstes Antwortbyte);
+// Stack-Zaehler aus der Summe der Module, Vorzeichenwechsel im Intervall
+// wird am Nulldurchgang aufgeteilt.
 namespace EnergyTracker {
-  static Preferences s_prefs;
-  static bool s_prefsOpen = false;
   static bool s_dirty = false;
-  static unsigned long s_lastPersistMs = 0;
 
-  static void begin(dailyEnergyData& energy) {
-    s_prefsOpen = s_prefs.begin("daily-energy", false);
-    if (!s_prefsOpen) return;
+  // Voriger Messwert je Modulplatz
+  static uint32_t s_prevMs = 0;
+  static bool     s_prevPresent[MAX_PYLON_BATTERIES] = {false};
+  static long     s_prevMv[MAX_PYLON_BATTERIES] = {0};
+  static long     s_prevMa[MAX_PYLON_BATTERIES] = {0};
 
-    energy.valid = true;
-    energy.localDayNumber = s_prefs.getULong("day", 0);
-    energy.chargeKWhToday = s_prefs.getFloat("chg", 0.0f);
-    energy.dischargeKWhToday = s_prefs.getFloat("dsg", 0.0f);
+  static void refreshDerived(dailyEnergyData& energy) {
+    energy.chargeKWhToday = energy.chargeToday.kWh();
+    energy.dischargeKWhToday = energy.dischargeToday.kWh();
   }
 
-  static void persist(const dailyEnergyData& energy, bool force = false) {
-    if (!s_prefsOpen) return;
-    const unsigned long nowMs = millis();
-    if (!force && (!s_dirty || (nowMs - s_lastPersistMs) < 300000UL)) return;
+  // Nach NvsStore::begin()
+  static void begin(dailyEnergyData& energy) {
+    const NvsStore::Record& rec = NvsStore::record();
+    energy.valid = true;
+    energy.localDayNumber = rec.energyDay;
+    energy.chargeToday = rec.chargeToday;
+    energy.dischargeToday = rec.dischargeToday;
+    energy.chargeTotal = rec.chargeTotal;
+    energy.dischargeTotal = rec.dischargeTotal;
+    memcpy(energy.batCharge, rec.batCharge, sizeof(rec.batCharge));
+    memcpy(energy.batDischarge, rec.batDischarge, sizeof(rec.batDischarge));
+    refreshDerived(energy);
+  }
 
-    s_prefs.putULong("day", energy.localDayNumber);
-    s_prefs.putFloat("chg", energy.chargeKWhToday);
-    s_prefs.putFloat("dsg", energy.dischargeKWhToday);
-    s_lastPersistMs = nowMs;
+  // Uebergibt geaenderte Zaehler an NvsStore; wann geschrieben wird,
+  // entscheidet dessen Budget
+  static void persist(const dailyEnergyData& energy) {
+    if (!s_dirty) return;
+    NvsStore::Record& rec = NvsStore::record();
+    rec.energyDay = energy.localDayNumber;
+    rec.chargeToday = energy.chargeToday;
+    rec.dischargeToday = energy.dischargeToday;
+    rec.chargeTotal = energy.chargeTotal;
+    rec.dischargeTotal = energy.dischargeTotal;
+    memcpy(rec.batCharge, energy.batCharge, sizeof(rec.batCharge));
+    memcpy(rec.batDischarge, energy.batDischarge, sizeof(rec.batDischarge));
+    NvsStore::markDirty();
     s_dirty = false;
   }
 
-  static void update(dailyEnergyData& energy, const batteryStack& stack, NTPClient& clock) {
-    static unsigned long lastIntegrateMs = 0;
-    const unsigned long nowMs = millis();
+  // Flaeche unter der Geraden a -> b ueber dtMs, getrennt nach Vorzeichen
+  static void trapezoid(int64_t a, int64_t b, uint32_t dtMs, uint64_t& pos, uint64_t& neg) {
+    pos = neg = 0;
+    if (a >= 0 && b >= 0) {
+      pos = (uint64_t)((a + b) * dtMs / 2);
+    } else if (a <= 0 && b <= 0) {
+      neg = (uint64_t)(-(a + b) * dtMs / 2);
+    } else {
+      const int64_t absA = a < 0 ? -a : a;
+      const int64_t absB = b < 0 ? -b : b;
+      const int64_t t0 = (int64_t)dtMs * absA / (absA + absB);
+      const int64_t rest = (int64_t)dtMs - t0;
+      if (a > 0) {
+        pos = (uint64_t)(absA * t0 / 2);
+        neg = (uint64_t)(absB * rest / 2);
+      } else {
+        neg = (uint64_t)(absA * t0 / 2);
+        pos = (uint64_t)(absB * rest / 2);
+      }
+    }
+  }
 
-    if (lastIntegrateMs == 0) {
-      lastIntegrateMs = nowMs;
+  // Uebernommener pwr-Messwert; sampleMs = erstes Antwortbyte
+  static void sample(dailyEnergyData& energy, const batteryStack& stack, uint32_t sampleMs) {
+    if (!sampleMs) sampleMs = millis();
+    const uint32_t dtMs = sampleMs - s_prevMs;
+
+    if (s_prevMs && dtMs > ENERGY_MAX_GAP_MS) {
+      energy.gaps++;
+      energy.gapMs += dtMs;
+    } else if (s_prevMs && dtMs > 0) {
+      // mV x mA = uW, uW x ms = nWs, mA x ms = uAs
+      int64_t p0 = 0, p1 = 0, i0 = 0, i1 = 0;
+      uint64_t ePos, eNeg, qPos, qNeg;
+      for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+        const pylonBattery& b = stack.batts[i];
+        if (!b.isPresent || !s_prevPresent[i]) continue;
+        const int64_t bp0 = (int64_t)s_prevMv[i] * s_prevMa[i];
+        const int64_t bp1 = (int64_t)b.voltage * b.current;
+        trapezoid(bp0, bp1, dtMs, ePos, eNeg);
+        trapezoid(s_prevMa[i], b.current, dtMs, qPos, qNeg);
+        energy.batCharge[i].add(ePos, qPos);
+        energy.batDischarge[i].add(eNeg, qNeg);
+        p0 += bp0;
+        p1 += bp1;
+        i0 += s_prevMa[i];
+        i1 += b.current;
+      }
+      trapezoid(p0, p1, dtMs, ePos, eNeg);
+      trapezoid(i0, i1, dtMs, qPos, qNeg);
+      energy.chargeToday.add(ePos, qPos);
+      energy.dischargeToday.add(eNeg, qNeg);
+      energy.chargeTotal.add(ePos, qPos);
+      energy.dischargeTotal.add(eNeg, qNeg);
+      energy.samples++;
+      refreshDerived(energy);
+      s_dirty = true;
     }
 
-    unsigned long dtMs = nowMs - lastIntegrateMs;
-    lastIntegrateMs = nowMs;
+    s_prevMs = sampleMs;
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      s_prevPresent[i] = stack.batts[i].isPresent;
+      s_prevMv[i] = stack.batts[i].voltage;
+      s_prevMa[i] = stack.batts[i].current;
+    }
+  }
 
+  static void update(dailyEnergyData& energy, NTPClient& clock) {
     energy.valid = true;
-    energy.lastUpdateMs = nowMs;
+    energy.lastUpdateMs = millis();
 
     const unsigned long epoch = clock.getEpochTime();
     const bool timeSynced = epoch > 1577836800UL;
+    // Tageswerte und timeSynced stehen im Snapshot-Cache von /api/stack
+    bool changed = (timeSynced != energy.timeSynced);
     energy.timeSynced = timeSynced;
     energy.currentEpoch = epoch;
 
@@ -506,29 +585,17 @@ namespace EnergyTracker {
       if (energy.localDayNumber == 0) {
         energy.localDayNumber = dayNumber;
         s_dirty = true;
+        changed = true;
       } else if (dayNumber != energy.localDayNumber) {
         energy.localDayNumber = dayNumber;
-        energy.chargeKWhToday = 0.0f;
-        energy.dischargeKWhToday = 0.0f;
+        energy.chargeToday = energyCounter();
+        energy.dischargeToday = energyCounter();
+        refreshDerived(energy);
         s_dirty = true;
+        changed = true;
       }
     }
-
-    if (!stack.valid || dtMs == 0 || dtMs > 15000UL) {
-      persist(energy);
-      return;
-    }
-
-    const float powerW = (float)stack.getPowerDC();
-    const float deltaHours = (float)dtMs / 3600000.0f;
-
-    if (powerW > 0.0f) {
-      energy.chargeKWhToday += (powerW * deltaHours) / 1000.0f;
-      s_dirty = true;
-    } else if (powerW < 0.0f) {
-      energy.dischargeKWhToday += ((-powerW) * deltaHours) / 1000.0f;
-      s_dirty = true;
-    }
+    if (changed) WebUI::markStackChanged();
 
     persist(energy);
   }
@@ -607,6 +674,8 @@ namespace StatRetry {
       }
 
       dbg.lastParseFailed = true;
+      link.noteParseFailure(CmdClass::Stat);
+      ParseCorpus::capture(statCmd, "parse_failed", recvBuf, link.stats().lastLatencyMs);
       strncpy(dbg.lastMessage,
               attempt < maxAttempts ? "parse failed, retry" : "parse failed",
               sizeof(dbg.lastMessage) - 1);
@@ -688,6 +757,7 @@ void roamIfNeeded(const char* ssid, const char* pass) {
   static unsigned long lastCheck = 0;
   if (millis() - lastCheck < 7000) return;
   lastCheck = millis();
+  Trace::Span span(Trace::Ev::Roam);
 
   if (WiFi.status() != WL_CONNECTED) return;
 
@@ -727,6 +797,57 @@ void roamIfNeeded(const char* ssid, const char* pass) {
   }
 }
 
+// -----------------------------------------------------------------------------
+// Laufzeit-Steuerung (MQTT-Befehlskanal, "!..."-Befehle)
+
+static unsigned long g_pwrPollMs    = 2000UL;
+static unsigned long g_pwrsysPollMs = 15000UL;   // bei unterdrueckter Ladung weiter 300 s
+static uint8_t g_statForceIdx   = 0;             // != 0: diese Batterie sofort abfragen
+static bool    g_statForceRound = false;         // erzwungene Runde im 30-s-Takt
+
+// "stat" = komplette stat-Runde jetzt, "stat <n>" = nur Batterie n,
+// "poll pwr|pwrsys <ms>" = Poll-Intervall bis zum naechsten Neustart aendern
+static bool handleControlCommand(const char* cmd, char* reply, size_t replySize) {
+  char verb[12] = "";
+  char arg[12] = "";
+  unsigned long value = 0;
+  const int n = sscanf(cmd, "%11s %11s %lu", verb, arg, &value);
+
+  if (n >= 1 && strcmp(verb, "stat") == 0) {
+    if (n == 1) {
+      g_statForceRound = true;
+      g_statForceIdx = 1;
+      snprintf(reply, replySize, "stat round scheduled");
+      return true;
+    }
+    const long idx = strtol(arg, nullptr, 10);
+    if (idx < 1 || idx > MAX_PYLON_BATTERIES) {
+      snprintf(reply, replySize, "battery 1..%d expected", MAX_PYLON_BATTERIES);
+      return false;
+    }
+    g_statForceIdx = (uint8_t)idx;
+    snprintf(reply, replySize, "stat %ld scheduled", idx);
+    return true;
+  }
+
+  if (n == 3 && strcmp(verb, "poll") == 0) {
+    if (strcmp(arg, "pwr") == 0 && value >= 1000UL && value <= 600000UL) {
+      g_pwrPollMs = value;
+    } else if (strcmp(arg, "pwrsys") == 0 && value >= 5000UL && value <= 600000UL) {
+      g_pwrsysPollMs = value;
+    } else {
+      snprintf(reply, replySize, "poll pwr 1000..600000 | poll pwrsys 5000..600000");
+      return false;
+    }
+    snprintf(reply, replySize, "%s every %lu ms", arg, value);
+    g_log.Log(reply);
+    return true;
+  }
+
+  snprintf(reply, replySize, "unknown control command");
+  return false;
+}
+
 // -----------------------------------------------------------------------------
 // Setup
 
@@ -740,8 +861,9 @@ void setup() {
     g_abnormalResetCount++;
   }
 
-  CrashTrace::begin();
+  NvsStore::begin();
   CrashTrace::mark(CrashPhase::Boot, true);
+  HeapHealth::begin();
 
   {
     char bootMsg[224];
@@ -783,6 +905,7 @@ void setup() {
   ArduinoOTA.setHostname(WIFI_HOSTNAME);
   ArduinoOTA
     .onStart([]() {
+      NvsStore::flush();
       Led::setOTA(true);
       Serial.println("OTA start");
     })
@@ -813,34 +936,11 @@ void setup() {
   Parser::init(&g_log);
 
   server.on("/", []() {
-    if (LittleFS.exists("/index.html")) {
-      File f = LittleFS.open("/index.html", "r");
-      server.streamFile(f, "text/html");
-      f.close();
-    } else {
-      server.send(404, "text/plain", "index.html not found");
-    }
+    WebUI::serveStatic("/index.html");
   });
 
   server.onNotFound([]() {
-    String path = server.uri();
-    if (path == "/") path = "/index.html";
-
-    if (LittleFS.exists(path)) {
-      String ct = "text/plain";
-      if (path.endsWith(".html")) ct = "text/html";
-      else if (path.endsWith(".css")) ct = "text/css";
-      else if (path.endsWith(".js")) ct = "application/javascript";
-      else if (path.endsWith(".json")) ct = "application/json";
-      else if (path.endsWith(".svg")) ct = "image/svg+xml";
-      else if (path.endsWith(".png")) ct = "image/png";
-
-      File f = LittleFS.open(path, "r");
-      server.streamFile(f, ct);
-      f.close();
-    } else {
-      server.send(404, "text/plain", "Not found");
-    }
+    WebUI::serveStatic(server.uri());
   });
 
   server.on("/health", []() {
@@ -861,42 +961,137 @@ void setup() {
   });
 
   server.on("/api/diag", []() {
-    StaticJsonDocument<1536> doc;
-    doc["resetReason"] = resetReasonToString(g_resetReason);
-    doc["savedPhase"] = CrashTrace::savedPhaseText();
-    doc["rtcPhase"] = CrashTrace::rtcPhaseText();
-    doc["bootCount"] = g_bootCount;
-    doc["abnormalResets"] = g_abnormalResetCount;
-    doc["freeHeap"] = ESP.getFreeHeap();
-    doc["minFreeHeap"] = ESP.getMinFreeHeap();
-    doc["uptimeMs"] = millis();
-    doc["wifiConnected"] = (WiFi.status() == WL_CONNECTED);
-    doc["wifiRssi"] = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
-    doc["lastEvent"] = g_diagLastEvent;
-    doc["lastCommand"] = g_diagLastCommand;
-    doc["lastError"] = g_diagLastError;
-    doc["lastRxLen"] = g_diagLastRxLen;
-    doc["lastRxExcerpt"] = g_diagLastRxExcerpt;
-    doc["lastFailureMs"] = g_diagLastFailureMs;
-    doc["lastSuccessCommand"] = g_diagLastSuccessCommand;
-    doc["lastSuccessMs"] = g_diagLastSuccessMs;
-
-    String out;
-    out.reserve(measureJson(doc) + 1);
-    serializeJson(doc, out);
-    server.sendHeader("Cache-Control", "no-store");
-    server.send(200, "application/json", out);
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    w.beginObject();
+    w.field("resetReason", resetReasonToString(g_resetReason));
+    w.field("savedPhase", CrashTrace::savedPhaseText());
+    w.field("rtcPhase", CrashTrace::rtcPhaseText());
+    w.field("bootCount", g_bootCount);
+    w.field("abnormalResets", g_abnormalResetCount);
+    w.field("freeHeap", ESP.getFreeHeap());
+    w.field("minFreeHeap", ESP.getMinFreeHeap());
+    w.field("uptimeMs", millis());
+    w.field("wifiConnected", (WiFi.status() == WL_CONNECTED));
+    w.field("wifiRssi", (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0);
+    w.field("lastEvent", g_diagLastEvent);
+    w.field("lastCommand", g_diagLastCommand);
+    w.field("lastError", g_diagLastError);
+    w.field("lastRxLen", g_diagLastRxLen);
+    w.field("lastRxExcerpt", g_diagLastRxExcerpt);
+    w.field("lastFailureMs", g_diagLastFailureMs);
+    w.field("lastSuccessCommand", g_diagLastSuccessCommand);
+    w.field("lastSuccessMs", g_diagLastSuccessMs);
+    w.field("sseClients", EventStream::clientCount());
+
+    w.beginObject("heap");
+    HeapHealth::writeFields(w);
+    w.endObject();
+
+    w.beginObject("nvs");
+    NvsStore::writeFields(w);
+    w.endObject();
+
+    w.beginObject("arena");
+    w.field("totalBytes", BufferPool::totalBytes());
+    w.beginArray("slots");
+    for (uint8_t i = 0; i < (uint8_t)BufferPool::Slot::Count; ++i) {
+      BufferPool::SlotStats st;
+      if (!BufferPool::stats((BufferPool::Slot)i, st)) continue;
+      w.beginObject();
+      w.field("name", st.name);
+      w.field("size", st.size);
+      w.field("highWater", st.highWater);
+      w.field("leases", st.leases);
+      w.field("denied", st.denied);
+      w.field("busy", st.busy);
+      w.field("owner", st.owner);
+      w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+
+#if ENABLE_MQTT
+    uint32_t mqttPublished = 0, mqttSuppressed = 0;
+    MQTTHandler::publishCounters(mqttPublished, mqttSuppressed);
+    w.beginObject("mqtt");
+    w.field("published", mqttPublished);
+    w.field("suppressed", mqttSuppressed);
+    const MQTTHandler::ConnStats c = MQTTHandler::connStats();
+    w.beginObject("conn");
+    w.field("phase", c.phase == MQTTHandler::ConnPhase::Connected  ? "connected" :
+                     c.phase == MQTTHandler::ConnPhase::Connecting ? "connecting" : "backoff");
+    w.field("health", c.health);
+    w.field("attempts", c.attempts);
+    w.field("successes", c.successes);
+    w.field("failures", c.failures);
+    w.field("disconnects", c.disconnects);
+    w.field("backoffMs", c.backoffMs);
+    w.field("lastConnectMs", c.lastConnectMs);
+    w.field("maxConnectMs", c.maxConnectMs);
+    w.endObject();
+    const MqttQueue::Stats q = MqttQueue::stats();
+    w.beginObject("queue");
+    w.field("depth", q.depth);
+    w.field("bytes", q.bytes);
+    w.field("spillBytes", q.spillBytes);
+    w.field("enqueued", q.enqueued);
+    w.field("sent", q.sent);
+    w.field("coalesced", q.coalesced);
+    w.field("spilled", q.spilled);
+    w.field("dropped", q.dropped);
+    w.endObject();
+    w.endObject();
+#endif
+
+    w.endObject();
+  });
+
+  // UART-Link je Befehlsart: Latenz-Histogramm (Grenzen in boundsMs) und Fehlerbilder
+  server.on("/api/link", HTTP_GET, []() {
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    const LinkStats& total = batt.stats();
+    w.beginObject();
+    w.field("busy", batt.isBusy());
+    w.field("ok", total.ok);
+    w.field("failed", total.failed);
+    w.beginArray("boundsMs");
+    for (size_t i = 0; i < kLinkLatencyBuckets; ++i) w.value(kLinkLatencyBucketMs[i]);
+    w.endArray();
+    w.beginObject("commands");
+    for (size_t c = 0; c < (size_t)CmdClass::Count; ++c) {
+      w.beginObject(cmdClassName((CmdClass)c));
+      writeLinkClassFields(w, batt.classStats((CmdClass)c));
+      w.endObject();
+    }
+    w.endObject();
+    w.endObject();
   });
 
   server.on("/log", []() {
-    server.send(200, "text/html", g_log.c_str());
+    // Ringpuffer direkt in zwei Abschnitten senden statt ihn vorher zu linearisieren
+    server.setContentLength(g_log.length());
+    server.send(200, "text/html", "");
+    g_log.forEachSegment([](const char* data, size_t len) {
+      server.sendContent(data, len);
+    });
   });
 
   WebUI::init(&server, &batt, &g_stack, &g_systemStack, &g_dailyEnergy,
               &g_statDebug,
-              g_szRecvBuffCmd,
-              sizeof(g_szRecvBuffCmd),
               &g_log);
+  EventStream::init(&server, &g_stack, &g_systemStack, &g_dailyEnergy, &g_log);
+  ConsoleJobs::init(&server, &batt, &g_log);
+  Metrics::init(&server, &batt, &g_stack, &g_systemStack, &g_dailyEnergy);
+  ParseCorpus::init(&server, &g_dailyEnergy);
+  DataAge::init(&server, &g_dailyEnergy);
+  Trace::init(&server);
+  SoakMonitor::init(&server, &g_dailyEnergy, &g_log);
+#if PYLON_SIMULATOR
+  g_sim.init(&server);
+  SoakMonitor::setReference([]() { return g_sim.stackPowerMw(); });
+#endif
 
   server.begin();
   Serial.println("HTTP server started");
@@ -904,7 +1099,9 @@ void setup() {
 #if ENABLE_MQTT
   mqttClient.setServer(MQTT_SERVER, MQTT_PORT);
   mqttClient.setBufferSize(1024);
-  MQTTHandler::init(&mqttClient, &g_stack, &g_systemStack, &g_dailyEnergy);
+  MQTTHandler::init(&mqttClient, &espClient, &g_stack, &g_systemStack, &g_dailyEnergy);
+  MQTTHandler::setControlHandler(handleControlCommand);
+  SoakMonitor::setOutageHandler(MQTTHandler::suspend);
 #endif
 }
 
@@ -912,16 +1109,39 @@ void setup() {
 // Loop
 
 void loop() {
+  RuntimeStats::LoopTimer loopTimer;
+  Trace::Span loopSpan(Trace::Ev::Loop);
   CrashTrace::mark(CrashPhase::Loop);
   ArduinoOTA.handle();
-  server.handleClient();
-  timeClient.update();
-  EnergyTracker::update(g_dailyEnergy, g_stack, timeClient);
+  {
+    HeapHealth::Scope heapScope(HeapHealth::Sub::Web);
+    Trace::Span span(Trace::Ev::HandleClient);
+    server.handleClient();
+    WebUI::loop();
+    EventStream::loop();
+  }
+  {
+    HeapHealth::Scope heapScope(HeapHealth::Sub::Jobs);
+    Trace::Span span(Trace::Ev::Jobs);
+    ConsoleJobs::loop();
+  }
+  {
+    Trace::Span span(Trace::Ev::Ntp);
+    timeClient.update();
+  }
+  EnergyTracker::update(g_dailyEnergy, timeClient);
+  HeapHealth::loop();
+  SoakMonitor::loop();
+  NvsStore::loop();
 
 #if ENABLE_MQTT
-  CrashTrace::mark(CrashPhase::MqttLoop);
-  MQTTHandler::loop();
-  publishMqttDiagnosticSnapshot();
+  {
+    HeapHealth::Scope heapScope(HeapHealth::Sub::Mqtt);
+    CrashTrace::mark(CrashPhase::MqttLoop);
+    Trace::Span span(Trace::Ev::MqttLoop);
+    MQTTHandler::loop();
+    publishMqttDiagnosticSnapshot();
+  }
 #endif
 
   bool wifiOK = (WiFi.status() == WL_CONNECTED);
@@ -965,26 +1185,38 @@ void loop() {
   // ---------------------------
   // Hauptpolling
   // ---------------------------
+  // Allokationen ab hier bis loop()-Ende zaehlen als "poll"
+  HeapHealth::Scope pollHeapScope(HeapHealth::Sub::Poll);
+  // Laeuft gerade ein Konsolen-Job, wartet das Polling, bis
+  // ConsoleJobs::loop() den Link wieder freigibt.
   static uint32_t lastPollPwr = 0;
-  if (millis() - lastPollPwr >= 2000UL) {
+  if (millis() - lastPollPwr >= g_pwrPollMs && !batt.isBusy()) {
+    if (lastPollPwr) SoakMonitor::notePoll(SoakMonitor::Poll::Pwr, millis() - lastPollPwr, g_pwrPollMs);
     lastPollPwr = millis();
     CrashTrace::mark(CrashPhase::PwrPoll);
 
+    BufferLease rx(BufferPool::Slot::Rx, "pwr");
+    char* const recvBuf = rx.data();
+    const size_t recvBufLen = rx.size();
+
+    if (!rx) g_log.Log("PWR skipped - rx buffer busy");
+
     const unsigned long pwrT0 = millis();
-    bool pwrHandled = false;
+    bool pwrHandled = !rx;
     for (int attempt = 1; attempt <= 2 && !pwrHandled; ++attempt) {
-      memset(g_szRecvBuffPoll, 0, sizeof(g_szRecvBuffPoll));
-      if (!batt.sendAndReceive("pwr", g_szRecvBuffPoll, sizeof(g_szRecvBuffPoll), 4000)) {
+      memset(recvBuf, 0, recvBufLen);
+      if (!batt.sendAndReceive("pwr", recvBuf, recvBufLen, 4000)) {
         char msg[48];
         snprintf(msg, sizeof(msg), "PWR timeout after %lums", millis() - pwrT0);
         g_log.Log(msg);
-        publishMqttDiagnosticFailure("pwr", msg, g_szRecvBuffPoll);
+        publishMqttDiagnosticFailure("pwr", msg, recvBuf);
         break;
       }
 
       const unsigned long pwrMs = millis() - pwrT0;
       batteryStack parsedStack = g_stack;
-      if (Parser::parsePwr(g_szRecvBuffPoll, &parsedStack)) {
+      if (Parser::parsePwr(recvBuf, &parsedStack)) {
+        const uint32_t parsedMs = millis();
         clearMqttDiagnosticFailure("pwr");
         if (StackGuard::shouldAcceptParsedStack(g_stack, parsedStack)) {
           const bool stateChanged = strcmp(g_stack.baseState, parsedStack.baseState) != 0
@@ -992,6 +1224,13 @@ void loop() {
           batteryStack previousStack = g_stack;
           g_stack = parsedStack;
           StackGuard::markAccepted(previousStack, parsedStack);
+          DataAge::noteSample(DataAge::Source::Pwr, batt.lastTiming(), parsedMs, millis());
+          EnergyTracker::sample(g_dailyEnergy, g_stack, batt.lastTiming().firstRxMs);
+          WebUI::markStackChanged();
+          EventStream::notifyStack();
+#if ENABLE_MQTT
+          MQTTHandler::markUpdated(MQTTHandler::Source::Pwr);
+#endif
           if (stateChanged || pwrMs > 2000) {
             char msg[80];
             snprintf(msg, sizeof(msg), "PWR %dbats state=%s SoC=%d%% %lums",
@@ -1008,20 +1247,25 @@ void loop() {
                    StackGuard::missingCycles());
           g_log.Log(msg);
           publishMqttDiagnosticEvent(msg, true);
+          ParseCorpus::capture("pwr", "held_drop", recvBuf, pwrMs);
         }
         pwrHandled = true;
         continue;
       }
 
-      if (attempt == 1 && rxLooksLikePwrsysPayload(g_szRecvBuffPoll)) {
+      if (attempt == 1 && rxLooksLikePwrsysPayload(recvBuf)) {
+        batt.noteMisattributed(CmdClass::Pwr);
+        ParseCorpus::capture("pwr", "misattributed", recvBuf, pwrMs);
         g_log.Log("PWR got PWRSYS payload - retrying");
         publishMqttDiagnosticEvent("PWR got PWRSYS payload - retrying", true);
         delay(80);
         continue;
       }
 
+      batt.noteParseFailure(CmdClass::Pwr);
+      ParseCorpus::capture("pwr", "parse_failed", recvBuf, pwrMs);
       g_log.Log("PWR parse failed - keeping previous values");
-      publishMqttDiagnosticFailure("pwr", "PWR parse failed - keeping previous values", g_szRecvBuffPoll);
+      publishMqttDiagnosticFailure("pwr", "PWR parse failed - keeping previous values", recvBuf);
       break;
     }
   }
@@ -1035,35 +1279,49 @@ void loop() {
     g_systemStack.soc >= 99 &&
     g_systemStack.rec_chg_current == 0 &&
     g_systemStack.sys_rec_chg_current == 0;
-  const unsigned long pwrsysPollInterval = chargeSuppressed ? 300000UL : 15000UL;
+  const unsigned long pwrsysPollInterval = chargeSuppressed ? 300000UL : g_pwrsysPollMs;
   const unsigned long pwrsysTimeoutMs = chargeSuppressed ? 5000UL : 6000UL;
 
-  if (millis() - lastPollPwrsys >= pwrsysPollInterval) {
+  if (millis() - lastPollPwrsys >= pwrsysPollInterval && !batt.isBusy()) {
+    if (lastPollPwrsys) SoakMonitor::notePoll(SoakMonitor::Poll::Pwrsys, millis() - lastPollPwrsys, pwrsysPollInterval);
     lastPollPwrsys = millis();
     CrashTrace::mark(CrashPhase::PwrsysPoll);
 
+    BufferLease rx(BufferPool::Slot::Rx, "pwrsys");
+    char* const recvBuf = rx.data();
+    const size_t recvBufLen = rx.size();
+
+    if (!rx) g_log.Log("PWRSYS skipped - rx buffer busy");
+
     const unsigned long pwrsysT0 = millis();
-    bool pwrsysHandled = false;
+    bool pwrsysHandled = !rx;
     for (int attempt = 1; attempt <= 2 && !pwrsysHandled; ++attempt) {
-      memset(g_szRecvBuffPoll, 0, sizeof(g_szRecvBuffPoll));
-      if (!batt.sendAndReceive("pwrsys", g_szRecvBuffPoll, sizeof(g_szRecvBuffPoll), pwrsysTimeoutMs)) {
-        if (chargeSuppressed && rxLooksLikePromptOnly(g_szRecvBuffPoll)) {
+      memset(recvBuf, 0, recvBufLen);
+      if (!batt.sendAndReceive("pwrsys", recvBuf, recvBufLen, pwrsysTimeoutMs)) {
+        if (chargeSuppressed && rxLooksLikePromptOnly(recvBuf)) {
           g_log.Log("PWRSYS prompt-only timeout in idle/full - keeping previous values");
           publishMqttDiagnosticEvent("PWRSYS prompt-only timeout in idle/full - keeping previous values");
         } else {
           char msg[48];
           snprintf(msg, sizeof(msg), "PWRSYS timeout after %lums", millis() - pwrsysT0);
           g_log.Log(msg);
-          publishMqttDiagnosticFailure("pwrsys", msg, g_szRecvBuffPoll);
+          publishMqttDiagnosticFailure("pwrsys", msg, recvBuf);
         }
         break;
       }
 
       const unsigned long pwrsysMs = millis() - pwrsysT0;
       systemData parsedSystem = g_systemStack;
-      if (Parser::parsePwrsys(g_szRecvBuffPoll, &parsedSystem)) {
+      if (Parser::parsePwrsys(recvBuf, &parsedSystem)) {
+        const uint32_t parsedMs = millis();
         clearMqttDiagnosticFailure("pwrsys");
         g_systemStack = parsedSystem;
+        DataAge::noteSample(DataAge::Source::Pwrsys, batt.lastTiming(), parsedMs, millis());
+        WebUI::markSystemChanged();
+        EventStream::notifySystem();
+#if ENABLE_MQTT
+        MQTTHandler::markUpdated(MQTTHandler::Source::Pwrsys);
+#endif
         if (pwrsysMs > 3000) {
           char msg[48];
           snprintf(msg, sizeof(msg), "PWRSYS slow: %lums", pwrsysMs);
@@ -1074,19 +1332,23 @@ void loop() {
         continue;
       }
 
-      if (attempt == 1 && rxLooksLikePwrPayload(g_szRecvBuffPoll)) {
+      if (attempt == 1 && rxLooksLikePwrPayload(recvBuf)) {
+        batt.noteMisattributed(CmdClass::Pwrsys);
+        ParseCorpus::capture("pwrsys", "misattributed", recvBuf, pwrsysMs);
         g_log.Log("PWRSYS got PWR payload - retrying");
         publishMqttDiagnosticEvent("PWRSYS got PWR payload - retrying", true);
         delay(80);
         continue;
       }
 
-      if (chargeSuppressed && rxLooksLikePromptOnly(g_szRecvBuffPoll)) {
+      if (chargeSuppressed && rxLooksLikePromptOnly(recvBuf)) {
         g_log.Log("PWRSYS prompt-only in idle/full - keeping previous values");
         publishMqttDiagnosticEvent("PWRSYS prompt-only in idle/full - keeping previous values");
       } else {
+        batt.noteParseFailure(CmdClass::Pwrsys);
+        ParseCorpus::capture("pwrsys", "parse_failed", recvBuf, pwrsysMs);
         g_log.Log("PWRSYS parse failed - keeping previous values");
-        publishMqttDiagnosticFailure("pwrsys", "PWRSYS parse failed - keeping previous values", g_szRecvBuffPoll);
+        publishMqttDiagnosticFailure("pwrsys", "PWRSYS parse failed - keeping previous values", recvBuf);
       }
       break;
     }
@@ -1108,13 +1370,26 @@ const unsigned long statBootDelayMs       = 60000UL;       // 60 s nach Boot war
 const unsigned long statInitialIntervalMs = 30000UL;       // 30 s zwischen Batterien beim Initiallauf
 const unsigned long statRegularIntervalMs = 14400000UL;    // 4 h zwischen Batterien danach
 
-if (millis() - statBootDelayStart >= statBootDelayMs) {
-  unsigned long statInterval = statInitialRun ? statInitialIntervalMs : statRegularIntervalMs;
+const bool statForced = (g_statForceIdx != 0);
+if (statForced || millis() - statBootDelayStart >= statBootDelayMs) {
+  unsigned long statInterval = (statInitialRun || g_statForceRound) ? statInitialIntervalMs : statRegularIntervalMs;
 
-  if (lastPollStat == 0 || (millis() - lastPollStat >= statInterval)) {
+  if (!batt.isBusy() && (statForced || lastPollStat == 0 || (millis() - lastPollStat >= statInterval))) {
     lastPollStat = millis();
     CrashTrace::mark(CrashPhase::StatPoll);
 
+    // einzeln angeforderte Batterie: danach normal weiter, wo die Runde stand
+    uint8_t resumeIdx = 0;
+    if (statForced) {
+      if (g_statForceRound) {
+        statIdx = g_statForceIdx;
+      } else {
+        resumeIdx = statIdx;
+        statIdx = g_statForceIdx;
+      }
+      g_statForceIdx = 0;
+    }
+
     int highestPresentIdx = 0;
     for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
       if (g_stack.batts[i].isPresent) {
@@ -1129,7 +1404,7 @@ if (millis() - statBootDelayStart >= statBootDelayMs) {
     if (maxBat < 1) maxBat = 1;
     if (maxBat > MAX_PYLON_BATTERIES) maxBat = MAX_PYLON_BATTERIES;
 
-    if (statIdx > maxBat) statIdx = 1;
+    if (statIdx > maxBat && !resumeIdx) statIdx = 1;
 
     g_statDebug.currentIdx = statIdx;
     g_statDebug.maxBat = maxBat;
@@ -1152,18 +1427,27 @@ if (millis() - statBootDelayStart >= statBootDelayMs) {
       publishMqttDiagnosticEvent(dbg);
     }
 
-    StatRetry::run(batt,
-                   g_log,
-                   g_szRecvBuffPoll,
-                   sizeof(g_szRecvBuffPoll),
-                   statIdx,
-                   g_stack,
-                   g_statDebug);
+    {
+      BufferLease rx(BufferPool::Slot::Rx, "stat");
+      if (rx && StatRetry::run(batt,
+                               g_log,
+                               rx.data(),
+                               rx.size(),
+                               statIdx,
+                               g_stack,
+                               g_statDebug)) {
+        WebUI::markStackChanged();
+#if ENABLE_MQTT
+        MQTTHandler::markUpdated(MQTTHandler::Source::Stat);
+#endif
+      }
+    }
 
-    statIdx++;
+    statIdx = resumeIdx ? resumeIdx : (uint8_t)(statIdx + 1);
 
     if (statIdx > maxBat) {
       statIdx = 1;
+      g_statForceRound = false;
 
       if (statInitialRun) {
         statInitialRun = false;
@@ -1179,7 +1463,10 @@ if (millis() - statBootDelayStart >= statBootDelayMs) {
 
 #if ENABLE_MQTT
   CrashTrace::mark(CrashPhase::MqttPublish);
-  MQTTHandler::publishIfConnected();
+  {
+    HeapHealth::Scope heapScope(HeapHealth::Sub::Mqtt);
+    MQTTHandler::publishIfConnected();
+  }
 #endif
 
   CrashTrace::mark(CrashPhase::Roam);
@@ -0,0 +1,35 @@
+#include "RuntimeStats.h"
+#include <Arduino.h>
+
+const uint32_t RuntimeStats::kLoopBucketUs[RuntimeStats::kLoopBuckets] = {
+  1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000
+};
+
+namespace {
+  RuntimeStats::LoopStats s_loop;
+}
+
+void RuntimeStats::recordLoop(uint32_t us) {
+  s_loop.count++;
+  s_loop.sumUs += us;
+  s_loop.lastUs = us;
+  if (us > s_loop.maxUs) s_loop.maxUs = us;
+
+  for (size_t i = 0; i < kLoopBuckets; ++i) {
+    if (us <= kLoopBucketUs[i]) {
+      s_loop.buckets[i]++;
+      return;
+    }
+  }
+  s_loop.overflow++;
+}
+
+const RuntimeStats::LoopStats& RuntimeStats::loop() {
+  return s_loop;
+}
+
+RuntimeStats::LoopTimer::LoopTimer() : m_startUs(micros()) {}
+
+RuntimeStats::LoopTimer::~LoopTimer() {
+  recordLoop(micros() - m_startUs);
+}
@@ -0,0 +1,332 @@
+#include "SoakMonitor.h"
+#include "HeapHealth.h"
+#include "JsonWriter.h"
+#include "RuntimeStats.h"
+#include "WebUI.h"
+#include <Arduino.h>
+
+namespace {
+  constexpr size_t kMetrics = (size_t)SoakMonitor::Metric::Count;
+  constexpr size_t kPolls   = (size_t)SoakMonitor::Poll::Count;
+
+  const char* const kMetricNames[kMetrics] = {
+    "freeHeap", "largestBlock", "allocBlocks", "netAllocs",
+    "loopAvgUs", "pwrLateMs", "pwrsysLateMs", "minStackFree"
+  };
+  const char* const kPollNames[kPolls] = { "pwr", "pwrsys" };
+
+  // -1 = Abnahme ist schlecht, +1 = Zunahme, 0 = nicht bewerten
+  const int8_t kDirection[kMetrics] = { -1, -1, +1, +1, +1, +1, +1, 0 };
+
+  // Vorzeichenbehaftet: netAllocs kann negativ werden (Freigaben von
+  // Speicher, der vor dem Zaehlen angelegt wurde)
+  struct Sample {
+    uint32_t uptimeS;
+    int32_t  v[kMetrics];
+  };
+
+  struct PollStats {
+    uint32_t count = 0;
+    uint32_t expectedMs = 0;
+    uint32_t lateMaxMs = 0;
+    uint64_t lateSumMs = 0;
+    // Fenster seit der letzten Abtastung
+    uint32_t winCount = 0;
+    uint64_t winLateMs = 0;
+  };
+
+  struct Energy {
+    double truthChgWh = 0, truthDsgWh = 0;
+    double obsChgWh = 0,   obsDsgWh = 0;
+    uint64_t lastChgMWs = 0, lastDsgMWs = 0;
+    uint32_t lastMs = 0;
+  };
+
+  WebServer*                 s_server = nullptr;
+  const dailyEnergyData*     s_energy = nullptr;
+  circular_log<16384>*       s_log = nullptr;
+  SoakMonitor::PowerFn       s_reference = nullptr;
+  SoakMonitor::OutageFn      s_outage = nullptr;
+
+  Sample    s_ring[SOAK_SAMPLES];
+  Sample    s_baseline;
+  uint32_t  s_head = 0;             // Abtastungen seit Start/Reset
+  uint32_t  s_lastSampleMs = 0;
+  uint32_t  s_loopCount = 0;        // Stand von RuntimeStats beim letzten Abtasten
+  uint64_t  s_loopSumUs = 0;
+  PollStats s_polls[kPolls];
+  Energy    s_nrg;
+
+  int       s_failedMetric = -1;    // kMetrics = Energiebilanz
+  uint32_t  s_failedAtS = 0;
+
+  const Sample& at(uint32_t idx) { return s_ring[idx % SOAK_SAMPLES]; }
+
+  // Laenge der juengsten Folge ohne Erholung; worse = davon echte Verschlechterungen
+  uint32_t growthRun(size_t m, uint32_t& worse) {
+    worse = 0;
+    const uint32_t avail = s_head < SOAK_SAMPLES ? s_head : SOAK_SAMPLES;
+    if (!kDirection[m] || avail < 2) return 0;
+    uint32_t run = 0;
+    for (uint32_t i = s_head - 1; i > s_head - avail; --i) {
+      const long long d = ((long long)at(i).v[m] - (long long)at(i - 1).v[m]) * kDirection[m];
+      if (d < 0) break;
+      if (d > 0) worse++;
+      run++;
+    }
+    return run;
+  }
+
+  long energyErrPermille() {
+    const double truth = s_nrg.truthChgWh + s_nrg.truthDsgWh;
+    if (truth < 10.0) return 0;
+    const double obs = s_nrg.obsChgWh + s_nrg.obsDsgWh;
+    return (long)((obs - truth) * 1000.0 / truth);
+  }
+
+  void integrateEnergy(uint32_t now) {
+    if (!s_reference || !s_energy) return;
+    // Gesamtzaehler statt Tageswerte: kein Sprung beim Tageswechsel
+    const uint64_t chg = s_energy->chargeTotal.mWs;
+    const uint64_t dsg = s_energy->dischargeTotal.mWs;
+    if (!s_nrg.lastMs) {
+      s_nrg.lastMs = now;
+      s_nrg.lastChgMWs = chg;
+      s_nrg.lastDsgMWs = dsg;
+      return;
+    }
+    const uint32_t dt = now - s_nrg.lastMs;
+    if (dt < 1000) return;
+
+    const double wh = (double)s_reference() * dt / 3600000.0 / 1000.0;
+    if (wh > 0) s_nrg.truthChgWh += wh;
+    else        s_nrg.truthDsgWh -= wh;
+
+    s_nrg.obsChgWh += (double)(chg - s_nrg.lastChgMWs) / 3600000.0;
+    s_nrg.obsDsgWh += (double)(dsg - s_nrg.lastDsgMWs) / 3600000.0;
+    s_nrg.lastChgMWs = chg;
+    s_nrg.lastDsgMWs = dsg;
+    s_nrg.lastMs = now;
+  }
+
+  void takeSample(uint32_t now) {
+    const HeapHealth::Info& hi = HeapHealth::info();
+    Sample& s = s_ring[s_head % SOAK_SAMPLES];
+    s.uptimeS = now / 1000;
+    s.v[(size_t)SoakMonitor::Metric::FreeHeap]     = (int32_t)hi.freeBytes;
+    s.v[(size_t)SoakMonitor::Metric::LargestBlock] = (int32_t)hi.largestBlock;
+    s.v[(size_t)SoakMonitor::Metric::AllocBlocks]  = (int32_t)hi.allocatedBlocks;
+
+    int64_t net = 0;
+    if (HeapHealth::hookEnabled()) {
+      for (size_t i = 0; i < (size_t)HeapHealth::Sub::Count; ++i) {
+        const HeapHealth::SubStats& st = HeapHealth::subStats((HeapHealth::Sub)i);
+        net += (int64_t)st.allocs - (int64_t)st.frees;
+      }
+    }
+    if (net > INT32_MAX) net = INT32_MAX;
+    if (net < INT32_MIN) net = INT32_MIN;
+    s.v[(size_t)SoakMonitor::Metric::NetAllocs] = (int32_t)net;
+
+    const RuntimeStats::LoopStats& ls = RuntimeStats::loop();
+    const uint32_t loops = ls.count - s_loopCount;
+    s.v[(size_t)SoakMonitor::Metric::LoopAvgUs] = loops ? (int32_t)((ls.sumUs - s_loopSumUs) / loops) : 0;
+    s_loopCount = ls.count;
+    s_loopSumUs = ls.sumUs;
+
+    for (size_t p = 0; p < kPolls; ++p) {
+      PollStats& ps = s_polls[p];
+      s.v[(size_t)SoakMonitor::Metric::PwrLateMs + p] = ps.winCount ? (int32_t)(ps.winLateMs / ps.winCount) : 0;
+      ps.winCount = 0;
+      ps.winLateMs = 0;
+    }
+
+    uint32_t minStack = UINT32_MAX;
+    for (size_t i = 0; i < HeapHealth::taskCount(); ++i) {
+      const char* name = nullptr;
+      uint32_t freeBytes = 0;
+      if (HeapHealth::task(i, name, freeBytes) && freeBytes < minStack) minStack = freeBytes;
+    }
+    s.v[(size_t)SoakMonitor::Metric::MinStackFree] = minStack == UINT32_MAX ? 0 : (int32_t)minStack;
+
+    if (!s_head) s_baseline = s;
+    s_head++;
+
+    if (s_failedMetric >= 0) return;
+    for (size_t m = 0; m < kMetrics; ++m) {
+      uint32_t worse = 0;
+      if (growthRun(m, worse) >= SOAK_GROWTH_RUN && worse * 2 >= SOAK_GROWTH_RUN) {
+        s_failedMetric = (int)m;
+        break;
+      }
+    }
+    const long err = energyErrPermille();
+    if (s_failedMetric < 0 && (err > SOAK_ENERGY_ERR_PERMILLE || err < -SOAK_ENERGY_ERR_PERMILLE)) {
+      s_failedMetric = (int)kMetrics;
+    }
+    if (s_failedMetric >= 0) {
+      s_failedAtS = s.uptimeS;
+      if (s_log) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "SOAK fail: %s", SoakMonitor::failedMetric());
+        s_log->Log(msg);
+      }
+    }
+  }
+
+  void reset() {
+    s_head = 0;
+    s_lastSampleMs = millis();
+    s_failedMetric = -1;
+    s_failedAtS = 0;
+    for (PollStats& ps : s_polls) ps = PollStats();
+    s_nrg = Energy();
+    const RuntimeStats::LoopStats& ls = RuntimeStats::loop();
+    s_loopCount = ls.count;
+    s_loopSumUs = ls.sumUs;
+  }
+
+  void sendJson() {
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    const uint32_t avail = s_head < SOAK_SAMPLES ? s_head : SOAK_SAMPLES;
+
+    w.beginObject();
+    w.field("uptimeMs", millis());
+    w.field("intervalMs", (unsigned long)SOAK_SAMPLE_INTERVAL_MS);
+    w.field("samples", s_head);
+    w.field("growthRun", (unsigned)SOAK_GROWTH_RUN);
+    w.field("verdict", s_failedMetric >= 0 ? "fail" : (s_head > SOAK_GROWTH_RUN ? "ok" : "collecting"));
+    if (s_failedMetric >= 0) {
+      w.field("failed", SoakMonitor::failedMetric());
+      w.field("failedAtS", s_failedAtS);
+    }
+
+    w.beginObject("metrics");
+    for (size_t m = 0; m < kMetrics; ++m) {
+      uint32_t worse = 0;
+      const uint32_t run = growthRun(m, worse);
+      w.beginObject(kMetricNames[m]);
+      if (s_head) {
+        w.field("baseline", s_baseline.v[m]);
+        w.field("last", at(s_head - 1).v[m]);
+      }
+      w.field("run", run);
+      w.field("worse", worse);
+      w.endObject();
+    }
+    w.endObject();
+
+    w.beginObject("polls");
+    for (size_t p = 0; p < kPolls; ++p) {
+      const PollStats& ps = s_polls[p];
+      w.beginObject(kPollNames[p]);
+      w.field("count", ps.count);
+      w.field("expectedMs", ps.expectedMs);
+      w.field("lateAvgMs", ps.count ? (uint32_t)(ps.lateSumMs / ps.count) : 0U);
+      w.field("lateMaxMs", ps.lateMaxMs);
+      w.endObject();
+    }
+    w.endObject();
+
+    if (s_log) {
+      w.beginObject("log");
+      w.field("bytes", (unsigned long)s_log->length());
+      w.field("capacity", (unsigned long)s_log->capacity());
+      w.endObject();
+    }
+
+    if (s_reference) {
+      w.beginObject("energy");
+      w.field("truthChgWh", s_nrg.truthChgWh);
+      w.field("obsChgWh", s_nrg.obsChgWh);
+      w.field("truthDsgWh", s_nrg.truthDsgWh);
+      w.field("obsDsgWh", s_nrg.obsDsgWh);
+      w.field("errPermille", energyErrPermille());
+      w.endObject();
+    }
+
+    w.beginArray("columns");
+    w.value("uptimeS");
+    for (size_t m = 0; m < kMetrics; ++m) w.value(kMetricNames[m]);
+    w.endArray();
+    w.beginArray("history");
+    for (uint32_t i = s_head - avail; i != s_head; ++i) {
+      const Sample& s = at(i);
+      w.beginArray();
+      w.value(s.uptimeS);
+      for (size_t m = 0; m < kMetrics; ++m) w.value(s.v[m]);
+      w.endArray();
+    }
+    w.endArray();
+    w.endObject();
+  }
+
+  void handlePost() {
+    if (s_server->hasArg("reset")) reset();
+    if (s_server->hasArg("mqttOutageS")) {
+      const unsigned long s = strtoul(s_server->arg("mqttOutageS").c_str(), nullptr, 10);
+      if (!s_outage) {
+        s_server->send(501, "text/plain", "no mqtt");
+        return;
+      }
+      if (s < 1 || s > 86400) {
+        s_server->send(400, "text/plain", "mqttOutageS: 1..86400");
+        return;
+      }
+      s_outage(s * 1000UL);
+    }
+    s_server->send(204);
+  }
+}
+
+void SoakMonitor::init(WebServer* server, const dailyEnergyData* energy, circular_log<16384>* clog) {
+  s_server = server;
+  s_energy = energy;
+  s_log    = clog;
+  s_lastSampleMs = millis();
+  if (!s_server) return;
+  s_server->on("/api/soak", HTTP_GET, []() { sendJson(); });
+  s_server->on("/api/soak", HTTP_POST, []() { handlePost(); });
+}
+
+void SoakMonitor::setReference(PowerFn fn) {
+  s_reference = fn;
+}
+
+void SoakMonitor::setOutageHandler(OutageFn fn) {
+  s_outage = fn;
+}
+
+void SoakMonitor::loop() {
+  const uint32_t now = millis();
+  integrateEnergy(now);
+  if (now - s_lastSampleMs < SOAK_SAMPLE_INTERVAL_MS) return;
+  s_lastSampleMs = now;
+  takeSample(now);
+}
+
+void SoakMonitor::notePoll(Poll poll, uint32_t intervalMs, uint32_t expectedMs) {
+  if ((size_t)poll >= kPolls) return;
+  PollStats& ps = s_polls[(size_t)poll];
+  const uint32_t late = intervalMs > expectedMs ? intervalMs - expectedMs : 0;
+  ps.count++;
+  ps.expectedMs = expectedMs;
+  ps.lateSumMs += late;
+  if (late > ps.lateMaxMs) ps.lateMaxMs = late;
+  ps.winCount++;
+  ps.winLateMs += late;
+}
+
+bool SoakMonitor::failed() {
+  return s_failedMetric >= 0;
+}
+
+const char* SoakMonitor::failedMetric() {
+  if (s_failedMetric < 0) return nullptr;
+  return (size_t)s_failedMetric < kMetrics ? kMetricNames[s_failedMetric] : "energy";
+}
+
+const char* SoakMonitor::metricName(Metric m) {
+  return (size_t)m < kMetrics ? kMetricNames[(size_t)m] : "?";
+}
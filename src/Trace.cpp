@@ -0,0 +1,112 @@
+#include "Trace.h"
+#include "JsonWriter.h"
+#include "WebUI.h"
+#include <esp_timer.h>
+#include <Arduino.h>
+
+static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS muss eine Zweierpotenz sein");
+
+namespace {
+  struct Event {
+    uint64_t startUs;
+    uint32_t durUs;
+    uint16_t arg;
+    uint8_t  ev;
+    uint8_t  reserved;
+  };
+
+  const char* const kNames[(size_t)Trace::Ev::Count] = {
+    "loop", "handleClient", "consoleJobs", "ntp", "mqttLoop", "publishData", "discovery",
+    "sendAndReceive", "uartRead", "parsePwr", "parsePwrsys", "parseStat", "roam", "nvsWrite"
+  };
+
+  WebServer* s_server = nullptr;
+#if TRACE_ENABLE
+  Event      s_ring[TRACE_EVENTS];
+#endif
+  uint32_t   s_head = 0;          // naechster Schreibplatz, laeuft ueber
+  bool       s_paused = false;    // waehrend des Exports
+
+  void sendTrace() {
+    s_paused = true;
+    const uint32_t head = s_head;
+    const uint32_t count = head < TRACE_EVENTS ? head : TRACE_EVENTS;
+
+    WebUI::JsonResponse res;
+    JsonWriter& w = res.json();
+    w.beginObject();
+    w.field("displayTimeUnit", "ms");
+    w.beginArray("traceEvents");
+
+    w.beginObject();
+    w.field("name", "thread_name");
+    w.field("ph", "M");
+    w.field("pid", 1);
+    w.field("tid", 1);
+    w.beginObject("args").field("name", "loopTask").endObject();
+    w.endObject();
+
+#if TRACE_ENABLE
+    for (uint32_t i = head - count; i != head; ++i) {
+      const Event& e = s_ring[i & (TRACE_EVENTS - 1)];
+      w.beginObject();
+      w.field("name", Trace::name((Trace::Ev)e.ev));
+      w.field("ph", "X");
+      w.field("ts", (unsigned long long)e.startUs);
+      w.field("dur", e.durUs);
+      w.field("pid", 1);
+      w.field("tid", 1);
+      w.beginObject("args").field("arg", (unsigned)e.arg).endObject();
+      w.endObject();
+    }
+#endif
+    w.endArray();
+
+    w.beginObject("otherData");
+    w.field("uptimeMs", millis());
+    w.field("recorded", head);
+    w.field("dropped", head - count);
+    w.field("minUs", (unsigned long)TRACE_MIN_US);
+    w.endObject();
+    w.endObject();
+    s_paused = false;
+  }
+}
+
+void Trace::init(WebServer* server) {
+  s_server = server;
+  if (s_server) s_server->on("/api/trace", HTTP_GET, []() { sendTrace(); });
+}
+
+uint64_t Trace::now() {
+  return (uint64_t)esp_timer_get_time();
+}
+
+void Trace::record(Ev ev, uint64_t startUs, uint32_t durUs, uint16_t arg) {
+#if TRACE_ENABLE
+  if (s_paused || durUs < TRACE_MIN_US) return;
+  Event& e = s_ring[s_head & (TRACE_EVENTS - 1)];
+  e.startUs = startUs;
+  e.durUs = durUs;
+  e.arg = arg;
+  e.ev = (uint8_t)ev;
+  s_head++;
+#else
+  (void)ev;
+  (void)startUs;
+  (void)durUs;
+  (void)arg;
+#endif
+}
+
+uint32_t Trace::recorded() {
+  return s_head;
+}
+
+const char* Trace::name(Ev ev) {
+  return (size_t)ev < (size_t)Ev::Count ? kNames[(size_t)ev] : "?";
+}
+
+Trace::Span::~Span() {
+  record(m_ev, m_startUs, (uint32_t)(now() - m_startUs), m_arg);
+}
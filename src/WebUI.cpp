@@ -1,9 +1,16 @@
 #include "WebUI.h"
 #include "PylonLink.h"
+#include "BufferPool.h"
+#include "ConsoleJobs.h"
+#include "JsonWriter.h"
+#include "MsgPackWriter.h"
+#include "DataAge.h"
 #include "circular_log.h"
-#include <ArduinoJson.h>
+#include "NetWrite.h"
+#include <LittleFS.h>
 #include "Config.h"
 #include <string.h>
+#include <math.h>
 #include <Arduino.h>
 
 static WebServer*          s_server = nullptr;
@@ -12,290 +19,785 @@ static batteryStack*       s_stack  = nullptr;
 static systemData*         s_system = nullptr;
 static dailyEnergyData*    s_energy = nullptr;
 static statDebugData*      s_statDbg = nullptr;
-static char*               s_rawBuf = nullptr;
-static size_t              s_rawLen = 0;
 static circular_log<16384>* s_log    = nullptr;
-static bool                s_cmdBusy = false;
-static unsigned long       s_lastCmdMs = 0;
-
-static bool startsWithIgnoreCase(const char* text, const char* prefix) {
-  if (!text || !prefix) return false;
-  while (*prefix) {
-    if (!*text) return false;
-    if (tolower((unsigned char)*text) != tolower((unsigned char)*prefix)) return false;
-    ++text;
-    ++prefix;
-  }
-  return true;
+
+// ---------- Snapshot-Cache ----------
+// /api/stack, /api/system und /api/status werden je Datengeneration genau
+// einmal kodiert und danach allen Clients aus dem Cache geliefert. Das
+// ETag leitet sich aus einer Boot-Kennung und den Generationszaehlern ab
+// (die nach jedem Neustart wieder bei 1 beginnen), If-None-Match bekommt
+// 304. In die Snapshots gehoert nur, was eine Generation weiterzaehlt:
+// currentEpoch/lastUpdateMs im Rumpf sind der Zeitpunkt der letzten
+// Stack-Generation, Uptime und laufende Uhrzeit kommen je Antwort in den
+// Headern X-Uptime-Ms und X-Epoch.
+
+// Kodiert in buf; len = benoetigte Bytes (auch bei Ueberlauf). false bei
+// Ueberlauf oder inkonsistenter Ausgabe.
+typedef bool (*SnapshotEncoder)(char* buf, size_t size, size_t& len);
+
+struct Snapshot {
+  BufferPool::Slot slot;
+  const char*      name;
+  const char*      contentType;
+  char*            buf;
+  size_t           size;
+  size_t           len;
+  uint32_t         builtStackGen;
+  uint32_t         builtSystemGen;
+  bool             valid;
+};
+
+static uint32_t s_bootId    = 0;
+static uint32_t s_stackGen  = 1;
+static uint32_t s_systemGen = 1;
+static unsigned long s_stackGenMs    = 0;   // Uptime bzw. Epoch beim letzten markStackChanged()
+static unsigned long s_stackGenEpoch = 0;
+static Snapshot s_snapStack      = { BufferPool::Slot::StackJson,  "stack",  "application/json",    nullptr, 0, 0, 0, 0, false };
+static Snapshot s_snapSystem     = { BufferPool::Slot::SystemJson, "system", "application/json",    nullptr, 0, 0, 0, 0, false };
+static Snapshot s_snapStatus     = { BufferPool::Slot::StatusJson, "status", "application/json",    nullptr, 0, 0, 0, 0, false };
+static Snapshot s_snapStatusPack = { BufferPool::Slot::StatusPack, "spack",  "application/msgpack", nullptr, 0, 0, 0, 0, false };
+
+static bool clientHasEtag(const char* etag) {
+  if (!s_server->hasHeader("If-None-Match")) return false;
+  const String inm = s_server->header("If-None-Match");
+  return inm.indexOf(etag) >= 0 || inm == "*";
 }
 
-static bool equalsIgnoreCase(const char* a, const char* b) {
-  if (!a || !b) return false;
-  while (*a && *b) {
-    if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) return false;
-    ++a;
-    ++b;
+// Alter beim Abruf; der Snapshot selbst bleibt je Datengeneration gleich.
+// Nur fuer tatsaechlich ausgelieferte Daten (200/304): welche Quellen
+// enthalten sind, ergibt sich aus den Generationen (0 = nicht enthalten),
+// der Header nennt das Alter von pwr bzw. bei /api/system von pwrsys.
+static void noteServed(uint32_t stackGen, uint32_t systemGen) {
+  const DataAge::Source src = stackGen ? DataAge::Source::Pwr : DataAge::Source::Pwrsys;
+  if (DataAge::sample(src).seq) {
+    char age[12];
+    snprintf(age, sizeof(age), "%lu", (unsigned long)DataAge::ageMs(src));
+    s_server->sendHeader("X-Data-Age-Ms", age);
   }
-  return *a == '\0' && *b == '\0';
+  if (stackGen)  DataAge::noteConsumed(DataAge::Path::Http, DataAge::Source::Pwr);
+  if (systemGen) DataAge::noteConsumed(DataAge::Path::Http, DataAge::Source::Pwrsys);
 }
 
-static bool commandNeedsPrompt(const char* cmd) {
-  if (!cmd) return false;
+static void serveSnapshot(Snapshot& snap,
+                          uint32_t stackGen,
+                          uint32_t systemGen,
+                          SnapshotEncoder encode) {
+  if (!s_server) return;
 
-  return equalsIgnoreCase(cmd, "help") ||
-         startsWithIgnoreCase(cmd, "stat") ||
-         startsWithIgnoreCase(cmd, "log") ||
-         startsWithIgnoreCase(cmd, "bat") ||
-         startsWithIgnoreCase(cmd, "data");
-}
+  char etag[48];
+  snprintf(etag, sizeof(etag), "\"%s%08lx-%lu-%lu\"", snap.name, (unsigned long)s_bootId,
+           (unsigned long)stackGen, (unsigned long)systemGen);
+
+  s_server->sendHeader("Cache-Control", "no-cache");
+  s_server->sendHeader("ETag", etag);
+  char num[12];
+  snprintf(num, sizeof(num), "%lu", (unsigned long)millis());
+  s_server->sendHeader("X-Uptime-Ms", num);
+  if (s_energy && s_energy->timeSynced) {
+    snprintf(num, sizeof(num), "%lu", (unsigned long)s_energy->currentEpoch);
+    s_server->sendHeader("X-Epoch", num);
+  }
+  if (clientHasEtag(etag)) {
+    noteServed(stackGen, systemGen);
+    s_server->send(304);
+    return;
+  }
 
-static void sendJsonDocument(JsonDocument& doc) {
-  if (!s_server) return;
-  String out;
-  out.reserve(measureJson(doc) + 1);
-  serializeJson(doc, out);
-  s_server->sendHeader("Cache-Control", "no-store");
-  s_server->send(200, "application/json", out);
-}
+  if (!snap.buf) {
+    snap.buf = BufferPool::acquire(snap.slot, snap.name);
+    snap.size = snap.buf ? BufferPool::size(snap.slot) : 0;
+    if (!snap.buf) {
+      s_server->send(503, "text/plain", "snapshot buffer busy");
+      return;
+    }
+  }
 
-static void sendJsonStack() {
-  if (!s_server) return;
+  if (!snap.valid || snap.builtStackGen != stackGen || snap.builtSystemGen != systemGen) {
+    size_t len = 0;
+    const bool ok = encode(snap.buf, snap.size, len);
+    BufferPool::noteUsed(snap.slot, len);
+    if (!ok) {
+      snap.valid = false;
+      if (s_log) s_log->Log("HTTP: snapshot overflow");
+      s_server->send(500, "text/plain", "snapshot overflow");
+      return;
+    }
+    snap.len = len;
+    snap.builtStackGen = stackGen;
+    snap.builtSystemGen = systemGen;
+    snap.valid = true;
+  }
 
-  StaticJsonDocument<4096> doc;
+  noteServed(stackGen, systemGen);
+  s_server->setContentLength(snap.len);
+  s_server->send(200, snap.contentType, "");
+  s_server->sendContent(snap.buf, snap.len);
+}
 
+template <void (*Build)(JsonWriter&)>
+static bool encodeJson(char* buf, size_t size, size_t& len) {
+  BufferPrint out(buf, size);
+  JsonWriter w(out);
+  w.beginObject();
+  Build(w);
+  w.endObject();
+  len = out.overflowed() ? w.length() + 1 : out.length();
+  return !out.overflowed();
+}
+
+static void buildJsonStack(JsonWriter& w) {
   if (s_stack) {
-    doc["valid"]         = s_stack->valid;
-    doc["lastUpdateMs"]  = s_stack->lastUpdateMs;
-    doc["soc"]           = s_stack->soc;
-    doc["state"]         = s_stack->baseState;
-    doc["count"]         = s_stack->batteryCount;
-    doc["voltage_V"]     = (float)s_stack->avgVoltage / 1000.0f;
-    doc["current_A"]     = (float)s_stack->currentDC / 1000.0f;
-    doc["current_mA"]    = s_stack->currentDC;
-    doc["temp_c"]        = (float)s_stack->temp / 1000.0f;
-    doc["dc_W"]          = (long)s_stack->getPowerDC();
-    doc["ac_W_est"]      = (long)s_stack->getEstPowerAc();
-    doc["isNormal"]      = s_stack->isNormal();
+    w.field("valid",         s_stack->valid);
+    w.field("lastUpdateMs",  s_stack->lastUpdateMs);
+    w.field("soc",           s_stack->soc);
+    w.field("state",         s_stack->baseState);
+    w.field("count",         s_stack->batteryCount);
+    w.field("voltage_V",     (float)s_stack->avgVoltage / 1000.0f);
+    w.field("current_A",     (float)s_stack->currentDC / 1000.0f);
+    w.field("current_mA",    s_stack->currentDC);
+    w.field("temp_c",        (float)s_stack->temp / 1000.0f);
+    w.field("dc_W",          (long)s_stack->getPowerDC());
+    w.field("ac_W_est",      (long)s_stack->getEstPowerAc());
+    w.field("isNormal",      s_stack->isNormal());
     if (s_energy) {
-      doc["chargeKWhToday"]    = s_energy->chargeKWhToday;
-      doc["dischargeKWhToday"] = s_energy->dischargeKWhToday;
-      doc["energyTimeSynced"]  = s_energy->timeSynced;
-      doc["currentEpoch"]      = s_energy->currentEpoch;
+      w.field("chargeKWhToday",    s_energy->chargeKWhToday);
+      w.field("dischargeKWhToday", s_energy->dischargeKWhToday);
+      w.field("energyTimeSynced",  s_energy->timeSynced);
+      w.field("currentEpoch",      s_stackGenEpoch);
     }
 
     // Legacy-/Kompatibilitätsfelder
-    doc["batteryCount"]  = s_stack->batteryCount;
-    doc["baseState"]     = s_stack->baseState;
-    doc["avgVoltage"]    = s_stack->avgVoltage;
-    doc["currentDC"]     = s_stack->currentDC;
+    w.field("batteryCount",  s_stack->batteryCount);
+    w.field("baseState",     s_stack->baseState);
+    w.field("avgVoltage",    s_stack->avgVoltage);
+    w.field("currentDC",     s_stack->currentDC);
 
-    JsonArray batts = doc.createNestedArray("batts");
+    w.beginArray("batts");
     for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
       const pylonBattery& b = s_stack->batts[i];
       if (!b.isPresent) continue;
 
-      JsonObject nb = batts.createNestedObject();
-      nb["idx"]           = i + 1;
-      nb["isPresent"]     = true;
-      nb["soc"]           = b.soc;
-      nb["voltage"]       = b.voltage;
-      nb["current"]       = b.current;
-      nb["tempr"]         = b.tempr;
-      nb["cellVoltLow"]   = b.cellVoltLow;
-      nb["cellVoltHigh"]  = b.cellVoltHigh;
-      nb["cellTempLow"]   = b.cellTempLow;
-      nb["cellTempHigh"]  = b.cellTempHigh;
-      nb["baseState"]     = (b.baseState[0] ? b.baseState : "Unknown");
-      nb["voltage_V"]     = (float)b.voltage / 1000.0f;
-      nb["current_A"]     = (float)b.current / 1000.0f;
-      nb["temp_c"]        = (float)b.tempr / 1000.0f;
-      nb["isNormal"]      = b.isNormal();
-      nb["cycleTimes"]    = b.cycleTimes;
-      nb["alarmText"]     = (b.alarmText[0] ? b.alarmText : "Normal");
+      w.beginObject();
+      w.field("idx",           i + 1);
+      w.field("isPresent",     true);
+      w.field("soc",           b.soc);
+      w.field("voltage",       b.voltage);
+      w.field("current",       b.current);
+      w.field("tempr",         b.tempr);
+      w.field("cellVoltLow",   b.cellVoltLow);
+      w.field("cellVoltHigh",  b.cellVoltHigh);
+      w.field("cellTempLow",   b.cellTempLow);
+      w.field("cellTempHigh",  b.cellTempHigh);
+      w.field("baseState",     (b.baseState[0] ? b.baseState : "Unknown"));
+      w.field("voltage_V",     (float)b.voltage / 1000.0f);
+      w.field("current_A",     (float)b.current / 1000.0f);
+      w.field("temp_c",        (float)b.tempr / 1000.0f);
+      w.field("isNormal",      b.isNormal());
+      w.field("cycleTimes",    b.cycleTimes);
+      w.field("alarmText",     (b.alarmText[0] ? b.alarmText : "Normal"));
+      w.endObject();
     }
+    w.endArray();
+  }
+}
+
+static void buildJsonSystem(JsonWriter& w) {
+  if (s_system) {
+    w.field("valid",        s_system->valid);
+    w.field("lastUpdateMs", s_system->lastUpdateMs);
+    w.field("soc",          s_system->soc);
+    w.field("soh",          s_system->soh);
+    w.field("voltage",      s_system->voltage);
+    w.field("current",      s_system->current);
+    w.field("rc",           s_system->rc);
+    w.field("fcc",          s_system->fcc);
+    w.field("temp_avg",     s_system->temp_avg);
+    w.field("temp_low",     s_system->temp_low);
+    w.field("temp_high",    s_system->temp_high);
+    w.field("volt_avg",     s_system->volt_avg);
+    w.field("volt_low",     s_system->volt_low);
+    w.field("volt_high",    s_system->volt_high);
+    w.field("state",        s_system->state);
+    w.field("alarmState",   s_system->alarmState);
+
+    w.field("voltage_V",    (float)s_system->voltage / 1000.0f);
+    w.field("current_A",    (float)s_system->current / 1000.0f);
+    w.field("temp_avg_c",   (float)s_system->temp_avg / 1000.0f);
+    w.field("temp_low_c",   (float)s_system->temp_low / 1000.0f);
+    w.field("temp_high_c",  (float)s_system->temp_high / 1000.0f);
+    w.field("volt_avg_V",   (float)s_system->volt_avg / 1000.0f);
+    w.field("volt_low_V",   (float)s_system->volt_low / 1000.0f);
+    w.field("volt_high_V",  (float)s_system->volt_high / 1000.0f);
+
+    w.field("rec_chg_voltage",      s_system->rec_chg_voltage);
+    w.field("rec_dsg_voltage",      s_system->rec_dsg_voltage);
+    w.field("rec_chg_current",      s_system->rec_chg_current);
+    w.field("rec_dsg_current",      s_system->rec_dsg_current);
+
+    w.field("sys_rec_chg_voltage",  s_system->sys_rec_chg_voltage);
+    w.field("sys_rec_dsg_voltage",  s_system->sys_rec_dsg_voltage);
+    w.field("sys_rec_chg_current",  s_system->sys_rec_chg_current);
+    w.field("sys_rec_dsg_current",  s_system->sys_rec_dsg_current);
+
+    w.field("rec_chg_voltage_V",    (float)s_system->rec_chg_voltage / 1000.0f);
+    w.field("rec_dsg_voltage_V",    (float)s_system->rec_dsg_voltage / 1000.0f);
+    w.field("rec_chg_current_A",    (float)s_system->rec_chg_current / 1000.0f);
+    w.field("rec_dsg_current_A",    (float)s_system->rec_dsg_current / 1000.0f);
+
+    w.field("sys_rec_chg_voltage_V", (float)s_system->sys_rec_chg_voltage / 1000.0f);
+    w.field("sys_rec_dsg_voltage_V", (float)s_system->sys_rec_dsg_voltage / 1000.0f);
+    w.field("sys_rec_chg_current_A", (float)s_system->sys_rec_chg_current / 1000.0f);
+    w.field("sys_rec_dsg_current_A", (float)s_system->sys_rec_dsg_current / 1000.0f);
   }
+}
 
-  sendJsonDocument(doc);
+// Messzeitpunkt (erstes UART-Byte) als Uptime und, mit Zeitsync, als
+// Unixzeit; das Alter beim Abruf steht im Header X-Data-Age-Ms
+static void writeSampleTime(JsonWriter& w, DataAge::Source src) {
+  const DataAge::Sample& sm = DataAge::sample(src);
+  if (!sm.seq) return;
+  w.field("sampleMs", sm.firstRxMs);
+  const unsigned long epoch = DataAge::sampleEpoch(src);
+  if (epoch) w.field("sampleEpoch", epoch);
 }
 
-static void sendJsonSystem() {
-  if (!s_server) return;
+static void buildJsonStatus(JsonWriter& w) {
+  // Uptime zum Abruf steht im Header X-Uptime-Ms
+  w.beginObject("meta");
+  w.field("stackGen", s_stackGen);
+  w.field("systemGen", s_systemGen);
+  w.endObject();
 
-  StaticJsonDocument<2048> doc;
+  w.beginObject("stack");
+  if (s_stack) {
+    w.field("valid",         s_stack->valid);
+    w.field("lastUpdateMs",  s_stack->lastUpdateMs);
+    w.field("soc",           s_stack->soc);
+    w.field("batteryCount",  s_stack->batteryCount);
+    w.field("baseState",     s_stack->baseState);
+    w.field("avgVoltage",    s_stack->avgVoltage);
+    w.field("currentDC",     s_stack->currentDC);
+    w.field("temp",          s_stack->temp);
+    w.field("avgVoltage_V",  (float)s_stack->avgVoltage / 1000.0f);
+    w.field("currentDC_A",   (float)s_stack->currentDC / 1000.0f);
+    w.field("temp_c",        (float)s_stack->temp / 1000.0f);
+    w.field("isNormal",      s_stack->isNormal());
+    writeSampleTime(w, DataAge::Source::Pwr);
+  }
+  w.endObject();
 
+  w.beginObject("system");
   if (s_system) {
-    doc["valid"]        = s_system->valid;
-    doc["lastUpdateMs"] = s_system->lastUpdateMs;
-    doc["soc"]          = s_system->soc;
-    doc["soh"]          = s_system->soh;
-    doc["voltage"]      = s_system->voltage;
-    doc["current"]      = s_system->current;
-    doc["rc"]           = s_system->rc;
-    doc["fcc"]          = s_system->fcc;
-    doc["temp_avg"]     = s_system->temp_avg;
-    doc["temp_low"]     = s_system->temp_low;
-    doc["temp_high"]    = s_system->temp_high;
-    doc["volt_avg"]     = s_system->volt_avg;
-    doc["volt_low"]     = s_system->volt_low;
-    doc["volt_high"]    = s_system->volt_high;
-    doc["state"]        = s_system->state;
-    doc["alarmState"]   = s_system->alarmState;
-
-    doc["voltage_V"]    = (float)s_system->voltage / 1000.0f;
-    doc["current_A"]    = (float)s_system->current / 1000.0f;
-    doc["temp_avg_c"]   = (float)s_system->temp_avg / 1000.0f;
-    doc["temp_low_c"]   = (float)s_system->temp_low / 1000.0f;
-    doc["temp_high_c"]  = (float)s_system->temp_high / 1000.0f;
-    doc["volt_avg_V"]   = (float)s_system->volt_avg / 1000.0f;
-    doc["volt_low_V"]   = (float)s_system->volt_low / 1000.0f;
-    doc["volt_high_V"]  = (float)s_system->volt_high / 1000.0f;
-
-    doc["rec_chg_voltage"]      = s_system->rec_chg_voltage;
-    doc["rec_dsg_voltage"]      = s_system->rec_dsg_voltage;
-    doc["rec_chg_current"]      = s_system->rec_chg_current;
-    doc["rec_dsg_current"]      = s_system->rec_dsg_current;
-
-    doc["sys_rec_chg_voltage"]  = s_system->sys_rec_chg_voltage;
-    doc["sys_rec_dsg_voltage"]  = s_system->sys_rec_dsg_voltage;
-    doc["sys_rec_chg_current"]  = s_system->sys_rec_chg_current;
-    doc["sys_rec_dsg_current"]  = s_system->sys_rec_dsg_current;
-
-    doc["rec_chg_voltage_V"]    = (float)s_system->rec_chg_voltage / 1000.0f;
-    doc["rec_dsg_voltage_V"]    = (float)s_system->rec_dsg_voltage / 1000.0f;
-    doc["rec_chg_current_A"]    = (float)s_system->rec_chg_current / 1000.0f;
-    doc["rec_dsg_current_A"]    = (float)s_system->rec_dsg_current / 1000.0f;
-
-    doc["sys_rec_chg_voltage_V"] = (float)s_system->sys_rec_chg_voltage / 1000.0f;
-    doc["sys_rec_dsg_voltage_V"] = (float)s_system->sys_rec_dsg_voltage / 1000.0f;
-    doc["sys_rec_chg_current_A"] = (float)s_system->sys_rec_chg_current / 1000.0f;
-    doc["sys_rec_dsg_current_A"] = (float)s_system->sys_rec_dsg_current / 1000.0f;
-  }
-
-  sendJsonDocument(doc);
+    w.field("valid",         s_system->valid);
+    w.field("lastUpdateMs",  s_system->lastUpdateMs);
+    w.field("soc",           s_system->soc);
+    w.field("soh",           s_system->soh);
+    w.field("voltage",       s_system->voltage);
+    w.field("current",       s_system->current);
+    w.field("rc",            s_system->rc);
+    w.field("fcc",           s_system->fcc);
+    w.field("temp_avg",      s_system->temp_avg);
+    w.field("temp_low",      s_system->temp_low);
+    w.field("temp_high",     s_system->temp_high);
+    w.field("volt_avg",      s_system->volt_avg);
+    w.field("volt_low",      s_system->volt_low);
+    w.field("volt_high",     s_system->volt_high);
+    w.field("state",         s_system->state);
+    w.field("alarmState",    s_system->alarmState);
+    w.field("voltage_V",     (float)s_system->voltage / 1000.0f);
+    w.field("current_A",     (float)s_system->current / 1000.0f);
+    writeSampleTime(w, DataAge::Source::Pwrsys);
+
+    w.field("rec_chg_voltage",      s_system->rec_chg_voltage);
+    w.field("rec_dsg_voltage",      s_system->rec_dsg_voltage);
+    w.field("rec_chg_current",      s_system->rec_chg_current);
+    w.field("rec_dsg_current",      s_system->rec_dsg_current);
+
+    w.field("sys_rec_chg_voltage",  s_system->sys_rec_chg_voltage);
+    w.field("sys_rec_dsg_voltage",  s_system->sys_rec_dsg_voltage);
+    w.field("sys_rec_chg_current",  s_system->sys_rec_chg_current);
+    w.field("sys_rec_dsg_current",  s_system->sys_rec_dsg_current);
+
+    w.field("rec_chg_voltage_V",    (float)s_system->rec_chg_voltage / 1000.0f);
+    w.field("rec_dsg_voltage_V",    (float)s_system->rec_dsg_voltage / 1000.0f);
+    w.field("rec_chg_current_A",    (float)s_system->rec_chg_current / 1000.0f);
+    w.field("rec_dsg_current_A",    (float)s_system->rec_dsg_current / 1000.0f);
+
+    w.field("sys_rec_chg_voltage_V", (float)s_system->sys_rec_chg_voltage / 1000.0f);
+    w.field("sys_rec_dsg_voltage_V", (float)s_system->sys_rec_dsg_voltage / 1000.0f);
+    w.field("sys_rec_chg_current_A", (float)s_system->sys_rec_chg_current / 1000.0f);
+    w.field("sys_rec_dsg_current_A", (float)s_system->sys_rec_dsg_current / 1000.0f);
+  }
+  w.endObject();
+
+  w.beginObject("derived");
+  if (s_stack && s_stack->valid) {
+    w.field("dc_W",     s_stack->getPowerDC());
+    w.field("ac_W_est", s_stack->getEstPowerAc());
+  }
+  w.endObject();
+
+  w.beginObject("energy");
+  if (s_energy) {
+    w.field("valid", s_energy->valid);
+    w.field("timeSynced", s_energy->timeSynced);
+    w.field("lastUpdateMs", s_stackGenMs);
+    w.field("currentEpoch", s_stackGenEpoch);
+    w.field("localDayNumber", s_energy->localDayNumber);
+    w.field("chargeKWhToday", s_energy->chargeKWhToday);
+    w.field("dischargeKWhToday", s_energy->dischargeKWhToday);
+    w.field("chargeWhToday", s_energy->chargeToday.wh());
+    w.field("dischargeWhToday", s_energy->dischargeToday.wh());
+    w.field("chargeMAhToday", s_energy->chargeToday.mAh());
+    w.field("dischargeMAhToday", s_energy->dischargeToday.mAh());
+    w.field("chargeWhTotal", s_energy->chargeTotal.wh());
+    w.field("dischargeWhTotal", s_energy->dischargeTotal.wh());
+    w.field("chargeMAhTotal", s_energy->chargeTotal.mAh());
+    w.field("dischargeMAhTotal", s_energy->dischargeTotal.mAh());
+    w.field("samples", s_energy->samples);
+    w.field("gaps", s_energy->gaps);
+    w.field("gapMs", (unsigned long long)s_energy->gapMs);
+    w.beginArray("batteries");
+    for (int i = 0; i < MAX_PYLON_BATTERIES; ++i) {
+      const energyCounter& chg = s_energy->batCharge[i];
+      const energyCounter& dsg = s_energy->batDischarge[i];
+      w.beginObject();
+      w.field("chargeWhTotal", chg.wh());
+      w.field("dischargeWhTotal", dsg.wh());
+      w.field("chargeMAhTotal", chg.mAh());
+      w.field("dischargeMAhTotal", dsg.mAh());
+      w.endObject();
+    }
+    w.endArray();
+  }
+  w.endObject();
 }
 
-static void sendJsonStatus() {
-  if (!s_server) return;
+// MessagePack-Variante von /api/status fuer Clients mit hoher Abfragerate.
+// Stabiles Schema (Version in "v"), nur Ganzzahlen in den Einheiten des
+// Parsers: mV, mA, m°C, mAh; Energie in Wh. Neue Felder nur mit neuer "v".
+// v2: sampleMs/sampleEpoch (Messzeitpunkt, 0 = unbekannt) in stack und system
+// v3: ohne uptimeMs (Header X-Uptime-Ms); energy.lastUpdateMs/epoch sind
+//     der Zeitpunkt der Stack-Generation statt der laufenden Uhr
+static constexpr int kStatusPackVersion = 3;
 
-  StaticJsonDocument<2048> doc;
+static bool encodePackStatus(char* buf, size_t size, size_t& len) {
+  BufferPrint out(buf, size);
+  MsgPackWriter w(out);
 
-  JsonObject meta = doc.createNestedObject("meta");
-  meta["uptimeMs"] = millis();
+  w.beginMap(4);
+  w.field("v", kStatusPackVersion);
 
-  JsonObject stack = doc.createNestedObject("stack");
+  w.beginMap(s_stack ? 13 : 0, "stack");
   if (s_stack) {
-    stack["valid"]         = s_stack->valid;
-    stack["lastUpdateMs"]  = s_stack->lastUpdateMs;
-    stack["soc"]           = s_stack->soc;
-    stack["batteryCount"]  = s_stack->batteryCount;
-    stack["baseState"]     = s_stack->baseState;
-    stack["avgVoltage"]    = s_stack->avgVoltage;
-    stack["currentDC"]     = s_stack->currentDC;
-    stack["temp"]          = s_stack->temp;
-    stack["avgVoltage_V"]  = (float)s_stack->avgVoltage / 1000.0f;
-    stack["currentDC_A"]   = (float)s_stack->currentDC / 1000.0f;
-    stack["temp_c"]        = (float)s_stack->temp / 1000.0f;
-    stack["isNormal"]      = s_stack->isNormal();
-
-  }
-
-  JsonObject system = doc.createNestedObject("system");
+    w.field("valid",        s_stack->valid);
+    w.field("lastUpdateMs", s_stack->lastUpdateMs);
+    w.field("soc",          s_stack->soc);
+    w.field("count",        s_stack->batteryCount);
+    w.field("state",        s_stack->baseState);
+    w.field("voltage_mV",   s_stack->avgVoltage);
+    w.field("current_mA",   s_stack->currentDC);
+    w.field("temp_mC",      s_stack->temp);
+    w.field("dc_W",         s_stack->valid ? s_stack->getPowerDC() : 0L);
+    w.field("ac_W_est",     s_stack->valid ? s_stack->getEstPowerAc() : 0L);
+    w.field("isNormal",     s_stack->isNormal());
+    w.field("sampleMs",     DataAge::sample(DataAge::Source::Pwr).firstRxMs);
+    w.field("sampleEpoch",  DataAge::sampleEpoch(DataAge::Source::Pwr));
+  }
+  w.end();
+
+  w.beginMap(s_system ? 26 : 0, "system");
   if (s_system) {
-    system["valid"]         = s_system->valid;
-    system["lastUpdateMs"]  = s_system->lastUpdateMs;
-    system["soc"]           = s_system->soc;
-    system["soh"]           = s_system->soh;
-    system["voltage"]       = s_system->voltage;
-    system["current"]       = s_system->current;
-    system["rc"]            = s_system->rc;
-    system["fcc"]           = s_system->fcc;
-    system["temp_avg"]      = s_system->temp_avg;
-    system["temp_low"]      = s_system->temp_low;
-    system["temp_high"]     = s_system->temp_high;
-    system["volt_avg"]      = s_system->volt_avg;
-    system["volt_low"]      = s_system->volt_low;
-    system["volt_high"]     = s_system->volt_high;
-    system["state"]         = s_system->state;
-    system["alarmState"]    = s_system->alarmState;
-    system["voltage_V"]     = (float)s_system->voltage / 1000.0f;
-    system["current_A"]     = (float)s_system->current / 1000.0f;
-
-    system["rec_chg_voltage"]      = s_system->rec_chg_voltage;
-    system["rec_dsg_voltage"]      = s_system->rec_dsg_voltage;
-    system["rec_chg_current"]      = s_system->rec_chg_current;
-    system["rec_dsg_current"]      = s_system->rec_dsg_current;
-
-    system["sys_rec_chg_voltage"]  = s_system->sys_rec_chg_voltage;
-    system["sys_rec_dsg_voltage"]  = s_system->sys_rec_dsg_voltage;
-    system["sys_rec_chg_current"]  = s_system->sys_rec_chg_current;
-    system["sys_rec_dsg_current"]  = s_system->sys_rec_dsg_current;
-
-    system["rec_chg_voltage_V"]    = (float)s_system->rec_chg_voltage / 1000.0f;
-    system["rec_dsg_voltage_V"]    = (float)s_system->rec_dsg_voltage / 1000.0f;
-    system["rec_chg_current_A"]    = (float)s_system->rec_chg_current / 1000.0f;
-    system["rec_dsg_current_A"]    = (float)s_system->rec_dsg_current / 1000.0f;
-
-    system["sys_rec_chg_voltage_V"] = (float)s_system->sys_rec_chg_voltage / 1000.0f;
-    system["sys_rec_dsg_voltage_V"] = (float)s_system->sys_rec_dsg_voltage / 1000.0f;
-    system["sys_rec_chg_current_A"] = (float)s_system->sys_rec_chg_current / 1000.0f;
-    system["sys_rec_dsg_current_A"] = (float)s_system->sys_rec_dsg_current / 1000.0f;
-  }
-
-  JsonObject derived = doc.createNestedObject("derived");
-  if (s_stack && s_stack->valid) {
-    derived["dc_W"]     = s_stack->getPowerDC();
-    derived["ac_W_est"] = s_stack->getEstPowerAc();
+    w.field("valid",          s_system->valid);
+    w.field("lastUpdateMs",   s_system->lastUpdateMs);
+    w.field("soc",            s_system->soc);
+    w.field("soh",            s_system->soh);
+    w.field("voltage_mV",     s_system->voltage);
+    w.field("current_mA",     s_system->current);
+    w.field("rc_mAh",         s_system->rc);
+    w.field("fcc_mAh",        s_system->fcc);
+    w.field("temp_avg_mC",    s_system->temp_avg);
+    w.field("temp_low_mC",    s_system->temp_low);
+    w.field("temp_high_mC",   s_system->temp_high);
+    w.field("volt_avg_mV",    s_system->volt_avg);
+    w.field("volt_low_mV",    s_system->volt_low);
+    w.field("volt_high_mV",   s_system->volt_high);
+    w.field("state",          s_system->state);
+    w.field("alarmState",     s_system->alarmState);
+    w.field("rec_chg_mV",     s_system->rec_chg_voltage);
+    w.field("rec_dsg_mV",     s_system->rec_dsg_voltage);
+    w.field("rec_chg_mA",     s_system->rec_chg_current);
+    w.field("rec_dsg_mA",     s_system->rec_dsg_current);
+    w.field("sys_rec_chg_mV", s_system->sys_rec_chg_voltage);
+    w.field("sys_rec_dsg_mV", s_system->sys_rec_dsg_voltage);
+    w.field("sys_rec_chg_mA", s_system->sys_rec_chg_current);
+    w.field("sys_rec_dsg_mA", s_system->sys_rec_dsg_current);
+    w.field("sampleMs",       DataAge::sample(DataAge::Source::Pwrsys).firstRxMs);
+    w.field("sampleEpoch",    DataAge::sampleEpoch(DataAge::Source::Pwrsys));
   }
+  w.end();
 
-  JsonObject energy = doc.createNestedObject("energy");
+  w.beginMap(s_energy ? 7 : 0, "energy");
   if (s_energy) {
-    energy["valid"] = s_energy->valid;
-    energy["timeSynced"] = s_energy->timeSynced;
-    energy["lastUpdateMs"] = s_energy->lastUpdateMs;
-    energy["currentEpoch"] = s_energy->currentEpoch;
-    energy["localDayNumber"] = s_energy->localDayNumber;
-    energy["chargeKWhToday"] = s_energy->chargeKWhToday;
-    energy["dischargeKWhToday"] = s_energy->dischargeKWhToday;
+    w.field("valid",          s_energy->valid);
+    w.field("timeSynced",     s_energy->timeSynced);
+    w.field("lastUpdateMs",   s_stackGenMs);
+    w.field("epoch",          s_stackGenEpoch);
+    w.field("dayNumber",      s_energy->localDayNumber);
+    w.field("chargeWhToday",    s_energy->chargeToday.wh());
+    w.field("dischargeWhToday", s_energy->dischargeToday.wh());
   }
+  w.end();
+  w.end();
 
-  sendJsonDocument(doc);
+  len = w.length();
+  if (!w.ok() && s_log) s_log->Log("HTTP: msgpack schema mismatch");
+  return w.ok() && !out.overflowed();
 }
 
-static bool tryBeginCommand() {
-  const unsigned long now = millis();
-  if (s_cmdBusy) return false;
-  if ((now - s_lastCmdMs) < 1500UL) return false;
-  s_cmdBusy = true;
-  return true;
-}
-
-static void endCommand() {
-  s_cmdBusy = false;
-  s_lastCmdMs = millis();
+static bool clientWantsMsgPack() {
+  if (!s_server->hasHeader("Accept")) return false;
+  const String accept = s_server->header("Accept");
+  return accept.indexOf("application/msgpack") >= 0 || accept.indexOf("application/x-msgpack") >= 0;
 }
 
 static void sendJsonStatDebug() {
   if (!s_server) return;
 
-  StaticJsonDocument<1024> doc;
+  WebUI::JsonResponse res;
+  JsonWriter& w = res.json();
+  w.beginObject();
   if (s_statDbg) {
-    doc["currentIdx"] = s_statDbg->currentIdx;
-    doc["maxBat"] = s_statDbg->maxBat;
-    doc["detected"] = s_statDbg->detected;
-    doc["highestPresentIdx"] = s_statDbg->highestPresentIdx;
-    doc["initialRun"] = s_statDbg->initialRun;
-    doc["inProgress"] = s_statDbg->inProgress;
-    doc["lastSuccess"] = s_statDbg->lastSuccess;
-    doc["lastTimedOut"] = s_statDbg->lastTimedOut;
-    doc["lastParseFailed"] = s_statDbg->lastParseFailed;
-    doc["lastCycleTimes"] = s_statDbg->lastCycleTimes;
-    doc["lastAttemptMs"] = s_statDbg->lastAttemptMs;
-    doc["lastSuccessMs"] = s_statDbg->lastSuccessMs;
-    doc["lastCommand"] = s_statDbg->lastCommand;
-    doc["lastMessage"] = s_statDbg->lastMessage;
-  }
-
-  sendJsonDocument(doc);
+    w.field("currentIdx", s_statDbg->currentIdx);
+    w.field("maxBat", s_statDbg->maxBat);
+    w.field("detected", s_statDbg->detected);
+    w.field("highestPresentIdx", s_statDbg->highestPresentIdx);
+    w.field("initialRun", s_statDbg->initialRun);
+    w.field("inProgress", s_statDbg->inProgress);
+    w.field("lastSuccess", s_statDbg->lastSuccess);
+    w.field("lastTimedOut", s_statDbg->lastTimedOut);
+    w.field("lastParseFailed", s_statDbg->lastParseFailed);
+    w.field("lastCycleTimes", s_statDbg->lastCycleTimes);
+    w.field("lastAttemptMs", s_statDbg->lastAttemptMs);
+    w.field("lastSuccessMs", s_statDbg->lastSuccessMs);
+    w.field("lastCommand", s_statDbg->lastCommand);
+    w.field("lastMessage", s_statDbg->lastMessage);
+  }
+  w.endObject();
+}
+
+ChunkedPrint::ChunkedPrint(WebServer& server, const char* contentType, char* buf, size_t size)
+  : m_server(server), m_type(contentType), m_buf(buf), m_size(size) {}
+
+size_t ChunkedPrint::write(const uint8_t* data, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    if (m_len == m_size) flush();
+    const size_t room = m_size - m_len;
+    const size_t take = (n - done < room) ? (n - done) : room;
+    memcpy(m_buf + m_len, data + done, take);
+    m_len += take;
+    done += take;
+  }
+  m_total += n;
+  return n;
+}
+
+void ChunkedPrint::flush() {
+  if (!m_started) {
+    // Antwort passt nicht in den Puffer: auf chunked umschalten. Den
+    // abschliessenden Null-Chunk sendet WebServer nach dem Handler selbst.
+    m_server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    m_server.send(200, m_type, "");
+    m_started = true;
+  }
+  if (m_len) m_server.sendContent(m_buf, m_len);
+  m_len = 0;
+}
+
+void ChunkedPrint::finish() {
+  if (!m_started) {
+    m_server.setContentLength(m_len);
+    m_server.send(200, m_type, "");
+    m_started = true;
+  }
+  if (m_len) m_server.sendContent(m_buf, m_len);
+  m_len = 0;
+}
+
+WebUI::JsonResponse::JsonResponse()
+  : m_lease(BufferPool::Slot::JsonOut, "http-json"),
+    m_print(*s_server,
+            "application/json",
+            m_lease ? m_lease.data() : m_fallback,
+            m_lease ? m_lease.size() : sizeof(m_fallback)),
+    m_writer(m_print)
+{
+  s_server->sendHeader("Cache-Control", "no-store");
+}
+
+WebUI::JsonResponse::~JsonResponse() {
+  m_print.finish();
+  m_lease.noteUsed(m_print.total() < m_lease.size() ? m_print.total() : m_lease.size());
+}
+
+void WebUI::markStackChanged() {
+  s_stackGen++;
+  s_stackGenMs = millis();
+  s_stackGenEpoch = s_energy ? s_energy->currentEpoch : 0;
+}
+
+void WebUI::markSystemChanged() {
+  s_systemGen++;
+}
+
+// /api/cmd und /cmd laufen als Konsolen-Job; der Client bekommt die Antwort
+// am Stueck, sobald der Job fertig ist (siehe ConsoleJobs). Der WebServer
+// ist dabei sofort wieder frei.
+static void runConsoleCommand(const String& code, bool promptMode, unsigned long timeoutMs) {
+  const char* err = nullptr;
+  const int status = ConsoleJobs::checkCommand(code.c_str(), &err);
+  if (status) {
+    s_server->send(status, "text/plain", err);
+    return;
+  }
+
+  const uint32_t id = ConsoleJobs::submit(code.c_str(), promptMode, timeoutMs);
+  if (!id) {
+    s_server->send(429, "text/plain", "busy");
+    return;
+  }
+  ConsoleJobs::attach(id, true);
+}
+
+// ---------- Statische Dateien ----------
+
+#ifndef WEBUI_ASSET_TAG_SLOTS
+#define WEBUI_ASSET_TAG_SLOTS 8
+#endif
+
+struct ContentTypeEntry {
+  const char* ext;
+  const char* type;
+};
+
+static const ContentTypeEntry kContentTypes[] = {
+  { ".html", "text/html" },
+  { ".css",  "text/css" },
+  { ".js",   "application/javascript" },
+  { ".json", "application/json" },
+  { ".svg",  "image/svg+xml" },
+  { ".png",  "image/png" },
+  { ".ico",  "image/x-icon" },
+  { ".txt",  "text/plain" },
+};
+
+// Inhalts-Hash je Datei, einmal beim ersten Abruf berechnet. Groesse und
+// Aenderungszeit dienen als Gueltigkeitspruefung nach einem uploadfs.
+struct AssetTag {
+  char     path[48];
+  size_t   size;
+  time_t   lastWrite;
+  uint32_t hash;
+};
+
+static AssetTag s_assetTags[WEBUI_ASSET_TAG_SLOTS];
+static uint8_t  s_assetTagNext = 0;
+
+static const char* contentTypeFor(const char* path) {
+  const size_t plen = strlen(path);
+  for (const ContentTypeEntry& e : kContentTypes) {
+    const size_t elen = strlen(e.ext);
+    if (plen >= elen && strcmp(path + plen - elen, e.ext) == 0) return e.type;
+  }
+  return "text/plain";
+}
+
+static bool clientAcceptsGzip() {
+  if (!s_server->hasHeader("Accept-Encoding")) return false;
+  return s_server->header("Accept-Encoding").indexOf("gzip") >= 0;
+}
+
+static uint32_t assetHash(File& f, const char* path, uint8_t* buf, size_t bufLen) {
+  const size_t size = f.size();
+  const time_t lastWrite = f.getLastWrite();
+
+  AssetTag* slot = nullptr;
+  for (AssetTag& t : s_assetTags) {
+    if (strcmp(t.path, path) != 0) continue;
+    if (t.size == size && t.lastWrite == lastWrite) return t.hash;
+    slot = &t;
+    break;
+  }
+
+  // FNV-1a ueber den Dateiinhalt
+  uint32_t h = 2166136261u;
+  size_t n;
+  while ((n = f.read(buf, bufLen)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      h ^= buf[i];
+      h *= 16777619u;
+    }
+  }
+  f.seek(0);
+
+  if (strlen(path) >= sizeof(slot->path)) return h;  // zu lang fuer den Cache
+  if (!slot) {
+    slot = &s_assetTags[s_assetTagNext];
+    s_assetTagNext = (s_assetTagNext + 1) % WEBUI_ASSET_TAG_SLOTS;
+  }
+  snprintf(slot->path, sizeof(slot->path), "%s", path);
+  slot->size = size;
+  slot->lastWrite = lastWrite;
+  slot->hash = h;
+  return h;
+}
+
+#ifndef WEBUI_STATIC_SENDERS
+#define WEBUI_STATIC_SENDERS 4            // gleichzeitige Datei-Auslieferungen
+#endif
+#ifndef WEBUI_STATIC_STALL_MS
+#define WEBUI_STATIC_STALL_MS 10000UL     // ohne Fortschritt so lange, dann trennen
+#endif
+
+// Laufende Datei-Auslieferungen. Nach den Headern uebernimmt WebUI::loop()
+// die Verbindung und schreibt je Durchlauf nur, was der TCP-Sendepuffer
+// ohne Warten aufnimmt. Ein langsamer Client haelt so weder loop() noch
+// andere Clients auf; die Dateiposition ist der Offset.
+struct StaticSender {
+  WiFiClient client;
+  File       file;
+  size_t     left = 0;
+  uint32_t   lastProgressMs = 0;
+  bool       active = false;
+};
+
+static StaticSender s_senders[WEBUI_STATIC_SENDERS];
+
+static void closeSender(StaticSender& s) {
+  s.file.close();
+  s.file = File();
+  s.client.stop();
+  s.client = WiFiClient();
+  s.active = false;
+}
+
+// false = beendet (fertig, Lesefehler oder Verbindung weg)
+static bool pumpSender(StaticSender& s, uint8_t* buf, size_t bufLen) {
+  while (s.left) {
+    const size_t pos = s.file.position();
+    const size_t got = s.file.read(buf, s.left < bufLen ? s.left : bufLen);
+    if (!got) return false;
+    const int sent = NetWrite::sendSome(s.client, buf, got);
+    if (sent < 0) return false;
+    if (sent > 0) {
+      s.left -= (size_t)sent;
+      s.lastProgressMs = millis();
+    }
+    if ((size_t)sent < got) {
+      // Sendepuffer voll: Rest beim naechsten Durchlauf ab hier
+      s.file.seek(pos + (size_t)sent);
+      return true;
+    }
+  }
+  return false;
+}
+
+void WebUI::loop() {
+  bool any = false;
+  for (const StaticSender& s : s_senders) any = any || s.active;
+  if (!any) return;
+
+  BufferLease chunk(BufferPool::Slot::JsonOut, "static");
+  uint8_t fallback[512];
+  uint8_t* buf = chunk ? (uint8_t*)chunk.data() : fallback;
+  const size_t bufLen = chunk ? chunk.size() : sizeof(fallback);
+
+  for (StaticSender& s : s_senders) {
+    if (!s.active) continue;
+    if (!pumpSender(s, buf, bufLen)) {
+      closeSender(s);
+    } else if (millis() - s.lastProgressMs > WEBUI_STATIC_STALL_MS) {
+      if (s_log) s_log->Log("HTTP: static client stalled");
+      closeSender(s);
+    }
+  }
+}
+
+void WebUI::serveStatic(const String& uri) {
+  if (!s_server) return;
+
+  char path[64];
+  char gzPath[sizeof(path) + 3];
+  snprintf(path, sizeof(path), "%s", (uri.length() == 0 || uri == "/") ? "/index.html" : uri.c_str());
+  if (uri.length() >= sizeof(path) || strstr(path, "..")) {
+    s_server->send(404, "text/plain", "Not found");
+    return;
+  }
+
+  File f;
+  bool gzip = false;
+  if (clientAcceptsGzip()) {
+    snprintf(gzPath, sizeof(gzPath), "%s.gz", path);
+    if (LittleFS.exists(gzPath)) {
+      f = LittleFS.open(gzPath, "r");
+      gzip = (bool)f;
+    }
+  }
+  if (!f && LittleFS.exists(path)) {
+    f = LittleFS.open(path, "r");
+  }
+  if (!f || f.isDirectory()) {
+    s_server->send(404, "text/plain", "Not found");
+    return;
+  }
+
+  // Lese-Puffer: JsonOut-Slot, falls frei, sonst ein kleiner Stack-Puffer
+  BufferLease chunk(BufferPool::Slot::JsonOut, "static");
+  uint8_t fallback[512];
+  uint8_t* buf = chunk ? (uint8_t*)chunk.data() : fallback;
+  const size_t bufLen = chunk ? chunk.size() : sizeof(fallback);
+
+  char etag[12];
+  snprintf(etag, sizeof(etag), "\"%08lx\"",
+           (unsigned long)assetHash(f, gzip ? gzPath : path, buf, bufLen));
+
+  // Keine versionierten Asset-URLs: immer revalidieren, das ETag spart den Rumpf
+  s_server->sendHeader("Cache-Control", "no-cache");
+  s_server->sendHeader("ETag", etag);
+  s_server->sendHeader("Vary", "Accept-Encoding");
+  if (clientHasEtag(etag)) {
+    f.close();
+    s_server->send(304);
+    return;
+  }
+
+  if (gzip) s_server->sendHeader("Content-Encoding", "gzip");
+  s_server->setContentLength(f.size());
+  s_server->send(200, contentTypeFor(path), "");
+
+  for (StaticSender& s : s_senders) {
+    if (s.active) continue;
+    // Verbindung uebernehmen; die Referenz des WebServers freigeben, damit
+    // er nicht bis HTTP_MAX_CLOSE_WAIT auf das Schliessen wartet
+    s.client = s_server->client();
+    s_server->client().stop();
+    s.file = f;
+    s.left = f.size();
+    s.lastProgressMs = millis();
+    s.active = true;
+    // Kleine Dateien passen meist schon jetzt komplett in den Sendepuffer
+    if (!pumpSender(s, buf, bufLen)) closeSender(s);
+    return;
+  }
+
+  // Alle Plaetze belegt: am Stueck, blockierend wie frueher
+  WiFiClient& client = s_server->client();
+  size_t n;
+  while ((n = f.read(buf, bufLen)) > 0) {
+    if (client.write(buf, n) != n) break;
+  }
+  f.close();
 }
 
 void WebUI::init(WebServer* server,
@@ -304,30 +806,41 @@ void WebUI::init(WebServer* server,
                  systemData* sys,
                  dailyEnergyData* energy,
                  statDebugData* statDbg,
-                 char* rawBuf,
-                 size_t rawBufLen,
                  circular_log<16384>* clog)
 {
   s_server = server;
+  s_bootId = esp_random();
   s_link   = link;
   s_stack  = stk;
   s_system = sys;
   s_energy = energy;
   s_statDbg = statDbg;
-  s_rawBuf = rawBuf;
-  s_rawLen = rawBufLen;
   s_log    = clog;
 
+  // Nur gesammelte Header bleiben erhalten; collectHeaders() ersetzt die Liste.
+  static const char* kCollectHeaders[] = { "If-None-Match", "Accept-Encoding", "Accept" };
+  s_server->collectHeaders(kCollectHeaders, sizeof(kCollectHeaders) / sizeof(kCollectHeaders[0]));
+
   s_server->on("/api/stack", HTTP_GET, []() {
-    sendJsonStack();
+    serveSnapshot(s_snapStack, s_stackGen, 0, encodeJson<buildJsonStack>);
   });
 
   s_server->on("/api/system", HTTP_GET, []() {
-    sendJsonSystem();
+    serveSnapshot(s_snapSystem, 0, s_systemGen, encodeJson<buildJsonSystem>);
   });
 
+  // JSON oder MessagePack je nach Accept-Header
   s_server->on("/api/status", HTTP_GET, []() {
-    sendJsonStatus();
+    s_server->sendHeader("Vary", "Accept");
+    if (clientWantsMsgPack()) {
+      serveSnapshot(s_snapStatusPack, s_stackGen, s_systemGen, encodePackStatus);
+    } else {
+      serveSnapshot(s_snapStatus, s_stackGen, s_systemGen, encodeJson<buildJsonStatus>);
+    }
+  });
+
+  s_server->on("/api/status.msgpack", HTTP_GET, []() {
+    serveSnapshot(s_snapStatusPack, s_stackGen, s_systemGen, encodePackStatus);
   });
 
   s_server->on("/api/stat_debug", HTTP_GET, []() {
@@ -347,70 +860,14 @@ void WebUI::init(WebServer* server,
       s_server->send(503, "text/plain", "no link");
       return;
     }
-    if (!s_rawBuf || s_rawLen == 0) {
-      s_server->send(500, "text/plain", "raw buffer not configured");
-      return;
-    }
-
     String code;
     if (s_server->hasArg("plain")) code = s_server->arg("plain");
     else if (s_server->hasArg("code")) code = s_server->arg("code");
     else if (s_server->args() >= 1) code = s_server->arg(0);
 
     code.trim();
-    if (!code.length()) {
-      s_server->send(400, "text/plain", "empty");
-      return;
-    }
-    if (code.length() > 64) {
-      s_server->send(413, "text/plain", "command too long");
-      return;
-    }
-    for (int i = 0; i < (int)code.length(); i++) {
-      unsigned char c = (unsigned char)code[i];
-      if (c < 0x20 || c > 0x7E) {
-        s_server->send(400, "text/plain", "invalid characters");
-        return;
-      }
-    }
-    if (!tryBeginCommand()) {
-      s_server->send(429, "text/plain", "busy");
-      return;
-    }
-
-    if (s_log) {
-      String s = "CMD: " + code;
-      s_log->Log(s.c_str());
-    }
-
-    memset(s_rawBuf, 0, s_rawLen);
-
-    const unsigned long cmdT0 = millis();
-    bool ok = false;
-    if (commandNeedsPrompt(code.c_str())) {
-      ok = s_link->sendAndReceivePrompt(code.c_str(), s_rawBuf, s_rawLen, 20000);
-    } else {
-      ok = s_link->sendAndReceive(code.c_str(), s_rawBuf, s_rawLen, 8000);
-    }
-    endCommand();
-
-    if (s_log) {
-      char msg[64];
-      snprintf(msg, sizeof(msg), "CMD done: %s %lums", ok ? "ok" : "timeout", millis() - cmdT0);
-      s_log->Log(msg);
-    }
-
-    if (!ok) {
-      s_server->send(504, "text/plain", "timeout");
-      return;
-    }
-
-    char* p = strstr(s_rawBuf, "pylon_debug>");
-    if (!p) p = strstr(s_rawBuf, "pylon>");
-    if (p) *p = '\0';
-
-    s_server->sendHeader("Cache-Control", "no-store");
-    s_server->send(200, "text/plain", s_rawBuf);
+    const bool prompt = ConsoleJobs::needsPrompt(code.c_str());
+    runConsoleCommand(code, prompt, prompt ? 20000UL : 8000UL);
   });
 
   s_server->on("/cmd", HTTP_GET, []() {
@@ -418,51 +875,11 @@ void WebUI::init(WebServer* server,
       s_server->send(503, "text/plain", "no link");
       return;
     }
-    if (!s_rawBuf || s_rawLen == 0) {
-      s_server->send(500, "text/plain", "raw buffer not configured");
-      return;
-    }
-
     String code = s_server->arg("code");
     if (!code.length()) {
       s_server->send(400, "text/plain", "missing code");
       return;
     }
-    if (code.length() > 64) {
-      s_server->send(413, "text/plain", "command too long");
-      return;
-    }
-    for (int i = 0; i < (int)code.length(); i++) {
-      unsigned char c = (unsigned char)code[i];
-      if (c < 0x20 || c > 0x7E) {
-        s_server->send(400, "text/plain", "invalid characters");
-        return;
-      }
-    }
-    if (!tryBeginCommand()) {
-      s_server->send(429, "text/plain", "busy");
-      return;
-    }
-
-    if (s_log) {
-      String s = "CMD(GET): " + code;
-      s_log->Log(s.c_str());
-    }
-
-    memset(s_rawBuf, 0, s_rawLen);
-
-    bool ok = s_link->sendAndReceivePrompt(code.c_str(), s_rawBuf, s_rawLen, 15000);
-    endCommand();
-    if (!ok) {
-      s_server->send(504, "text/plain", "timeout");
-      return;
-    }
-
-    char* p = strstr(s_rawBuf, "pylon_debug>");
-    if (!p) p = strstr(s_rawBuf, "pylon>");
-    if (p) *p = '\0';
-
-    s_server->sendHeader("Cache-Control", "no-store");
-    s_server->send(200, "text/plain", s_rawBuf);
+    runConsoleCommand(code, true, 15000UL);
   });
 }
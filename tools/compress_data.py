@@ -0,0 +1,39 @@
+# PlatformIO pre-Script: legt neben jeder Text-Datei in data/ eine .gz-Variante
+# ab, bevor das LittleFS-Image gebaut wird. Die Firmware liefert die .gz-Datei
+# mit Content-Encoding: gzip aus, wenn der Browser das erlaubt, und faellt
+# sonst auf das Original zurueck.
+import gzip
+import os
+import shutil
+
+Import("env")  # noqa: F821 (von PlatformIO bereitgestellt)
+
+COMPRESS_EXT = (".html", ".css", ".js", ".json", ".svg", ".txt")
+
+
+def compress_file(src, dst):
+    # mtime=0 und ohne Dateinamen im Header: gleiche Eingabe -> gleiche Bytes,
+    # damit das ETag (Inhalts-Hash) nur bei echten Aenderungen wechselt.
+    with open(src, "rb") as f_in, open(dst, "wb") as raw_out:
+        with gzip.GzipFile(filename="", mode="wb", fileobj=raw_out,
+                           compresslevel=9, mtime=0) as f_out:
+            shutil.copyfileobj(f_in, f_out)
+
+
+def compress_data_dir(data_dir):
+    if not os.path.isdir(data_dir):
+        return
+    for root, _, files in os.walk(data_dir):
+        for name in files:
+            if not name.endswith(COMPRESS_EXT):
+                continue
+            src = os.path.join(root, name)
+            dst = src + ".gz"
+            if os.path.exists(dst) and os.path.getmtime(dst) >= os.path.getmtime(src):
+                continue
+            compress_file(src, dst)
+            print("compress_data: %s -> %d / %d bytes" % (
+                os.path.relpath(dst, data_dir), os.path.getsize(dst), os.path.getsize(src)))
+
+
+compress_data_dir(env.subst("$PROJECT_DATA_DIR"))  # noqa: F821
@@ -0,0 +1,48 @@
+# Laedt den Parse-Korpus (/api/corpus) eines Geraets in ein lokales
+# Verzeichnis. Dateinamen enthalten Geraet, Befehl, Grund, laufende Nummer
+# und einen Hash des Inhalts: gleiche Nummern von einem zweiten Geraet oder
+# nach einem NVS-Loeschen ueberschreiben nichts und gehen nicht verloren,
+# nur inhaltlich identische Dateien werden uebersprungen.
+#
+#   python3 tools/fetch_corpus.py pylontech-esp32.local corpus/
+import hashlib
+import json
+import os
+import re
+import sys
+import urllib.parse
+import urllib.request
+
+
+def fetch(url):
+    with urllib.request.urlopen(url, timeout=10) as resp:
+        return resp.read()
+
+
+def main(argv):
+    if len(argv) < 3:
+        print("usage: fetch_corpus.py <host> <zielverzeichnis>", file=sys.stderr)
+        return 2
+
+    host, out_dir = argv[1], argv[2]
+    base = host if host.startswith("http") else "http://" + host
+    device = re.sub(r"[^A-Za-z0-9.-]+", "-", urllib.parse.urlsplit(base).netloc)
+    os.makedirs(out_dir, exist_ok=True)
+
+    listing = json.loads(fetch(base + "/api/corpus"))
+    for entry in listing.get("files", []):
+        data = fetch("%s/api/corpus/%d" % (base, entry["file"]))
+        digest = hashlib.sha1(data).hexdigest()[:10]
+        cmd = entry["cmd"].replace(" ", "_")
+        name = "%s_%s_%s_%06d_%s.txt" % (device, cmd, entry["reason"], entry["seq"], digest)
+        path = os.path.join(out_dir, name)
+        if os.path.exists(path):
+            continue
+        with open(path, "wb") as f:
+            f.write(data)
+        print(name)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,160 @@
+# Lasttest gegen das Geraet: N Clients fragen gleichzeitig die Web-Endpunkte
+# ab, optional halten langsame Leser (schwaches WLAN) die Startseite offen.
+# Ausgegeben werden je Pfad Anzahl, Fehler und Latenz-Perzentile sowie die
+# mittlere Verspaetung der pwr/pwrsys-Polls im Testzeitraum aus /api/soak,
+# also ob die Erfassung unter Last ihren Takt haelt. Exit-Code 1, wenn ein
+# Grenzwert (--max-p95-ms, --max-poll-late-ms) verletzt ist.
+#
+#   python3 tools/http_load.py pylontech-esp32.local --clients 8 --slow 2 --seconds 60
+import argparse
+import http.client
+import json
+import socket
+import sys
+import threading
+import time
+import urllib.parse
+
+DEFAULT_PATHS = ["/", "/api/status", "/api/stack", "/api/system", "/metrics"]
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    k = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[k]
+
+
+def get(host, port, path, timeout):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        conn.request("GET", path, headers={"Accept-Encoding": "gzip"})
+        resp = conn.getresponse()
+        body = resp.read()
+        return resp.status, body
+    finally:
+        conn.close()
+
+
+def poll_lateness(host, port):
+    try:
+        status, body = get(host, port, "/api/soak", 10)
+        if status != 200:
+            return None
+        return json.loads(body)["polls"]
+    except (OSError, ValueError, KeyError, http.client.HTTPException):
+        return None
+
+
+def window_late(before, after):
+    # lateAvgMs ist ueber alle Polls seit Start gemittelt; auf das Fenster umrechnen
+    out = {}
+    for name in after:
+        a, b = after[name], before.get(name, {"count": 0, "lateAvgMs": 0})
+        n = a["count"] - b["count"]
+        if n > 0:
+            out[name] = (a["count"] * a["lateAvgMs"] - b["count"] * b["lateAvgMs"]) / n, n
+    return out
+
+
+def worker(args, host, port, stop, results, lock, idx):
+    paths = args.paths
+    i = idx
+    while not stop.is_set():
+        path = paths[i % len(paths)]
+        i += 1
+        t0 = time.monotonic()
+        try:
+            status, _ = get(host, port, path, args.timeout)
+            ok = status in (200, 304)
+        except (OSError, http.client.HTTPException):
+            ok = False
+        ms = (time.monotonic() - t0) * 1000.0
+        with lock:
+            entry = results.setdefault(path, {"ms": [], "errors": 0})
+            if ok:
+                entry["ms"].append(ms)
+            else:
+                entry["errors"] += 1
+
+
+def slow_reader(host, port, stop, stats, lock):
+    # Liest die Startseite mit 256 Byte/s, wie ein Client am Rand der Reichweite
+    while not stop.is_set():
+        try:
+            s = socket.create_connection((host, port), timeout=30)
+            s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1024)
+            s.sendall(b"GET / HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % host.encode())
+            while not stop.is_set():
+                chunk = s.recv(256)
+                if not chunk:
+                    break
+                time.sleep(1.0)
+            s.close()
+            with lock:
+                stats["slowDone"] += 1
+        except OSError:
+            with lock:
+                stats["slowErrors"] += 1
+            time.sleep(1.0)
+
+
+def main(argv):
+    ap = argparse.ArgumentParser()
+    ap.add_argument("host")
+    ap.add_argument("--clients", type=int, default=8)
+    ap.add_argument("--slow", type=int, default=0, help="zusaetzliche langsame Leser")
+    ap.add_argument("--seconds", type=float, default=60.0)
+    ap.add_argument("--timeout", type=float, default=15.0)
+    ap.add_argument("--paths", nargs="+", default=DEFAULT_PATHS)
+    ap.add_argument("--max-p95-ms", type=float, default=0.0)
+    ap.add_argument("--max-poll-late-ms", type=float, default=0.0)
+    args = ap.parse_args(argv[1:])
+
+    url = urllib.parse.urlsplit(args.host if "//" in args.host else "http://" + args.host)
+    host, port = url.hostname, url.port or 80
+
+    before = poll_lateness(host, port)
+    stop = threading.Event()
+    lock = threading.Lock()
+    results = {}
+    stats = {"slowDone": 0, "slowErrors": 0}
+    threads = [threading.Thread(target=worker, args=(args, host, port, stop, results, lock, i), daemon=True)
+               for i in range(args.clients)]
+    threads += [threading.Thread(target=slow_reader, args=(host, port, stop, stats, lock), daemon=True)
+                for _ in range(args.slow)]
+    for t in threads:
+        t.start()
+    time.sleep(args.seconds)
+    stop.set()
+    for t in threads:
+        t.join(args.timeout + 2)
+    after = poll_lateness(host, port)
+
+    failed = False
+    print("%-22s %6s %6s %8s %8s %8s %8s" % ("path", "n", "err", "p50ms", "p95ms", "p99ms", "maxms"))
+    for path in args.paths:
+        e = results.get(path, {"ms": [], "errors": 0})
+        ms = e["ms"]
+        p95 = percentile(ms, 95)
+        print("%-22s %6d %6d %8.0f %8.0f %8.0f %8.0f" % (
+            path, len(ms), e["errors"], percentile(ms, 50), p95, percentile(ms, 99), max(ms) if ms else 0))
+        if args.max_p95_ms and p95 > args.max_p95_ms:
+            failed = True
+    if args.slow:
+        print("slow readers: %d pages, %d errors" % (stats["slowDone"], stats["slowErrors"]))
+
+    if before is not None and after is not None:
+        for name, (late, n) in sorted(window_late(before, after).items()):
+            print("poll %-7s %5d polls, avg late %6.0f ms" % (name, n, late))
+            if args.max_poll_late_ms and late > args.max_poll_late_ms:
+                failed = True
+    else:
+        print("poll lateness: /api/soak not available")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
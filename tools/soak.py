@@ -0,0 +1,114 @@
+# Treibt einen Dauerlauf gegen ein Geraet (am besten Build-Env esp32-sim)
+# und wertet /api/soak aus: HTTP-Lastspitzen, stat-Runden ueber /api/jobs,
+# MQTT-Ausfaelle und haengende Konsole im Simulator. Endet mit Exit-Code 1,
+# sobald das Geraet "fail" meldet oder nicht mehr antwortet.
+#
+#   python3 tools/soak.py pylontech-esp32.local --hours 72
+import argparse
+import json
+import sys
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+
+BURST_PATHS = ["/api/status", "/api/stack", "/api/system", "/metrics", "/api/status.msgpack"]
+
+
+def request(base, path, data=None, timeout=15):
+    body = urllib.parse.urlencode(data).encode() if data is not None else None
+    with urllib.request.urlopen(base + path, data=body, timeout=timeout) as resp:
+        return resp.status, resp.read()
+
+
+def try_request(base, path, data=None):
+    try:
+        return request(base, path, data)[0]
+    except (urllib.error.URLError, OSError):
+        return 0
+
+
+def main(argv):
+    ap = argparse.ArgumentParser()
+    ap.add_argument("host")
+    ap.add_argument("--hours", type=float, default=24.0)
+    ap.add_argument("--burst-every", type=int, default=120, help="Sekunden zwischen HTTP-Lastspitzen")
+    ap.add_argument("--burst-size", type=int, default=40)
+    ap.add_argument("--stat-every", type=int, default=900, help="Sekunden zwischen stat-Runden")
+    ap.add_argument("--outage-every", type=int, default=3600, help="Sekunden zwischen MQTT-Ausfaellen")
+    ap.add_argument("--outage-s", type=int, default=120)
+    ap.add_argument("--hang-every", type=int, default=5400, help="Sekunden zwischen Konsolen-Haengern (nur Simulator)")
+    ap.add_argument("--hang-s", type=int, default=45)
+    ap.add_argument("--batteries", type=int, default=3)
+    args = ap.parse_args(argv[1:])
+
+    base = args.host if args.host.startswith("http") else "http://" + args.host
+    sim = try_request(base, "/api/sim") == 200
+    request(base, "/api/soak", {"reset": "1"})
+
+    start = time.time()
+    end = start + args.hours * 3600
+    due = {"burst": start, "stat": start, "outage": start + args.outage_every,
+           "hang": start + args.hang_every, "report": start}
+    hang_until = 0
+    failures = 0
+
+    while time.time() < end:
+        now = time.time()
+
+        if now >= due["burst"]:
+            due["burst"] = now + args.burst_every
+            for i in range(args.burst_size):
+                try_request(base, BURST_PATHS[i % len(BURST_PATHS)])
+
+        if now >= due["stat"]:
+            due["stat"] = now + args.stat_every
+            for idx in range(1, args.batteries + 1):
+                try_request(base, "/api/jobs", {"code": "stat %d" % idx})
+
+        if now >= due["outage"]:
+            due["outage"] = now + args.outage_every
+            try_request(base, "/api/soak", {"mqttOutageS": str(args.outage_s)})
+
+        if sim and now >= due["hang"]:
+            due["hang"] = now + args.hang_every
+            hang_until = now + args.hang_s
+            try_request(base, "/api/sim", {"fault": "silent"})
+        if hang_until and now >= hang_until:
+            hang_until = 0
+            try_request(base, "/api/sim", {"fault": "none"})
+
+        if now >= due["report"]:
+            due["report"] = now + 60
+            try:
+                soak = json.loads(request(base, "/api/soak")[1])
+                failures = 0
+            except (urllib.error.URLError, OSError, ValueError) as e:
+                failures += 1
+                print("%7.2fh no answer (%s)" % ((now - start) / 3600, e), flush=True)
+                if failures >= 10:
+                    return 1
+                time.sleep(5)
+                continue
+
+            m = soak["metrics"]
+            line = "%7.2fh %-10s heap=%s block=%s loop=%sus pwrLate=%sms" % (
+                (now - start) / 3600, soak["verdict"],
+                m["freeHeap"].get("last"), m["largestBlock"].get("last"),
+                m["loopAvgUs"].get("last"), m["pwrLateMs"].get("last"))
+            if "energy" in soak:
+                line += " energyErr=%s/1000" % soak["energy"]["errPermille"]
+            print(line, flush=True)
+            if soak["verdict"] == "fail":
+                print("FAIL: %s at %ss" % (soak["failed"], soak["failedAtS"]), file=sys.stderr)
+                return 1
+
+        time.sleep(1)
+
+    if hang_until:
+        try_request(base, "/api/sim", {"fault": "none"})
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))